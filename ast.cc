@@ -27,8 +27,10 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include <cassert>
+#include <cstddef>
 #include <cstdlib>
 #include "ast.hh"
+#include "pika.hh"
 
 
 namespace {
@@ -36,6 +38,10 @@ namespace {
  * The current AST container.  When constructing an object, this is set and
  * then the constructors for the fields run, accessing it to detect their
  * parents.
+ *
+ * This is per-thread, and is only read by constructors that run inside the
+ * constructor that set it, on the same thread, so parse procedures that
+ * construct AST nodes may run on several threads at once.
  */
 // FIXME: Should be thread_local, but that doesn't seem to work on OS X for
 // some reason (__thread does)
@@ -44,8 +50,28 @@ __thread pegmatite::ASTContainer *current = nullptr;
  * The current parser delegate.  When constructing an object, this is set and
  * then the constructors for the fields run, accessing it to detect their
  * parents.
+ *
+ * As with `current`, this is only used while a delegate is being
+ * constructed, on the constructing thread.  Parsing does not use it, so a
+ * constructed delegate may be shared by several threads.
+ */
+__thread pegmatite::ASTParserDelegate *currentParserDelegate = nullptr;
+/**
+ * The layout that the next container constructed on this thread will use,
+ * set by `BindAST` when it has recorded the layout of the class that it is
+ * about to construct.
+ */
+__thread const pegmatite::ASTLayout *nextLayout = nullptr;
+/**
+ * The arena in which a node has just been allocated on this thread, which the
+ * node takes when its `ASTNode` is constructed.
+ */
+__thread pegmatite::ASTArena *nextArena = nullptr;
+/**
+ * The arena that holds the node that is being deleted on this thread, set by
+ * its destructor for `operator delete`, which runs straight after it.
  */
-__thread pegmatite::ASTParserDelegate *currentParserDelegate;
+__thread pegmatite::ASTArena *deletedArena = nullptr;
 }
 
 namespace pegmatite {
@@ -66,19 +92,136 @@ std::string demangle(std::string mangled)
 }
 
 
+ASTNode::ASTNode() : arena(nextArena)
+{
+	nextArena = nullptr;
+}
+
 /**
  * Out-of-line virtual destructor forces vtable to be emitted in this
  * translation unit only.
  */
 ASTNode::~ASTNode()
 {
+	// A `delete` of this node calls `operator delete` straight after this.
+	deletedArena = arena;
+}
+
+std::string type_name(const ASTNode &n)
+{
+#ifdef USE_RTTI
+	return demangle(typeid(n).name());
+#else
+	return n.kind().name;
+#endif
+}
+
+void *ASTNode::operator new(std::size_t size)
+{
+	nextArena = nullptr;
+	return ::operator new(size);
+}
+
+void *ASTNode::operator new(std::size_t size, ASTArena &arena)
+{
+	void *p = arena.allocate(size);
+	nextArena = &arena;
+	return p;
+}
+
+void ASTNode::operator delete(void *p)
+{
+	ASTArena *arena = deletedArena;
+	deletedArena = nullptr;
+	if (arena)
+	{
+		arena->release();
+		return;
+	}
+	::operator delete(p);
+}
+
+void ASTNode::operator delete(void *, ASTArena &arena)
+{
+	// The constructor failed, after the destructor of the `ASTNode` had run
+	// if it had been constructed.
+	deletedArena = nullptr;
+	nextArena = nullptr;
+	arena.release();
+}
+
+ASTArena::~ASTArena()
+{
+	assert(live() == 0 && "AST nodes outlived their arena");
+}
+
+void *ASTArena::allocate(std::size_t bytes)
+{
+	const std::size_t align = alignof(std::max_align_t);
+	bytes = (bytes + align - 1) & ~(align - 1);
+	// Only this thread adds nodes, so if there are none then none can be
+	// added before this one, and the blocks can be reused.
+	if (live() == 0)
+	{
+		reset();
+	}
+	if (blocks.empty() || (used + bytes > blocks[current].size))
+	{
+		// Move to the next block that is large enough, allocating one if the
+		// arena has none left.  Blocks that are too small are used again
+		// once the arena has been emptied.
+		std::size_t next = blocks.empty() ? 0 : current + 1;
+		while ((next < blocks.size()) && (blocks[next].size < bytes))
+		{
+			next++;
+		}
+		if (next == blocks.size())
+		{
+			std::size_t size = std::max(block_size, bytes);
+			blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+			total_size += size;
+		}
+		current = next;
+		used = 0;
+	}
+	void *p = blocks[current].data.get() + used;
+	used += bytes;
+	live_nodes.fetch_add(1, std::memory_order_relaxed);
+	return p;
+}
+
+void ASTArena::release()
+{
+	assert(live() > 0);
+	live_nodes.fetch_sub(1, std::memory_order_release);
+}
+
+void ASTArena::reset()
+{
+	assert(live() == 0 && "AST nodes remain in the arena");
+	current = 0;
+	used = 0;
 }
 
 
+void ASTSharedLayout::record(const ASTContainer &c)
+{
+	ASTLayout *l = c.own_layout ? new ASTLayout(*c.own_layout) :
+	                              new ASTLayout();
+	const ASTLayout *expected = nullptr;
+	// Another thread may have recorded the same layout first.
+	if (!layout.compare_exchange_strong(expected, l,
+	                                    std::memory_order_acq_rel))
+	{
+		delete l;
+	}
+}
+
 /** sets the container under construction to be this.
  */
-ASTContainer::ASTContainer()
+ASTContainer::ASTContainer() : layout(nextLayout)
 {
+	nextLayout = nullptr;
 	current = this;
 }
 
@@ -86,6 +229,11 @@ ASTContainer::~ASTContainer()
 {
 }
 
+void ASTContainer::use_layout(const ASTLayout *l)
+{
+	nextLayout = l;
+}
+
 
 /** Asks all members to construct themselves from the stack.
 	The members are asked to construct themselves in reverse order.
@@ -96,22 +244,35 @@ bool ASTContainer::construct(const InputRange &r, ASTStack &st,
                              const ErrorReporter &err)
 {
 	bool success = true;
-
-	for(auto it = members.rbegin(); it != members.rend(); ++it)
+	if (!layout)
 	{
-		ASTMember *member = *it;
+		return success;
+	}
+	char *base = reinterpret_cast<char*>(this);
+	for(auto it = layout->offsets.rbegin(); it != layout->offsets.rend(); ++it)
+	{
+		ASTMember *member = reinterpret_cast<ASTMember*>(base + *it);
 		success |= member->construct(r, st, err);
 	}
-	// We don't need the members vector anymore, so clean up the storage it
-	// uses.
-	members.clear();
 	return success;
 }
 
 ASTMember::ASTMember()
 {
 	assert(current && "ASTMember must be contained within an ASTContainer");
-	current->members.push_back(this);
+	ASTContainer *c = current;
+	// A container with a shared layout already knows where its fields are.
+	if (c->layout && !c->own_layout)
+	{
+		return;
+	}
+	if (!c->own_layout)
+	{
+		c->own_layout.reset(new ASTLayout());
+		c->layout = c->own_layout.get();
+	}
+	c->own_layout->offsets.push_back(reinterpret_cast<char*>(this) -
+	                                 reinterpret_cast<char*>(c));
 }
 ASTMember::~ASTMember() {}
 
@@ -134,6 +295,13 @@ parse_proc ASTParserDelegate::get_parse_proc(const Rule &r) const
 	if (it == handlers.end()) return nullptr;
 	return it->second;
 }
+const parse_proc *ASTParserDelegate::find_parse_proc(const Rule &r,
+                                                     parse_proc &) const
+{
+	auto it = handlers.find(std::addressof(r));
+	if (it == handlers.end()) return nullptr;
+	return std::addressof(it->second);
+}
 
 /** parses the given input.
 	@param input input.
@@ -147,20 +315,234 @@ parse_proc ASTParserDelegate::get_parse_proc(const Rule &r) const
 std::unique_ptr<ASTNode> parse(Input &input, const Rule &g, const Rule &ws,
                                ErrorReporter &err, const ParserDelegate &d)
 {
-	ASTStack st;
-	if (!parse(input, g, ws, err, d, &st)) return nullptr;
+	ParseStats stats;
+	return parse(input, g, ws, err, d, stats);
+}
+
+void ASTStack::discard()
+{
+	clear();
+	// Nodes in an arena are counted by the arena's blocks, which the arena
+	// keeps.
+	if (stats && !arena)
+	{
+		stats->deallocated(stats->ast_nodes, stats->ast_nodes.current_bytes);
+	}
+}
+
+/**
+ * Removes the root of the AST from the stack after a successful parse.
+ */
+static std::unique_ptr<ASTNode> take_root(ASTStack &st)
+{
 	if (st.size() > 1)
 	{
 		int i = 0;
 		for (auto &I : st)
 		{
 			auto *val = I.second.get();
-			fprintf(stderr, "[%d] %s\n", i++, typeid(*val).name());
+			fprintf(stderr, "[%d] %s\n", i++, type_name(*val).c_str());
 		}
 	}
 	assert(st.size() == 1);
-	return std::move(st[0].second);
+	std::unique_ptr<ASTNode> root = std::move(st[0].second);
+	st.clear();
+	return root;
+}
+
+std::unique_ptr<ASTNode> parse(Input &input, const Rule &g, const Rule &ws,
+                               ErrorReporter &err, const ParserDelegate &d,
+                               ParseStats &stats)
+{
+	ASTStack st(&stats);
+	if (!parse(input, g, ws, err, d, &st, stats))
+	{
+		st.discard();
+		return nullptr;
+	}
+	return take_root(st);
+}
+
+std::unique_ptr<ASTNode> parse(Input &input, const Rule &g, const Rule &ws,
+                               ErrorReporter &err, const ParserDelegate &d,
+                               ParseStats &stats, ASTArena &arena)
+{
+	ASTStack st(&stats);
+	st.arena = &arena;
+	if (!parse(input, g, ws, err, d, &st, stats))
+	{
+		st.discard();
+		return nullptr;
+	}
+	return take_root(st);
+}
+
+std::unique_ptr<ASTNode> parse(const DeferredRegion &r, const Rule &body,
+                               const Rule &ws, ErrorReporter &err,
+                               const ParserDelegate &d, ParseStats &stats)
+{
+	ASTStack st(&stats);
+	if (!r.parse(body, ws, err, d, &st, stats))
+	{
+		st.discard();
+		return nullptr;
+	}
+	return take_root(st);
+}
+
+std::unique_ptr<ASTNode> parse_pika(Input &input, const PikaGrammar &g,
+                                    ErrorReporter &err,
+                                    const ParserDelegate &d,
+                                    ParseStats &stats, unsigned threads)
+{
+	ASTStack st(&stats);
+	if (!parse_pika(input, g, err, d, &st, stats, threads))
+	{
+		st.discard();
+		return nullptr;
+	}
+	return take_root(st);
 }
+
+std::unique_ptr<ASTNode> parse_pipelined(Input &input, const Rule &g,
+                                         const Rule &ws, ErrorReporter &err,
+                                         const ParserDelegate &d,
+                                         ParseStats &stats)
+{
+	// The stack is used by the worker thread, so it records its memory use in
+	// its own statistics, which are added once the worker has finished.
+	ParseStats ast_stats;
+	ast_stats.memory_limit = stats.memory_limit;
+	std::unique_ptr<ASTNode> root;
+	{
+		ASTStack st(&ast_stats);
+		if (parse_pipelined(input, g, ws, err, d, &st, stats))
+		{
+			root = take_root(st);
+		}
+		else
+		{
+			st.discard();
+		}
+	}
+	stats.merge(ast_stats);
+	return root;
+}
+
+ASTParseSession::ASTParseSession(bool use_arena) : stack(&stats())
+{
+	if (use_arena)
+	{
+		stack.arena = &arena;
+	}
+}
+
+std::unique_ptr<ASTNode> ASTParseSession::parse(Input &i, const Rule &g,
+                                                const Rule &ws,
+                                                ErrorReporter &err,
+                                                const ParserDelegate &d)
+{
+	bool ok = ParseSession::parse(i, g, ws, err, d, &stack);
+	if (!ok)
+	{
+		// Discard any nodes that were constructed before the failure.
+		stack.discard();
+		return nullptr;
+	}
+	return take_root(stack);
+}
+ASTRecordParser::ASTRecordParser(Input &i, const Rule &record,
+                                 const Rule &ws, ErrorReporter &err,
+                                 const ASTParserDelegate &d)
+	: RecordParser(i, record, ws, err, d), stack(&stats()) {}
+
+std::unique_ptr<ASTNode> ASTRecordParser::parse_next()
+{
+	bool ok = RecordParser::parse_next(&stack);
+	if (!ok)
+	{
+		stack.discard();
+		return nullptr;
+	}
+	ParseStats &s = stats();
+	s.deallocated(s.ast_nodes, s.ast_nodes.current_bytes);
+	return take_root(stack);
+}
+
+ASTPushParser::ASTPushParser(const Rule &record, const Rule &ws,
+                             ErrorReporter &err, const ASTParserDelegate &d,
+                             const std::string &name)
+	: PushParser(record, ws, err, d, &stack, name), stack(&stats()) {}
+
+std::unique_ptr<ASTNode> ASTPushParser::next()
+{
+	if (records.empty())
+	{
+		return nullptr;
+	}
+	std::unique_ptr<ASTNode> node = std::move(records.front());
+	records.pop_front();
+	return node;
+}
+
+void ASTPushParser::record_parsed()
+{
+	ParseStats &s = stats();
+	s.deallocated(s.ast_nodes, s.ast_nodes.current_bytes);
+	records.push_back(take_root(stack));
+}
+
+ASTSplitParser::ASTSplitParser(const Rule &record, const Rule &ws,
+                               const InputSplitter &split, ErrorReporter &err,
+                               const ASTParserDelegate &d, unsigned threads,
+                               std::size_t chunk_size)
+	: SplitParser(record, ws, split, err, d, &stack, threads, chunk_size),
+	  stack(&stats()) {}
+
+bool ASTSplitParser::parse(Input &i, std::vector<std::unique_ptr<ASTNode>> &nodes)
+{
+	records = &nodes;
+	bool ok = SplitParser::parse(i);
+	records = nullptr;
+	stack.discard();
+	return ok;
+}
+
+void ASTSplitParser::record_parsed()
+{
+	ParseStats &s = stats();
+	s.deallocated(s.ast_nodes, s.ast_nodes.current_bytes);
+	records->push_back(take_root(stack));
+}
+
+ASTIncrementalParser::ASTIncrementalParser(const Rule &g, const Rule &ws,
+                                           ErrorReporter &err,
+                                           const ASTParserDelegate &d,
+                                           const std::string &name)
+	: IncrementalParser(g, ws, err, d, name), stack(&stats()) {}
+
+std::unique_ptr<ASTNode> ASTIncrementalParser::parse(const std::string &text)
+{
+	if (!IncrementalParser::parse(text, &stack))
+	{
+		// Discard any nodes that were constructed before the failure.
+		stack.discard();
+		return nullptr;
+	}
+	return take_root(stack);
+}
+
+std::unique_ptr<ASTNode> ASTIncrementalParser::reparse(
+	const std::vector<TextEdit> &edits)
+{
+	if (!IncrementalParser::reparse(edits, &stack))
+	{
+		stack.discard();
+		return nullptr;
+	}
+	return take_root(stack);
+}
+
 bool ASTString::construct(const pegmatite::InputRange &r, pegmatite::ASTStack &,
                           const ErrorReporter &)
 {
@@ -31,11 +31,14 @@
 
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <deque>
 #include <list>
 #include <unordered_map>
 #include <sstream>
 #include <memory>
+#include <type_traits>
 #include <cxxabi.h>
 #include "parser.hh"
 
@@ -48,49 +51,231 @@ namespace pegmatite {
  */
 std::string demangle(std::string);
 
+class ASTNode;
+/**
+ * Returns the name of the class of `n`, for use in error messages.
+ */
+std::string type_name(const ASTNode &n);
+/**
+ * Returns the name of the class `T`, for use in error messages.
+ */
+template <class T> std::string type_name();
+
 #ifdef DEBUG_AST_CONSTRUCTION
 template <class T> void debug_log(const char *msg, size_t depth, T *obj)
 {
-	std::string demangled = demangle(typeid(*obj).name());
+	std::string name = type_name(*obj);
 	fprintf(stderr, "[%zd] %s %s (%p) off the AST stack\n",
-			depth, msg, demangled.c_str(), static_cast<const void*>(obj));
+			depth, msg, name.c_str(), static_cast<const void*>(obj));
 }
 #else
 template <class T> void debug_log(const char *, size_t /* depth */, T *) {}
 #endif // DEBUG_AST_CONSTRUCTION
 
-class ASTNode;
+class ASTContainer;
+class ASTMember;
 template <class T, bool Optional> class ASTPtr;
 template <class T> class ASTList;
+template <class T> class ASTVector;
 template <class T> class BindAST;
 
+/**
+ * A region of memory in which `BindAST` can construct AST nodes.  Nodes are
+ * placed one after another in large blocks, rather than being allocated
+ * individually, and deleting a node runs its destructor but does not free its
+ * memory.  Each node records the arena that holds it, so deleting one only
+ * counts it out of the arena, without a lookup or a lock.  The memory is
+ * released in bulk: once every node in the arena has been deleted, the next
+ * node starts again from the beginning of the first block, so the blocks are
+ * reused by the next parse.  The blocks are freed only when the arena is
+ * destroyed.
+ *
+ * The nodes are still owned by `std::unique_ptr`s and are deleted in the
+ * usual way, which runs their destructors, but they must all be deleted
+ * before the arena is destroyed.  Nodes may be deleted on any thread, but
+ * only one thread at a time may construct nodes in an arena.
+ */
+class ASTArena
+{
+public:
+	/**
+	 * Constructs an empty arena that allocates blocks of `block_size` bytes
+	 * (or larger, for nodes that do not fit in a block of that size).
+	 */
+	explicit ASTArena(std::size_t block_size = 64 * 1024)
+		: block_size(block_size) {}
+	/**
+	 * Frees the blocks.  No nodes may remain in the arena.
+	 */
+	~ASTArena();
+	ASTArena(const ASTArena &) = delete;
+	ASTArena &operator=(const ASTArena &) = delete;
+	/**
+	 * Returns `bytes` bytes of memory for a new node, suitably aligned for
+	 * any type.
+	 */
+	void *allocate(std::size_t bytes);
+	/**
+	 * Records that a node in the arena has been deleted.  When there are no
+	 * nodes left, the memory in the blocks is reused.  This may be called on
+	 * any thread.
+	 */
+	void release();
+	/**
+	 * Makes the memory in all of the blocks available for new nodes at once,
+	 * without visiting the nodes.  No nodes may remain in the arena.  This is
+	 * done automatically when a node is allocated in an empty arena.
+	 */
+	void reset();
+	/**
+	 * Returns the number of nodes in the arena that have not been deleted.
+	 */
+	std::size_t live() const
+	{
+		return live_nodes.load(std::memory_order_acquire);
+	}
+	/**
+	 * Returns the total size of the blocks that the arena holds.
+	 */
+	std::size_t capacity() const { return total_size; }
+private:
+	/**
+	 * A block of memory, which nodes are placed in from the start.
+	 */
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		std::size_t size;
+	};
+	/**
+	 * The blocks, in the order in which they are filled.
+	 */
+	std::vector<Block> blocks;
+	/**
+	 * The index of the block that new nodes are placed in.
+	 */
+	std::size_t current = 0;
+	/**
+	 * The number of bytes used in the current block.
+	 */
+	std::size_t used = 0;
+	/**
+	 * The number of nodes that have not been deleted, which is decremented
+	 * on whichever thread deletes a node.
+	 */
+	std::atomic<std::size_t> live_nodes{0};
+	/**
+	 * The sum of the sizes of the blocks.
+	 */
+	std::size_t total_size = 0;
+	/**
+	 * The size of the blocks that the arena allocates.
+	 */
+	std::size_t block_size;
+};
 
 typedef std::pair<const InputRange, std::unique_ptr<ASTNode>> ASTStackEntry;
 /** type of AST node stack.
  */
-typedef std::vector<ASTStackEntry> ASTStack;
+class ASTStack : public std::vector<ASTStackEntry,
+                                    StatsAllocator<ASTStackEntry>>
+{
+public:
+	/**
+	 * Constructs an empty stack.  If `s` is not null, then the memory used by
+	 * the stack and by the nodes constructed on it is recorded in `s`.
+	 */
+	explicit ASTStack(ParseStats *s = nullptr)
+		: std::vector<ASTStackEntry, StatsAllocator<ASTStackEntry>>(
+			StatsAllocator<ASTStackEntry>(s, s ? &s->ast_stack : nullptr)),
+		  stats(s) {}
+	/**
+	 * The statistics for the parse that is using this stack, or null.
+	 */
+	ParseStats *stats;
+	/**
+	 * The arena in which `BindAST` constructs nodes, or null to allocate
+	 * each node separately.
+	 */
+	ASTArena *arena = nullptr;
+	/**
+	 * Deletes the nodes on the stack after a failed parse.  Every node
+	 * constructed during the parse is either on the stack or owned by a node
+	 * that is, so this also records in `stats` that the memory for all of
+	 * them has been freed.
+	 */
+	void discard();
+};
 
 #ifdef USE_RTTI
 #define PEGMATITE_RTTI(thisclass, superclass)
 #else
+/**
+ * Describes a class for pegmatite's lightweight RTTI replacement.  Each
+ * description records the descriptions of the class and all of its
+ * superclasses, indexed by their depth below `ASTNode`, so testing whether an
+ * object is an instance of a class is a single comparison, however deep the
+ * class hierarchy is.
+ */
+class ASTType
+{
+public:
+	/**
+	 * Describes the root class, `ASTNode`.
+	 */
+	explicit ASTType(const char *n) : name(n), depth(0), ancestors{this} {}
+	/**
+	 * Describes the class `n`, whose superclass is described by `super`.
+	 */
+	ASTType(const char *n, const ASTType &super)
+		: name(n), depth(super.depth + 1), ancestors(super.ancestors)
+	{
+		ancestors.push_back(this);
+	}
+	ASTType(const ASTType &) = delete;
+	ASTType &operator=(const ASTType &) = delete;
+	/**
+	 * Returns true if this describes the class described by `t` or one of
+	 * its subclasses.
+	 */
+	bool isa(const ASTType &t) const
+	{
+		return (t.depth <= depth) && (ancestors[t.depth] == &t);
+	}
+	/**
+	 * The name of the class.
+	 */
+	const char *const name;
+private:
+	/**
+	 * The number of superclasses between this class and `ASTNode`.
+	 */
+	const std::size_t depth;
+	/**
+	 * The descriptions of this class's superclasses, starting with
+	 * `ASTNode`, and then of this class.
+	 */
+	std::vector<const ASTType*> ancestors;
+};
 /**
  * Define the methods required for pegmatite's lightweight RTTI replacement to
  * work.  This should be used at the end of the class definition and will
- * provide support for safe downcasting.
+ * provide support for safe downcasting.  A class that does not use it is
+ * indistinguishable from its nearest superclass that does.
  */
 #define PEGMATITE_RTTI(thisclass, superclass)            \
 	friend ASTNode;                                      \
 protected:                                               \
-	static char *classKind()                             \
+	static const pegmatite::ASTType &classKind()         \
 	{                                                    \
-		static char thisclass ## id;                     \
-		return &thisclass ## id;                         \
+		static const pegmatite::ASTType type(#thisclass, \
+			superclass::classKind());                    \
+		return type;                                     \
 	}                                                    \
 public:                                                  \
-	virtual bool isa(char *x) override                   \
+	virtual const pegmatite::ASTType &kind() const override \
 	{                                                    \
-		return (x == classKind()) ||                     \
-				(superclass::isa(x));                    \
+		return classKind();                              \
 	}
 #endif
 
@@ -102,9 +287,10 @@ class ASTNode
 {
 public:
 	/**
-	 * Default constructor.
+	 * Default constructor, which records whether the node is being
+	 * constructed in an arena.
 	 */
-	ASTNode() {}
+	ASTNode();
 
 	/**
 	 * Copying AST nodes is not supported.
@@ -126,53 +312,108 @@ public:
 	virtual ~ASTNode();
 
 	/**
-	 * Explicitly default the copy-assignment operator.  This is required
-	 * by subclasses as C++11 deprecates implicitly defaulted copy-assignment
-	 * operators in classes that have user-defined destructors.
+	 * Copy-assignment operator, which subclasses use.  It copies nothing,
+	 * because where each node was allocated stays with that node.
 	 */
-	ASTNode& operator=(const ASTNode&) = default;
+	ASTNode& operator=(const ASTNode&) { return *this; }
+
+	/**
+	 * Allocates a node on the heap.
+	 */
+	static void *operator new(std::size_t size);
+	/**
+	 * Allocates a node in `arena`.
+	 */
+	static void *operator new(std::size_t size, ASTArena &arena);
+	/**
+	 * Frees the memory for a node allocated with either form of `new`.  The
+	 * node's destructor has just passed on the arena that holds it, if any,
+	 * in which case the memory is left for the arena to reuse.
+	 */
+	static void operator delete(void *p);
+	/**
+	 * Frees the memory for a node whose constructor failed in `arena`.
+	 */
+	static void operator delete(void *p, ASTArena &arena);
 
 private:
 
 	template <class T, bool Optional> friend class ASTPtr;
 	template <class T> friend class ASTList;
+	template <class T> friend class ASTVector;
 	template <class T> friend class BindAST;
+	friend std::string type_name(const ASTNode &n);
+	template <class T> friend std::string type_name();
+
+	/**
+	 * The arena that holds this node, or null if it is on the heap.
+	 */
+	ASTArena *arena;
 
 #ifndef USE_RTTI
+	/**
+	 * Returns this object as an `ASTContainer`, or null if it is not one.
+	 * `ASTNode` is a virtual base class, so casts to subclasses must go
+	 * through the class that inherits from it.
+	 */
+	virtual ASTContainer *as_container() { return nullptr; }
+	/**
+	 * Returns this object as an `ASTMember`, or null if it is not one.
+	 */
+	virtual ASTMember *as_member() { return nullptr; }
+	/**
+	 * Casts this object, which is known to be a `T`, to a `T` that is a
+	 * subclass of `ASTContainer`.
+	 */
+	template <class T> T* downcast(std::integral_constant<int, 0>)
+	{
+		return static_cast<T*>(as_container());
+	}
+	/**
+	 * Casts this object to a `T` that is a subclass of `ASTMember`.
+	 */
+	template <class T> T* downcast(std::integral_constant<int, 1>)
+	{
+		return static_cast<T*>(as_member());
+	}
+	/**
+	 * Casts this object to a `T` that inherits from `ASTNode` non-virtually.
+	 */
+	template <class T> T* downcast(std::integral_constant<int, 2>)
+	{
+		return static_cast<T*>(this);
+	}
 protected:
 	/**
-	 * Returns the kind of object class.  This is a unique pointer that can be
-	 * tested against pointers returned by classKind() to determine whether
-	 * they can be safely compared.
+	 * Returns the description of this object's class.
 	 */
-	virtual char *kind() { return classKind(); }
+	virtual const ASTType &kind() const { return classKind(); }
 	/**
-	 * Returns the unique identifier for this class.
+	 * Returns the description of this class.
 	 */
-	static char *classKind()
+	static const ASTType &classKind()
 	{
-		static char ASTNodeid;
-		return &ASTNodeid;
+		static const ASTType type("ASTNode");
+		return type;
 	}
-public:
 	/**
-	 * Root implementation of the RTTI-replacement for builds not wishing to
-	 * use RTTI.  This returns true if `x` is the value returned from
-	 * `classKind()`, or false otherwise.
+	 * Returns the description of the class `T`, which `ASTNode` can access
+	 * because `PEGMATITE_RTTI` makes it a friend.
 	 */
-	virtual bool isa(char *x)
+	template <class T> static const ASTType &kind_of()
 	{
-		return x == classKind();
+		return T::classKind();
 	}
+public:
 	/**
 	 * Returns true if this object is an instance of `T`.  Note that this
 	 * *only* works with single-inheritance hierarchies.  If you wish to use
 	 * multiple inheritance in your AST classes, then you must define
 	 * `USE_RTTI` and use the C++ RTTI mechanism.
 	 */
-	template <class T> bool isa()
+	template <class T> bool isa() const
 	{
-		return isa(T::classKind());
+		return kind().isa(kind_of<T>());
 	}
 	/**
 	 * Returns a pointer to this object as a pointer to a child class, or
@@ -184,8 +425,10 @@ public:
 	 */
 	template <class T> T* get_as()
 	{
-		auto *t = this;
-		return t ? (isa<T>() ? static_cast<T*>(this) : nullptr) : nullptr;
+		typedef std::integral_constant<int,
+			std::is_base_of<ASTContainer, T>::value ? 0 :
+			std::is_base_of<ASTMember, T>::value ? 1 : 2> path;
+		return isa<T>() ? downcast<T>(path()) : nullptr;
 	}
 #else
 public:
@@ -196,13 +439,54 @@ public:
 #endif
 };
 
-
-class ASTMember;
+template <class T> std::string type_name()
+{
+#ifdef USE_RTTI
+	return demangle(typeid(T).name());
+#else
+	return ASTNode::kind_of<T>().name;
+#endif
+}
 
 
-/** type of ast member vector.
+/**
+ * The fields of an `ASTContainer` subclass that are constructed
+ * automatically, recorded as the offsets of the `ASTMember` objects from the
+ * `ASTContainer` part of the object, in the order in which they are declared.
+ * Every instance of a subclass has the same fields, so this is recorded once
+ * for each class that `BindAST` constructs and shared by all of its
+ * instances.
  */
+struct ASTLayout
+{
+	std::vector<std::ptrdiff_t> offsets;
+};
 
+/**
+ * The layout shared by all instances of one `ASTContainer` subclass, which is
+ * recorded from the first instance that is constructed.
+ */
+class ASTSharedLayout
+{
+public:
+	ASTSharedLayout() {}
+	ASTSharedLayout(const ASTSharedLayout &) = delete;
+	ASTSharedLayout &operator=(const ASTSharedLayout &) = delete;
+	~ASTSharedLayout() { delete layout.load(); }
+	/**
+	 * Returns the layout, or null if it has not been recorded yet.
+	 */
+	const ASTLayout *get() const
+	{
+		return layout.load(std::memory_order_acquire);
+	}
+	/**
+	 * Records the layout of `c`, if no layout has been recorded yet.
+	 */
+	void record(const ASTContainer &c);
+private:
+	std::atomic<const ASTLayout*> layout{nullptr};
+};
 
 /**
  * The base class for non-leaf AST nodes.  Subclasses can have instances of
@@ -212,9 +496,12 @@ class ASTContainer : public virtual ASTNode
 {
 public:
 	/**
-	 * Constructs the container, setting a thread-local value to point to it
-	 * allowing constructors in fields of the subclass to register themselves
-	 * in the members vector.
+	 * Constructs the container.  If `BindAST` has already recorded the
+	 * layout of the subclass being constructed then the container uses it
+	 * and the fields do nothing when they are constructed.  Otherwise, this
+	 * sets a thread-local value to point to the container, allowing
+	 * constructors in fields of the subclass to register themselves in the
+	 * container's own layout.
 	 */
 	ASTContainer();
 	virtual ~ASTContainer() override;
@@ -229,22 +516,33 @@ public:
 	bool construct(const InputRange &r, ASTStack &st,
 	               const ErrorReporter&) override;
 
+	/**
+	 * Sets the layout that the next container constructed on this thread
+	 * will use, or null if it must record its own.  Used by `BindAST`.
+	 */
+	static void use_layout(const ASTLayout *l);
+
 private:
+#ifndef USE_RTTI
+	ASTContainer *as_container() override { return this; }
+#endif
 	/**
-	 * The type used for tracking the fields of subclasses.
+	 * The fields of the subclass that will be automatically constructed.
+	 * This is either shared with the other instances of the subclass or
+	 * points to `own_layout`.
 	 */
-	typedef std::vector<ASTMember *> ASTMember_vector;
+	const ASTLayout *layout = nullptr;
 	/**
-	 * References to all of the fields of the subclass that will be
-	 * automatically constructed.
+	 * The layout recorded as this object's fields were constructed, if it
+	 * was not given a shared one.
 	 */
-	ASTMember_vector members;
+	std::unique_ptr<ASTLayout> own_layout;
 
 	friend class ASTMember;
+	friend class ASTSharedLayout;
 	PEGMATITE_RTTI(ASTContainer, ASTNode)
 };
 
-
 /**
  * Base class for children of `ASTContainer`.
  */
@@ -253,12 +551,16 @@ class ASTMember : public virtual ASTNode
 	PEGMATITE_RTTI(ASTMember, ASTNode)
 public:
 	/**
-	 * On construction, `ASTMember` sets its `container_node` field to the
-	 * `ASTContainer` currently under construction and registers itself with
-	 * the container, to be notified during the construction phase.
+	 * On construction, `ASTMember` registers itself with the `ASTContainer`
+	 * currently under construction, to be notified during the construction
+	 * phase, unless the container already has its subclass's layout.
 	 */
 	ASTMember();
 	virtual ~ASTMember() override;
+private:
+#ifndef USE_RTTI
+	ASTMember *as_member() override { return this; }
+#endif
 protected:
 	/**
 	 * The container that owns this object.
@@ -304,7 +606,7 @@ std::pair<bool, std::unique_ptr<T>> popFromASTStack(const InputRange &r,
 			return {true, nullptr};
 		}
 		err(childRange,
-			"Non-optional " + demangle(typeid(T).name()) + " expected.");
+			"Non-optional " + type_name<T>() + " expected.");
 		return {false, nullptr};
 	}
 	//get the node
@@ -315,8 +617,7 @@ std::pair<bool, std::unique_ptr<T>> popFromASTStack(const InputRange &r,
 	if (obj == nullptr and not Optional)
 	{
 		err(childRange,
-			"Expected " + demangle(typeid(T).name())
-			+ ", found " + demangle(typeid(*node).name()));
+			"Expected " + type_name<T>() + ", found " + type_name(*node));
 		return {false, nullptr};
 	}
 
@@ -458,6 +759,95 @@ public:
 
 };
 
+/** A list of objects, stored contiguously.
+	It takes the same objects from the ast stack as `ASTList` does, but
+	counts them first and then moves them into a vector of exactly the
+	required size, in order, rather than allocating a list node for each.
+	It assumes ownership of objects.
+	@tparam T type of object to control.
+ */
+template <class T> class ASTVector : public ASTMember, public std::vector<std::unique_ptr<T>>
+{
+public:
+
+	///the default constructor.
+	ASTVector() {}
+
+	/**
+	 * Pops objects of type T from the stack (`st`) until no more objects can
+	 * be popped.
+	 */
+	bool construct(const InputRange &r, ASTStack &st,
+	               const ErrorReporter&) override
+	{
+		// Count the entries that belong to this list, stopping at the first
+		// one that is outside the range.
+		std::size_t count = 0;
+		for (auto i = st.rbegin() ; i != st.rend() ; ++i)
+		{
+			const InputRange &childRange = i->first;
+			if ((childRange.begin() < r.begin()) ||
+			    (childRange.end() > r.end()))
+			{
+				break;
+			}
+			count++;
+		}
+		// Move them into place from the end, so that the vector is in the
+		// same order as the input.  An entry of the wrong type ends the list,
+		// as it does for `ASTList`, and the construction fails.
+		std::size_t base = this->size();
+		this->resize(base + count);
+		std::size_t taken = 0;
+		bool success = true;
+		while (taken < count)
+		{
+			T *obj = st.back().second->template get_as<T>();
+			if (!obj)
+			{
+				success = false;
+				break;
+			}
+			debug_log("Popped", st.size()-1, obj);
+			st.back().second.release();
+			st.pop_back();
+			taken++;
+			(*this)[base + count - taken].reset(obj);
+		}
+		if (taken < count)
+		{
+			this->erase(this->begin() + base,
+			            this->begin() + base + count - taken);
+		}
+		return success;
+	}
+	virtual ~ASTVector() override {}
+
+};
+
+/**
+ * An AST node for a region skipped by a `defer()` expression.  Bind it to a
+ * rule whose expression is the `defer()` expression.  The node records the
+ * region, which can be parsed with the body rule when its contents are
+ * needed, for example with `ASTParserDelegate::parse()` or, for many regions
+ * at once, with `parse_deferred()`.
+ */
+class ASTDeferred : public ASTContainer
+{
+public:
+	/**
+	 * The region.
+	 */
+	DeferredRegion region;
+	bool construct(const InputRange &r, ASTStack &,
+	               const ErrorReporter &) override
+	{
+		region = DeferredRegion(r);
+		return true;
+	}
+	PEGMATITE_RTTI(ASTDeferred, ASTContainer)
+};
+
 /** parses the given input.
 	@param i input.
 	@param g root rule of grammar.
@@ -470,6 +860,254 @@ public:
 std::unique_ptr<ASTNode> parse(Input &i, const Rule &g, const Rule &ws,
                                ErrorReporter &err, const ParserDelegate &d);
 
+/** parses the given input, recording memory statistics.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback for reporting errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse, including the AST.
+	@return pointer to ast node created, or null if there was an error.
+ */
+std::unique_ptr<ASTNode> parse(Input &i, const Rule &g, const Rule &ws,
+                               ErrorReporter &err, const ParserDelegate &d,
+                               ParseStats &stats);
+
+/** parses the given input, as above, constructing the AST nodes in `arena`.
+	Every node in the AST must be deleted before the arena is destroyed.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback for reporting errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse, including the AST.
+	@param arena the arena that holds the AST nodes.
+	@return pointer to ast node created, or null if there was an error.
+ */
+std::unique_ptr<ASTNode> parse(Input &i, const Rule &g, const Rule &ws,
+                               ErrorReporter &err, const ParserDelegate &d,
+                               ParseStats &stats, ASTArena &arena);
+
+/** parses the given input, constructing the AST on a second thread while
+	parsing continues (see `pegmatite::parse_pipelined()`).  The AST nodes
+	are constructed, and any errors that they report are reported, on that
+	thread.  The memory used by the AST is recorded separately and then
+	added to `stats`, so `stats.memory_limit` applies to the parse and to
+	the AST separately.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback for reporting errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse, including the AST.
+	@return pointer to ast node created, or null if there was an error.
+ */
+std::unique_ptr<ASTNode> parse_pipelined(Input &i, const Rule &g,
+                                         const Rule &ws, ErrorReporter &err,
+                                         const ParserDelegate &d,
+                                         ParseStats &stats);
+
+/** parses a region skipped by a `defer()` expression, recording memory
+	statistics (see `DeferredRegion::parse()`).
+	@param r region.
+	@param body rule that parses the contents of the region.
+	@param ws whitespace rule.
+	@param err callback for reporting errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse, including the AST.
+	@return pointer to ast node created, or null if there was an error.
+ */
+std::unique_ptr<ASTNode> parse(const DeferredRegion &r, const Rule &body,
+                               const Rule &ws, ErrorReporter &err,
+                               const ParserDelegate &d, ParseStats &stats);
+
+/** parses the given input with the Pika parser (see
+	`pegmatite::parse_pika()`), recording memory statistics.
+	@param i input.
+	@param g compiled grammar.
+	@param err callback for reporting errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse, including the AST.
+	@param threads number of threads on which to match the terminals.
+	@return pointer to ast node created, or null if there was an error.
+ */
+std::unique_ptr<ASTNode> parse_pika(Input &i, const PikaGrammar &g,
+                                    ErrorReporter &err,
+                                    const ParserDelegate &d,
+                                    ParseStats &stats, unsigned threads = 1);
+
+class ASTParserDelegate;
+
+/**
+ * A parse session that builds ASTs.  In addition to the parser's data
+ * structures, the session reuses the stack on which AST nodes are constructed.
+ *
+ * A session can also construct the AST nodes in an arena that it owns (see
+ * `ASTArena`), so that building an AST does not allocate each node
+ * separately and the arena's memory is reused once the previous ASTs have
+ * been deleted.  The ASTs must then be deleted before the session.
+ */
+class ASTParseSession : public ParseSession
+{
+	/**
+	 * The arena for the AST nodes, if the session uses one.
+	 */
+	ASTArena arena;
+	/**
+	 * The stack used to construct AST nodes.  It is empty between parses.
+	 */
+	ASTStack stack;
+public:
+	/**
+	 * Constructs a session, which constructs AST nodes in its own arena if
+	 * `use_arena` is true.
+	 */
+	explicit ASTParseSession(bool use_arena = false);
+	using ParseSession::parse;
+	/** parses the given input.
+		@param i input.
+		@param g root rule of grammar.
+		@param ws whitespace rule.
+		@param err callback for reporting errors.
+		@param d the delegate that creates AST nodes.
+		@return pointer to ast node created, or null if there was an error.
+	 */
+	std::unique_ptr<ASTNode> parse(Input &i, const Rule &g, const Rule &ws,
+	                               ErrorReporter &err, const ParserDelegate &d);
+};
+
+/**
+ * A record parser (see `RecordParser`) that constructs an AST for each
+ * record.  The record rule must construct a single AST node.
+ */
+class ASTRecordParser : public RecordParser
+{
+	/**
+	 * The stack used to construct AST nodes.  It is empty between records.
+	 */
+	ASTStack stack;
+public:
+	/**
+	 * Prepares to parse `i` as a sequence of `record`s separated by `ws`,
+	 * constructing AST nodes with `d`.
+	 */
+	ASTRecordParser(Input &i, const Rule &record, const Rule &ws,
+	                ErrorReporter &err, const ASTParserDelegate &d);
+	using RecordParser::parse_next;
+	/**
+	 * Parses the next record and returns the AST node constructed for it, or
+	 * null at the end of the input or on an error.  The node belongs to the
+	 * caller, so its memory is no longer counted in the statistics.
+	 */
+	std::unique_ptr<ASTNode> parse_next();
+};
+
+/**
+ * A push parser (see `PushParser`) that constructs an AST for each record.
+ * The record rule must construct a single AST node.  The nodes for the
+ * records that have been parsed are queued until they are taken with
+ * `next()`.
+ */
+class ASTPushParser : public PushParser
+{
+	/**
+	 * The stack used to construct AST nodes.  It is empty between records.
+	 */
+	ASTStack stack;
+	/**
+	 * The nodes for the records that have been parsed but not yet taken.
+	 */
+	std::deque<std::unique_ptr<ASTNode>> records;
+public:
+	/**
+	 * Prepares to parse a sequence of `record`s separated by `ws`,
+	 * constructing AST nodes with `d`.
+	 */
+	ASTPushParser(const Rule &record, const Rule &ws, ErrorReporter &err,
+	              const ASTParserDelegate &d, const std::string &name = "");
+	/**
+	 * Returns the node for the next record that has been parsed, or null if
+	 * there is none yet.  The node belongs to the caller.
+	 */
+	std::unique_ptr<ASTNode> next();
+protected:
+	/**
+	 * Moves the node for the record that has just been parsed to the queue.
+	 */
+	void record_parsed() override;
+};
+
+/**
+ * A split parser (see `SplitParser`) that constructs an AST for each record
+ * on the calling thread, while later records are still being matched.  The
+ * record rule must construct a single AST node.
+ */
+class ASTSplitParser : public SplitParser
+{
+	/**
+	 * The stack used to construct AST nodes.  It is empty between records.
+	 */
+	ASTStack stack;
+	/**
+	 * The vector that the nodes for the current parse are added to.
+	 */
+	std::vector<std::unique_ptr<ASTNode>> *records = nullptr;
+public:
+	/**
+	 * Prepares to parse sequences of `record`s separated by `ws`, split with
+	 * `split`, constructing AST nodes with `d`.
+	 */
+	ASTSplitParser(const Rule &record, const Rule &ws,
+	               const InputSplitter &split, ErrorReporter &err,
+	               const ASTParserDelegate &d, unsigned threads = 0,
+	               std::size_t chunk_size = 1 << 20);
+	/**
+	 * Parses all of the records in `i`, appending the node for each to
+	 * `nodes`.  Returns true if all of them were parsed.  On an error, the
+	 * nodes for the records before it are still added.  The nodes belong to
+	 * the caller.
+	 */
+	bool parse(Input &i, std::vector<std::unique_ptr<ASTNode>> &nodes);
+protected:
+	/**
+	 * Moves the node for the record that has just been parsed to the vector.
+	 */
+	void record_parsed() override;
+};
+
+/**
+ * An incremental parser (see `IncrementalParser`) that constructs an AST for
+ * the whole text each time that it is parsed.
+ */
+class ASTIncrementalParser : public IncrementalParser
+{
+	/**
+	 * The stack used to construct AST nodes.  It is empty between parses.
+	 */
+	ASTStack stack;
+public:
+	/**
+	 * Prepares to parse texts with the grammar `g` and the whitespace rule
+	 * `ws`, constructing AST nodes with `d`.
+	 */
+	ASTIncrementalParser(const Rule &g, const Rule &ws, ErrorReporter &err,
+	                     const ASTParserDelegate &d,
+	                     const std::string &name = "");
+	using IncrementalParser::parse;
+	using IncrementalParser::reparse;
+	/**
+	 * Replaces the text with `text`, parses it and returns the root of the
+	 * AST, or null if there was an error.  The AST belongs to the caller.
+	 */
+	std::unique_ptr<ASTNode> parse(const std::string &text);
+	/**
+	 * Applies `edits` to the text and parses it again, as
+	 * `IncrementalParser::reparse()` does, returning the root of the new
+	 * AST, or null if there was an error.
+	 */
+	std::unique_ptr<ASTNode> reparse(const std::vector<TextEdit> &edits);
+};
+
 /**
  * A parser delegate that is responsible for creating AST nodes from the input.
  *
@@ -489,6 +1127,19 @@ class ASTParserDelegate : ParserDelegate
 	 * which should never be called from anything else.
 	 */
 	template <class T> friend class BindAST;
+	/**
+	 * ASTRecordParser is a friend so that it can use this as the delegate for
+	 * the records that it parses.
+	 */
+	friend class ASTRecordParser;
+	/**
+	 * ASTPushParser, ASTSplitParser, ASTIncrementalParser and ParserPool are
+	 * friends for the same reason.
+	 */
+	friend class ASTPushParser;
+	friend class ASTSplitParser;
+	friend class ASTIncrementalParser;
+	friend class ParserPool;
 	private:
 	/**
 	 * The map from rules to parsing handlers.
@@ -512,6 +1163,12 @@ class ASTParserDelegate : ParserDelegate
 	 */
 	ASTParserDelegate();
 	virtual parse_proc get_parse_proc(const Rule &) const;
+	/**
+	 * Returns a pointer to the handler registered for the rule, without
+	 * copying it.
+	 */
+	virtual const parse_proc *find_parse_proc(const Rule &r,
+	                                          parse_proc &storage) const;
 	/**
 	 * Parse an input `i`, starting from rule `g` in the grammar for which
 	 * this is a delegate.  The rule `ws` is used as whitespace.  Errors are
@@ -524,8 +1181,89 @@ class ASTParserDelegate : ParserDelegate
 	                              ErrorReporter err,
 	                              std::unique_ptr<T> &ast) const
 	{
-		std::unique_ptr<ASTNode> node = pegmatite::parse(i, g, ws, err, *this);
-		T *n = node->get_as<T>();
+		ParseStats stats;
+		return parse(i, g, ws, err, ast, stats);
+	}
+	/**
+	 * Parse an input, as above, recording memory statistics for the parse
+	 * (including the AST) in `stats`.
+	 */
+	template <class T> bool parse(Input &i, const Rule &g, const Rule &ws,
+	                              ErrorReporter err,
+	                              std::unique_ptr<T> &ast,
+	                              ParseStats &stats) const
+	{
+		return take_root(pegmatite::parse(i, g, ws, err, *this, stats), ast);
+	}
+	/**
+	 * Parse an input, as above, constructing the AST nodes in `arena`.  The
+	 * AST must be deleted before the arena.
+	 */
+	template <class T> bool parse(Input &i, const Rule &g, const Rule &ws,
+	                              ErrorReporter err,
+	                              std::unique_ptr<T> &ast,
+	                              ParseStats &stats, ASTArena &arena) const
+	{
+		return take_root(pegmatite::parse(i, g, ws, err, *this, stats, arena),
+		                 ast);
+	}
+	/**
+	 * Parse an input, as above, constructing the AST on a second thread while
+	 * parsing continues.  See `pegmatite::parse_pipelined()`.
+	 */
+	template <class T> bool parse_pipelined(Input &i, const Rule &g,
+	                                        const Rule &ws, ErrorReporter err,
+	                                        std::unique_ptr<T> &ast,
+	                                        ParseStats &stats) const
+	{
+		return take_root(pegmatite::parse_pipelined(i, g, ws, err, *this,
+		                                            stats), ast);
+	}
+	/**
+	 * Parse a region skipped by a `defer()` expression with its body rule
+	 * `body`, as above.  See `DeferredRegion::parse()`.
+	 */
+	template <class T> bool parse(const DeferredRegion &r, const Rule &body,
+	                              const Rule &ws, ErrorReporter err,
+	                              std::unique_ptr<T> &ast,
+	                              ParseStats &stats) const
+	{
+		return take_root(pegmatite::parse(r, body, ws, err, *this, stats),
+		                 ast);
+	}
+	/**
+	 * Parse an input, as above, with the Pika parser, using the grammar `g`,
+	 * which must have been compiled from the grammar for which this is a
+	 * delegate.  See `pegmatite::parse_pika()`.
+	 */
+	template <class T> bool parse_pika(Input &i, const PikaGrammar &g,
+	                                   ErrorReporter err,
+	                                   std::unique_ptr<T> &ast,
+	                                   ParseStats &stats,
+	                                   unsigned threads = 1) const
+	{
+		return take_root(pegmatite::parse_pika(i, g, err, *this, stats,
+		                                       threads), ast);
+	}
+	/**
+	 * Parse an input, as above, reusing the memory held by `session`.  The
+	 * statistics for the parse are available from the session.
+	 */
+	template <class T> bool parse(ASTParseSession &session, Input &i,
+	                              const Rule &g, const Rule &ws,
+	                              ErrorReporter err,
+	                              std::unique_ptr<T> &ast) const
+	{
+		return take_root(session.parse(i, g, ws, err, *this), ast);
+	}
+	private:
+	/**
+	 * Moves `node` into `ast` if it is of the type that `ast` holds.
+	 */
+	template <class T> static bool take_root(std::unique_ptr<ASTNode> node,
+	                                         std::unique_ptr<T> &ast)
+	{
+		T *n = node ? node->get_as<T>() : nullptr;
 		if (n)
 		{
 			node.release();
@@ -543,6 +1281,58 @@ class ASTParserDelegate : ParserDelegate
  */
 template <class T> class BindAST
 {
+	/**
+	 * The layout of `T`, if it is an `ASTContainer`.
+	 */
+	static ASTSharedLayout layout;
+	/**
+	 * Constructs a `T` that is an `ASTContainer`, in `arena` if it is not
+	 * null, giving it the layout recorded for `T` or recording the layout
+	 * from it.
+	 */
+	static T *create(ASTArena *arena, std::true_type)
+	{
+		const ASTLayout *l = layout.get();
+		ASTContainer::use_layout(l);
+		T *obj;
+		try
+		{
+			obj = arena ? new (*arena) T() : new T();
+		}
+		catch (...)
+		{
+			// The allocation may have failed before the container could
+			// take the layout, which must not pass to the next container
+			// constructed on this thread.
+			ASTContainer::use_layout(nullptr);
+			throw;
+		}
+		if (!l)
+		{
+			layout.record(*obj);
+		}
+		return obj;
+	}
+	/**
+	 * Constructs a `T` that is not an `ASTContainer`, in `arena` if it is
+	 * not null.
+	 */
+	static T *create(ASTArena *arena, std::false_type)
+	{
+		return arena ? new (*arena) T() : new T();
+	}
+	/**
+	 * Deletes a node that `create()` returned but that will not be pushed
+	 * onto `st`, removing it from the statistics if they count it.
+	 */
+	static void discard(T *obj, ASTStack *st)
+	{
+		delete obj;
+		if (st->stats && !st->arena)
+		{
+			st->stats->deallocated(st->stats->ast_nodes, sizeof(T));
+		}
+	}
 public:
 	/**
 	 * Bind the AST class described in the grammar to the rule specified.
@@ -554,11 +1344,31 @@ public:
 		                                             void *d)
 			{
 				ASTStack *st = reinterpret_cast<ASTStack *>(d);
-				T *obj = new T();
+				ASTArena *arena = st->arena;
+				std::size_t capacity = arena ? arena->capacity() : 0;
+				T *obj = create(arena,
+					std::is_base_of<ASTContainer, T>());
+				if (st->stats)
+				{
+					// Nodes in an arena are counted as the arena's blocks are
+					// allocated.
+					std::size_t bytes = arena ?
+						arena->capacity() - capacity : sizeof(T);
+					if (bytes > 0)
+					{
+						st->stats->allocated(st->stats->ast_nodes, bytes);
+					}
+					if (st->stats->limit_exceeded)
+					{
+						discard(obj, st);
+						return false;
+					}
+				}
 				debug_log("Constructing", st->size(), obj);
 				if (not obj->construct(range, *st, err))
 				{
 					debug_log("Failed", st->size(), obj);
+					discard(obj, st);
 					return false;
 				}
 				st->push_back(std::make_pair(range, std::unique_ptr<ASTNode>(obj)));
@@ -568,6 +1378,8 @@ public:
 	}
 };
 
+template <class T> ASTSharedLayout BindAST<T>::layout;
+
 /**
  * Helper class for adopting strings as children of AST nodes.
  */
@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The number of calls to the global `operator new` since the program started.
+ */
+std::atomic<std::size_t> allocation_count(0);
+}
+
+void *operator new(std::size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(size ? size : 1);
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	free(p);
+}
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Converts a duration to nanoseconds.
+ */
+long long ns(Clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+/**
+ * A delegate that provides a handler for every rule that another delegate
+ * handles, but whose handlers do nothing.  Running a parse with this delegate
+ * measures the cost of dispatching parse procedures, separately from the cost
+ * of the work that they do.
+ */
+class NullDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	parse_proc nothing = [](const InputRange &, void *) { return true; };
+public:
+	NullDelegate(const ASTParserDelegate &d) : inner(d) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		return inner.get_parse_proc(r) ? nothing : nullptr;
+	}
+	const parse_proc *find_parse_proc(const Rule &r,
+	                                  parse_proc &storage) const override
+	{
+		return inner.find_parse_proc(r, storage) ? &nothing : nullptr;
+	}
+};
+
+/**
+ * The results of one benchmark run.
+ */
+struct Result
+{
+	bool ok = false;
+	long long parse_ns = 0;
+	long long procs_ns = 0;
+	long long ast_ns = 0;
+	long long teardown_ns = 0;
+	long long arena_teardown_ns = 0;
+	long long recognize_ns = 0;
+	long long pipelined_ns = 0;
+	std::size_t allocations = 0;
+	std::size_t session_allocations = 0;
+	std::size_t arena_allocations = 0;
+	std::size_t peak_bytes = 0;
+	/**
+	 * Keeps the fastest timings from `other`.
+	 */
+	void merge(const Result &other)
+	{
+		ok = ok && other.ok;
+		parse_ns = std::min(parse_ns, other.parse_ns);
+		procs_ns = std::min(procs_ns, other.procs_ns);
+		ast_ns = std::min(ast_ns, other.ast_ns);
+		teardown_ns = std::min(teardown_ns, other.teardown_ns);
+		arena_teardown_ns = std::min(arena_teardown_ns,
+		                             other.arena_teardown_ns);
+		recognize_ns = std::min(recognize_ns, other.recognize_ns);
+		pipelined_ns = std::min(pipelined_ns, other.pipelined_ns);
+	}
+};
+
+/**
+ * Parses `text` with the grammar that `Parser` builds an AST for, once with
+ * a delegate that does nothing and once building the AST.
+ */
+template<class Parser>
+Result run(const std::string &text)
+{
+	static Parser p;
+	Result result;
+	ErrorReporter err = defaultErrorReporter;
+
+	NullDelegate null(p);
+	StringInput null_input(text);
+	ParseStats null_stats;
+	bool null_ok = parse(null_input, p.root(), p.whitespace(), err, null,
+	                     nullptr, null_stats);
+
+	StringInput recognize_input(text);
+	ParseStats recognize_stats;
+	std::size_t length;
+	bool recognized = recognize(recognize_input, p.root(), p.whitespace(),
+	                            length, err, recognize_stats);
+
+	StringInput input(text);
+	ParseStats stats;
+	std::unique_ptr<typename Parser::Root> root;
+	std::size_t allocations = allocation_count.load();
+	bool ok = p.parse(input, p.root(), p.whitespace(), err, root, stats);
+	result.allocations = allocation_count.load() - allocations;
+	auto teardown_start = Clock::now();
+	root.reset();
+	result.teardown_ns = ns(Clock::now() - teardown_start);
+
+	// Parse twice with a session, so that the second parse reuses the memory
+	// that the first one allocated.
+	static ASTParseSession session;
+	StringInput warm_input(text);
+	p.parse(session, warm_input, p.root(), p.whitespace(), err, root);
+	root.reset();
+	StringInput session_input(text);
+	allocations = allocation_count.load();
+	ok = p.parse(session, session_input, p.root(), p.whitespace(), err, root) &&
+	     ok;
+	result.session_allocations = allocation_count.load() - allocations;
+	root.reset();
+
+	// The same again with a session that constructs the nodes in an arena,
+	// which the second parse reuses once the first AST has been deleted.
+	static ASTParseSession arena_session(true);
+	StringInput arena_warm_input(text);
+	p.parse(arena_session, arena_warm_input, p.root(), p.whitespace(), err,
+	        root);
+	root.reset();
+	StringInput arena_input(text);
+	allocations = allocation_count.load();
+	ok = p.parse(arena_session, arena_input, p.root(), p.whitespace(), err,
+	             root) && ok;
+	result.arena_allocations = allocation_count.load() - allocations;
+	teardown_start = Clock::now();
+	root.reset();
+	result.arena_teardown_ns = ns(Clock::now() - teardown_start);
+
+	// Parse while building the AST on a second thread.  This is timed from
+	// start to finish, because the two threads' times overlap.
+	StringInput pipelined_input(text);
+	ParseStats pipelined_stats;
+	auto pipelined_start = Clock::now();
+	ok = p.parse_pipelined(pipelined_input, p.root(), p.whitespace(), err, root,
+	                       pipelined_stats) && ok;
+	result.pipelined_ns = ns(Clock::now() - pipelined_start);
+	root.reset();
+
+	result.ok = null_ok && recognized && ok;
+	result.parse_ns = ns(stats.match_time);
+	result.procs_ns = ns(null_stats.proc_time);
+	result.ast_ns = std::max(0LL, ns(stats.proc_time) - result.procs_ns);
+	result.peak_bytes = stats.peak_bytes;
+	result.recognize_ns = ns(recognize_stats.match_time);
+	return result;
+}
+
+/**
+ * An element of the lists built by `run_list()`.
+ */
+class ListElement : public ASTContainer
+{
+public:
+	std::size_t value = 0;
+	PEGMATITE_RTTI(ListElement, ASTContainer)
+};
+
+/**
+ * A node with a single list of `ListElement`s, held in a `List`.
+ */
+template<class List>
+class ListNode : public ASTContainer
+{
+public:
+	List elements;
+	PEGMATITE_RTTI(ListNode, ASTContainer)
+};
+
+/**
+ * The results of one run of the list benchmark.
+ */
+struct ListResult
+{
+	long long construct_ns = 0;
+	long long traverse_ns = 0;
+	std::size_t allocations = 0;
+	std::size_t sum = 0;
+	/**
+	 * Keeps the fastest timings from `other`.
+	 */
+	void merge(const ListResult &other)
+	{
+		construct_ns = std::min(construct_ns, other.construct_ns);
+		traverse_ns = std::min(traverse_ns, other.traverse_ns);
+	}
+};
+
+/**
+ * Pushes `count` elements onto an AST stack, as the parse procedures for the
+ * elements of a list would, and times constructing a `List` from them and
+ * then walking it.
+ */
+template<class List>
+ListResult run_list(std::size_t count)
+{
+	ListResult result;
+	ErrorReporter err = defaultErrorReporter;
+	std::string text(count, 'x');
+	StringInput input(text);
+	ASTStack st;
+	st.reserve(count);
+	ParserPosition start(input);
+	ParserPosition finish(input);
+	for (std::size_t i=0 ; i<count ; i++)
+	{
+		finish.it = start.it;
+		++finish.it;
+		ListElement *element = new ListElement();
+		element->value = i;
+		st.push_back(std::make_pair(InputRange(start, finish),
+		                            std::unique_ptr<ASTNode>(element)));
+		start.it = finish.it;
+	}
+	start.it = input.begin();
+	ListNode<List> node;
+	std::size_t allocations = allocation_count.load();
+	auto construct_start = Clock::now();
+	node.construct(InputRange(start, finish), st, err);
+	result.construct_ns = ns(Clock::now() - construct_start);
+	result.allocations = allocation_count.load() - allocations;
+	auto traverse_start = Clock::now();
+	for (auto &element : node.elements)
+	{
+		result.sum += element->value;
+	}
+	result.traverse_ns = ns(Clock::now() - traverse_start);
+	return result;
+}
+
+/**
+ * Runs the list benchmark for one kind of list and prints the result.
+ */
+template<class List>
+void print_list(const char *name, std::size_t count, unsigned repeats)
+{
+	ListResult result = run_list<List>(count);
+	for (unsigned i=1 ; i<repeats ; i++)
+	{
+		result.merge(run_list<List>(count));
+	}
+	std::cout << "{\"list\": \"" << name << '"'
+	          << ", \"elements\": " << count
+	          << ", \"ok\": "
+	          << (result.sum == count * (count - 1) / 2 ? "true" : "false")
+	          << ", \"allocations\": " << result.allocations
+	          << ", \"construct_ns\": " << result.construct_ns
+	          << ", \"traverse_ns\": " << result.traverse_ns
+	          << '}' << std::endl;
+}
+
+/**
+ * Adjusts the generator's choice weights for a grammar.  By default, every
+ * alternative is equally likely.
+ */
+void weights(const ASTParserDelegate &, GeneratorOptions &) {}
+
+/**
+ * A JSON document is a single value, so make objects and arrays more likely
+ * than scalars, or most generated documents would be a single scalar.
+ */
+void weights(const Bench::JSON::Parser &p, GeneratorOptions &options)
+{
+	options.rule_weights[std::addressof(p.g.object)] = 4;
+	options.rule_weights[std::addressof(p.g.array)] = 4;
+}
+
+/**
+ * Generates an input of approximately `size` bytes from the grammar that
+ * `Parser` uses, rather than from the hand-written generators in inputs.cc.
+ */
+template<class Parser>
+std::string generate_from_grammar(std::size_t size, std::uint64_t seed,
+                                  unsigned depth)
+{
+	static Parser p;
+	GeneratorOptions options;
+	options.seed = seed;
+	options.target_size = size;
+	options.max_depth = depth;
+	weights(p, options);
+	return generate(p.root(), p.whitespace(), options);
+}
+
+/**
+ * A named benchmark.
+ */
+struct Benchmark
+{
+	const char *name;
+	std::function<Result(const std::string&)> run;
+	std::function<std::string(std::size_t, std::uint64_t, unsigned)> generate;
+};
+
+const std::vector<Benchmark> &benchmarks()
+{
+	static std::vector<Benchmark> all = {
+		{ "calculator", run<Bench::Calculator::Parser>,
+		  generate_from_grammar<Bench::Calculator::Parser> },
+		{ "json", run<Bench::JSON::Parser>,
+		  generate_from_grammar<Bench::JSON::Parser> },
+		{ "csv", run<Bench::CSV::Parser>,
+		  generate_from_grammar<Bench::CSV::Parser> },
+		{ "ini", run<Bench::INI::Parser>,
+		  generate_from_grammar<Bench::INI::Parser> },
+		{ "clike", run<Bench::CLike::Parser>,
+		  generate_from_grammar<Bench::CLike::Parser> },
+	};
+	return all;
+}
+
+/**
+ * Parses a size, with an optional K, M or G suffix.
+ */
+std::size_t parse_size(const char *str)
+{
+	char *end;
+	std::size_t size = strtoull(str, &end, 10);
+	switch (*end)
+	{
+		case 'g': case 'G': size *= 1024;
+		// fallthrough
+		case 'm': case 'M': size *= 1024;
+		// fallthrough
+		case 'k': case 'K': size *= 1024;
+	}
+	return size;
+}
+
+void usage(const char *name)
+{
+	std::cerr << "usage: " << name << " [-g grammar]... [-n min size]"
+		" [-x max size] [-s step factor] [-r repeats] [-S seed]"
+		" [-G max depth] [-l list elements]\n"
+		"Sizes may use K, M and G suffixes.  Grammars:";
+	for (auto &b : benchmarks())
+	{
+		std::cerr << ' ' << b.name;
+	}
+	std::cerr << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> selected;
+	std::size_t min_size = 1024;
+	std::size_t max_size = 1024 * 1024;
+	std::size_t step = 32;
+	unsigned repeats = 3;
+	std::uint64_t seed = 42;
+	unsigned depth = 0;
+	std::size_t list_elements = 0;
+	for (int i=1 ; i<argc ; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+		}
+		const char *arg = argv[i++];
+		if (strcmp(arg, "-g") == 0)
+		{
+			selected.push_back(argv[i]);
+		}
+		else if (strcmp(arg, "-n") == 0)
+		{
+			min_size = parse_size(argv[i]);
+		}
+		else if (strcmp(arg, "-x") == 0)
+		{
+			max_size = parse_size(argv[i]);
+		}
+		else if (strcmp(arg, "-s") == 0)
+		{
+			step = parse_size(argv[i]);
+		}
+		else if (strcmp(arg, "-r") == 0)
+		{
+			repeats = static_cast<unsigned>(parse_size(argv[i]));
+		}
+		else if (strcmp(arg, "-S") == 0)
+		{
+			seed = parse_size(argv[i]);
+		}
+		else if (strcmp(arg, "-G") == 0)
+		{
+			depth = static_cast<unsigned>(parse_size(argv[i]));
+		}
+		else if (strcmp(arg, "-l") == 0)
+		{
+			list_elements = parse_size(argv[i]);
+		}
+		else
+		{
+			usage(argv[0]);
+		}
+	}
+	if ((step < 2) || (repeats < 1) || (min_size < 1))
+	{
+		usage(argv[0]);
+	}
+
+	if (list_elements > 0)
+	{
+		print_list<ASTList<ListElement>>("ASTList", list_elements, repeats);
+		print_list<ASTVector<ListElement>>("ASTVector", list_elements,
+		                                   repeats);
+		return 0;
+	}
+
+	for (auto &b : benchmarks())
+	{
+		if (!selected.empty() &&
+		    std::find(selected.begin(), selected.end(), b.name) == selected.end())
+		{
+			continue;
+		}
+		for (std::size_t size=min_size ; size<=max_size ; size*=step)
+		{
+			std::string text = (depth > 0) ? b.generate(size, seed, depth) :
+				Bench::generate_input(b.name, size, seed);
+			Result result = b.run(text);
+			for (unsigned i=1 ; i<repeats ; i++)
+			{
+				result.merge(b.run(text));
+			}
+			long long total_ns = result.parse_ns + result.procs_ns + result.ast_ns;
+			double seconds = static_cast<double>(total_ns) / 1e9;
+			double mb = static_cast<double>(text.size()) / (1024 * 1024);
+			double kb = static_cast<double>(text.size()) / 1024;
+			std::cout << "{\"grammar\": \"" << b.name << '"'
+			          << ", \"bytes\": " << text.size()
+			          << ", \"ok\": " << (result.ok ? "true" : "false")
+			          << ", \"mb_per_s\": " << (seconds > 0 ? mb / seconds : 0)
+			          << ", \"allocations_per_kb\": "
+			          << static_cast<double>(result.allocations) / kb
+			          << ", \"session_allocations_per_kb\": "
+			          << static_cast<double>(result.session_allocations) / kb
+			          << ", \"arena_allocations_per_kb\": "
+			          << static_cast<double>(result.arena_allocations) / kb
+			          << ", \"peak_bytes\": " << result.peak_bytes
+			          << ", \"parse_ns\": " << result.parse_ns
+			          << ", \"procs_ns\": " << result.procs_ns
+			          << ", \"ast_ns\": " << result.ast_ns
+			          << ", \"teardown_ns\": " << result.teardown_ns
+			          << ", \"arena_teardown_ns\": " << result.arena_teardown_ns
+			          << ", \"recognize_ns\": " << result.recognize_ns
+			          << ", \"pipelined_ns\": " << result.pipelined_ns
+			          << '}' << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "grammars.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * Writes `s` as a JSON string.
+ */
+void write_string(std::ostream &out, const std::string &s)
+{
+	static const char hex[] = "0123456789abcdef";
+	out << '"';
+	for (char c : s)
+	{
+		switch (c)
+		{
+			case '"': out << "\\\""; break;
+			case '\\': out << "\\\\"; break;
+			case '\n': out << "\\n"; break;
+			case '\r': out << "\\r"; break;
+			case '\t': out << "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					out << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+				}
+				else
+				{
+					out << c;
+				}
+		}
+	}
+	out << '"';
+}
+
+/**
+ * Runs the fuzzer over the grammar that `Parser` uses.
+ */
+template<class Parser>
+std::vector<FuzzFinding> fuzz(const FuzzerOptions &options)
+{
+	static Parser p;
+	PerformanceFuzzer fuzzer(p.root(), p.whitespace(), options);
+	return fuzzer.run();
+}
+
+/**
+ * A named grammar to fuzz.
+ */
+struct Target
+{
+	const char *name;
+	std::function<std::vector<FuzzFinding>(const FuzzerOptions&)> fuzz;
+};
+
+const std::vector<Target> &targets()
+{
+	static std::vector<Target> all = {
+		{ "calculator", fuzz<Bench::Calculator::Parser> },
+		{ "json", fuzz<Bench::JSON::Parser> },
+		{ "csv", fuzz<Bench::CSV::Parser> },
+		{ "ini", fuzz<Bench::INI::Parser> },
+		{ "clike", fuzz<Bench::CLike::Parser> },
+	};
+	return all;
+}
+
+void usage(const char *name)
+{
+	std::cerr << "usage: " << name << " [-g grammar]... [-i iterations]"
+		" [-x max size] [-e exponent] [-S seed]\nGrammars:";
+	for (auto &t : targets())
+	{
+		std::cerr << ' ' << t.name;
+	}
+	std::cerr << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> selected;
+	FuzzerOptions options;
+	for (int i=1 ; i<argc ; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+		}
+		const char *arg = argv[i++];
+		if (strcmp(arg, "-g") == 0)
+		{
+			selected.push_back(argv[i]);
+		}
+		else if (strcmp(arg, "-i") == 0)
+		{
+			options.iterations = static_cast<unsigned>(strtoul(argv[i], nullptr, 10));
+		}
+		else if (strcmp(arg, "-x") == 0)
+		{
+			options.max_size = strtoull(argv[i], nullptr, 10);
+		}
+		else if (strcmp(arg, "-e") == 0)
+		{
+			options.exponent_threshold = strtod(argv[i], nullptr);
+		}
+		else if (strcmp(arg, "-S") == 0)
+		{
+			options.seed = strtoull(argv[i], nullptr, 10);
+		}
+		else
+		{
+			usage(argv[0]);
+		}
+	}
+	if (options.max_size < 1)
+	{
+		usage(argv[0]);
+	}
+
+	for (auto &t : targets())
+	{
+		if (!selected.empty() &&
+		    std::find(selected.begin(), selected.end(), t.name) == selected.end())
+		{
+			continue;
+		}
+		for (auto &f : t.fuzz(options))
+		{
+			std::cout << "{\"grammar\": \"" << t.name << "\", \"prefix\": ";
+			write_string(std::cout, f.prefix);
+			std::cout << ", \"pump\": ";
+			write_string(std::cout, f.pump);
+			std::cout << ", \"suffix\": ";
+			write_string(std::cout, f.suffix);
+			std::cout << ", \"exponent\": " << f.exponent
+			          << ", \"repeats\": " << f.repeats
+			          << ", \"work\": " << f.work << '}' << std::endl;
+		}
+	}
+	return 0;
+}
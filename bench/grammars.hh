@@ -0,0 +1,691 @@
+#ifndef PEGMATITE_BENCH_GRAMMARS_HH
+#define PEGMATITE_BENCH_GRAMMARS_HH
+
+#include <string>
+#include "pegmatite.hh"
+
+/**
+ * The grammars and ASTs used by the benchmarks.  Each grammar is a singleton
+ * class with one field per rule, following the pattern in the calculator
+ * example, and each has a parser delegate that builds a complete AST.
+ */
+namespace Bench
+{
+using namespace pegmatite;
+
+/**
+ * AST node that records the text that it matched.
+ */
+class Text : public ASTContainer
+{
+public:
+	/**
+	 * The source text.
+	 */
+	std::string value;
+	bool construct(const InputRange &r, ASTStack &,
+	               const ErrorReporter &) override
+	{
+		value = r.str();
+		return true;
+	}
+	PEGMATITE_RTTI(Text, ASTContainer)
+};
+
+namespace Calculator
+{
+/**
+ * The base class for expressions.
+ */
+class Expression : public ASTContainer
+{
+public:
+	/**
+	 * Evaluates the expression.
+	 */
+	virtual double eval() const = 0;
+	PEGMATITE_RTTI(Expression, ASTContainer)
+};
+
+/**
+ * A numeric literal.
+ */
+class Number : public Expression
+{
+	ASTValue<double> n;
+public:
+	double eval() const override { return n.value; }
+};
+
+/**
+ * A binary operation, whose operator is the template parameter.
+ */
+template<char Op>
+class BinaryExpression : public Expression
+{
+	ASTPtr<Expression> left, right;
+public:
+	double eval() const override
+	{
+		double l = left->eval();
+		double r = right->eval();
+		switch (Op)
+		{
+			case '+': return l + r;
+			case '-': return l - r;
+			case '*': return l * r;
+			default: return l / r;
+		}
+	}
+};
+
+/**
+ * A statement: an expression terminated by a semicolon.
+ */
+class Statement : public ASTContainer
+{
+public:
+	ASTPtr<Expression> expr;
+	PEGMATITE_RTTI(Statement, ASTContainer)
+};
+
+/**
+ * The root of the AST.
+ */
+class Program : public ASTContainer
+{
+public:
+	ASTList<Statement> statements;
+	PEGMATITE_RTTI(Program, ASTContainer)
+};
+
+/**
+ * The calculator grammar from the example, extended to a sequence of
+ * semicolon-terminated statements.
+ */
+struct Grammar
+{
+	Rule ws        = *(" \t"_S | nl('\n'_E));
+	Rule num       = term(+range('0', '9') >> -('.'_E >> +range('0', '9')));
+	Rule val       = num | '(' >> expr >> ')';
+	Rule mul_op    = mul >> '*' >> mul;
+	Rule div_op    = mul >> '/' >> mul;
+	Rule mul       = mul_op | div_op | val;
+	Rule add_op    = expr >> '+' >> expr;
+	Rule sub_op    = expr >> '-' >> expr;
+	Rule expr      = add_op | sub_op | mul;
+	Rule statement = expr >> ';';
+	Rule program   = *statement;
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+/**
+ * Builds the calculator AST.
+ */
+struct Parser : public ASTParserDelegate
+{
+	typedef Program Root;
+	const Grammar &g = Grammar::get();
+	BindAST<Number> num = g.num;
+	BindAST<BinaryExpression<'+'>> add = g.add_op;
+	BindAST<BinaryExpression<'-'>> sub = g.sub_op;
+	BindAST<BinaryExpression<'*'>> mul = g.mul_op;
+	BindAST<BinaryExpression<'/'>> div = g.div_op;
+	BindAST<Statement> statement = g.statement;
+	BindAST<Program> program = g.program;
+	const Rule &root() const { return g.program; }
+	const Rule &whitespace() const { return g.ws; }
+};
+}
+
+namespace JSON
+{
+/**
+ * The base class for JSON values.
+ */
+class Value : public ASTContainer
+{
+	PEGMATITE_RTTI(Value, ASTContainer)
+};
+
+/**
+ * A string, including its quotes.
+ */
+class String : public Value
+{
+public:
+	std::string value;
+	bool construct(const InputRange &r, ASTStack &,
+	               const ErrorReporter &) override
+	{
+		value = r.str();
+		return true;
+	}
+	PEGMATITE_RTTI(String, Value)
+};
+
+/**
+ * A number.
+ */
+class Number : public Value
+{
+public:
+	ASTValue<double> value;
+};
+
+/**
+ * One of `true`, `false` or `null`.
+ */
+class Keyword : public Value
+{
+};
+
+/**
+ * A key-value pair in an object.
+ */
+class Member : public ASTContainer
+{
+public:
+	ASTPtr<String> key;
+	ASTPtr<Value> value;
+	PEGMATITE_RTTI(Member, ASTContainer)
+};
+
+/**
+ * An object.
+ */
+class Object : public Value
+{
+public:
+	ASTList<Member> members;
+};
+
+/**
+ * An array.
+ */
+class Array : public Value
+{
+public:
+	ASTList<Value> elements;
+};
+
+/**
+ * The JSON grammar.
+ */
+struct Grammar
+{
+	Rule ws      = *(" \t\r"_S | nl('\n'_E));
+	ExprPtr digits = +range('0', '9');
+	Rule string  = term('"' >> *(('\\'_E >> any()) | (!"\"\\"_S >> any())) >> '"');
+	Rule number  = term(-"-"_E >> digits >> -('.'_E >> digits) >>
+	                    -("eE"_S >> -"+-"_S >> digits));
+	Rule keyword = "true"_E | "false"_E | "null"_E;
+	Rule member  = string >> ':' >> value;
+	Rule object  = '{' >> -(member >> *(',' >> member)) >> '}';
+	Rule array   = '[' >> -(value >> *(',' >> value)) >> ']';
+	Rule value   = object | array | string | number | keyword;
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+/**
+ * Builds the JSON AST.
+ */
+struct Parser : public ASTParserDelegate
+{
+	typedef Value Root;
+	const Grammar &g = Grammar::get();
+	BindAST<String> string = g.string;
+	BindAST<Number> number = g.number;
+	BindAST<Keyword> keyword = g.keyword;
+	BindAST<Member> member = g.member;
+	BindAST<Object> object = g.object;
+	BindAST<Array> array = g.array;
+	const Rule &root() const { return g.value; }
+	const Rule &whitespace() const { return g.ws; }
+};
+}
+
+namespace CSV
+{
+/**
+ * A field, with quotes removed and doubled quotes unescaped.
+ */
+class Field : public ASTContainer
+{
+public:
+	std::string value;
+	bool construct(const InputRange &r, ASTStack &,
+	               const ErrorReporter &) override
+	{
+		std::string text = r.str();
+		if (text.empty() || text[0] != '"')
+		{
+			value = std::move(text);
+			return true;
+		}
+		for (size_t i=1 ; i+1<text.size() ; i++)
+		{
+			value += text[i];
+			if (text[i] == '"')
+			{
+				i++;
+			}
+		}
+		return true;
+	}
+	PEGMATITE_RTTI(Field, ASTContainer)
+};
+
+/**
+ * A record.
+ */
+class Row : public ASTContainer
+{
+public:
+	ASTList<Field> fields;
+	PEGMATITE_RTTI(Row, ASTContainer)
+};
+
+/**
+ * The root of the AST.
+ */
+class File : public ASTContainer
+{
+public:
+	ASTList<Row> rows;
+	PEGMATITE_RTTI(File, ASTContainer)
+};
+
+/**
+ * An RFC 4180 style CSV grammar.  Every rule is a terminal, because spaces
+ * are significant.
+ */
+struct Grammar
+{
+	Rule ws       = *" "_E;
+	Rule quoted   = '"' >> *("\"\""_E | (!"\""_E >> any())) >> '"';
+	Rule unquoted = *(!",\"\r\n"_S >> any());
+	Rule field    = quoted | unquoted;
+	Rule row      = field >> *(',' >> field) >> -"\r"_E >> nl('\n'_E);
+	Rule file     = term(*row);
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+/**
+ * Builds the CSV AST.
+ */
+struct Parser : public ASTParserDelegate
+{
+	typedef File Root;
+	const Grammar &g = Grammar::get();
+	BindAST<Field> field = g.field;
+	BindAST<Row> row = g.row;
+	BindAST<File> file = g.file;
+	const Rule &root() const { return g.file; }
+	const Rule &whitespace() const { return g.ws; }
+};
+}
+
+namespace INI
+{
+/**
+ * The name of a section.
+ */
+class Name : public Text
+{
+	PEGMATITE_RTTI(Name, Text)
+};
+
+/**
+ * The key in an entry.
+ */
+class Key : public Text
+{
+	PEGMATITE_RTTI(Key, Text)
+};
+
+/**
+ * The value in an entry.
+ */
+class Value : public Text
+{
+	PEGMATITE_RTTI(Value, Text)
+};
+
+/**
+ * A `key = value` line.
+ */
+class Entry : public ASTContainer
+{
+public:
+	ASTPtr<Key> key;
+	ASTPtr<Value> value;
+	PEGMATITE_RTTI(Entry, ASTContainer)
+};
+
+/**
+ * A section header and the entries that follow it.
+ */
+class Section : public ASTContainer
+{
+public:
+	ASTPtr<Name> name;
+	ASTList<Entry> entries;
+	PEGMATITE_RTTI(Section, ASTContainer)
+};
+
+/**
+ * The root of the AST.
+ */
+class File : public ASTContainer
+{
+public:
+	ASTList<Section> sections;
+	PEGMATITE_RTTI(File, ASTContainer)
+};
+
+/**
+ * A grammar for INI-style configuration files, with `;` comments.
+ */
+struct Grammar
+{
+	Rule ws        = *" \t"_S;
+	ExprPtr ident  = +(range('a', 'z') | range('A', 'Z') | range('0', '9') |
+	                   "_.-"_S);
+	Rule comment   = term(';' >> *(!"\n"_E >> any()));
+	Rule eol       = -comment >> nl('\n'_E);
+	Rule name      = term(ident);
+	Rule key       = term(ident);
+	Rule value     = term(*(!"\n;"_S >> any()));
+	Rule header    = '[' >> name >> ']' >> eol;
+	Rule entry     = key >> '=' >> value >> eol;
+	Rule section   = header >> *(entry | eol);
+	Rule file      = *eol >> *section;
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+/**
+ * Builds the INI AST.
+ */
+struct Parser : public ASTParserDelegate
+{
+	typedef File Root;
+	const Grammar &g = Grammar::get();
+	BindAST<Name> name = g.name;
+	BindAST<Key> key = g.key;
+	BindAST<Value> value = g.value;
+	BindAST<Entry> entry = g.entry;
+	BindAST<Section> section = g.section;
+	BindAST<File> file = g.file;
+	const Rule &root() const { return g.file; }
+	const Rule &whitespace() const { return g.ws; }
+};
+}
+
+namespace CLike
+{
+/**
+ * An identifier.
+ */
+class Name : public Text
+{
+	PEGMATITE_RTTI(Name, Text)
+};
+
+/**
+ * The base class for expressions.
+ */
+class Expression : public ASTContainer
+{
+	PEGMATITE_RTTI(Expression, ASTContainer)
+};
+
+/**
+ * An integer literal.
+ */
+class Number : public Expression
+{
+	ASTValue<long long> value;
+};
+
+/**
+ * A reference to a variable.
+ */
+class Variable : public Expression
+{
+	ASTPtr<Name> name;
+};
+
+/**
+ * A function call.
+ */
+class Call : public Expression
+{
+	ASTPtr<Name> callee;
+	ASTList<Expression> arguments;
+};
+
+/**
+ * An operator and its right-hand operand, in a chain of binary operations.
+ */
+class Operand : public ASTContainer
+{
+public:
+	/**
+	 * The operator.
+	 */
+	char op = 0;
+	ASTPtr<Expression> value;
+	bool construct(const InputRange &r, ASTStack &st,
+	               const ErrorReporter &err) override
+	{
+		op = static_cast<char>(*r.begin());
+		return ASTContainer::construct(r, st, err);
+	}
+	PEGMATITE_RTTI(Operand, ASTContainer)
+};
+
+/**
+ * A left-associative chain of binary operations of the same precedence.
+ */
+class Chain : public Expression
+{
+	ASTPtr<Expression> first;
+	ASTList<Operand> rest;
+};
+
+/**
+ * The base class for statements.
+ */
+class Statement : public ASTContainer
+{
+	PEGMATITE_RTTI(Statement, ASTContainer)
+};
+
+/**
+ * A braced list of statements.
+ */
+class Block : public Statement
+{
+public:
+	ASTList<Statement> statements;
+	PEGMATITE_RTTI(Block, Statement)
+};
+
+/**
+ * The `else` part of an `if` statement.
+ */
+class Else : public ASTContainer
+{
+	ASTPtr<Block> body;
+	PEGMATITE_RTTI(Else, ASTContainer)
+};
+
+/**
+ * A variable declaration, with an optional initialiser.
+ */
+class Declaration : public Statement
+{
+	ASTPtr<Name> name;
+	ASTPtr<Expression, true> init;
+};
+
+/**
+ * An assignment to a variable.
+ */
+class Assignment : public Statement
+{
+	ASTPtr<Name> target;
+	ASTPtr<Expression> value;
+};
+
+/**
+ * An `if` statement.
+ */
+class If : public Statement
+{
+	ASTPtr<Expression> condition;
+	ASTPtr<Block> body;
+	ASTPtr<Else, true> otherwise;
+};
+
+/**
+ * A `while` loop.
+ */
+class While : public Statement
+{
+	ASTPtr<Expression> condition;
+	ASTPtr<Block> body;
+};
+
+/**
+ * A `return` statement.
+ */
+class Return : public Statement
+{
+	ASTPtr<Expression, true> value;
+};
+
+/**
+ * An expression evaluated for its side effects.
+ */
+class ExpressionStatement : public Statement
+{
+	ASTPtr<Expression> expr;
+};
+
+/**
+ * The root of the AST.
+ */
+class Program : public ASTContainer
+{
+public:
+	ASTList<Statement> statements;
+	PEGMATITE_RTTI(Program, ASTContainer)
+};
+
+/**
+ * A small C-like statement language.
+ */
+struct Grammar
+{
+	Rule comment     = "//"_E >> *(!"\n"_E >> any());
+	Rule ws          = *(" \t\r"_S | nl('\n'_E) | comment);
+	ExprPtr alpha    = range('a', 'z') | range('A', 'Z') | '_'_E;
+	ExprPtr alnum    = alpha | range('0', '9');
+	Rule keyword     = term(("int"_E | "if"_E | "else"_E | "while"_E |
+	                         "return"_E) >> !alnum);
+	Rule name        = term(!keyword >> alpha >> *alnum);
+	Rule number      = term(+range('0', '9'));
+	Rule variable    = name;
+	Rule call        = name >> '(' >> -(expr >> *(',' >> expr)) >> ')';
+	Rule primary     = number | call | variable | '(' >> expr >> ')';
+	Rule product_op  = "*/%"_S >> primary;
+	Rule product     = primary >> +product_op;
+	Rule factor      = product | primary;
+	Rule sum_op      = "+-"_S >> factor;
+	Rule sum         = factor >> +sum_op;
+	Rule addend      = sum | factor;
+	Rule compare_op  = ("=="_E | "!="_E | "<="_E | ">="_E | "<"_E | ">"_E)
+	                   >> addend;
+	Rule comparison  = addend >> +compare_op;
+	Rule expr        = comparison | addend;
+	Rule block       = '{' >> *statement >> '}';
+	Rule declaration = term("int"_E >> !alnum) >> name >> -('=' >> expr) >> ';';
+	Rule assignment  = name >> '=' >> expr >> ';';
+	Rule else_part   = term("else"_E >> !alnum) >> block;
+	Rule if_stmt     = term("if"_E >> !alnum) >> '(' >> expr >> ')' >> block >>
+	                   -else_part;
+	Rule while_stmt  = term("while"_E >> !alnum) >> '(' >> expr >> ')' >> block;
+	Rule return_stmt = term("return"_E >> !alnum) >> -expr >> ';';
+	Rule expr_stmt   = expr >> ';';
+	Rule statement   = declaration | if_stmt | while_stmt | return_stmt |
+	                   assignment | expr_stmt | block;
+	Rule program     = *statement;
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+/**
+ * Builds the AST for the C-like language.
+ */
+struct Parser : public ASTParserDelegate
+{
+	typedef Program Root;
+	const Grammar &g = Grammar::get();
+	BindAST<Name> name = g.name;
+	BindAST<Number> number = g.number;
+	BindAST<Variable> variable = g.variable;
+	BindAST<Call> call = g.call;
+	BindAST<Operand> product_op = g.product_op;
+	BindAST<Chain> product = g.product;
+	BindAST<Operand> sum_op = g.sum_op;
+	BindAST<Chain> sum = g.sum;
+	BindAST<Operand> compare_op = g.compare_op;
+	BindAST<Chain> comparison = g.comparison;
+	BindAST<Block> block = g.block;
+	BindAST<Declaration> declaration = g.declaration;
+	BindAST<Assignment> assignment = g.assignment;
+	BindAST<Else> else_part = g.else_part;
+	BindAST<If> if_stmt = g.if_stmt;
+	BindAST<While> while_stmt = g.while_stmt;
+	BindAST<Return> return_stmt = g.return_stmt;
+	BindAST<ExpressionStatement> expr_stmt = g.expr_stmt;
+	BindAST<Program> program = g.program;
+	const Rule &root() const { return g.program; }
+	const Rule &whitespace() const { return g.ws; }
+};
+}
+
+}
+
+#endif // PEGMATITE_BENCH_GRAMMARS_HH
@@ -0,0 +1,415 @@
+#include <random>
+#include <stdexcept>
+#include "inputs.hh"
+
+namespace
+{
+/**
+ * Wrapper around a deterministic random number generator, with helpers for
+ * producing the fragments that the input generators need.
+ */
+class Random
+{
+	std::mt19937_64 engine;
+public:
+	Random(std::uint64_t seed) : engine(seed) {}
+	/**
+	 * Returns a random number in the range [0, n).
+	 */
+	unsigned below(unsigned n)
+	{
+		return static_cast<unsigned>(engine() % n);
+	}
+	/**
+	 * Returns true with a probability of `percent` percent.
+	 */
+	bool chance(unsigned percent)
+	{
+		return below(100) < percent;
+	}
+	/**
+	 * Returns a lower-case word of between 1 and `max` letters.
+	 */
+	std::string word(unsigned max = 8)
+	{
+		std::string w;
+		for (unsigned i=0, e=1+below(max) ; i<e ; i++)
+		{
+			w += static_cast<char>('a' + below(26));
+		}
+		return w;
+	}
+	/**
+	 * Returns a non-negative integer with up to `digits` digits.
+	 */
+	std::string integer(unsigned digits = 6)
+	{
+		return std::to_string(engine() % ipow(10, 1 + below(digits)));
+	}
+	/**
+	 * Returns a decimal number.
+	 */
+	std::string decimal()
+	{
+		return integer(4) + "." + integer(3);
+	}
+private:
+	static std::uint64_t ipow(std::uint64_t b, unsigned e)
+	{
+		std::uint64_t r = 1;
+		while (e--)
+		{
+			r *= b;
+		}
+		return r;
+	}
+};
+
+void calculator_expression(Random &rnd, std::string &out, unsigned depth)
+{
+	if (depth == 0 || rnd.chance(35))
+	{
+		out += rnd.chance(20) ? rnd.decimal() : rnd.integer(3);
+		return;
+	}
+	bool brackets = rnd.chance(25);
+	if (brackets)
+	{
+		out += '(';
+	}
+	calculator_expression(rnd, out, depth - 1);
+	out += ' ';
+	out += "+-*/"[rnd.below(4)];
+	out += ' ';
+	calculator_expression(rnd, out, depth - 1);
+	if (brackets)
+	{
+		out += ')';
+	}
+}
+
+std::string calculator(Random &rnd, std::size_t bytes)
+{
+	std::string out;
+	while (out.size() < bytes)
+	{
+		calculator_expression(rnd, out, 3);
+		out += ";\n";
+	}
+	return out;
+}
+
+void json_string(Random &rnd, std::string &out)
+{
+	out += '"';
+	out += rnd.word();
+	if (rnd.chance(20))
+	{
+		out += "\\\"";
+		out += rnd.word();
+	}
+	out += '"';
+}
+
+void json_value(Random &rnd, std::string &out, unsigned depth)
+{
+	unsigned kind = rnd.below(depth == 0 ? 4 : 6);
+	switch (kind)
+	{
+		case 0:
+			json_string(rnd, out);
+			break;
+		case 1:
+			if (rnd.chance(30))
+			{
+				out += '-';
+			}
+			out += rnd.chance(50) ? rnd.integer() : rnd.decimal();
+			if (rnd.chance(10))
+			{
+				out += "e+" + rnd.integer(2);
+			}
+			break;
+		case 2:
+			out += rnd.chance(50) ? "true" : "false";
+			break;
+		case 3:
+			out += "null";
+			break;
+		case 4:
+		{
+			out += '[';
+			for (unsigned i=0, e=rnd.below(5) ; i<e ; i++)
+			{
+				if (i > 0)
+				{
+					out += ", ";
+				}
+				json_value(rnd, out, depth - 1);
+			}
+			out += ']';
+			break;
+		}
+		default:
+		{
+			out += '{';
+			for (unsigned i=0, e=rnd.below(5) ; i<e ; i++)
+			{
+				if (i > 0)
+				{
+					out += ", ";
+				}
+				json_string(rnd, out);
+				out += ": ";
+				json_value(rnd, out, depth - 1);
+			}
+			out += '}';
+			break;
+		}
+	}
+}
+
+std::string json(Random &rnd, std::size_t bytes)
+{
+	std::string out = "[\n";
+	bool first = true;
+	while (out.size() + 2 < bytes)
+	{
+		if (!first)
+		{
+			out += ",\n";
+		}
+		first = false;
+		out += "  {\"id\": " + rnd.integer() + ", \"name\": ";
+		json_string(rnd, out);
+		out += ", \"score\": " + rnd.decimal() + ", \"active\": ";
+		out += rnd.chance(50) ? "true" : "false";
+		out += ", \"data\": ";
+		json_value(rnd, out, 3);
+		out += '}';
+	}
+	out += "\n]\n";
+	return out;
+}
+
+std::string csv(Random &rnd, std::size_t bytes)
+{
+	std::string out = "id,name,description,price,quantity\n";
+	while (out.size() < bytes)
+	{
+		out += rnd.integer() + ',' + rnd.word() + ',';
+		if (rnd.chance(40))
+		{
+			out += '"' + rnd.word() + ", " + rnd.word();
+			if (rnd.chance(30))
+			{
+				out += " \"\"" + rnd.word() + "\"\"";
+			}
+			out += '"';
+		}
+		else
+		{
+			out += rnd.word() + ' ' + rnd.word();
+		}
+		out += ',' + rnd.decimal() + ',';
+		if (rnd.chance(90))
+		{
+			out += rnd.integer(3);
+		}
+		out += rnd.chance(10) ? "\r\n" : "\n";
+	}
+	return out;
+}
+
+std::string ini(Random &rnd, std::size_t bytes)
+{
+	std::string out = "; generated configuration\n";
+	unsigned section = 0;
+	while (out.size() < bytes)
+	{
+		out += "\n[section_" + std::to_string(section++) + "]\n";
+		for (unsigned i=0, e=3+rnd.below(8) ; i<e ; i++)
+		{
+			if (rnd.chance(10))
+			{
+				out += "; " + rnd.word() + ' ' + rnd.word() + '\n';
+			}
+			out += rnd.word() + '_' + std::to_string(i) + " = ";
+			switch (rnd.below(3))
+			{
+				case 0: out += rnd.integer(); break;
+				case 1: out += rnd.word() + ' ' + rnd.word(); break;
+				default: out += "/usr/" + rnd.word() + '/' + rnd.word(); break;
+			}
+			if (rnd.chance(15))
+			{
+				out += " ; " + rnd.word();
+			}
+			out += '\n';
+		}
+	}
+	return out;
+}
+
+void clike_expression(Random &rnd, std::string &out, unsigned depth)
+{
+	if (depth == 0 || rnd.chance(40))
+	{
+		switch (rnd.below(3))
+		{
+			case 0:
+				out += rnd.integer(4);
+				break;
+			case 1:
+				out += 'v' + rnd.word(4);
+				break;
+			default:
+				out += 'f' + rnd.word(4) + '(';
+				for (unsigned i=0, e=rnd.below(3) ; i<e ; i++)
+				{
+					if (i > 0)
+					{
+						out += ", ";
+					}
+					clike_expression(rnd, out, depth ? depth - 1 : 0);
+				}
+				out += ')';
+		}
+		return;
+	}
+	static const char *ops[] = { "+", "-", "*", "/", "%", "<", ">", "==",
+	                             "!=", "<=", ">=" };
+	bool brackets = rnd.chance(20);
+	if (brackets)
+	{
+		out += '(';
+	}
+	clike_expression(rnd, out, depth - 1);
+	out += ' ';
+	out += ops[rnd.below(sizeof(ops) / sizeof(ops[0]))];
+	out += ' ';
+	clike_expression(rnd, out, depth - 1);
+	if (brackets)
+	{
+		out += ')';
+	}
+}
+
+void clike_statement(Random &rnd, std::string &out, unsigned depth,
+                     const std::string &indent);
+
+void clike_block(Random &rnd, std::string &out, unsigned depth,
+                 const std::string &indent)
+{
+	out += "{\n";
+	for (unsigned i=0, e=1+rnd.below(4) ; i<e ; i++)
+	{
+		clike_statement(rnd, out, depth - 1, indent + '\t');
+	}
+	out += indent + '}';
+}
+
+void clike_statement(Random &rnd, std::string &out, unsigned depth,
+                     const std::string &indent)
+{
+	out += indent;
+	unsigned kind = rnd.below(depth == 0 ? 4 : 7);
+	switch (kind)
+	{
+		case 0:
+			out += "int v" + rnd.word(4);
+			if (rnd.chance(70))
+			{
+				out += " = ";
+				clike_expression(rnd, out, 3);
+			}
+			out += ';';
+			break;
+		case 1:
+			out += 'v' + rnd.word(4) + " = ";
+			clike_expression(rnd, out, 3);
+			out += ';';
+			break;
+		case 2:
+			out += 'f' + rnd.word(4) + '(';
+			clike_expression(rnd, out, 2);
+			out += ");";
+			break;
+		case 3:
+			out += "return";
+			if (rnd.chance(70))
+			{
+				out += ' ';
+				clike_expression(rnd, out, 2);
+			}
+			out += ';';
+			break;
+		case 4:
+			out += "if (";
+			clike_expression(rnd, out, 2);
+			out += ") ";
+			clike_block(rnd, out, depth, indent);
+			if (rnd.chance(40))
+			{
+				out += " else ";
+				clike_block(rnd, out, depth, indent);
+			}
+			break;
+		case 5:
+			out += "while (";
+			clike_expression(rnd, out, 2);
+			out += ") ";
+			clike_block(rnd, out, depth, indent);
+			break;
+		default:
+			clike_block(rnd, out, depth, indent);
+			break;
+	}
+	if (rnd.chance(10))
+	{
+		out += " // " + rnd.word() + ' ' + rnd.word();
+	}
+	out += '\n';
+}
+
+std::string clike(Random &rnd, std::size_t bytes)
+{
+	std::string out;
+	while (out.size() < bytes)
+	{
+		clike_statement(rnd, out, 3, "");
+	}
+	return out;
+}
+
+}
+
+namespace Bench
+{
+std::string generate_input(const std::string &grammar, std::size_t bytes,
+                           std::uint64_t seed)
+{
+	Random rnd(seed);
+	if (grammar == "calculator")
+	{
+		return calculator(rnd, bytes);
+	}
+	if (grammar == "json")
+	{
+		return json(rnd, bytes);
+	}
+	if (grammar == "csv")
+	{
+		return csv(rnd, bytes);
+	}
+	if (grammar == "ini")
+	{
+		return ini(rnd, bytes);
+	}
+	if (grammar == "clike")
+	{
+		return clike(rnd, bytes);
+	}
+	throw std::invalid_argument("unknown grammar: " + grammar);
+}
+}
@@ -0,0 +1,19 @@
+#ifndef PEGMATITE_BENCH_INPUTS_HH
+#define PEGMATITE_BENCH_INPUTS_HH
+
+#include <cstdint>
+#include <string>
+
+namespace Bench
+{
+/**
+ * Generates a deterministic, syntactically valid input of approximately
+ * `bytes` bytes for the named grammar (one of "calculator", "json", "csv",
+ * "ini" or "clike"), using `seed` to initialise the random number generator.
+ * The generated input is never shorter than `bytes`.
+ */
+std::string generate_input(const std::string &grammar, std::size_t bytes,
+                           std::uint64_t seed);
+}
+
+#endif // PEGMATITE_BENCH_INPUTS_HH
@@ -0,0 +1,383 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "fuzzer.hh"
+#include "generator.hh"
+
+namespace pegmatite {
+
+namespace {
+/**
+ * Returns the number of repetitions of a pump to try after `n`.
+ */
+unsigned next_repeats(unsigned n)
+{
+	return n + std::max(1U, n / 2);
+}
+/**
+ * The first and last printable ASCII characters, used for inserted
+ * characters that are not copied from elsewhere in the input.
+ */
+const char first_printable = 0x20;
+const char last_printable = 0x7e;
+/**
+ * The longest segment that is tried as a pump.
+ */
+const std::size_t max_pump = 16;
+/**
+ * A delegate that does not handle any rules, so parses only match.
+ */
+class NullDelegate : public ParserDelegate
+{
+	parse_proc get_parse_proc(const Rule &) const override
+	{
+		return nullptr;
+	}
+};
+}
+
+std::string FuzzFinding::input(unsigned n) const
+{
+	std::string result = prefix;
+	result.reserve(prefix.size() + pump.size() * n + suffix.size());
+	for (unsigned i=0 ; i<n ; i++)
+	{
+		result += pump;
+	}
+	result += suffix;
+	return result;
+}
+
+PerformanceFuzzer::PerformanceFuzzer(const Rule &g, const Rule &ws,
+                                     const FuzzerOptions &o) :
+	grammar(g), whitespace(ws), options(o), random(o.seed) {}
+
+std::size_t PerformanceFuzzer::below(std::size_t n)
+{
+	return (n == 0) ? 0 : static_cast<std::size_t>(random() % n);
+}
+
+std::size_t PerformanceFuzzer::work(const std::string &input)
+{
+	StringInput in(input);
+	ErrorReporter err = [](const InputRange &, const std::string &) {};
+	NullDelegate delegate;
+	ParseStats stats;
+	stats.work_limit = options.work_limit;
+	parse(in, grammar, whitespace, err, delegate, nullptr, stats);
+	return stats.rule_entries + stats.characters_examined;
+}
+
+void PerformanceFuzzer::consider(const std::string &input)
+{
+	if (std::find(inputs.begin(), inputs.end(), input) != inputs.end())
+	{
+		return;
+	}
+	double score = static_cast<double>(work(input)) /
+	               static_cast<double>(input.size() + 1);
+	if ((population.size() >= options.population) &&
+	    (score <= population.back().score))
+	{
+		return;
+	}
+	auto pos = std::upper_bound(population.begin(), population.end(), score,
+		[](double s, const Candidate &c) { return s > c.score; });
+	inputs.insert(inputs.begin() + (pos - population.begin()), input);
+	population.insert(pos, { input, score });
+	if (population.size() > options.population)
+	{
+		population.pop_back();
+		inputs.pop_back();
+	}
+}
+
+void PerformanceFuzzer::mutate(std::string &input)
+{
+	auto random_char = [&]()
+		{
+			if (!input.empty() && below(2))
+			{
+				return input[below(input.size())];
+			}
+			return static_cast<char>(first_printable +
+			                         below(last_printable - first_printable + 1));
+		};
+	std::size_t size = input.size();
+	std::size_t pos = below(size + 1);
+	std::size_t length = 1 + below(std::min<std::size_t>(max_pump, size - pos + 1));
+	length = std::min(length, size - pos);
+	switch (below(size == 0 ? 1 : 6))
+	{
+		// Insert a character.
+		case 0:
+			input.insert(pos, 1, random_char());
+			break;
+		// Replace a character.
+		case 1:
+			if (pos < size)
+			{
+				input[pos] = random_char();
+			}
+			break;
+		// Delete a range.
+		case 2:
+			input.erase(pos, length);
+			break;
+		// Copy a range to somewhere else.
+		case 3:
+			input.insert(below(size + 1), input.substr(pos, length));
+			break;
+		// Repeat a range in place.
+		case 4:
+		{
+			std::string range = input.substr(pos, length);
+			for (std::size_t i=0, e=1+below(8) ; i<e ; i++)
+			{
+				input.insert(pos, range);
+			}
+			break;
+		}
+		// Splice in part of another input in the population.
+		default:
+		{
+			const std::string &other = inputs[below(inputs.size())];
+			std::size_t start = below(other.size() + 1);
+			input.insert(pos, other.substr(start, 1 + below(4 * max_pump)));
+			break;
+		}
+	}
+}
+
+double PerformanceFuzzer::exponent(const FuzzFinding &f, unsigned low,
+                                   unsigned high)
+{
+	std::string small = f.input(low);
+	std::string large = f.input(high);
+	if ((large.size() <= small.size()) ||
+	    (large.size() > options.max_pumped_size))
+	{
+		return 0;
+	}
+	std::size_t small_work = work(small);
+	std::size_t large_work = work(large);
+	if (large_work > options.work_limit)
+	{
+		return 0;
+	}
+	double work_ratio = static_cast<double>(large_work) /
+	                    static_cast<double>(small_work);
+	double size_ratio = static_cast<double>(large.size()) /
+	                    static_cast<double>(small.size());
+	return std::log(work_ratio) / std::log(size_ratio);
+}
+
+void PerformanceFuzzer::pump(FuzzFinding &f)
+{
+	f.exponent = 0;
+	f.repeats = 0;
+	std::size_t previous_size = f.input(1).size();
+	std::size_t previous_work = work(f.input(1));
+	if (previous_work > options.work_limit)
+	{
+		return;
+	}
+	// Grow the number of repetitions geometrically, but slowly enough that
+	// an exponential is still measured a few times before it reaches the
+	// work limit.
+	for (unsigned n=2 ;; n=next_repeats(n))
+	{
+		std::string input = f.input(n);
+		if (input.size() > options.max_pumped_size)
+		{
+			break;
+		}
+		std::size_t w = work(input);
+		if (w > options.work_limit)
+		{
+			break;
+		}
+		f.exponent = std::log(static_cast<double>(w) /
+		                      static_cast<double>(previous_work)) /
+		             std::log(static_cast<double>(input.size()) /
+		                      static_cast<double>(previous_size));
+		f.repeats = n;
+		f.work = w;
+		previous_size = input.size();
+		previous_work = w;
+	}
+}
+
+void PerformanceFuzzer::shrink(std::string &part, std::size_t min_size,
+                               const std::function<bool()> &keep)
+{
+	// Try removing progressively smaller chunks.
+	for (std::size_t chunk=std::max<std::size_t>(part.size() / 2, 1) ;
+	     chunk>0 ; chunk/=2)
+	{
+		for (std::size_t pos=0 ; (pos + chunk <= part.size()) &&
+		     (part.size() - chunk >= min_size) ;)
+		{
+			std::string removed = part.substr(pos, chunk);
+			part.erase(pos, chunk);
+			if (keep())
+			{
+				continue;
+			}
+			part.insert(pos, removed);
+			pos += chunk;
+		}
+	}
+}
+
+void PerformanceFuzzer::minimise(FuzzFinding &f)
+{
+	unsigned high = f.repeats;
+	unsigned low = 1;
+	while (next_repeats(low) < high)
+	{
+		low = next_repeats(low);
+	}
+	auto keep = [&]()
+		{
+			return exponent(f, low, high) >= options.exponent_threshold;
+		};
+	shrink(f.suffix, 0, keep);
+	shrink(f.prefix, 0, keep);
+	shrink(f.pump, 1, keep);
+	pump(f);
+}
+
+std::vector<FuzzFinding> PerformanceFuzzer::run()
+{
+	for (auto &s : options.seeds)
+	{
+		consider(s);
+	}
+	for (unsigned i=0 ; i<options.generated_seeds ; i++)
+	{
+		GeneratorOptions g;
+		g.seed = options.seed + i;
+		g.target_size = std::max<std::size_t>(options.max_size >> (1 + i % 4), 1);
+		g.max_depth = 8;
+		std::string input = generate(grammar, whitespace, g);
+		input.resize(std::min(input.size(), options.max_size));
+		consider(input);
+	}
+	if (population.empty())
+	{
+		consider(std::string());
+	}
+	for (unsigned i=0 ; i<options.iterations ; i++)
+	{
+		// Tournament selection, favouring the inputs that score highest.
+		std::size_t parent = std::min(below(population.size()),
+		                              below(population.size()));
+		std::string child = population[parent].input;
+		for (std::size_t m=0, e=1+below(4) ; m<e ; m++)
+		{
+			mutate(child);
+		}
+		child.resize(std::min(child.size(), options.max_size));
+		consider(child);
+	}
+
+	std::vector<FuzzFinding> findings;
+	std::unordered_set<std::string> pumps;
+	std::unordered_set<std::string> reduced;
+	// Copy the population, because pumping parses inputs but must not
+	// change it.
+	std::vector<std::string> candidates = inputs;
+	for (auto &input : candidates)
+	{
+		// Remove the parts of the input that do not contribute to the work
+		// per byte.  This also reduces inputs that hit the work limit until
+		// they no longer do, so that they can be pumped.
+		double score = static_cast<double>(work(input)) /
+		               static_cast<double>(input.size() + 1);
+		shrink(input, 1, [&]()
+			{
+				double s = static_cast<double>(work(input)) /
+				           static_cast<double>(input.size() + 1);
+				if (s < score)
+				{
+					return false;
+				}
+				score = s;
+				return true;
+			});
+		// Leave room to repeat part of the input before reaching the limit.
+		while ((input.size() > 1) && (work(input) > options.work_limit / 64))
+		{
+			input.pop_back();
+		}
+		if (input.empty() || !reduced.insert(input).second)
+		{
+			continue;
+		}
+		for (unsigned i=0 ; i<options.pump_candidates ; i++)
+		{
+			std::size_t pos = below(input.size());
+			std::size_t length =
+				1 + below(std::min(max_pump, input.size() - pos));
+			FuzzFinding f;
+			f.prefix = input.substr(0, pos);
+			f.pump = input.substr(pos, length);
+			f.suffix = input.substr(pos + length);
+			pump(f);
+			if ((f.repeats < 3) || (f.exponent < options.exponent_threshold))
+			{
+				continue;
+			}
+			minimise(f);
+			if ((f.repeats < 3) || (f.exponent < options.exponent_threshold) ||
+			    !pumps.insert(f.pump).second)
+			{
+				continue;
+			}
+			findings.push_back(f);
+		}
+	}
+	std::sort(findings.begin(), findings.end(),
+		[](const FuzzFinding &a, const FuzzFinding &b)
+		{
+			return a.exponent > b.exponent;
+		});
+	if (findings.size() > options.max_findings)
+	{
+		findings.resize(options.max_findings);
+	}
+	return findings;
+}
+
+} //namespace pegmatite
@@ -0,0 +1,239 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEGMATITE_FUZZER_HPP
+#define PEGMATITE_FUZZER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include "parser.hh"
+
+namespace pegmatite {
+
+/**
+ * Options controlling a `PerformanceFuzzer`.
+ */
+struct FuzzerOptions
+{
+	/**
+	 * The seed for the random number generator.  The same grammar, options
+	 * and seed always produce the same results.
+	 */
+	std::uint64_t seed = 0;
+	/**
+	 * The number of mutated inputs to try.
+	 */
+	unsigned iterations = 10000;
+	/**
+	 * The maximum size of a mutated input, in bytes.  Small inputs keep each
+	 * iteration cheap; super-linear behaviour is confirmed separately by
+	 * repeating part of the input.
+	 */
+	std::size_t max_size = 256;
+	/**
+	 * The number of inputs kept in the population that mutations are drawn
+	 * from.  The inputs that cause the most work per byte are kept.
+	 */
+	unsigned population = 32;
+	/**
+	 * Inputs to start from, in addition to those produced by running a
+	 * `Generator` over the grammar.
+	 */
+	std::vector<std::string> seeds;
+	/**
+	 * The number of inputs produced by the generator to start from.
+	 */
+	unsigned generated_seeds = 8;
+	/**
+	 * The number of segments of each of the inputs in the final population
+	 * that are repeated to check for super-linear behaviour.
+	 */
+	unsigned pump_candidates = 8;
+	/**
+	 * The largest input that is parsed when checking for super-linear
+	 * behaviour, in bytes.  The parser recurses for each level of nesting in
+	 * the input, so repeating an opening bracket too many times can exhaust
+	 * the stack.
+	 */
+	std::size_t max_pumped_size = 4 * 1024;
+	/**
+	 * The largest amount of work (see `PerformanceFuzzer::work()`) that is
+	 * allowed for a single parse.  Parses that reach it are stopped, and are
+	 * not used to measure how the work grows.
+	 */
+	std::size_t work_limit = 250000;
+	/**
+	 * Inputs whose work grows at least as fast as their size raised to this
+	 * power are reported.
+	 */
+	double exponent_threshold = 1.3;
+	/**
+	 * The maximum number of findings to report.
+	 */
+	unsigned max_findings = 8;
+};
+
+/**
+ * An input that shows super-linear behaviour.  The input consists of a
+ * prefix, a segment that is repeated (the pump) and a suffix.  As the number
+ * of repetitions grows, the work done by the parser grows faster than the
+ * size of the input.
+ */
+struct FuzzFinding
+{
+	/**
+	 * The text before the repeated segment.
+	 */
+	std::string prefix;
+	/**
+	 * The repeated segment.
+	 */
+	std::string pump;
+	/**
+	 * The text after the repeated segment.
+	 */
+	std::string suffix;
+	/**
+	 * The estimated exponent of the growth of work with input size: 1 is
+	 * linear, 2 is quadratic.  Exponential growth shows up as an exponent
+	 * that keeps increasing with the number of repetitions, so this is
+	 * measured between the two largest numbers of repetitions that were
+	 * tried.
+	 */
+	double exponent = 0;
+	/**
+	 * The number of repetitions at which `exponent` was measured.
+	 */
+	unsigned repeats = 0;
+	/**
+	 * The work done parsing `input(repeats)`.
+	 */
+	std::size_t work = 0;
+	/**
+	 * Returns the input with the pump repeated `n` times.
+	 */
+	std::string input(unsigned n) const;
+};
+
+/**
+ * A fuzzer that searches for inputs that make the parser do a lot of work,
+ * to find grammars whose backtracking or left recursion can make parsing
+ * slow.  It does not need coverage instrumentation: inputs are scored by the
+ * work counters in `ParseStats`, divided by their size, and the highest
+ * scoring inputs are mutated to find worse ones.  The inputs in the final
+ * population are then checked for super-linear behaviour by repeating parts
+ * of them, and the ones that show it are minimised and reported.
+ *
+ * Inputs do not need to be valid: work done on the way to a syntax error is
+ * as much a problem as work done on a valid input.
+ */
+class PerformanceFuzzer
+{
+public:
+	/**
+	 * Constructs a fuzzer for the grammar whose root is `g`, with the
+	 * whitespace rule `ws`.
+	 */
+	PerformanceFuzzer(const Rule &g, const Rule &ws,
+	                  const FuzzerOptions &o = FuzzerOptions());
+	/**
+	 * Runs the fuzzer, returning the inputs that show super-linear behaviour,
+	 * with the fastest growing first.
+	 */
+	std::vector<FuzzFinding> run();
+	/**
+	 * Returns the work done parsing `input`: the number of rule entries plus
+	 * the number of characters examined.  The parse is stopped once this
+	 * passes `FuzzerOptions::work_limit`.
+	 */
+	std::size_t work(const std::string &input);
+	/**
+	 * Returns the inputs in the current population, with the most work per
+	 * byte first.
+	 */
+	const std::vector<std::string> &worst_inputs() const { return inputs; }
+private:
+	/**
+	 * An input in the population and its score.
+	 */
+	struct Candidate
+	{
+		std::string input;
+		double score;
+	};
+	const Rule &grammar;
+	const Rule &whitespace;
+	FuzzerOptions options;
+	std::mt19937_64 random;
+	/**
+	 * The population, with the highest score first.
+	 */
+	std::vector<Candidate> population;
+	/**
+	 * The inputs from `population`, in the same order.
+	 */
+	std::vector<std::string> inputs;
+	/**
+	 * Returns a random number in the range [0, n).
+	 */
+	std::size_t below(std::size_t n);
+	/**
+	 * Adds `input` to the population if it scores highly enough.
+	 */
+	void consider(const std::string &input);
+	/**
+	 * Applies a random mutation to `input`.
+	 */
+	void mutate(std::string &input);
+	/**
+	 * Measures the growth exponent of `f` between `low` and `high`
+	 * repetitions of the pump.  Returns 0 if the inputs are too large.
+	 */
+	double exponent(const FuzzFinding &f, unsigned low, unsigned high);
+	/**
+	 * Repeats the pump in `f` until the inputs become too large or too slow
+	 * to parse, filling in the exponent at the largest number of repetitions.
+	 */
+	void pump(FuzzFinding &f);
+	/**
+	 * Removes chunks from `part`, keeping it at least `min_size` bytes long,
+	 * for as long as `keep` returns true after each removal.
+	 */
+	void shrink(std::string &part, std::size_t min_size,
+	            const std::function<bool()> &keep);
+	/**
+	 * Shrinks the prefix, pump and suffix of `f` while it still shows
+	 * super-linear behaviour at the same number of repetitions.
+	 */
+	void minimise(FuzzFinding &f);
+};
+
+} //namespace pegmatite
+
+#endif //PEGMATITE_FUZZER_HPP
@@ -0,0 +1,914 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include "generator.hh"
+
+namespace pegmatite {
+
+namespace {
+/**
+ * The depth used for rules that can never finish generating.
+ */
+const unsigned unreachable = std::numeric_limits<unsigned>::max() / 2;
+/**
+ * The amount of output that is kept in memory when writing to a stream, so
+ * that recent output can still be checked and regenerated.
+ */
+const std::size_t keep_bytes = 64 * 1024;
+/**
+ * The amount of output that is written to the stream at a time.
+ */
+const std::size_t flush_bytes = 1024 * 1024;
+/**
+ * The first and last printable ASCII characters, used when any character is
+ * allowed.
+ */
+const char32_t first_printable = 0x20;
+const char32_t last_printable = 0x7e;
+/**
+ * The last character that can be emitted.  Output is read back one byte per
+ * character by `StringInput`, which only handles 7-bit ASCII.
+ */
+const char32_t last_ascii = 0x7f;
+/**
+ * Returns the code point `c` in hexadecimal, with at least four digits.
+ */
+std::string hex(char32_t c)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	std::string s;
+	do
+	{
+		s.insert(s.begin(), digits[c & 0xf]);
+		c >>= 4;
+	} while ((c != 0) || (s.size() < 4));
+	return s;
+}
+}
+
+/**
+ * A node in a parsed regular expression.
+ */
+struct Generator::RegexNode
+{
+	/**
+	 * The kinds of node.
+	 */
+	enum Kind
+	{
+		/**
+		 * A single character.
+		 */
+		Literal,
+		/**
+		 * A character from a bracket expression.
+		 */
+		Class,
+		/**
+		 * Any character.
+		 */
+		Any,
+		/**
+		 * One of a list of alternative sequences.
+		 */
+		Group
+	} kind = Group;
+	/**
+	 * The character, for literals.
+	 */
+	char32_t literal = 0;
+	/**
+	 * The inclusive ranges of characters, for classes.
+	 */
+	std::vector<std::pair<char32_t, char32_t>> ranges;
+	/**
+	 * Whether a class matches the characters not in `ranges`.
+	 */
+	bool negated = false;
+	/**
+	 * The alternatives, for groups.
+	 */
+	std::vector<std::vector<RegexNode>> alternatives;
+	/**
+	 * The minimum number of repetitions.
+	 */
+	unsigned min = 1;
+	/**
+	 * The maximum number of repetitions.
+	 */
+	unsigned max = 1;
+	/**
+	 * Returns true if `c` is in the ranges of this class.
+	 */
+	bool contains(char32_t c) const
+	{
+		for (auto &r : ranges)
+		{
+			if ((c >= r.first) && (c <= r.second))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+namespace {
+typedef std::u32string::size_type Index;
+
+/**
+ * Adds the ranges for a class escape (`\d`, `\w` or `\s`) to `ranges`.
+ * Returns false if `c` is not a class escape.
+ */
+bool class_escape(char32_t c,
+                  std::vector<std::pair<char32_t, char32_t>> &ranges)
+{
+	switch (c)
+	{
+		case 'd':
+			ranges.emplace_back('0', '9');
+			return true;
+		case 'w':
+			ranges.emplace_back('a', 'z');
+			ranges.emplace_back('A', 'Z');
+			ranges.emplace_back('0', '9');
+			ranges.emplace_back('_', '_');
+			return true;
+		case 's':
+			ranges.emplace_back(' ', ' ');
+			ranges.emplace_back('\t', '\r');
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Returns the character represented by the escape sequence at `i` in `p`,
+ * which is just after the backslash, advancing `i` past it.
+ */
+char32_t character_escape(const std::u32string &p, Index &i)
+{
+	char32_t c = p[i++];
+	unsigned digits = 0;
+	switch (c)
+	{
+		case 'n': return '\n';
+		case 't': return '\t';
+		case 'r': return '\r';
+		case 'f': return '\f';
+		case 'v': return '\v';
+		case '0': return 0;
+		case 'x': digits = 2; break;
+		case 'u': digits = 4; break;
+		default: return c;
+	}
+	char32_t value = 0;
+	for (unsigned d=0 ; (d<digits) && (i<p.size()) ; d++, i++)
+	{
+		char32_t h = p[i];
+		value *= 16;
+		if ((h >= '0') && (h <= '9'))
+		{
+			value += h - '0';
+		}
+		else if ((h >= 'a') && (h <= 'f'))
+		{
+			value += h - 'a' + 10;
+		}
+		else if ((h >= 'A') && (h <= 'F'))
+		{
+			value += h - 'A' + 10;
+		}
+	}
+	return value;
+}
+
+/**
+ * Parses a decimal number at `i` in `p`, advancing `i` past it.
+ */
+unsigned regex_number(const std::u32string &p, Index &i)
+{
+	unsigned n = 0;
+	while ((i < p.size()) && (p[i] >= '0') && (p[i] <= '9'))
+	{
+		n = n * 10 + (p[i++] - '0');
+	}
+	return n;
+}
+}
+
+const Generator::RegexNode &Generator::parse_regex(const std::u32string &pattern)
+{
+	auto found = regexes.find(pattern);
+	if (found != regexes.end())
+	{
+		return *found->second;
+	}
+	// A small recursive-descent parser for the subset of the ECMAScript
+	// syntax that the generator understands.  Anything that it does not
+	// understand is treated as a literal.
+	const std::u32string &p = pattern;
+	Index i = 0;
+	std::function<RegexNode()> alternatives;
+	std::function<RegexNode()> atom = [&]()
+	{
+		RegexNode n;
+		char32_t c = p[i++];
+		switch (c)
+		{
+			case '(':
+				if ((i + 1 < p.size()) && (p[i] == '?'))
+				{
+					// Lookaheads generate nothing.
+					bool lookahead = (p[i+1] == '=') || (p[i+1] == '!');
+					i += 2;
+					n = alternatives();
+					if (lookahead)
+					{
+						n.alternatives.assign(1, std::vector<RegexNode>());
+					}
+				}
+				else
+				{
+					n = alternatives();
+				}
+				if ((i < p.size()) && (p[i] == ')'))
+				{
+					i++;
+				}
+				break;
+			case '[':
+				n.kind = RegexNode::Class;
+				if ((i < p.size()) && (p[i] == '^'))
+				{
+					n.negated = true;
+					i++;
+				}
+				for (bool first=true ; (i < p.size()) && (first || (p[i] != ']')) ; first=false)
+				{
+					char32_t start = p[i++];
+					if (start == '\\' && (i < p.size()))
+					{
+						if (class_escape(p[i], n.ranges))
+						{
+							i++;
+							continue;
+						}
+						start = character_escape(p, i);
+					}
+					char32_t end = start;
+					if ((i + 1 < p.size()) && (p[i] == '-') && (p[i+1] != ']'))
+					{
+						i++;
+						end = p[i++];
+						if (end == '\\' && (i < p.size()))
+						{
+							end = character_escape(p, i);
+						}
+					}
+					n.ranges.emplace_back(start, std::max(start, end));
+				}
+				i++;
+				break;
+			case '.':
+				n.kind = RegexNode::Any;
+				break;
+			case '^':
+			case '$':
+				n.alternatives.assign(1, std::vector<RegexNode>());
+				break;
+			case '\\':
+				if (i >= p.size())
+				{
+					n.kind = RegexNode::Literal;
+					n.literal = c;
+					break;
+				}
+				if ((p[i] == 'b') || (p[i] == 'B'))
+				{
+					i++;
+					n.alternatives.assign(1, std::vector<RegexNode>());
+					break;
+				}
+				n.kind = RegexNode::Class;
+				if (class_escape(p[i], n.ranges))
+				{
+					i++;
+					break;
+				}
+				if (class_escape(static_cast<char32_t>(tolower(static_cast<int>(p[i]))), n.ranges))
+				{
+					n.negated = true;
+					i++;
+					break;
+				}
+				n.kind = RegexNode::Literal;
+				n.literal = character_escape(p, i);
+				break;
+			default:
+				n.kind = RegexNode::Literal;
+				n.literal = c;
+		}
+		// Parse any quantifier
+		if (i < p.size())
+		{
+			switch (p[i])
+			{
+				case '*':
+					n.min = 0;
+					n.max = unreachable;
+					i++;
+					break;
+				case '+':
+					n.min = 1;
+					n.max = unreachable;
+					i++;
+					break;
+				case '?':
+					n.min = 0;
+					n.max = 1;
+					i++;
+					break;
+				case '{':
+				{
+					Index start = i++;
+					n.min = regex_number(p, i);
+					n.max = n.min;
+					if ((i < p.size()) && (p[i] == ','))
+					{
+						i++;
+						n.max = ((i < p.size()) && (p[i] == '}')) ?
+							unreachable : std::max(n.min, regex_number(p, i));
+					}
+					if ((i < p.size()) && (p[i] == '}'))
+					{
+						i++;
+					}
+					else
+					{
+						// Not a valid quantifier, so the brace is a literal.
+						i = start;
+						n.min = n.max = 1;
+					}
+					break;
+				}
+			}
+			// Lazy and possessive quantifiers generate the same strings.
+			if ((i < p.size()) && (p[i] == '?') && (n.min != 1 || n.max != 1))
+			{
+				i++;
+			}
+		}
+		return n;
+	};
+	alternatives = [&]()
+	{
+		RegexNode n;
+		n.alternatives.emplace_back();
+		while (i < p.size() && (p[i] != ')'))
+		{
+			if (p[i] == '|')
+			{
+				i++;
+				n.alternatives.emplace_back();
+				continue;
+			}
+			n.alternatives.back().push_back(atom());
+		}
+		return n;
+	};
+	std::shared_ptr<RegexNode> root(new RegexNode(alternatives()));
+	regexes.emplace(pattern, root);
+	return *root;
+}
+
+void Generator::generate_regex(const RegexNode &n)
+{
+	unsigned max = std::min(n.max, n.min + options.max_repeat);
+	if (finishing())
+	{
+		max = n.min;
+	}
+	unsigned count = n.min + static_cast<unsigned>(below(max - n.min + 1));
+	for (unsigned i=0 ; i<count ; i++)
+	{
+		switch (n.kind)
+		{
+			case RegexNode::Literal:
+				emit(n.literal);
+				break;
+			case RegexNode::Any:
+				emit_any();
+				break;
+			case RegexNode::Class:
+			{
+				if (n.negated)
+				{
+					char32_t c;
+					unsigned tries = 0;
+					do
+					{
+						c = first_printable +
+						    static_cast<char32_t>(below(last_printable - first_printable + 1));
+					} while (n.contains(c) && (++tries < 64));
+					emit(c);
+					break;
+				}
+				// Only the ASCII part of each range can be emitted.
+				auto ascii_size = [](const std::pair<char32_t, char32_t> &r)
+				{
+					return (r.first > last_ascii) ? std::size_t(0) :
+					       std::size_t(std::min(r.second, last_ascii) -
+					                   r.first + 1);
+				};
+				std::size_t total = 0;
+				for (auto &r : n.ranges)
+				{
+					total += ascii_size(r);
+				}
+				if ((total == 0) && !n.ranges.empty())
+				{
+					emit(n.ranges.front().first);
+				}
+				std::size_t pick = below(total);
+				for (auto &r : n.ranges)
+				{
+					std::size_t size = ascii_size(r);
+					if (pick < size)
+					{
+						emit(r.first + static_cast<char32_t>(pick));
+						break;
+					}
+					pick -= size;
+				}
+				break;
+			}
+			case RegexNode::Group:
+			{
+				if (n.alternatives.empty())
+				{
+					break;
+				}
+				auto &alternative = n.alternatives[below(n.alternatives.size())];
+				for (auto &child : alternative)
+				{
+					generate_regex(child);
+				}
+				break;
+			}
+		}
+	}
+}
+
+const std::size_t Generator::check_window;
+
+Generator::Generator(const Rule &ws, const GeneratorOptions &o) :
+	options(o), whitespace(ws), random(o.seed) {}
+
+void Generator::generate(const Rule &g, std::ostream &out)
+{
+	sink = &out;
+	rule(g);
+	flush(true);
+	sink = nullptr;
+	flushed = 0;
+	constraints.clear();
+}
+
+std::string Generator::generate(const Rule &g)
+{
+	rule(g);
+	std::string result;
+	std::swap(result, buffer);
+	constraints.clear();
+	return result;
+}
+
+std::size_t Generator::below(std::size_t n)
+{
+	return (n == 0) ? 0 : static_cast<std::size_t>(random() % n);
+}
+
+void Generator::emit(char32_t c)
+{
+	if (c > last_ascii)
+	{
+		throw std::domain_error("cannot generate non-ASCII character U+" +
+		                        hex(c));
+	}
+	buffer.push_back(static_cast<char>(c));
+}
+
+void Generator::emit_any()
+{
+	emit(first_printable +
+	     static_cast<char32_t>(below(last_printable - first_printable + 1)));
+}
+
+void Generator::emit_set(const std::vector<bool> &set)
+{
+	std::size_t end = std::min<std::size_t>(set.size(), last_ascii + 1);
+	std::size_t count = std::count(set.begin(), set.begin() + end, true);
+	if (count == 0)
+	{
+		// Only characters that cannot be emitted remain, so report the first.
+		auto first = std::find(set.begin(), set.end(), true);
+		if (first != set.end())
+		{
+			emit(static_cast<char32_t>(first - set.begin()));
+		}
+		return;
+	}
+	std::size_t pick = below(count);
+	for (std::size_t i=0 ; i<end ; i++)
+	{
+		if (set[i] && (pick-- == 0))
+		{
+			emit(static_cast<char32_t>(i));
+			return;
+		}
+	}
+}
+
+void Generator::emit_regex(const std::u32string &pattern)
+{
+	generate_regex(parse_regex(pattern));
+}
+
+void Generator::separator()
+{
+	// Whitespace is optional between non-terminals.  If leaving it out makes
+	// adjacent tokens run together, then the constraints on the tokens will
+	// be violated and the enclosing sequence is regenerated.
+	if (term || below(2))
+	{
+		return;
+	}
+	term = true;
+	loop_depth++;
+	spacing = true;
+	for (unsigned i=0 ; i<4 ; i++)
+	{
+		Mark m = mark();
+		whitespace.expr->generate(*this);
+		if (size() > m.size)
+		{
+			break;
+		}
+		rewind(m);
+	}
+	spacing = false;
+	loop_depth--;
+	term = false;
+}
+
+bool Generator::rewind(const Mark &m)
+{
+	if (m.size < flushed)
+	{
+		return false;
+	}
+	buffer.resize(m.size - flushed);
+	rewinds++;
+	constraints.erase(constraints.begin() +
+	                  static_cast<std::ptrdiff_t>(m.constraints),
+	                  constraints.end());
+	return true;
+}
+
+template<typename Fn>
+void Generator::attempt(Fn fn)
+{
+	if (!options.check_constraints)
+	{
+		fn();
+		return;
+	}
+	Mark m = mark();
+	// Nested retries multiply, so allow fewer attempts for each level of
+	// nesting.
+	unsigned retries = (retrying < 8) ? options.retries >> (2 * retrying) : 0;
+	unsigned outer_retrying = retrying;
+	for (unsigned i=0 ;; i++)
+	{
+		fn();
+		if (check(m, false))
+		{
+			break;
+		}
+		if ((i >= retries) || !rewind(m))
+		{
+			check(m, true);
+			break;
+		}
+		retrying = outer_retrying + 1;
+	}
+	retrying = outer_retrying;
+}
+
+bool Generator::check(const Mark &m, bool discard)
+{
+	bool ok = true;
+	auto out = constraints.begin() + static_cast<std::ptrdiff_t>(m.constraints);
+	for (auto i=out ; i!=constraints.end() ; ++i)
+	{
+		// Skip constraints that were undecided when last checked, unless
+		// some output has been discarded since or the amount of output after
+		// the constraint has doubled.  This bounds the number of times that
+		// each constraint is checked.
+		if ((i->checked_rewinds == rewinds) &&
+		    (size() - i->position < 2 * (i->checked_size - i->position)))
+		{
+			*out++ = *i;
+			continue;
+		}
+		switch (check(*i))
+		{
+			case Satisfied:
+				break;
+			case Undecided:
+				i->checked_size = size();
+				i->checked_rewinds = rewinds;
+				*out++ = *i;
+				break;
+			case Violated:
+				if (!discard)
+				{
+					return false;
+				}
+				ok = false;
+				break;
+		}
+	}
+	constraints.erase(out, constraints.end());
+	return ok;
+}
+
+void Generator::flush(bool all)
+{
+	if (!sink)
+	{
+		return;
+	}
+	if (!all && (buffer.size() < flush_bytes + keep_bytes))
+	{
+		return;
+	}
+	std::size_t bytes = all ? buffer.size() : buffer.size() - keep_bytes;
+	sink->write(buffer.data(), static_cast<std::streamsize>(bytes));
+	buffer.erase(0, bytes);
+	flushed += bytes;
+}
+
+void Generator::sequence(const Expr &left, const Expr &right)
+{
+	bool repeats = right.estimate(*this).repeats;
+	attempt([&]()
+		{
+			bool was_followed = followed;
+			followed = followed || repeats;
+			left.generate(*this);
+			followed = was_followed;
+			separator();
+			right.generate(*this);
+		});
+}
+
+void Generator::choice(const Expr &left, const Expr &right)
+{
+	GeneratorEstimate l = left.estimate(*this);
+	GeneratorEstimate r = right.estimate(*this);
+	// Whitespace is kept simple, so that it does not disturb the tokens
+	// around it.
+	bool simple = finishing() || spacing;
+	bool fits_left = !simple && (depth + l.depth <= options.max_depth);
+	bool fits_right = !simple && (depth + r.depth <= options.max_depth);
+	bool pick_left;
+	if (fits_left != fits_right)
+	{
+		pick_left = fits_left;
+	}
+	else if (!fits_left && (l.depth != r.depth))
+	{
+		// Neither fits, so take the one that finishes soonest.
+		pick_left = l.depth < r.depth;
+	}
+	else
+	{
+		double total = l.weight + r.weight;
+		double unit = static_cast<double>(random() >> 11) * (1.0 / 9007199254740992.0);
+		pick_left = (total <= 0) || (unit * total < l.weight);
+	}
+	if (pick_left)
+	{
+		left.generate(*this);
+		return;
+	}
+	// The parser only tries the second alternative if the first fails.  This
+	// does not apply when generating the left operand of a left-recursive
+	// rule, because the parser grows those matches from the shortest one.
+	if ((size() != left_recursion) && !spacing)
+	{
+		lookahead(left, false);
+	}
+	right.generate(*this);
+}
+
+void Generator::repeat(const Expr &e, unsigned min)
+{
+	// The outermost loop that contains some structure (rather than just
+	// repeating characters) grows the output to the target size, unless
+	// another loop follows it.
+	unsigned e_depth = e.estimate(*this).depth;
+	bool top = (loop_depth == 0) && (e_depth > 0) && !followed;
+	unsigned count = spacing ? 1 :
+		static_cast<unsigned>(below(options.max_repeat + 1));
+	count = std::max(count, min);
+	loop_depth++;
+	for (unsigned i=0 ;; i++)
+	{
+		if (i >= min)
+		{
+			if (top ? finishing() :
+			    ((i >= count) || (!spacing && finishing()) ||
+			     (depth + e_depth > options.max_depth)))
+			{
+				break;
+			}
+		}
+		std::size_t before = size();
+		attempt([&]()
+			{
+				separator();
+				e.generate(*this);
+			});
+		// Stop if the body generates nothing, or we would never finish.
+		if ((size() == before) && (i >= min))
+		{
+			break;
+		}
+		if (top)
+		{
+			flush();
+		}
+	}
+	loop_depth--;
+	// Loops are greedy, so the loop only ends if the body does not match.
+	// The parser skips as much whitespace as it can, so two pieces of
+	// generated whitespace next to each other are harmless.
+	if (!spacing)
+	{
+		lookahead(e, false);
+	}
+}
+
+void Generator::optional(const Expr &e)
+{
+	// An optional loop outside any other loop may be the only thing that can
+	// grow the output to the target size, so always take it if there is room.
+	GeneratorEstimate estimate = e.estimate(*this);
+	bool top = (loop_depth == 0) && estimate.repeats;
+	if (!finishing() && (depth + estimate.depth <= options.max_depth) &&
+	    (top || below(2)))
+	{
+		e.generate(*this);
+		return;
+	}
+	lookahead(e, false);
+}
+
+void Generator::lookahead(const Expr &e, bool positive)
+{
+	if (options.check_constraints)
+	{
+		constraints.push_back({ &e, size(), positive, term, size(), 0 });
+	}
+}
+
+void Generator::terminal(const Expr &e)
+{
+	bool was_term = term;
+	term = true;
+	e.generate(*this);
+	term = was_term;
+}
+
+void Generator::rule(const Rule &r)
+{
+	std::size_t start = size();
+	std::size_t outer_left_recursion = left_recursion;
+	for (auto &active : active_rules)
+	{
+		if ((active.first == std::addressof(r)) && (active.second == start))
+		{
+			left_recursion = start;
+			break;
+		}
+	}
+	active_rules.emplace_back(std::addressof(r), start);
+	depth++;
+	r.expr->generate(*this);
+	depth--;
+	active_rules.pop_back();
+	left_recursion = outer_left_recursion;
+}
+
+GeneratorEstimate Generator::estimate(const Rule &r)
+{
+	auto weight = options.rule_weights.find(std::addressof(r));
+	return { min_depth(r),
+	         (weight == options.rule_weights.end()) ? 1 : weight->second,
+	         false };
+}
+
+unsigned Generator::min_depth(const Rule &r)
+{
+	auto found = rule_depths.find(std::addressof(r));
+	if (found != rule_depths.end())
+	{
+		return found->second;
+	}
+	rule_depths.emplace(std::addressof(r), unreachable);
+	pending_rules.push_back(std::addressof(r));
+	// If we're already computing depths, then this rule will be visited by
+	// the loop below.
+	if (pending_rules.size() > 1)
+	{
+		return unreachable;
+	}
+	// Compute the depths of all of the rules reachable from this one together,
+	// repeatedly recomputing them until none change.  Rules that have not yet
+	// been computed count as unreachable, so the depths only ever decrease.
+	bool changed;
+	do
+	{
+		changed = false;
+		for (std::size_t i=0 ; i<pending_rules.size() ; i++)
+		{
+			const Rule *pending = pending_rules[i];
+			unsigned d = std::min(unreachable,
+			                      pending->expr->estimate(*this).depth + 1);
+			unsigned &current = rule_depths[pending];
+			if (d < current)
+			{
+				current = d;
+				changed = true;
+			}
+		}
+	} while (changed);
+	pending_rules.clear();
+	return rule_depths[std::addressof(r)];
+}
+
+void Expr::generate(Generator &) const
+{
+}
+
+GeneratorEstimate Expr::estimate(Generator &) const
+{
+	return { 0, 1, false };
+}
+
+std::string generate(const Rule &g, const Rule &ws,
+                     const GeneratorOptions &options)
+{
+	Generator gen(ws, options);
+	return gen.generate(g);
+}
+
+void generate(const Rule &g, const Rule &ws, std::ostream &out,
+              const GeneratorOptions &options)
+{
+	Generator gen(ws, options);
+	gen.generate(g, out);
+}
+
+} //namespace pegmatite
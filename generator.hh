@@ -0,0 +1,439 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEGMATITE_GENERATOR_HPP
+#define PEGMATITE_GENERATOR_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "parser.hh"
+
+namespace pegmatite {
+
+/**
+ * Options controlling the sentences produced by a `Generator`.
+ */
+struct GeneratorOptions
+{
+	/**
+	 * The seed for the random number generator.  The same grammar, options
+	 * and seed always produce the same output.
+	 */
+	std::uint64_t seed = 0;
+	/**
+	 * The approximate size of the output, in bytes.  The first loop that is
+	 * not nested inside another loop, is not followed by another loop, and
+	 * whose body refers to a rule keeps repeating until the output reaches
+	 * this size.  Once it has been reached, every other choice is made to
+	 * finish the sentence as quickly as possible.
+	 */
+	std::size_t target_size = 1024;
+	/**
+	 * The maximum nesting depth of rules.  Beyond this depth, the generator
+	 * only picks the alternatives that reach a terminal in the fewest rules.
+	 */
+	unsigned max_depth = 16;
+	/**
+	 * The maximum number of iterations of a nested loop.  Each loop picks a
+	 * number of iterations uniformly up to this value.
+	 */
+	unsigned max_repeat = 4;
+	/**
+	 * Weights for the alternatives in choice expressions, keyed by rule.  An
+	 * alternative that is a reference to one of these rules is picked in
+	 * proportion to its weight.  All other alternatives have a weight of 1.
+	 */
+	std::unordered_map<const Rule*, double> rule_weights;
+	/**
+	 * If set, then the generator checks that the lookahead expressions, the
+	 * ordered choices and the greedy loops in the grammar would make the
+	 * parser follow the derivation that was generated, regenerating the
+	 * enclosing sequence when they would not.  Disabling this is faster, but
+	 * the output is then less likely to be parsed by the grammar.
+	 */
+	bool check_constraints = true;
+	/**
+	 * The number of times that a sequence is regenerated when its output
+	 * violates a constraint.  After this many attempts the last one is kept.
+	 */
+	unsigned retries = 16;
+};
+
+/**
+ * An estimate of the cost of generating a string from an expression, used to
+ * choose between alternatives.
+ */
+struct GeneratorEstimate
+{
+	/**
+	 * The minimum depth of rule nesting needed to generate from the
+	 * expression.
+	 */
+	unsigned depth;
+	/**
+	 * The relative probability of picking this expression when it is an
+	 * alternative in a choice.  For a choice, this is the sum of the weights
+	 * of its alternatives.
+	 */
+	double weight;
+	/**
+	 * Whether the expression contains a loop, not counting loops in the rules
+	 * that it refers to.
+	 */
+	bool repeats;
+};
+
+/**
+ * Generates random sentences of the language described by a grammar.  The
+ * generator walks the expression graph of the grammar, with each expression
+ * calling back into the generator from `Expr::generate()` to produce its
+ * output.
+ *
+ * The generator follows the structure of the grammar, but PEGs are defined by
+ * the recogniser, not by the set of strings that their expressions generate.
+ * The generator checks the constraints that parsing imposes on the output (see
+ * `GeneratorOptions::check_constraints`) as far as it can, but it is still
+ * possible to write grammars that it generates strings for that they do not
+ * parse.  Characters are emitted as single bytes, in the format read by
+ * `StringInput`, which reads only 7-bit ASCII correctly, so sets, ranges and
+ * character classes generate only their ASCII members.  The generator throws
+ * `std::domain_error` if it reaches a character, set or range with no ASCII
+ * members, so grammars whose alternatives need other characters cannot be
+ * generated for.  Regular expressions are supported only for the common
+ * subset of the ECMAScript syntax: literals, `.`, bracket expressions, the
+ * `\d`, `\w` and `\s` classes, groups, alternation and quantifiers.
+ */
+class Generator
+{
+public:
+	/**
+	 * Constructs a generator, using `ws` as the whitespace rule.
+	 */
+	Generator(const Rule &ws, const GeneratorOptions &o = GeneratorOptions());
+	/**
+	 * Generates a sentence for the rule `g`, writing it to `out`.  Output is
+	 * written in blocks while it is generated, so the sentence does not need
+	 * to fit in memory.
+	 */
+	void generate(const Rule &g, std::ostream &out);
+	/**
+	 * Generates a sentence for the rule `g` and returns it.
+	 */
+	std::string generate(const Rule &g);
+
+	/**
+	 * @name Interface for expressions
+	 *
+	 * These functions are called from `Expr::generate()` implementations.
+	 * @{
+	 */
+	/**
+	 * Appends a character to the output.  Throws `std::domain_error` if the
+	 * character is not ASCII.
+	 */
+	void emit(char32_t c);
+	/**
+	 * Appends a random printable character to the output.
+	 */
+	void emit_any();
+	/**
+	 * Appends a random ASCII character from a set to the output, where the
+	 * set contains each character whose index in `set` is true.
+	 */
+	void emit_set(const std::vector<bool> &set);
+	/**
+	 * Appends a random string matched by the regular expression `pattern`.
+	 */
+	void emit_regex(const std::u32string &pattern);
+	/**
+	 * Generates `left` followed by `right`, with whitespace in between if
+	 * the sequence is not a terminal.
+	 */
+	void sequence(const Expr &left, const Expr &right);
+	/**
+	 * Generates one of `left` or `right`.
+	 */
+	void choice(const Expr &left, const Expr &right);
+	/**
+	 * Generates `e` repeatedly, at least `min` times.
+	 */
+	void repeat(const Expr &e, unsigned min);
+	/**
+	 * Generates `e` or nothing.
+	 */
+	void optional(const Expr &e);
+	/**
+	 * Records that `e` must match at the current position (if `positive` is
+	 * true) or must not match (if it is false).  Generates nothing.
+	 */
+	void lookahead(const Expr &e, bool positive);
+	/**
+	 * Generates `e` as a terminal.
+	 */
+	void terminal(const Expr &e);
+	/**
+	 * Generates the rule `r`.
+	 */
+	void rule(const Rule &r);
+	/**
+	 * Returns the cost estimate for a reference to the rule `r`.
+	 */
+	GeneratorEstimate estimate(const Rule &r);
+	/** @} */
+private:
+	/**
+	 * A lookahead condition that the output must satisfy.
+	 */
+	struct Constraint
+	{
+		/**
+		 * The expression that must or must not match.
+		 */
+		const Expr *expr;
+		/**
+		 * The position in the output where it must or must not match.
+		 */
+		std::size_t position;
+		/**
+		 * Whether the expression must match.
+		 */
+		bool positive;
+		/**
+		 * Whether the expression is matched as a terminal.
+		 */
+		bool term;
+		/**
+		 * The size of the output when the constraint was last checked and
+		 * found to be undecided.
+		 */
+		std::size_t checked_size;
+		/**
+		 * The value of `rewinds` when the constraint was last checked.
+		 */
+		std::size_t checked_rewinds;
+	};
+	/**
+	 * The result of checking a constraint.
+	 */
+	enum CheckResult
+	{
+		/**
+		 * The constraint holds, whatever is appended to the output.
+		 */
+		Satisfied,
+		/**
+		 * The constraint does not hold, whatever is appended to the output.
+		 */
+		Violated,
+		/**
+		 * The constraint depends on output that has not been generated yet.
+		 */
+		Undecided
+	};
+	/**
+	 * A point in the generation that can be returned to.
+	 */
+	struct Mark
+	{
+		/**
+		 * The size of the output.
+		 */
+		std::size_t size;
+		/**
+		 * The number of constraints.
+		 */
+		std::size_t constraints;
+	};
+	/**
+	 * The maximum number of bytes of output that are examined when checking
+	 * a constraint.
+	 */
+	static const std::size_t check_window = 4096;
+	/**
+	 * The parsed form of a regular expression.
+	 */
+	struct RegexNode;
+	/**
+	 * The options for this generator.
+	 */
+	GeneratorOptions options;
+	/**
+	 * The whitespace rule.
+	 */
+	const Rule &whitespace;
+	/**
+	 * The random number generator.
+	 */
+	std::mt19937_64 random;
+	/**
+	 * The output that has not yet been written to the stream.
+	 */
+	std::string buffer;
+	/**
+	 * The number of bytes of output that have already been written to the
+	 * stream and removed from `buffer`.
+	 */
+	std::size_t flushed = 0;
+	/**
+	 * The stream that output is written to, if any.
+	 */
+	std::ostream *sink = nullptr;
+	/**
+	 * Constraints that have not yet been shown to hold.
+	 */
+	std::vector<Constraint> constraints;
+	/**
+	 * The number of times that output has been discarded by `rewind()`.
+	 */
+	std::size_t rewinds = 0;
+	/**
+	 * The current nesting depth of rules.
+	 */
+	unsigned depth = 0;
+	/**
+	 * The current nesting depth of loops.
+	 */
+	unsigned loop_depth = 0;
+	/**
+	 * Whether expressions are currently being generated as terminals.
+	 */
+	bool term = false;
+	/**
+	 * Whether the whitespace between non-terminals is being generated.
+	 */
+	bool spacing = false;
+	/**
+	 * Whether the expression being generated is followed by a loop.
+	 */
+	bool followed = false;
+	/**
+	 * The number of nested attempts that are regenerating output because it
+	 * violated a constraint.
+	 */
+	unsigned retrying = 0;
+	/**
+	 * The rules that are being generated, and the positions in the output
+	 * where they started.
+	 */
+	std::vector<std::pair<const Rule*, std::size_t>> active_rules;
+	/**
+	 * The position of the innermost left-recursive rule being generated.
+	 */
+	std::size_t left_recursion = static_cast<std::size_t>(-1);
+	/**
+	 * The minimum depths computed for rules.
+	 */
+	std::unordered_map<const Rule*, unsigned> rule_depths;
+	/**
+	 * The rules whose depths are being computed.
+	 */
+	std::vector<const Rule*> pending_rules;
+	/**
+	 * Parsed regular expressions, keyed by pattern.
+	 */
+	std::unordered_map<std::u32string, std::shared_ptr<RegexNode>> regexes;
+	/**
+	 * Returns the total number of bytes generated so far.
+	 */
+	std::size_t size() const { return flushed + buffer.size(); }
+	/**
+	 * Returns a random number in the range [0, n).
+	 */
+	std::size_t below(std::size_t n);
+	/**
+	 * Returns true if the output is big enough that the sentence should be
+	 * finished as quickly as possible.
+	 */
+	bool finishing() const { return size() >= options.target_size; }
+	/**
+	 * Emits whitespace between non-terminal expressions.
+	 */
+	void separator();
+	/**
+	 * Records the current point in the generation.
+	 */
+	Mark mark() const { return { size(), constraints.size() }; }
+	/**
+	 * Returns to a point recorded with `mark()`.  Returns false if this is
+	 * impossible because the output has already been flushed.
+	 */
+	bool rewind(const Mark &m);
+	/**
+	 * Calls `fn` to generate some output, regenerating it while it violates
+	 * any of the constraints added since it started.
+	 */
+	template<typename Fn>
+	void attempt(Fn fn);
+	/**
+	 * Checks the constraints added since `m`, discarding those that are
+	 * satisfied.  Returns false if any are violated.  If `discard` is true,
+	 * violated constraints are discarded too.
+	 */
+	bool check(const Mark &m, bool discard);
+	/**
+	 * Checks a constraint against the output.
+	 */
+	CheckResult check(const Constraint &c);
+	/**
+	 * Writes all but the most recent output to the stream, if there is a
+	 * stream and enough output has accumulated.
+	 */
+	void flush(bool all = false);
+	/**
+	 * Computes the minimum depth of the rule `r`.
+	 */
+	unsigned min_depth(const Rule &r);
+	/**
+	 * Parses a regular expression pattern.
+	 */
+	const RegexNode &parse_regex(const std::u32string &pattern);
+	/**
+	 * Generates a string matched by a parsed regular expression.
+	 */
+	void generate_regex(const RegexNode &n);
+};
+
+/**
+ * Generates a random sentence for the rule `g`, using `ws` as the whitespace
+ * rule.
+ */
+std::string generate(const Rule &g, const Rule &ws,
+                     const GeneratorOptions &options = GeneratorOptions());
+
+/**
+ * Generates a random sentence for the rule `g`, using `ws` as the whitespace
+ * rule, and writes it to `out`.
+ */
+void generate(const Rule &g, const Rule &ws, std::ostream &out,
+              const GeneratorOptions &options = GeneratorOptions());
+
+} //namespace pegmatite
+
+#endif //PEGMATITE_GENERATOR_HPP
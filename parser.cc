@@ -26,21 +26,33 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <stdexcept>
 #include <sstream>
+#include <thread>
 #include <regex>
 #include <unordered_map>
 #include <unordered_set>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
 #include "parser.hh"
+#include "generator.hh"
+#include "pika.hh"
 
 
 using namespace pegmatite;
@@ -52,37 +64,29 @@ class ParsingState
 {
 public:
 	//position
-	ParserPosition position;
+	Input::iterator position;
 
 	//size of match vector
 	size_t matches;
 
 	//constructor
 	ParsingState(Context &con);
-};
-
 
+	/**
+	 * Destructor.  Matches may be committed once no states are live.
+	 */
+	~ParsingState();
 
-//match
-class ParseMatch
-{
-public:
-	//const Rule matched
-	const Rule *matched_rule;
-
-	//source range
-	InputRange source;
+	ParsingState(const ParsingState &) = delete;
+	ParsingState &operator=(const ParsingState &) = delete;
+private:
+	/**
+	 * The context that this state was saved from.
+	 */
+	Context &context;
+};
 
-	//null constructor
-	ParseMatch() {}
 
-	//constructor from parameters
-	ParseMatch(const Rule *r, const ParserPosition &b, const ParserPosition &e) :
-		matched_rule(r),
-		source(b, e)
-	{
-	}
-};
 
 /**
  * String expression.  Matches a sequence of characters.
@@ -101,6 +105,14 @@ public:
 	virtual bool parse_non_term(Context &con) const;
 	virtual bool parse_term(Context &con) const;
 	virtual void dump() const;
+	virtual void generate(Generator &g) const;
+	virtual void line_ends(std::vector<char32_t> &chars) const
+	{
+		if (!characters.empty())
+		{
+			chars.push_back(characters.back());
+		}
+	}
 private:
 	/**
 	 * The characters that this expression will match.
@@ -129,6 +141,10 @@ Expr::~Expr()
 {
 }
 
+void Expr::line_ends(std::vector<char32_t> &) const
+{
+}
+
 /**
  * Character expression, matches a single character.
  */
@@ -146,6 +162,11 @@ public:
 	virtual bool parse_non_term(Context &con) const;
 	virtual bool parse_term(Context &con) const;
 	virtual void dump() const;
+	virtual void generate(Generator &g) const;
+	virtual void line_ends(std::vector<char32_t> &chars) const
+	{
+		chars.push_back(character);
+	}
 	/**
 	 * Returns a range expression that recognises characters in the specified
 	 * range.
@@ -186,1629 +207,5936 @@ ExprPtr operator-(const CharacterExprPtr &left, char32_t right)
 ExprPtr::ExprPtr(const CharacterExprPtr &e) :
 	std::shared_ptr<Expr>(std::static_pointer_cast<Expr>(e)) {}
 
-//parsing context
-class Context
+/**
+ * A second window onto an input.  Reading an input through its iterators
+ * updates the window of characters that it caches, so another thread can
+ * only read the same input through a view, and then only if the input
+ * supports concurrent reads.  A view may also cover only part of the input.
+ */
+class InputView : public Input
 {
+	/**
+	 * The input that this views.
+	 */
+	Input &source;
+	/**
+	 * The index in the input of the first character of the view.
+	 */
+	Index offset;
+	/**
+	 * The number of characters in the view.
+	 */
+	Index length;
 public:
-	//const Rule that parses whitespace
-	const Rule &whitespace_rule;
-
-	//current position
-	ParserPosition position;
-
-	//Error position
-	ParserPosition error_pos;
-
-	//input begin
-	Input::iterator start;
-
-	//input end
-	Input::iterator finish;
-
-	//matches
-	std::vector<ParseMatch> matches;
-
 	/**
-	 * Depth of parsing.  Used for trace expressions.
+	 * Constructs a view of `i`.
 	 */
-	int depth = 0;
-
-	const ParserDelegate &delegate;
-
-	//constructor
-	Context(Input &i, const Rule &ws, const ParserDelegate &d) :
-		whitespace_rule(ws),
-		position(i),
-		error_pos(i),
-		start(i.begin()),
-		finish(i.end()),
-		delegate(d)
-	{
-	}
-
-	//check if the end is reached
-	bool end() const
-	{
-		return position.it == finish;
-	}
-
-	//get the current symbol
-	char32_t symbol() const
+	InputView(Input &i) : InputView(i, 0, i.size()) {}
+	/**
+	 * Constructs a view of the `l` characters of `i` starting at `o`.
+	 */
+	InputView(Input &i, Index o, Index l) :
+		Input(i.name()), source(i), offset(o), length(l)
 	{
-		assert(!end());
-		return *position.it;
+		viewed = i.viewed ? i.viewed : &i;
+		viewed_offset = i.viewed_offset + o;
 	}
-
-	//set the longest possible error
-	void set_error_pos()
+	bool fillBuffer(Index start, Index &l, char32_t *&b) override
 	{
-		if (position.it > error_pos.it)
+		if (start >= length)
 		{
-			error_pos = position;
+			return false;
+		}
+		// Inputs that return their own storage may return more characters
+		// than were asked for.
+		l = std::min(l, length - start);
+		if (!source.fillBuffer(offset + start, l, b))
+		{
+			return false;
 		}
+		l = std::min(l, length - start);
+		return true;
 	}
-
-	//next column
-	void next_col()
+	Index size() const override
 	{
-		++position.it;
-		++position.col;
+		return length;
 	}
-
-	/**
-	 * Consume the specified number of characters in the input.
-	 */
-	void consume(size_t chars)
+	bool supports_concurrent_reads() const override
 	{
-		position.it += chars;
-		position.col += chars;
+		return source.supports_concurrent_reads();
 	}
+};
 
-	//next line
-	void next_line()
+namespace {
+/**
+ * Delegate with no parse procedures, used to test whether an expression
+ * matches without recording any matches.
+ */
+struct NullDelegate : public ParserDelegate
+{
+	parse_proc get_parse_proc(const Rule &) const override
 	{
-		++position.line;
-		position.col = 1;
+		return nullptr;
 	}
-
-	//restore the state
-	void restore(const ParsingState &st)
+	const parse_proc *find_parse_proc(const Rule &, parse_proc &) const override
 	{
-		position = st.position;
-		matches.resize(st.matches);
+		return nullptr;
 	}
+};
 
-	//parse non-term rule.
-	bool parse_non_term(const Rule &r);
-
-	//parse term rule.
-	bool parse_term(const Rule &r);
+/**
+ * The mode for parsing a rule.
+ */
+enum MatchMode
+{
+	/**
+	 * Parse as normal.  If we're left recursing, then try again in reject
+	 * mode.
+	 */
+	PARSE,
+	/**
+	 * Parse as normal only if we are not left recursing.  If we are, then
+	 * fail this rule to force backtracking.
+	 */
+	REJECT
+};
 
-	//parse whitespace terminal
-	bool parse_ws() { return parse_term(whitespace_rule); }
+//state
+struct RuleState
+{
+	//position in source code, relative to start
+	size_t position;
 
-	parse_proc get_parse_proc(const Rule &r) const
-	{
-		return delegate.get_parse_proc(r);
-	}
+	//mode
+	MatchMode mode;
 
-	//execute all the parse procs
-	bool do_parse_procs(void *d) const
-	{
-		for(const auto &m : matches)
-		{
-			const parse_proc &p = get_parse_proc(*(m.matched_rule));
-			assert(p);
-			if (not p(m.source, d))
-				return false;
-		}
+	//constructor
+	RuleState(size_t ParserPosition = Input::npos, MatchMode m = PARSE) :
+		position(ParserPosition), mode(m) {}
+};
+/**
+ * The stack of states for a single rule.
+ */
+typedef std::vector<RuleState, StatsAllocator<RuleState>> RuleStateVector;
+/**
+ * The type of the map from rules to their states.
+ */
+typedef std::unordered_map<const Rule*, RuleStateVector,
+        std::hash<const Rule*>, std::equal_to<const Rule*>,
+        StatsAllocator<std::pair<const Rule* const, RuleStateVector>>>
+        RuleStateMap;
 
-		return true;
-	}
+/**
+ * The control characters other than '\n' that end lines, as a bit mask
+ * indexed by character.  Set by `nl()` for the characters that the
+ * expressions that it marks end with.
+ */
+std::atomic<std::uint32_t> line_end_controls{0};
 
+/**
+ * An index of the starts of the lines in an input, used to find the line and
+ * column of a position.  Lines are found by scanning the input for newline
+ * characters.  The scan is incremental: it only covers the input up to the
+ * furthest position that has been looked up, so a parse that never reports a
+ * position never scans the input.
+ */
+class LineIndex
+{
 	/**
-	 * Empty the cache.
+	 * The index of the first character of each line.  The first line starts
+	 * at 0.
 	 */
-	void clear_cache() { cache.clear(); }
-
-private:
+	std::vector<Input::Index, StatsAllocator<Input::Index>> line_starts;
+	/**
+	 * The input.
+	 */
+	Input *input = nullptr;
+	/**
+	 * The index up to which the input has been scanned for newlines.
+	 */
+	Input::Index scanned = 0;
+	/**
+	 * The line found by the last lookup.  Lookups are usually near each other,
+	 * so this is checked before searching the whole index.
+	 */
+	std::size_t last_line = 0;
+	/**
+	 * The number of lines whose starts have been discarded from the front of
+	 * the index, or that came before the start of the input.
+	 */
+	std::size_t first_line = 0;
+	/**
+	 * The number of columns before the start of the input on its first line.
+	 */
+	std::size_t first_col = 0;
+public:
+	/**
+	 * Constructs an empty index, recording its memory use in `s`.
+	 */
+	LineIndex(ParseStats &s) :
+		line_starts(StatsAllocator<Input::Index>(&s, &s.lines)) {}
 	/**
-	 * The mode for parsing a rule.
+	 * Prepares the index for the input `i`, keeping the memory allocated.
+	 * The first character of the input is at `line` and `col`, which are
+	 * greater than 1 if the input continues an earlier one.
 	 */
-	enum MatchMode
+	void reset(Input &i, std::size_t line = 1, std::size_t col = 1)
 	{
-		/**
-		 * Parse as normal.  If we're left recursing, then try again in reject
-		 * mode.
-		 */
-		PARSE,
-		/**
-		 * Parse as normal only if we are not left recursing.  If we are, then
-		 * fail this rule to force backtracking.
-		 */
-		REJECT
-	};
-
-	//state
-	struct RuleState
+		input = &i;
+		line_starts.assign(1, 0);
+		scanned = 0;
+		last_line = 0;
+		first_line = line - 1;
+		first_col = col - 1;
+	}
+	/**
+	 * Frees the memory used by the index.
+	 */
+	void release()
 	{
-		//position in source code, relative to start
-		size_t position;
-
-		//mode
-		MatchMode mode;
-
-		//constructor
-		RuleState(size_t ParserPosition = Input::npos, MatchMode m = PARSE) :
-			position(ParserPosition), mode(m) {}
-	};
-	//parse non-term rule.
-	//parse term rule.
-	std::unordered_map<const Rule*, std::vector<RuleState>> rule_states;
-	bool parse_rule(const Rule &r, bool (Context::*parse_func)(const Rule &));
-	bool _parse_non_term(const Rule &r);
-
-	bool _parse_term(const Rule &r);
-
+		decltype(line_starts)(line_starts.get_allocator()).swap(line_starts);
+		scanned = 0;
+		last_line = 0;
+		first_line = 0;
+		first_col = 0;
+	}
 	/**
-	 * The key used in the parsing cache.
+	 * Discards the starts of the lines before the one containing `offset`.
+	 * No position before that line may be looked up afterwards.
 	 */
-	struct CacheKey
+	void discard_before(Input::Index offset)
 	{
-		/**
-		 * The rule for which this cache entry applies.
-		 */
-		const Rule      *rule;
-		/**
-		 * The start address for this rule.
-		 */
-		Input::iterator  start;
-		/**
-		 * Compare two keys for equality.
-		 */
-		bool operator==(const CacheKey &other) const
+		auto next = std::upper_bound(line_starts.begin(), line_starts.end(),
+		                             offset);
+		auto line = next - line_starts.begin() - 1;
+		line_starts.erase(line_starts.begin(), line_starts.begin() + line);
+		first_line += static_cast<std::size_t>(line);
+		last_line = 0;
+		if (line > 0)
 		{
-			return (rule == other.rule) && (start == other.start);
+			first_col = 0;
 		}
-	};
+	}
 	/**
-	 * The hash calculator for CacheKey objects.  Note that performance of the
-	 * parser is *highly* dependent on the quality of this hash function.
+	 * Returns the position, including the line and column, for `it`.
 	 */
-	struct CacheKeyHash
+	ParserPosition locate(const Input::iterator &it)
 	{
-		/**
-		 * The hash function, xors the hash of the rule and the start index
-		 * together.
-		 */
-		size_t operator()(const CacheKey &k) const
+		ParserPosition p;
+		p.it = it;
+		Input::Index offset = it.index();
+		if (offset >= scanned)
 		{
-			std::hash<const Rule*> h;
-			std::hash<Input::Index> hi;
-			return h(k.rule) ^ (hi(k.start.index() << 1));
+			scan_to(offset);
 		}
-	};
+		std::size_t line = last_line;
+		// Positions that are looked up one after another are usually on the
+		// same line or a nearby one, so step from the last line for a few
+		// lines before searching the whole index.
+		for (int steps=0 ; ; steps++)
+		{
+			if (line_starts[line] > offset)
+			{
+				line--;
+			}
+			else if ((line + 1 < line_starts.size()) &&
+			         (line_starts[line + 1] <= offset))
+			{
+				line++;
+			}
+			else
+			{
+				break;
+			}
+			if (steps == 4)
+			{
+				auto next = std::upper_bound(line_starts.begin(),
+				                             line_starts.end(), offset);
+				line = static_cast<std::size_t>(next - line_starts.begin()) - 1;
+				break;
+			}
+		}
+		last_line = line;
+		p.line = first_line + line + 1;
+		p.col = offset - line_starts[line] + 1 + ((line == 0) ? first_col : 0);
+		return p;
+	}
+private:
 	/**
-	 * The type for cached entries.  The cache contains the position after
-	 * parsing a rule and the list of rules that were matched.
+	 * Records the starts of all of the lines up to and including the one
+	 * containing `offset`.
 	 */
-	typedef std::pair<ParserPosition, std::vector<ParseMatch>> CacheEntry;
-	/*
-	 * The cache.  After each rule is parsed, we cache the result to avoid
-	 * recomputing.  Note that we currently do not cache parse failures.
-	 */
-	std::unordered_map<CacheKey, CacheEntry, CacheKeyHash> cache;
+	void scan_to(Input::Index offset)
+	{
+		std::uint32_t ends = line_end_controls.load(std::memory_order_relaxed);
+		if (ends != 0)
+		{
+			// Other line ends are rare, so check every character for them
+			// rather than searching in blocks.
+			Input::Index size = input->end().index();
+			for ( ; (scanned <= offset) && (scanned < size) ; scanned++)
+			{
+				char32_t c = (*input)[scanned];
+				if ((c == '\n') ||
+				    ((c < 32) && ((ends >> c) & 1) &&
+				     !((c == '\r') && (scanned + 1 < size) &&
+				       ((*input)[scanned + 1] == '\n'))))
+				{
+					line_starts.push_back(scanned + 1);
+				}
+			}
+			scanned = std::max(scanned, offset + 1);
+			return;
+		}
+		while (scanned <= offset)
+		{
+			Input::Index nl = input->find_newline(scanned, offset + 1);
+			if (nl > offset)
+			{
+				scanned = offset + 1;
+				break;
+			}
+			line_starts.push_back(nl + 1);
+			scanned = nl + 1;
+		}
+	}
 };
 
-}
-
-namespace{
-
 /**
- * Set expression: matches characters in a set.
+ * The log of rules that have been matched, in the order in which their parse
+ * procedures will run.  The log is stored as parallel arrays, one for each
+ * field, rather than as an array of `InputRange`s, which would repeat the
+ * input pointer in every position.  The range for each match is only
+ * constructed when its parse procedure is invoked.
  */
-class SetExpr : public Expr
+class MatchLog
 {
+	/**
+	 * The index (see `Rule::index()`) of each matched rule.
+	 */
+	std::vector<std::uint32_t, StatsAllocator<std::uint32_t>> rules;
+	/**
+	 * The offset in the input of the start of each match.
+	 */
+	std::vector<Input::Index, StatsAllocator<Input::Index>> starts;
+	/**
+	 * The offset in the input of the end of each match.
+	 */
+	std::vector<Input::Index, StatsAllocator<Input::Index>> ends;
+	/**
+	 * For a log whose matches may be reused after the input is edited, the
+	 * number of matches recorded while matching each one, which are the
+	 * matches immediately before it.  Empty for other logs.
+	 */
+	std::vector<std::uint32_t, StatsAllocator<std::uint32_t>> spans;
+	/**
+	 * For a log whose matches may be reused, the number of characters,
+	 * from the start of each match, that were examined to make it.  This
+	 * includes lookahead past the end of the match, and is one more than the
+	 * number of characters remaining if the end of the input was examined.
+	 */
+	std::vector<Input::Index, StatsAllocator<Input::Index>> examined;
+	/**
+	 * For a log whose matches may be reused, the number of characters, from
+	 * the start of each match, to the furthest position at which matching
+	 * failed while making it, which is where an error would be reported.
+	 */
+	std::vector<Input::Index, StatsAllocator<Input::Index>> errors;
+	/**
+	 * The number of matches that have been discarded from the start of the
+	 * log.  Matches keep their indexes when earlier ones are discarded.
+	 */
+	std::size_t base = 0;
+	/**
+	 * Whether `spans`, `examined` and `errors` are kept.
+	 */
+	bool reusable = false;
 public:
-	//constructor from ansi string.
-	SetExpr(const char *s)
+	/**
+	 * Constructs an empty log, recording its memory use in the `category`
+	 * of `s`.
+	 */
+	MatchLog(ParseStats &s, AllocationStats &category) :
+		rules(StatsAllocator<std::uint32_t>(&s, &category)),
+		starts(StatsAllocator<Input::Index>(&s, &category)),
+		ends(StatsAllocator<Input::Index>(&s, &category)),
+		spans(StatsAllocator<std::uint32_t>(&s, &category)),
+		examined(StatsAllocator<Input::Index>(&s, &category)),
+		errors(StatsAllocator<Input::Index>(&s, &category)) {}
+	/**
+	 * Sets whether the log keeps what is needed to reuse its matches after
+	 * the input is edited.  This must be set while the log is empty.
+	 */
+	void set_reusable(bool r)
 	{
-		for(; *s; ++s)
-		{
-			_add(static_cast<char32_t>(*s));
-		}
+		assert(rules.empty());
+		reusable = r;
 	}
-
-	//constructor from range.
-	SetExpr(char32_t min, char32_t max)
+	/**
+	 * Returns the number of matches, including any that have been discarded.
+	 */
+	std::size_t size() const { return base + rules.size(); }
+	/**
+	 * Returns the index of the first match that has not been discarded.
+	 */
+	std::size_t first() const { return base; }
+	/**
+	 * Records a match of the rule with index `rule` between the offsets `b`
+	 * and `e` in the input.
+	 */
+	void push_back(std::size_t rule, Input::Index b, Input::Index e)
 	{
-		assert(min >= 0);
-		assert(min <= max);
-		mSetExpr.resize(static_cast<size_t>(max) + 1U);
-		for(; min <= max; ++min)
+		rules.push_back(static_cast<std::uint32_t>(rule));
+		starts.push_back(b);
+		ends.push_back(e);
+		if (reusable)
 		{
-			mSetExpr[static_cast<size_t>(min)] = true;
+			spans.push_back(0);
+			examined.push_back(e - b);
+			errors.push_back(0);
 		}
 	}
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
-	{
-		return _parse(con);
+	/**
+	 * Records, for the last match, that the `span` matches before it were
+	 * recorded while matching it, that `length` characters from its start
+	 * were examined, and that the furthest failure was `error` characters
+	 * from its start.
+	 */
+	void set_last_reuse(std::size_t span, Input::Index length,
+	                    Input::Index error)
+	{
+		assert(reusable);
+		spans.back() = static_cast<std::uint32_t>(span);
+		examined.back() = length;
+		errors.back() = error;
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+	/**
+	 * Appends `count` matches, starting from `first`, from another log.
+	 */
+	void append(const MatchLog &other, std::size_t first, std::size_t count)
 	{
-		return _parse(con);
+		first -= other.base;
+		append(rules, other.rules, first, count);
+		append(starts, other.starts, first, count);
+		append(ends, other.ends, first, count);
+		if (reusable)
+		{
+			assert(other.reusable);
+			append(spans, other.spans, first, count);
+			append(examined, other.examined, first, count);
+			append(errors, other.errors, first, count);
+		}
 	}
-
-	virtual void dump() const
+	/**
+	 * Appends `count` matches, starting from `first`, from another log,
+	 * moving them `shift` characters later in the input.
+	 */
+	void append_shifted(const MatchLog &other, std::size_t first,
+	                    std::size_t count, std::ptrdiff_t shift)
 	{
-		fprintf(stderr, "[");
-		char c = 0;
-		for (bool v : mSetExpr)
+		std::size_t old_size = rules.size();
+		append(other, first, count);
+		for (std::size_t i=old_size ; i<rules.size() ; i++)
 		{
-			if (v)
-				fprintf(stderr, "%c", c);
-			c++;
+			starts[i] = static_cast<Input::Index>(static_cast<std::ptrdiff_t>(starts[i]) + shift);
+			ends[i] = static_cast<Input::Index>(static_cast<std::ptrdiff_t>(ends[i]) + shift);
 		}
-		fprintf(stderr, "]");
 	}
-
-private:
-	//set is kept as an array of flags, for quick access
-	std::vector<bool> mSetExpr;
-
-	//add character
-	void _add(char32_t i)
+	/**
+	 * Discards all matches after the first `n`.
+	 */
+	void truncate(std::size_t n)
 	{
-		if (i >= mSetExpr.size())
+		assert(n >= base);
+		n -= base;
+		rules.resize(n);
+		starts.resize(n);
+		ends.resize(n);
+		if (reusable)
 		{
-			mSetExpr.resize(i + 1);
+			spans.resize(n);
+			examined.resize(n);
+			errors.resize(n);
 		}
-		mSetExpr[i] = true;
 	}
-
-	//internal parse
-	bool _parse(Context &con) const
+	/**
+	 * Discards the matches before the `n`th.
+	 */
+	void discard(std::size_t n)
 	{
-		if (!con.end())
+		assert((n >= base) && (n <= size()));
+		discard(rules, n - base);
+		discard(starts, n - base);
+		discard(ends, n - base);
+		if (reusable)
 		{
-			size_t ch = con.symbol();
-			if (ch < mSetExpr.size() && mSetExpr[ch])
-			{
-				con.next_col();
-				return true;
-			}
+			discard(spans, n - base);
+			discard(examined, n - base);
+			discard(errors, n - base);
 		}
-		con.set_error_pos();
-		return false;
+		base = n;
+	}
+	/**
+	 * Discards all matches, keeping the memory allocated for them.
+	 */
+	void clear()
+	{
+		truncate(base);
+		base = 0;
+	}
+	/**
+	 * Discards all matches and frees the memory allocated for them.
+	 */
+	void release()
+	{
+		release(rules);
+		release(starts);
+		release(ends);
+		release(spans);
+		release(examined);
+		release(errors);
+		base = 0;
+	}
+	/**
+	 * Returns the index of the rule for match `i`.
+	 */
+	std::size_t rule(std::size_t i) const { return rules[i - base]; }
+	/**
+	 * Returns the offset in the input of the start of match `i`.
+	 */
+	Input::Index start(std::size_t i) const { return starts[i - base]; }
+	/**
+	 * Returns the offset in the input of the end of match `i`.
+	 */
+	Input::Index end(std::size_t i) const { return ends[i - base]; }
+	/**
+	 * Returns the number of matches recorded while matching match `i`, in a
+	 * reusable log.
+	 */
+	std::size_t span(std::size_t i) const { return spans[i - base]; }
+	/**
+	 * Returns the number of characters examined to make match `i`, in a
+	 * reusable log.
+	 */
+	Input::Index examined_length(std::size_t i) const { return examined[i - base]; }
+	/**
+	 * Returns the number of characters from the start of match `i` to the
+	 * furthest failure while making it, in a reusable log.
+	 */
+	Input::Index error_length(std::size_t i) const { return errors[i - base]; }
+	/**
+	 * Exchanges the contents of this log with `other`, which must record
+	 * its memory use in the same place.
+	 */
+	void swap(MatchLog &other)
+	{
+		rules.swap(other.rules);
+		starts.swap(other.starts);
+		ends.swap(other.ends);
+		spans.swap(other.spans);
+		examined.swap(other.examined);
+		errors.swap(other.errors);
+		std::swap(base, other.base);
+		std::swap(reusable, other.reusable);
+	}
+	/**
+	 * Returns the range of the input for match `i`, where `begin` refers to
+	 * the start of the input.  The line and column numbers are found in
+	 * `lines`.
+	 */
+	InputRange range(std::size_t i, const Input::iterator &begin,
+	                 LineIndex &lines) const
+	{
+		Input::iterator b = begin;
+		Input::iterator e = begin;
+		b += starts[i - base];
+		e += ends[i - base];
+		return InputRange(lines.locate(b), lines.locate(e));
+	}
+private:
+	/**
+	 * Appends `count` elements of `from`, starting at `first`, to `to`.
+	 */
+	template<class Vector>
+	static void append(Vector &to, const Vector &from, std::size_t first,
+	                   std::size_t count)
+	{
+		auto begin = from.begin() +
+			static_cast<typename Vector::difference_type>(first);
+		to.insert(to.end(), begin,
+			begin + static_cast<typename Vector::difference_type>(count));
+	}
+	/**
+	 * Removes the first `n` elements of `v`.
+	 */
+	template<class Vector>
+	static void discard(Vector &v, std::size_t n)
+	{
+		v.erase(v.begin(), v.begin() + static_cast<typename Vector::difference_type>(n));
+	}
+	/**
+	 * Empties `v` and frees its memory.
+	 */
+	template<class Vector>
+	static void release(Vector &v)
+	{
+		Vector(v.get_allocator()).swap(v);
 	}
 };
 
 /**
- * Adaptor that modifies the type of the iterator.  This lets us use iterators
- * with things that expect char or whcar_t iterators (as long as casts work
- * appropriately).
+ * The memoisation cache.  After each rule is parsed, we cache the result to
+ * avoid recomputing.  Note that we currently do not cache parse failures.
+ *
+ * The cache is an open-addressed hash table with a fixed number of slots, and
+ * the matches recorded by all of the entries are copied into a single vector.
+ * Entries are invalidated by advancing a generation counter, so emptying the
+ * cache takes constant time and keeps its memory for reuse.
  */
-template<typename Src, typename Out, typename In>
-class IteratorAdaptor : public std::iterator<std::bidirectional_iterator_tag, Out>
+class MatchCache
 {
-		Src s;
-		public:
-		inline IteratorAdaptor(Src src) : s(src) {}
-		inline IteratorAdaptor() {}
-		inline Out operator*() const { return static_cast<Out>(*s); }
-		inline IteratorAdaptor &operator++()
-		{
-			++s;
-			return *this;
-		}
-		inline IteratorAdaptor<Src, Out,In> operator++(int /*dummy*/)
+public:
+	/**
+	 * A cache entry.
+	 */
+	struct Entry
+	{
+		/**
+		 * The rule for which this cache entry applies.
+		 */
+		const Rule *rule;
+		/**
+		 * The index in the input at which the rule was matched.
+		 */
+		Input::Index start;
+		/**
+		 * The generation in which this entry was written.  Entries from
+		 * earlier generations are empty.
+		 */
+		unsigned generation = 0;
+		/**
+		 * The position after parsing the rule.
+		 */
+		Input::iterator end;
+		/**
+		 * The index in `matches` of the first match recorded by the rule.
+		 */
+		std::size_t first_match;
+		/**
+		 * The number of matches recorded by the rule.
+		 */
+		std::size_t match_count;
+		/**
+		 * The offset of the end of the input examined to match the rule,
+		 * when the context is recording this.
+		 */
+		Input::Index examined;
+	};
+	/**
+	 * Constructs an empty cache, recording its memory use in `s`.
+	 */
+	MatchCache(ParseStats &s) :
+		slots(StatsAllocator<Entry>(&s, &s.cache)),
+		matches(s, s.cache) {}
+	/**
+	 * Returns the entry for rule `r` at index `start`, or null if there is
+	 * none.
+	 */
+	const Entry *find(const Rule *r, Input::Index start) const
+	{
+		if (slots.empty())
 		{
-			auto copy = *this;
-			s++;
-			return copy;
+			return nullptr;
 		}
-		inline IteratorAdaptor<Src, Out,In> &operator--()
+		const Entry &e = slots[slot_for(r, start)];
+		return (e.generation == generation) ? &e : nullptr;
+	}
+	/**
+	 * Appends the matches recorded by the entry `e` to `out`.
+	 */
+	void append_matches(const Entry &e, MatchLog &out) const
+	{
+		out.append(matches, e.first_match, e.match_count);
+	}
+	/**
+	 * Sets whether the matches held by the cache keep what is needed to
+	 * reuse them after the input is edited.  This must be set while the
+	 * cache is empty.
+	 */
+	void set_reusable(bool r)
+	{
+		matches.set_reusable(r);
+	}
+	/**
+	 * Records that rule `r`, matched at index `start`, finished at `end`
+	 * after examining the input up to `examined`, and recorded the matches
+	 * in `log` from `first` onwards.
+	 */
+	void insert(const Rule *r, Input::Index start, const Input::iterator &end,
+	            Input::Index examined, const MatchLog &log, std::size_t first)
+	{
+		// To prevent the cache growing too large, if it starts to get quite
+		// big, delete everything.  256 is a mostly arbitrary number generated
+		// by running a big(ish) parse with a few different values and finding
+		// the place where the increase in memory didn't come with a noticeable
+		// speedup.
+		if (entries > 256)
 		{
-			--s;
-			return *this;
+			clear();
 		}
-		inline bool operator==(const IteratorAdaptor<Src, Out,In> &other) const
+		if (slots.empty())
 		{
-			return s == other.s;
+			slots.resize(slot_count);
 		}
-		inline bool operator!=(const IteratorAdaptor<Src, Out,In> &other) const
+		Entry &e = slots[slot_for(r, start)];
+		if (e.generation != generation)
 		{
-			return s != other.s;
+			entries++;
 		}
-		inline bool operator>(const IteratorAdaptor<Src, Out,In> &other) const
+		e.rule = r;
+		e.start = start;
+		e.generation = generation;
+		e.end = end;
+		e.examined = examined;
+		e.first_match = matches.size();
+		e.match_count = log.size() - first;
+		matches.append(log, first, e.match_count);
+	}
+	/**
+	 * Removes all entries and frees the memory allocated for them.
+	 */
+	void release()
+	{
+		clear();
+		std::vector<Entry, StatsAllocator<Entry>>(slots.get_allocator()).swap(slots);
+		matches.release();
+	}
+	/**
+	 * Removes all entries, keeping the memory allocated for them.
+	 */
+	void clear()
+	{
+		entries = 0;
+		matches.clear();
+		if (++generation == 0)
 		{
-			return s > other.s;
+			for (auto &e : slots)
+			{
+				e.generation = 0;
+			}
+			generation = 1;
 		}
-		inline bool operator<(const IteratorAdaptor<Src, Out,In> &other) const
+	}
+private:
+	/**
+	 * The number of slots.  This must be a power of two, and is large enough
+	 * that the table is never more than about half full.
+	 */
+	static const std::size_t slot_count = 512;
+	/**
+	 * The slots in the hash table.
+	 */
+	std::vector<Entry, StatsAllocator<Entry>> slots;
+	/**
+	 * The matches recorded by all of the entries.
+	 */
+	MatchLog matches;
+	/**
+	 * The current generation.  Only slots written in this generation hold
+	 * entries.
+	 */
+	unsigned generation = 1;
+	/**
+	 * The number of entries in the current generation.
+	 */
+	std::size_t entries = 0;
+	/**
+	 * Returns the index of the slot holding the entry for rule `r` at index
+	 * `start`, or of the empty slot where it should be inserted.  Note that
+	 * performance of the parser is *highly* dependent on the quality of the
+	 * hash function.
+	 */
+	std::size_t slot_for(const Rule *r, Input::Index start) const
+	{
+		std::uint64_t h = reinterpret_cast<std::uintptr_t>(r) ^
+		                  (static_cast<std::uint64_t>(start) * 0x9e3779b97f4a7c15ULL);
+		h ^= h >> 32;
+		h *= 0xd6e8feb86659fd93ULL;
+		h ^= h >> 32;
+		for (std::size_t i=static_cast<std::size_t>(h) ;; i++)
 		{
-			return s < other.s;
+			const Entry &e = slots[i & (slot_count - 1)];
+			if ((e.generation != generation) ||
+			    ((e.rule == r) && (e.start == start)))
+			{
+				return i & (slot_count - 1);
+			}
 		}
+	}
 };
 
 /**
- * Preform a regular expression match, starting at `begin` and trying to match
- * up to `end`.  Returns true if the regular expression matches the input,
- * false otherwise.  If there is a match, then `length` will be set to the
- * length of the match.
+ * The table of handlers for each rule, indexed by `Rule::index()`.  Each
+ * rule's handler is looked up in the delegate the first time that the rule is
+ * encountered during a parse, and later lookups index the table.  Like the
+ * cache, entries are invalidated by advancing a generation counter, so that
+ * the table can be reused for the next parse without being emptied.
  */
-template <typename T>
-bool regexMatch(Input::iterator begin,
-                Input::iterator end,
-                const std::basic_regex<T> &r,
-                size_t &length)
+class HandlerTable
 {
-	typedef IteratorAdaptor<Input::iterator, T, char32_t> Iterator;
-	std::match_results<Iterator> match;
-	Iterator b(begin), e(end);
-	if (std::regex_search(b, e, match, r, std::regex_constants::match_continuous))
+	/**
+	 * An entry in the table.
+	 */
+	struct Entry
 	{
-		length = static_cast<size_t>(match.length());
-		return true;
-	}
-	return false;
-}
-
-/**
- * Matches characters that correspond to a given regular expression.
- */
-template<typename CharTy>
-class RegexExpr : public Expr
-{
-	std::basic_regex<CharTy> r;
-	bool parse(Context &con) const
+		/**
+		 * The generation in which this entry was resolved.  Entries from
+		 * earlier generations have not yet been resolved.
+		 */
+		unsigned generation = 0;
+		/**
+		 * The handler, or null if the rule has none.  This points either into
+		 * the delegate or to `local`.
+		 */
+		const parse_proc *proc = nullptr;
+		/**
+		 * The handler, if the delegate copied it here.
+		 */
+		parse_proc local;
+	};
+	/**
+	 * The entries, one per rule index.
+	 */
+	std::vector<Entry, StatsAllocator<Entry>> entries;
+	/**
+	 * Entries that were replaced when the table grew during a parse.  A
+	 * pipelined parse hands pointers to handlers to another thread, so the
+	 * handlers that they point to are kept until the next parse.
+	 */
+	std::vector<std::vector<Entry, StatsAllocator<Entry>>> retired;
+	/**
+	 * The delegate for the current parse.
+	 */
+	const ParserDelegate *delegate = nullptr;
+	/**
+	 * The current generation.
+	 */
+	unsigned generation = 1;
+public:
+	/**
+	 * Constructs an empty table, recording its memory use in `s`.
+	 */
+	HandlerTable(ParseStats &s) :
+		entries(StatsAllocator<Entry>(&s, &s.rule_states)) {}
+	/**
+	 * Prepares the table for a parse using the delegate `d`.
+	 */
+	void reset(const ParserDelegate &d)
 	{
-		size_t length;
-		if (regexMatch(con.position.it, con.finish, r, length))
+		delegate = &d;
+		retired.clear();
+		if (++generation == 0)
 		{
-			con.consume(length);
-			return true;
+			for (auto &e : entries)
+			{
+				e.generation = 0;
+			}
+			generation = 1;
+		}
+		if (entries.size() < Rule::index_limit())
+		{
+			entries.resize(Rule::index_limit());
 		}
-		con.set_error_pos();
-		return false;
 	}
-public:
-	RegexExpr(const CharTy *s) : r(s, std::regex_constants::optimize) {}
-	RegexExpr(const CharTy *s, size_t count) : r(s, count, std::regex_constants::optimize) {}
-
-	virtual bool parse_non_term(Context &con) const
+	/**
+	 * Returns the handler for rule `r`, or null if it has none.  The pointer
+	 * is valid until the next call to `find()` or `reset()`.
+	 */
+	const parse_proc *find(const Rule &r)
 	{
-		return parse(con);
+		std::size_t i = r.index();
+		if (i >= entries.size())
+		{
+			// Only rules created during the parse can get here.
+			resize(i + 1);
+		}
+		Entry &e = entries[i];
+		if (e.generation != generation)
+		{
+			e.generation = generation;
+			e.local = nullptr;
+			e.proc = delegate->find_parse_proc(r, e.local);
+		}
+		return e.proc;
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
-	{
-		return parse(con);
-	}
-
-	virtual void dump() const
-	{
-		fprintf(stderr, "<regex>");
-	}
-};
-
-
-//base class for unary expressions
-class UnaryExpr : public Expr
-{
-public:
-	UnaryExpr(const ExprPtr e) : expr(e) { }
-protected:
-	const ExprPtr expr;
-};
-
-
-//terminal
-class TerminalExpr : public UnaryExpr
-{
-public:
-	//constructor.
-	TerminalExpr(const ExprPtr e) :
-		UnaryExpr(e)
-	{
-	}
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	/**
+	 * Copies the handlers that `other` has found in its current parse, and
+	 * that this table has not, so that the matches recorded with `other`
+	 * can be run with this table.
+	 */
+	void adopt(const HandlerTable &other)
 	{
-		return expr->parse_term(con);
+		if (entries.size() < other.entries.size())
+		{
+			resize(other.entries.size());
+		}
+		for (std::size_t i=0 ; i<other.entries.size() ; i++)
+		{
+			const Entry &from = other.entries[i];
+			Entry &e = entries[i];
+			if ((from.generation != other.generation) ||
+			    (e.generation == generation))
+			{
+				continue;
+			}
+			e.generation = generation;
+			e.local = from.local;
+			e.proc = (from.proc == std::addressof(from.local)) ?
+				std::addressof(e.local) : from.proc;
+		}
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+	/**
+	 * Returns the handler for the rule with index `i`, which must already
+	 * have been found in this parse.
+	 */
+	const parse_proc *get(std::size_t i) const
 	{
-		return expr->parse_term(con);
+		return entries[i].proc;
 	}
-
-	virtual void dump() const
+private:
+	/**
+	 * Grows the table to `size` entries.  The old entries are retired rather
+	 * than moved, so the pointers to the handlers that they hold remain
+	 * valid.
+	 */
+	void resize(std::size_t size)
 	{
-		expr->dump();
+		std::vector<Entry, StatsAllocator<Entry>> grown(size, Entry(),
+		                                               entries.get_allocator());
+		for (std::size_t i=0 ; i<entries.size() ; i++)
+		{
+			grown[i].generation = entries[i].generation;
+			grown[i].proc = entries[i].proc;
+		}
+		retired.push_back(std::move(entries));
+		entries = std::move(grown);
 	}
-
 };
 
-
-//loop 0
-class Loop0Expr : public UnaryExpr
+/**
+ * The matches of an `IncrementalParser`'s last parse, indexed so that the
+ * next parse can reuse them.  The text is edited after the parse, so the
+ * table also keeps the parts of the current text that are unchanged copies
+ * of the parsed text.  A match can be reused if all of the input that was
+ * examined to make it lies within one of these parts, and it is moved by
+ * the distance that the part has moved.  A match is reused together with
+ * the matches recorded while matching it, which are the matches immediately
+ * before it.
+ */
+class ReuseTable
 {
+	/**
+	 * A part of the current text that is an unchanged copy of the parsed
+	 * text.  The end of each text is treated as one more character, so that
+	 * a match that examined the end of the input can only be reused while
+	 * nothing has been added after it.
+	 */
+	struct Part
+	{
+		/**
+		 * The offset of the part in the current text.
+		 */
+		Input::Index offset;
+		/**
+		 * The offset of the part in the parsed text.
+		 */
+		Input::Index parsed_offset;
+		/**
+		 * The number of characters in the part.
+		 */
+		Input::Index length;
+	};
+	/**
+	 * The matches, at their positions in the parsed text.
+	 */
+	MatchLog matches;
+	/**
+	 * For each offset in the parsed text, one more than the index of the
+	 * last match that starts there, or zero if none does.
+	 */
+	std::vector<std::uint32_t, StatsAllocator<std::uint32_t>> heads;
+	/**
+	 * For each match, one more than the index of the previous match that
+	 * starts at the same offset, or zero if there is none.
+	 */
+	std::vector<std::uint32_t, StatsAllocator<std::uint32_t>> next;
+	/**
+	 * The unchanged parts of the current text, in order.
+	 */
+	std::vector<Part> parts;
 public:
-	//constructor.
-	Loop0Expr(const ExprPtr e) :
-		UnaryExpr(e)
+	/**
+	 * Constructs an empty table, recording its memory use in `s`.
+	 */
+	ReuseTable(ParseStats &s) :
+		matches(s, s.matches),
+		heads(StatsAllocator<std::uint32_t>(&s, &s.cache)),
+		next(StatsAllocator<std::uint32_t>(&s, &s.cache))
 	{
+		matches.set_reusable(true);
 	}
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	/**
+	 * Forgets all of the matches.
+	 */
+	void clear()
 	{
-		//if parsing of the first fails, restore the context and stop
-		con.parse_ws();
-		ParsingState st(con);
-		if (!expr->parse_non_term(con))
-		{
-			con.restore(st);
-			return true;
-		}
-
-		//parse the rest
-		for(;;)
+		matches.clear();
+		heads.clear();
+		next.clear();
+		parts.clear();
+	}
+	/**
+	 * Replaces the matches with those in `log`, from a parse of a text of
+	 * `size` characters.  The log must be reusable and record its memory use
+	 * in the same place, and is left empty.
+	 */
+	void keep(MatchLog &log, Input::Index size)
+	{
+		assert(log.first() == 0);
+		matches.swap(log);
+		log.clear();
+		heads.assign(size + 1, 0);
+		next.resize(matches.size());
+		for (std::size_t i=0 ; i<matches.size() ; i++)
 		{
-			con.parse_ws();
-			ParsingState s(con);
-			if (!expr->parse_non_term(con))
-			{
-				con.restore(s);
-				break;
-			}
+			std::uint32_t &head = heads[matches.start(i)];
+			next[i] = head;
+			head = static_cast<std::uint32_t>(i + 1);
 		}
-
-		return true;
+		parts.assign(1, Part{ 0, 0, size + 1 });
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+	/**
+	 * Records that `removed` characters at `offset` in the current text have
+	 * been replaced by `inserted` characters.
+	 */
+	void edit(Input::Index offset, Input::Index removed, Input::Index inserted)
 	{
-		//if parsing of the first fails, restore the context and stop
-		ParsingState st(con);
-		if (!expr->parse_term(con))
+		if ((removed == 0) && (inserted == 0))
 		{
-			con.restore(st);
-			return true;
+			return;
 		}
-
-		//parse the rest until no more parsing is possible
-		for(;;)
+		std::vector<Part> edited;
+		Input::Index end = offset + removed;
+		for (const Part &p : parts)
 		{
-			ParsingState s(con);
-			if (!expr->parse_term(con))
+			Input::Index p_end = p.offset + p.length;
+			// The part before the edit.
+			if (p.offset < offset)
 			{
-				con.restore(s);
-				break;
+				edited.push_back(Part{ p.offset, p.parsed_offset,
+				                       std::min(p_end, offset) - p.offset });
 			}
-		}
-
-		return true;
-	}
-	virtual void dump() const
-	{
-		fprintf(stderr, "*( ");
-		expr->dump();
-		fprintf(stderr, " )");
-	}
-};
-
-
-//loop 1
-class Loop1Expr : public UnaryExpr
-{
-public:
-	Loop1Expr(const ExprPtr e) : UnaryExpr(e) { }
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
-	{
-		//parse the first; if the first fails, stop
-		con.parse_ws();
-		if (!expr->parse_non_term(con)) return false;
-
-		//parse the rest until no more parsing is possible
-		for(;;)
-		{
-			con.parse_ws();
-			ParsingState st(con);
-			if (!expr->parse_non_term(con))
+			// The part after the edit, which moves.
+			if (p_end > end)
 			{
-				con.restore(st);
-				break;
+				Input::Index from = std::max(p.offset, end);
+				edited.push_back(Part{ from - removed + inserted,
+				                       p.parsed_offset + (from - p.offset),
+				                       p_end - from });
 			}
 		}
-
-		return true;
+		parts.swap(edited);
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+	/**
+	 * Finds a match of the rule with index `rule` that can be reused at
+	 * offset `start` in the current text, setting `i` to its index and
+	 * `shift` to the distance that it has moved.
+	 */
+	bool find(std::size_t rule, Input::Index start, std::size_t &i,
+	          std::ptrdiff_t &shift) const
 	{
-		//parse the first; if the first fails, stop
-		if (!expr->parse_term(con)) return false;
-
-		//parse the rest until no more parsing is possible
-		for(;;)
+		auto part = std::upper_bound(parts.begin(), parts.end(), start,
+			[](Input::Index s, const Part &p) { return s < p.offset; });
+		if (part == parts.begin())
+		{
+			return false;
+		}
+		--part;
+		Input::Index offset = start - part->offset;
+		if (offset >= part->length)
+		{
+			return false;
+		}
+		Input::Index parsed_start = part->parsed_offset + offset;
+		for (std::uint32_t j=heads[parsed_start] ; j!=0 ; j=next[j - 1])
 		{
-			ParsingState st(con);
-			if (!expr->parse_term(con))
+			if (matches.rule(j - 1) == rule)
 			{
-				con.restore(st);
-				break;
+				if (offset + matches.examined_length(j - 1) > part->length)
+				{
+					return false;
+				}
+				i = j - 1;
+				shift = static_cast<std::ptrdiff_t>(part->offset) -
+				        static_cast<std::ptrdiff_t>(part->parsed_offset);
+				return true;
 			}
 		}
-
-		return true;
+		return false;
 	}
-
-	virtual void dump() const
+	/**
+	 * Appends match `i`, after the matches recorded while matching it, to
+	 * `log`, moved by `shift`.  Returns the number of matches appended.
+	 */
+	std::size_t append(std::size_t i, std::ptrdiff_t shift, MatchLog &log) const
 	{
-		fprintf(stderr, "+( ");
-		expr->dump();
-		fprintf(stderr, " )");
+		std::size_t span = matches.span(i);
+		log.append_shifted(matches, i - span, span + 1, shift);
+		return span + 1;
 	}
-};
-
-
-//optional
-class OptionalExpr : public UnaryExpr
-{
-public:
-	OptionalExpr(const ExprPtr e) : UnaryExpr(e) { }
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	/**
+	 * Returns the offset in the parsed text of the end of match `i`.
+	 */
+	Input::Index end(std::size_t i) const
 	{
-		ParsingState st(con);
-		if (!expr->parse_non_term(con)) con.restore(st);
-		return true;
+		return matches.end(i);
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+	/**
+	 * Returns the offset in the parsed text of the end of the input examined
+	 * to make match `i`.
+	 */
+	Input::Index examined_end(std::size_t i) const
 	{
-		ParsingState st(con);
-		if (!expr->parse_term(con)) con.restore(st);
-		return true;
+		return matches.start(i) + matches.examined_length(i);
 	}
-
-	virtual void dump() const
+	/**
+	 * Returns the offset in the parsed text of the furthest failure while
+	 * making match `i`.
+	 */
+	Input::Index error_end(std::size_t i) const
 	{
-		fprintf(stderr, "-( ");
-		expr->dump();
-		fprintf(stderr, " )");
+		return matches.start(i) + matches.error_length(i);
 	}
 };
 
-
-//and
-//FIXME: What is this?  Parses the subexpression but resets the state
-//independent of success or failure?
-//THIS IS WHY COMMENTS MATTER!
-class AndExpr : public UnaryExpr
+/**
+ * The data structures that a parse builds up.  These are kept separately from
+ * the `Context`, so that a `ParseSession` can reuse them (and their memory)
+ * for many parses.
+ */
+struct ContextState
 {
-public:
-	AndExpr(const ExprPtr e) : UnaryExpr(e) { }
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	/**
+	 * The rules matched so far.
+	 */
+	MatchLog matches;
+	/**
+	 * The per-rule state used to detect left recursion.  Each rule's stack is
+	 * empty between parses, so this does not need to be emptied.
+	 */
+	RuleStateMap rule_states;
+	/**
+	 * The cache of successful matches.
+	 */
+	MatchCache cache;
+	/**
+	 * The handler for each rule.
+	 */
+	HandlerTable handlers;
+	/**
+	 * The line starts found in the input.
+	 */
+	LineIndex lines;
+	/**
+	 * Constructs the structures, recording their memory use in `s`.
+	 */
+	ContextState(ParseStats &s) :
+		matches(s, s.matches),
+		rule_states(0, RuleStateMap::hasher(), RuleStateMap::key_equal(),
+		            RuleStateMap::allocator_type(&s, &s.rule_states)),
+		cache(s),
+		handlers(s),
+		lines(s) {}
+	/**
+	 * Empties the structures for a new parse, keeping their memory.
+	 */
+	void reset()
 	{
-		ParsingState st(con);
-		bool ok = expr->parse_non_term(con);
-		con.restore(st);
-		return ok;
+		matches.clear();
+		cache.clear();
 	}
+};
 
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+/**
+ * The worker thread that runs the parse procedures for a pipelined parse.
+ * The parsing thread hands committed matches to the worker in batches,
+ * through a ring of batches with one writer and one reader: the parsing
+ * thread fills the batch at `tail` and then advances it, and the worker runs
+ * the batch at `head` and then advances that.  Each index is written by only
+ * one thread, so no locks are needed.  The batches are reused, so once they
+ * have grown to their working size, handing over matches does not allocate.
+ */
+class ProcPipeline
+{
+	/**
+	 * A batch of matches.  The handler for each is looked up by the parsing
+	 * thread, which owns the handler table.
+	 */
+	struct Batch
 	{
-		ParsingState st(con);
-		bool ok = expr->parse_term(con);
-		con.restore(st);
-		return ok;
-	}
-
-	virtual void dump() const
+		/**
+		 * The handler for each match.
+		 */
+		std::vector<const parse_proc*, StatsAllocator<const parse_proc*>> procs;
+		/**
+		 * The offset in the input of the start of each match.
+		 */
+		std::vector<Input::Index, StatsAllocator<Input::Index>> starts;
+		/**
+		 * The offset in the input of the end of each match.
+		 */
+		std::vector<Input::Index, StatsAllocator<Input::Index>> ends;
+		/**
+		 * Constructs an empty batch, recording its memory use in `s`.
+		 */
+		Batch(ParseStats &s) :
+			procs(StatsAllocator<const parse_proc*>(&s, &s.matches)),
+			starts(StatsAllocator<Input::Index>(&s, &s.matches)),
+			ends(StatsAllocator<Input::Index>(&s, &s.matches)) {}
+	};
+	/**
+	 * The number of batches in the ring.  When all of them are waiting for
+	 * the worker, the parsing thread waits too, which bounds the memory used
+	 * when the procedures are slower than parsing.
+	 */
+	static const std::size_t slot_count = 8;
+	/**
+	 * The ring of batches.
+	 */
+	std::vector<Batch> slots;
+	/**
+	 * The number of batches that the worker has run.
+	 */
+	std::atomic<std::size_t> head;
+	/**
+	 * The number of batches that the parsing thread has handed over.
+	 */
+	std::atomic<std::size_t> tail;
+	/**
+	 * Set by the parsing thread once it will hand over no more batches.
+	 */
+	std::atomic<bool> closed;
+	/**
+	 * Set by the worker when a parse procedure fails.  The procedures for
+	 * later batches are not run.
+	 */
+	std::atomic<bool> failed;
+	/**
+	 * The exception thrown by a parse procedure on the worker, which is
+	 * rethrown on the parsing thread by `finish()`.  Set before `failed`.
+	 */
+	std::exception_ptr error;
+	/**
+	 * The statistics for the worker's own structures.
+	 */
+	ParseStats worker_stats;
+	/**
+	 * The worker's view of the input.
+	 */
+	InputView view;
+	/**
+	 * The worker's line index, over `view`.
+	 */
+	LineIndex lines;
+	/**
+	 * The argument for the parse procedures.
+	 */
+	void *data;
+	/**
+	 * The time that the worker has spent running parse procedures.
+	 */
+	std::chrono::steady_clock::duration proc_time =
+		std::chrono::steady_clock::duration::zero();
+	/**
+	 * The worker thread.
+	 */
+	std::thread worker;
+public:
+	/**
+	 * The number of matches that are collected before they are handed to the
+	 * worker, so that the cost of handing them over is spread over many
+	 * procedures.
+	 */
+	static const std::size_t batch_size = 1024;
+	/**
+	 * Starts a worker that runs parse procedures for matches in the input `i`
+	 * with the argument `d`.  The batches record their memory use in `s`.
+	 */
+	ProcPipeline(Input &i, ParseStats &s, void *d) :
+		head(0), tail(0), closed(false), failed(false), view(i),
+		lines(worker_stats), data(d)
 	{
-		fprintf(stderr, "&( ");
-		expr->dump();
-		fprintf(stderr, " )");
+		slots.reserve(slot_count);
+		for (std::size_t n=0 ; n<slot_count ; n++)
+		{
+			slots.emplace_back(s);
+		}
+		lines.reset(view);
+		worker = std::thread([this]() { run(); });
 	}
-};
-
-
-//not
-class NotExpr : public UnaryExpr
-{
-public:
-	NotExpr(const ExprPtr e) : UnaryExpr(e) { }
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	~ProcPipeline()
 	{
-		ParsingState st(con);
-		bool ok = !expr->parse_non_term(con);
-		con.restore(st);
-		return ok;
+		closed.store(true, std::memory_order_release);
+		if (worker.joinable())
+		{
+			worker.join();
+		}
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+	/**
+	 * Returns true if a parse procedure has failed.
+	 */
+	bool has_failed() const
 	{
-		ParsingState st(con);
-		bool ok = !expr->parse_term(con);
-		con.restore(st);
-		return ok;
+		return failed.load(std::memory_order_relaxed);
 	}
-
-	virtual void dump() const
+	/**
+	 * Hands the matches in `m` that have not been discarded to the worker,
+	 * looking up their handlers in `h`.  This waits if the worker is a whole
+	 * ring of batches behind.
+	 */
+	void submit(const MatchLog &m, const HandlerTable &h)
 	{
-		fprintf(stderr, "!( ");
-		expr->dump();
-		fprintf(stderr, " )");
+		std::size_t t = tail.load(std::memory_order_relaxed);
+		unsigned waits = 0;
+		while (t - head.load(std::memory_order_acquire) == slot_count)
+		{
+			wait(waits);
+		}
+		Batch &b = slots[t % slot_count];
+		b.procs.clear();
+		b.starts.clear();
+		b.ends.clear();
+		for (std::size_t i=m.first(), e=m.size() ; i<e ; i++)
+		{
+			const parse_proc *p = h.get(m.rule(i));
+			assert(p && *p);
+			b.procs.push_back(p);
+			b.starts.push_back(m.start(i));
+			b.ends.push_back(m.end(i));
+		}
+		tail.store(t + 1, std::memory_order_release);
 	}
-};
-
-
-//newline
-class NewlineExpr : public UnaryExpr
-{
-public:
-	NewlineExpr(const ExprPtr e) : UnaryExpr(e) { }
-
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	/**
+	 * Waits for the worker to run the procedures for all of the batches that
+	 * have been handed over, and adds its time and memory use to `s`.
+	 * Returns false if any procedure failed, or rethrows the exception if
+	 * one threw.
+	 */
+	bool finish(ParseStats &s)
 	{
-		if (!expr->parse_non_term(con)) return false;
-		con.next_line();
-		return true;
+		closed.store(true, std::memory_order_release);
+		worker.join();
+		lines.release();
+		s.proc_time += proc_time;
+		s.merge(worker_stats);
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+		return !has_failed();
 	}
-
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+private:
+	/**
+	 * Waits for the other thread, where `waits` is the number of times that
+	 * this thread has already waited for the same thing.  A short wait
+	 * yields, but a thread that keeps waiting sleeps, so that it does not
+	 * take time from the other thread if they share a core.
+	 */
+	static void wait(unsigned &waits)
 	{
-		if (!expr->parse_term(con)) return false;
-		con.next_line();
-		return true;
+		if (++waits < 64)
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
 	}
-
-	virtual void dump() const
+	/**
+	 * The body of the worker thread.
+	 */
+	void run()
 	{
-		fprintf(stderr, "nl( ");
-		expr->dump();
-		fprintf(stderr, " )");
+		typedef std::chrono::steady_clock clock;
+		Input::iterator begin = view.begin();
+		std::size_t h = head.load(std::memory_order_relaxed);
+		unsigned waits = 0;
+		for (;;)
+		{
+			if (h == tail.load(std::memory_order_acquire))
+			{
+				if (!closed.load(std::memory_order_acquire))
+				{
+					wait(waits);
+				}
+				else if (h == tail.load(std::memory_order_acquire))
+				{
+					break;
+				}
+				continue;
+			}
+			waits = 0;
+			const Batch &b = slots[h % slot_count];
+			if (!has_failed())
+			{
+				auto batch_start = clock::now();
+				try
+				{
+					for (std::size_t i=0, e=b.procs.size() ; i<e ; i++)
+					{
+						Input::iterator start = begin;
+						Input::iterator end = begin;
+						start += b.starts[i];
+						end += b.ends[i];
+						InputRange r(lines.locate(start), lines.locate(end));
+						if (not (*b.procs[i])(r, data))
+						{
+							failed.store(true, std::memory_order_relaxed);
+							break;
+						}
+					}
+				}
+				catch (...)
+				{
+					// Stop running procedures, as a failing one would, and
+					// hand the exception to the parsing thread.
+					error = std::current_exception();
+					failed.store(true, std::memory_order_relaxed);
+				}
+				proc_time += clock::now() - batch_start;
+			}
+			head.store(++h, std::memory_order_release);
+		}
 	}
 };
+}
 
-
-//base class for binary expressions
-class BinaryExpr : public Expr
+//parsing context
+class Context
 {
 public:
-	BinaryExpr(const ExprPtr &l, const ExprPtr &r) :
-		left(l), right(r) { }
-protected:
-	const ExprPtr left, right;
-};
+	//const Rule that parses whitespace
+	const Rule &whitespace_rule;
 
+	//current position
+	Input::iterator position;
 
-//sequence
-class SequenceExpr : public BinaryExpr
-{
-public:
-	SequenceExpr(const ExprPtr left, const ExprPtr right) : BinaryExpr(left, right) {}
+	//Error position
+	Input::iterator error_pos;
 
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
-	{
-		if (!left->parse_non_term(con)) return false;
-		con.parse_ws();
-		return right->parse_non_term(con);
-	}
+	//input begin
+	Input::iterator start;
 
-	//parse terminal
-	virtual bool parse_term(Context &con) const
-	{
-		if (!left->parse_term(con)) return false;
-		return right->parse_term(con);
-	}
+	//input end
+	Input::iterator finish;
 
-	virtual void dump() const
-	{
-		left->dump();
-		fprintf(stderr, " >> ");
-		right->dump();
-	}
-};
+	/**
+	 * Memory statistics for this parse.
+	 */
+	ParseStats &stats;
 
+	//matches
+	MatchLog &matches;
 
-//choice
-class ChoiceExpr : public BinaryExpr
-{
-public:
-	ChoiceExpr(const ExprPtr &left, const ExprPtr &right) :
-		BinaryExpr(left, right) {}
+	/**
+	 * Depth of parsing.  Used for trace expressions.
+	 */
+	int depth = 0;
 
-	virtual bool parse_non_term(Context &con) const
-	{
-		ParsingState st(con);
-		if (left->parse_non_term(con)) return true;
-		con.restore(st);
-		return right->parse_non_term(con);
-	}
+	/**
+	 * The handlers for the rules, looked up in the delegate.
+	 */
+	HandlerTable &handlers;
 
-	virtual bool parse_term(Context &con) const
-	{
-		ParsingState st(con);
-		if (left->parse_term(con)) return true;
-		con.restore(st);
-		return right->parse_term(con);
-	}
+	/**
+	 * The line starts, used to find line and column numbers.
+	 */
+	LineIndex &lines;
 
-	virtual void dump() const
-	{
-		left->dump();
-		fprintf(stderr, " | ");
-		right->dump();
-	}
-};
+	/**
+	 * Set when only recognising the input.  Rules are matched without
+	 * consulting the delegate or recording matches, and the error position
+	 * is not tracked.
+	 */
+	bool recognizing = false;
 
+	/**
+	 * Set when the parse procedures are run at commit points, rather than
+	 * once the whole input has matched.
+	 */
+	bool incremental = false;
 
-//reference to rule
-class RuleReferenceExpr : public Expr
-{
-public:
-	//constructor.
-	RuleReferenceExpr(const Rule &r) : referenced_rule(r) { }
+	/**
+	 * The argument for the parse procedures, when running them at commit
+	 * points.
+	 */
+	void *proc_data = nullptr;
 
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	/**
+	 * The number of saved parsing states that are live.  While any state is
+	 * live, the parser may backtrack and discard matches, so no matches can
+	 * be committed.
+	 */
+	std::size_t live_states = 0;
+
+	/**
+	 * Set when a parse procedure run at a commit point has failed, which
+	 * stops the parse.
+	 */
+	bool stopped = false;
+
+	/**
+	 * The worker that runs the parse procedures for committed matches, in a
+	 * pipelined parse.
+	 */
+	ProcPipeline *pipeline = nullptr;
+
+	/**
+	 * The delegate that provides the handlers for the rules.
+	 */
+	const ParserDelegate &delegate;
+
+	/**
+	 * For a context that speculatively matches one alternative of a parallel
+	 * choice, a flag that is set once its result is no longer needed.  The
+	 * match then stops at the next check of the limits.
+	 */
+	const std::atomic<bool> *abandoned = nullptr;
+
+	/**
+	 * For the parses of an `IncrementalParser`, the matches of the last
+	 * parse that may be reused.  While this is set, the context records how
+	 * much of the input was examined to make each match.
+	 */
+	const ReuseTable *reuse = nullptr;
+
+	/**
+	 * The offset of the end of the input examined so far while matching the
+	 * current rule, when `reuse` is set.
+	 */
+	Input::Index examined = 0;
+
+	//constructor
+	Context(Input &i, const Rule &ws, const ParserDelegate &d, ParseStats &s,
+	        ContextState &state) :
+		whitespace_rule(ws),
+		position(i.begin()),
+		error_pos(i.begin()),
+		start(i.begin()),
+		finish(i.end()),
+		stats(s),
+		matches(state.matches),
+		handlers(state.handlers),
+		lines(state.lines),
+		delegate(d),
+		rule_states(state.rule_states),
+		cache(state.cache),
+		next_check(s.check_interval)
 	{
-		return con.parse_non_term(referenced_rule);
+		stats.input.current_bytes = Input::window_bytes();
+		stats.input.peak_bytes = Input::window_bytes();
+		handlers.reset(d);
+		lines.reset(i);
 	}
 
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+	//check if the end is reached
+	bool end() const
 	{
-		return con.parse_term(referenced_rule);
+		return position == finish;
 	}
 
-	virtual void dump() const
+	//get the current symbol
+	char32_t symbol() const
 	{
-		fprintf(stderr, "{Reference to rule}");
+		assert(!end());
+		return *position;
+	}
+
+	//set the longest possible error
+	void set_error_pos()
+	{
+		stats.characters_examined++;
+		if (!recognizing && (position > error_pos))
+		{
+			error_pos = position;
+		}
+		examine(position);
+	}
+
+	/**
+	 * Records that the character at `it`, or the end of the input if `it`
+	 * is at the end, has been examined.
+	 */
+	void examine(const Input::iterator &it)
+	{
+		if (reuse)
+		{
+			examine_until(static_cast<Input::Index>(it - start) + 1);
+		}
+	}
+
+	/**
+	 * Records that the input up to the offset `end` has been examined.
+	 */
+	void examine_until(Input::Index end)
+	{
+		examined = std::max(examined, end);
+	}
+
+	//next column
+	void next_col()
+	{
+		stats.characters_examined++;
+		++position;
+	}
+
+	/**
+	 * Consume the specified number of characters in the input.
+	 */
+	void consume(size_t chars)
+	{
+		stats.characters_examined += chars;
+		position += chars;
+	}
+
+	/**
+	 * Returns the position of `it`, including its line and column.
+	 */
+	ParserPosition locate(const Input::iterator &it)
+	{
+		return lines.locate(it);
+	}
+
+	//restore the state
+	void restore(const ParsingState &st)
+	{
+		// Backtracking past characters means that they were examined.
+		examine(position);
+		position = st.position;
+		matches.truncate(st.matches);
+	}
+
+	//parse non-term rule.
+	bool parse_non_term(const Rule &r);
+
+	//parse term rule.
+	bool parse_term(const Rule &r);
+
+	//parse whitespace terminal
+	bool parse_ws() { return parse_term(whitespace_rule); }
+
+	/**
+	 * Returns the handler for the specified rule, or null if there is none.
+	 */
+	const parse_proc *find_parse_proc(const Rule &r)
+	{
+		return handlers.find(r);
+	}
+
+	/**
+	 * Runs the parse procedures for all of the matches that have not yet been
+	 * run, and then discards those matches.
+	 */
+	bool do_parse_procs(void *d)
+	{
+		unsigned countdown = stats.check_interval;
+		std::size_t e = matches.size();
+		for (std::size_t i=matches.first() ; i<e ; i++)
+		{
+			const parse_proc *p = handlers.get(matches.rule(i));
+			assert(p && *p);
+			if (not (*p)(matches.range(i, start, lines), d))
+			{
+				if (!stats.limit_exceeded)
+				{
+					stats.status = ParseStatus::ProcFailed;
+				}
+				return false;
+			}
+			if (stats.limit_exceeded)
+				return false;
+			// An interval of 0 checks after every procedure, as the matching
+			// does.
+			if (countdown > 1)
+			{
+				countdown--;
+				continue;
+			}
+			countdown = stats.check_interval;
+			if (!check_limits())
+				return false;
+		}
+		// Matches that may be reused by the next parse are kept.
+		if (!reuse)
+		{
+			matches.discard(e);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Called at a point where the parse may commit to the matches so far.
+	 * When parse procedures are run incrementally and the parser can no
+	 * longer backtrack, this runs them and frees the matches.  In a pipelined
+	 * parse, the matches are instead handed to the worker once there are
+	 * enough of them to fill a batch.
+	 */
+	void commit_point()
+	{
+		if (!incremental || (live_states != 0) || stopped ||
+		    (matches.size() == matches.first()))
+		{
+			return;
+		}
+		if (pipeline)
+		{
+			if (pipeline->has_failed())
+			{
+				stopped = true;
+			}
+			else if (matches.size() - matches.first() >= ProcPipeline::batch_size)
+			{
+				pipeline->submit(matches, handlers);
+				matches.discard(matches.size());
+				stats.commits++;
+			}
+			return;
+		}
+		typedef std::chrono::steady_clock clock;
+		auto proc_start = clock::now();
+		if (!do_parse_procs(proc_data))
+		{
+			stopped = true;
+		}
+		stats.proc_time += clock::now() - proc_start;
+		stats.commits++;
+	}
+
+	/**
+	 * Schedules the next check of the limits for `stats.check_interval` rule
+	 * entries from now.
+	 */
+	void schedule_check()
+	{
+		next_check = stats.rule_entries + stats.check_interval;
+	}
+
+	/**
+	 * Checks the limits in the statistics and schedules the next check.
+	 */
+	bool check_limits()
+	{
+		schedule_check();
+		if (abandoned && abandoned->load(std::memory_order_relaxed))
+		{
+			stopped = true;
+			return false;
+		}
+		return stats.check_limits();
+	}
+
+	/**
+	 * Prepares this context, which must be for a view of the same input, to
+	 * match from the current position of `parent` on another thread.  The
+	 * states used to detect left recursion at that position are copied, so
+	 * that rules are rejected here exactly as they would be in `parent`.
+	 */
+	void fork_from(const Context &parent)
+	{
+		std::size_t offset = parent.position - parent.start;
+		position = start;
+		position += offset;
+		depth = parent.depth;
+		recognizing = parent.recognizing;
+		for (auto &rule : parent.rule_states)
+		{
+			if (!rule.second.empty() && (rule.second.back().position == offset))
+			{
+				states_for_rule(*rule.first).push_back(rule.second.back());
+			}
+		}
 	}
 
 private:
-	//reference
-	const Rule &referenced_rule;
+	RuleStateMap &rule_states;
+	/**
+	 * Returns the states for the specified rule, creating an empty stack if
+	 * this is the first time that the rule has been encountered.
+	 */
+	RuleStateVector &states_for_rule(const Rule &r)
+	{
+		auto found = rule_states.find(std::addressof(r));
+		if (found == rule_states.end())
+		{
+			RuleStateVector states(rule_states.get_allocator());
+			found = rule_states.emplace(std::addressof(r), std::move(states)).first;
+		}
+		return found->second;
+	}
+	bool parse_rule(const Rule &r, bool (Context::*parse_func)(const Rule &));
+	bool _parse_non_term(const Rule &r);
+
+	bool _parse_term(const Rule &r);
+
+	/**
+	 * The cache of successful matches.
+	 */
+	MatchCache &cache;
+	/**
+	 * The value of `stats.rule_entries` at which the limits will next be
+	 * checked.
+	 */
+	std::size_t next_check;
 };
 
+}
 
-//eof
-class EndOfFileExpr : public Expr
+namespace{
+
+/**
+ * Set expression: matches characters in a set.
+ */
+class SetExpr : public Expr
 {
 public:
+	//constructor from ansi string.
+	SetExpr(const char *s)
+	{
+		for(; *s; ++s)
+		{
+			_add(static_cast<char32_t>(*s));
+		}
+	}
+
+	//constructor from range.
+	SetExpr(char32_t min, char32_t max)
+	{
+		assert(min >= 0);
+		assert(min <= max);
+		mSetExpr.resize(static_cast<size_t>(max) + 1U);
+		for(; min <= max; ++min)
+		{
+			mSetExpr[static_cast<size_t>(min)] = true;
+		}
+	}
+
 	//parse with whitespace
 	virtual bool parse_non_term(Context &con) const
 	{
-		return parse_term(con);
+		return _parse(con);
 	}
 
 	//parse terminal
 	virtual bool parse_term(Context &con) const
 	{
-		return con.end();
+		return _parse(con);
 	}
 
 	virtual void dump() const
 	{
-		fprintf(stderr, "$eof");
+		fprintf(stderr, "[");
+		char c = 0;
+		for (bool v : mSetExpr)
+		{
+			if (v)
+				fprintf(stderr, "%c", c);
+			c++;
+		}
+		fprintf(stderr, "]");
 	}
-};
 
+	virtual void generate(Generator &g) const
+	{
+		g.emit_set(mSetExpr);
+	}
 
-//AnyExpr
-class AnyExpr : public Expr
-{
-public:
-	//parse with whitespace
-	virtual bool parse_non_term(Context &con) const
+	virtual void line_ends(std::vector<char32_t> &chars) const
 	{
-		return parse_term(con);
+		for (std::size_t i=0 ; i<mSetExpr.size() ; i++)
+		{
+			if (mSetExpr[i])
+			{
+				chars.push_back(static_cast<char32_t>(i));
+			}
+		}
 	}
 
-	//parse terminal
-	virtual bool parse_term(Context &con) const
+private:
+	//set is kept as an array of flags, for quick access
+	std::vector<bool> mSetExpr;
+
+	//add character
+	void _add(char32_t i)
+	{
+		if (i >= mSetExpr.size())
+		{
+			mSetExpr.resize(i + 1);
+		}
+		mSetExpr[i] = true;
+	}
+
+	//internal parse
+	bool _parse(Context &con) const
+	{
+		if (!con.end())
+		{
+			size_t ch = con.symbol();
+			if (ch < mSetExpr.size() && mSetExpr[ch])
+			{
+				con.next_col();
+				return true;
+			}
+		}
+		con.set_error_pos();
+		return false;
+	}
+};
+
+/**
+ * Adaptor that modifies the type of the iterator.  This lets us use iterators
+ * with things that expect char or whcar_t iterators (as long as casts work
+ * appropriately).
+ */
+template<typename Src, typename Out, typename In>
+class IteratorAdaptor : public std::iterator<std::bidirectional_iterator_tag, Out>
+{
+		Src s;
+		/**
+		 * If not null, the furthest position that has been read through
+		 * this iterator or its copies.
+		 */
+		Src *furthest = nullptr;
+		public:
+		inline IteratorAdaptor(Src src, Src *f = nullptr) : s(src), furthest(f) {}
+		inline IteratorAdaptor() {}
+		inline Out operator*() const
+		{
+			if (furthest && (*furthest < s))
+			{
+				*furthest = s;
+			}
+			return static_cast<Out>(*s);
+		}
+		inline IteratorAdaptor &operator++()
+		{
+			++s;
+			return *this;
+		}
+		inline IteratorAdaptor<Src, Out,In> operator++(int /*dummy*/)
+		{
+			auto copy = *this;
+			s++;
+			return copy;
+		}
+		inline IteratorAdaptor<Src, Out,In> &operator--()
+		{
+			--s;
+			return *this;
+		}
+		inline bool operator==(const IteratorAdaptor<Src, Out,In> &other) const
+		{
+			return s == other.s;
+		}
+		inline bool operator!=(const IteratorAdaptor<Src, Out,In> &other) const
+		{
+			return s != other.s;
+		}
+		inline bool operator>(const IteratorAdaptor<Src, Out,In> &other) const
+		{
+			return s > other.s;
+		}
+		inline bool operator<(const IteratorAdaptor<Src, Out,In> &other) const
+		{
+			return s < other.s;
+		}
+};
+
+/**
+ * Preform a regular expression match, starting at `begin` and trying to match
+ * up to `end`.  Returns true if the regular expression matches the input,
+ * false otherwise.  If there is a match, then `length` will be set to the
+ * length of the match.  If `furthest` is not null, it is advanced to the
+ * furthest character that the match read.
+ */
+template <typename T>
+bool regexMatch(Input::iterator begin,
+                Input::iterator end,
+                const std::basic_regex<T> &r,
+                size_t &length,
+                Input::iterator *furthest = nullptr)
+{
+	typedef IteratorAdaptor<Input::iterator, T, char32_t> Iterator;
+	std::match_results<Iterator> match;
+	Iterator b(begin, furthest), e(end);
+	if (std::regex_search(b, e, match, r, std::regex_constants::match_continuous))
+	{
+		length = static_cast<size_t>(match.length());
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Matches characters that correspond to a given regular expression.
+ */
+template<typename CharTy>
+class RegexExpr : public Expr
+{
+	std::basic_regex<CharTy> r;
+	/**
+	 * The pattern that the regular expression was compiled from, kept for
+	 * the generator.
+	 */
+	std::u32string pattern;
+	bool parse(Context &con) const
+	{
+		size_t length;
+		Input::iterator furthest = con.position;
+		bool matched = regexMatch(con.position, con.finish, r, length,
+		                          con.reuse ? &furthest : nullptr);
+		if (con.reuse)
+		{
+			// A regular expression that read the last character may also
+			// have tested for the end of the input.
+			con.examine(furthest);
+			if (con.finish - furthest <= 1)
+			{
+				con.examine(con.finish);
+			}
+		}
+		if (matched)
+		{
+			con.consume(length);
+			return true;
+		}
+		con.set_error_pos();
+		return false;
+	}
+public:
+	RegexExpr(const CharTy *s) : RegexExpr(s, std::char_traits<CharTy>::length(s)) {}
+	RegexExpr(const CharTy *s, size_t count) :
+		r(s, count, std::regex_constants::optimize), pattern(s, s + count) {}
+
+	virtual bool parse_non_term(Context &con) const
+	{
+		return parse(con);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		return parse(con);
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "<regex>");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.emit_regex(pattern);
+	}
+};
+
+
+//base class for unary expressions
+class UnaryExpr : public Expr
+{
+public:
+	UnaryExpr(const ExprPtr e) : expr(e) { }
+protected:
+	const ExprPtr expr;
+};
+
+
+//terminal
+class TerminalExpr : public UnaryExpr
+{
+public:
+	//constructor.
+	TerminalExpr(const ExprPtr e) :
+		UnaryExpr(e)
+	{
+	}
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		return expr->parse_term(con);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		return expr->parse_term(con);
+	}
+
+	virtual void dump() const
+	{
+		expr->dump();
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.terminal(*expr.get());
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return expr->estimate(g);
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool) const
+	{
+		return g.clause(*expr.get(), true);
+	}
+
+};
+
+
+//loop 0
+class Loop0Expr : public UnaryExpr
+{
+public:
+	//constructor.
+	Loop0Expr(const ExprPtr e) :
+		UnaryExpr(e)
+	{
+	}
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		//parse until no more parsing is possible; if an iteration fails,
+		//restore the context and stop
+		for(;;)
+		{
+			con.parse_ws();
+			{
+				ParsingState s(con);
+				if (!expr->parse_non_term(con))
+				{
+					con.restore(s);
+					break;
+				}
+			}
+			con.commit_point();
+		}
+
+		return true;
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		//parse until no more parsing is possible
+		for(;;)
+		{
+			{
+				ParsingState s(con);
+				if (!expr->parse_term(con))
+				{
+					con.restore(s);
+					break;
+				}
+			}
+			con.commit_point();
+		}
+
+		return true;
+	}
+	virtual void dump() const
+	{
+		fprintf(stderr, "*( ");
+		expr->dump();
+		fprintf(stderr, " )");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.repeat(*expr.get(), 0);
+	}
+
+	virtual GeneratorEstimate estimate(Generator &) const
+	{
+		return { 0, 1, true };
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.repeat(*expr.get(), 0, term);
+	}
+};
+
+
+//loop 1
+class Loop1Expr : public UnaryExpr
+{
+public:
+	Loop1Expr(const ExprPtr e) : UnaryExpr(e) { }
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		//parse the first; if the first fails, stop
+		con.parse_ws();
+		if (!expr->parse_non_term(con)) return false;
+		con.commit_point();
+
+		//parse the rest until no more parsing is possible
+		for(;;)
+		{
+			con.parse_ws();
+			{
+				ParsingState st(con);
+				if (!expr->parse_non_term(con))
+				{
+					con.restore(st);
+					break;
+				}
+			}
+			con.commit_point();
+		}
+
+		return true;
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		//parse the first; if the first fails, stop
+		if (!expr->parse_term(con)) return false;
+		con.commit_point();
+
+		//parse the rest until no more parsing is possible
+		for(;;)
+		{
+			{
+				ParsingState st(con);
+				if (!expr->parse_term(con))
+				{
+					con.restore(st);
+					break;
+				}
+			}
+			con.commit_point();
+		}
+
+		return true;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "+( ");
+		expr->dump();
+		fprintf(stderr, " )");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.repeat(*expr.get(), 1);
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return { expr->estimate(g).depth, 1, true };
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.repeat(*expr.get(), 1, term);
+	}
+};
+
+
+//optional
+class OptionalExpr : public UnaryExpr
+{
+public:
+	OptionalExpr(const ExprPtr e) : UnaryExpr(e) { }
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		ParsingState st(con);
+		if (!expr->parse_non_term(con)) con.restore(st);
+		return true;
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		ParsingState st(con);
+		if (!expr->parse_term(con)) con.restore(st);
+		return true;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "-( ");
+		expr->dump();
+		fprintf(stderr, " )");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.optional(*expr.get());
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return { 0, 1, expr->estimate(g).repeats };
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.optional(*expr.get(), term);
+	}
+};
+
+
+//and
+//FIXME: What is this?  Parses the subexpression but resets the state
+//independent of success or failure?
+//THIS IS WHY COMMENTS MATTER!
+class AndExpr : public UnaryExpr
+{
+public:
+	AndExpr(const ExprPtr e) : UnaryExpr(e) { }
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		ParsingState st(con);
+		bool ok = expr->parse_non_term(con);
+		con.restore(st);
+		return ok;
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		ParsingState st(con);
+		bool ok = expr->parse_term(con);
+		con.restore(st);
+		return ok;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "&( ");
+		expr->dump();
+		fprintf(stderr, " )");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.lookahead(*expr.get(), true);
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.lookahead(*expr.get(), true, term);
+	}
+};
+
+
+//not
+class NotExpr : public UnaryExpr
+{
+public:
+	NotExpr(const ExprPtr e) : UnaryExpr(e) { }
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		ParsingState st(con);
+		bool ok = !expr->parse_non_term(con);
+		con.restore(st);
+		return ok;
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		ParsingState st(con);
+		bool ok = !expr->parse_term(con);
+		con.restore(st);
+		return ok;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "!( ");
+		expr->dump();
+		fprintf(stderr, " )");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.lookahead(*expr.get(), false);
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.lookahead(*expr.get(), false, term);
+	}
+};
+
+
+//newline
+class NewlineExpr : public UnaryExpr
+{
+public:
+	NewlineExpr(const ExprPtr e) : UnaryExpr(e)
+	{
+		std::vector<char32_t> chars;
+		e->line_ends(chars);
+		for (char32_t c : chars)
+		{
+			if ((c < 32) && (c != '\n'))
+			{
+				line_end_controls.fetch_or(1U << c);
+			}
+		}
+	}
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		return expr->parse_non_term(con);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		return expr->parse_term(con);
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "nl( ");
+		expr->dump();
+		fprintf(stderr, " )");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		expr->generate(g);
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return expr->estimate(g);
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.clause(*expr.get(), term);
+	}
+};
+
+
+//base class for binary expressions
+class BinaryExpr : public Expr
+{
+public:
+	BinaryExpr(const ExprPtr &l, const ExprPtr &r) :
+		left(l), right(r) { }
+protected:
+	const ExprPtr left, right;
+};
+
+
+//sequence
+class SequenceExpr : public BinaryExpr
+{
+public:
+	SequenceExpr(const ExprPtr left, const ExprPtr right) : BinaryExpr(left, right) {}
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		if (!left->parse_non_term(con)) return false;
+		con.parse_ws();
+		return right->parse_non_term(con);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		if (!left->parse_term(con)) return false;
+		return right->parse_term(con);
+	}
+
+	virtual void dump() const
+	{
+		left->dump();
+		fprintf(stderr, " >> ");
+		right->dump();
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.sequence(*left.get(), *right.get());
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		GeneratorEstimate l = left->estimate(g);
+		GeneratorEstimate r = right->estimate(g);
+		return { std::max(l.depth, r.depth), 1, l.repeats || r.repeats };
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.sequence(*left.get(), *right.get(), term);
+	}
+
+	virtual void line_ends(std::vector<char32_t> &chars) const
+	{
+		right->line_ends(chars);
+	}
+};
+
+
+//choice
+class ChoiceExpr : public BinaryExpr
+{
+public:
+	ChoiceExpr(const ExprPtr &left, const ExprPtr &right) :
+		BinaryExpr(left, right) {}
+
+	virtual bool parse_non_term(Context &con) const
+	{
+		ParsingState st(con);
+		if (left->parse_non_term(con)) return true;
+		con.restore(st);
+		return right->parse_non_term(con);
+	}
+
+	virtual bool parse_term(Context &con) const
+	{
+		ParsingState st(con);
+		if (left->parse_term(con)) return true;
+		con.restore(st);
+		return right->parse_term(con);
+	}
+
+	virtual void dump() const
+	{
+		left->dump();
+		fprintf(stderr, " | ");
+		right->dump();
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.choice(*left.get(), *right.get());
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		GeneratorEstimate l = left->estimate(g);
+		GeneratorEstimate r = right->estimate(g);
+		return { std::min(l.depth, r.depth), l.weight + r.weight,
+		         l.repeats || r.repeats };
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.choice(*left.get(), *right.get(), term);
+	}
+
+	virtual void line_ends(std::vector<char32_t> &chars) const
+	{
+		left->line_ends(chars);
+		right->line_ends(chars);
+	}
+};
+
+/**
+ * The threads that match the alternatives of parallel choices speculatively.
+ * They are started when a parallel choice first needs them and are shared
+ * by every parse.  A task that no thread has started by the time that its
+ * result is needed is run by the thread that needs it, so a parse never
+ * waits for threads that are busy with other parses.
+ */
+class SpeculationPool
+{
+public:
+	/**
+	 * A task run by the pool.
+	 */
+	class Task
+	{
+		friend class SpeculationPool;
+		/**
+		 * Where the task is in the pool.  Guarded by the pool's lock.
+		 */
+		enum { Idle, Queued, Running, Done } state = Idle;
+	public:
+		virtual ~Task() {}
+		/**
+		 * Does the work.
+		 */
+		virtual void run() = 0;
+	};
+	/**
+	 * Returns the pool, starting its threads if this is the first call.
+	 */
+	static SpeculationPool &get()
+	{
+		static SpeculationPool pool;
+		return pool;
+	}
+	/**
+	 * Queues `t`, which must remain valid until `wait()` or `cancel()` has
+	 * been called for it.
+	 */
+	void submit(Task &t)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			t.state = Task::Queued;
+			queue.push_back(&t);
+		}
+		queued.notify_one();
+	}
+	/**
+	 * Waits for `t` to finish, running it on this thread if no thread has
+	 * started it.
+	 */
+	void wait(Task &t)
+	{
+		finish(t, true);
+	}
+	/**
+	 * Waits for `t` to finish if a thread has started it, and otherwise
+	 * removes it from the queue without running it.
+	 */
+	void cancel(Task &t)
+	{
+		finish(t, false);
+	}
+	~SpeculationPool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		queued.notify_all();
+		for (auto &t : threads)
+		{
+			t.join();
+		}
+	}
+private:
+	/**
+	 * Starts one thread for each core other than the calling thread's, and
+	 * at least one.
+	 */
+	SpeculationPool()
+	{
+		unsigned cores = std::max(2U, std::thread::hardware_concurrency());
+		for (unsigned i=1 ; i<cores ; i++)
+		{
+			threads.emplace_back([this]() { work(); });
+		}
+	}
+	/**
+	 * Waits for `t` to finish, or takes it from the queue and runs it on
+	 * this thread if `run` is true.
+	 */
+	void finish(Task &t, bool run)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		if (t.state == Task::Queued)
+		{
+			queue.erase(std::find(queue.begin(), queue.end(), &t));
+			t.state = Task::Done;
+			guard.unlock();
+			if (run)
+			{
+				t.run();
+			}
+			return;
+		}
+		finished.wait(guard, [&]() { return t.state == Task::Done; });
+	}
+	/**
+	 * The body of each thread.
+	 */
+	void work()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		for (;;)
+		{
+			queued.wait(guard, [&]() { return stopping || !queue.empty(); });
+			if (queue.empty())
+			{
+				return;
+			}
+			Task *t = queue.front();
+			queue.pop_front();
+			t->state = Task::Running;
+			guard.unlock();
+			t->run();
+			guard.lock();
+			t->state = Task::Done;
+			finished.notify_all();
+		}
+	}
+	/**
+	 * Guards the queue and the state of each task.
+	 */
+	std::mutex lock;
+	/**
+	 * Signalled when a task is queued or the threads should stop.
+	 */
+	std::condition_variable queued;
+	/**
+	 * Signalled when a task finishes.
+	 */
+	std::condition_variable finished;
+	/**
+	 * The tasks that no thread has started.
+	 */
+	std::deque<Task*> queue;
+	/**
+	 * Set when the threads should stop.
+	 */
+	bool stopping = false;
+	/**
+	 * The threads.
+	 */
+	std::vector<std::thread> threads;
+};
+
+/**
+ * Parallel choice expression.  Matches the same input as a chain of ordered
+ * choices between its alternatives, but when the alternatives are expected
+ * to examine enough input, matches the alternatives after the first
+ * speculatively on other threads while the first is matched on this one.
+ * The alternatives are then consulted in order, and the first that matched
+ * is taken, so the result is the same as for the sequential choice.
+ * Alternatives after it are abandoned.
+ */
+class ParallelChoiceExpr : public Expr
+{
+	/**
+	 * The alternatives, in order.
+	 */
+	std::vector<ExprPtr> alternatives;
+	/**
+	 * The alternatives joined by ordered choices, used for generating,
+	 * dumping and compiling the grammar.
+	 */
+	ExprPtr sequential;
+	/**
+	 * The number of characters that alternatives must be expected to
+	 * examine for them to be matched in parallel.
+	 */
+	std::size_t min_span;
+	/**
+	 * For each alternative, a moving average of the number of characters
+	 * that matching it has examined, counting 0 when ordered choice would
+	 * not have tried it.  This is shared by every parse that uses the
+	 * grammar, so it is updated without synchronisation beyond atomicity.
+	 */
+	std::unique_ptr<std::atomic<std::size_t>[]> spans;
+	/**
+	 * An alternative matched on another thread, with its own context and
+	 * statistics, and its own view of the input.  Forks are reused, so
+	 * their structures keep the memory that they have grown to.
+	 */
+	struct Fork : public SpeculationPool::Task
+	{
+		/**
+		 * The statistics for this alternative, which start with the limits
+		 * and work counts of the parent.
+		 */
+		ParseStats stats;
+		/**
+		 * The data structures for the context.
+		 */
+		ContextState state;
+		/**
+		 * The work counts of the parent when this fork was started.
+		 */
+		std::size_t rule_entries = 0;
+		std::size_t characters_examined = 0;
+		/**
+		 * The view of the parent's input.
+		 */
+		std::unique_ptr<InputView> input;
+		/**
+		 * The context that the alternative is matched in.
+		 */
+		std::unique_ptr<Context> context;
+		/**
+		 * The alternative, and the function that matches it.
+		 */
+		const Expr *alternative = nullptr;
+		bool (Expr::*parse_func)(Context &) const = nullptr;
+		/**
+		 * Whether the alternative matched.
+		 */
+		bool ok = false;
+		Fork() : state(stats) {}
+		void run() override
+		{
+			ok = (alternative->*parse_func)(*context);
+		}
+		/**
+		 * Prepares to match `e` with `f` from the position of `parent`,
+		 * stopping when `abandon` is set.
+		 */
+		void start(Context &parent, const std::atomic<bool> &abandon,
+		           const Expr *e, bool (Expr::*f)(Context &) const)
+		{
+			// Take the parent's limits, keeping the memory that the
+			// structures still hold.
+			stats.restart();
+			ParseStats next = parent.stats;
+			next.reset();
+			next.merge(stats);
+			stats = next;
+			rule_entries = parent.stats.rule_entries;
+			characters_examined = parent.stats.characters_examined;
+			stats.rule_entries = rule_entries;
+			stats.characters_examined = characters_examined;
+			if (stats.memory_limit != 0)
+			{
+				stats.memory_limit = (stats.memory_limit > parent.stats.current_bytes) ?
+					stats.memory_limit - parent.stats.current_bytes : 1;
+			}
+			state.reset();
+			// The states that the last use copied from its parent are still
+			// on the stacks.
+			for (auto &rule : state.rule_states)
+			{
+				rule.second.clear();
+			}
+			input.reset(new InputView(parent.start.input()));
+			context.reset(new Context(*input, parent.whitespace_rule,
+			                          parent.delegate, stats, state));
+			context->fork_from(parent);
+			context->abandoned = &abandon;
+			alternative = e;
+			parse_func = f;
+			ok = false;
+		}
+		/**
+		 * Returns the number of characters that matching the alternative
+		 * examined.
+		 */
+		std::size_t examined() const
+		{
+			return stats.characters_examined - characters_examined;
+		}
+		/**
+		 * Adds the error position of the finished alternative and, if it
+		 * matched, its matches and end position to `parent`, along with its
+		 * statistics.
+		 */
+		void finish(Context &parent)
+		{
+			if (!parent.recognizing)
+			{
+				Input::iterator error_pos = parent.start;
+				error_pos += context->error_pos - context->start;
+				if (error_pos > parent.error_pos)
+				{
+					parent.error_pos = error_pos;
+				}
+			}
+			if (ok)
+			{
+				MatchLog &matches = context->matches;
+				parent.matches.append(matches, matches.first(),
+				                      matches.size() - matches.first());
+				parent.handlers.adopt(context->handlers);
+				parent.position = parent.start;
+				parent.position += context->position - context->start;
+			}
+			parent.stats.rule_entries += stats.rule_entries - rule_entries;
+			parent.stats.characters_examined += examined();
+			// The memory that the structures keep for the next use is not
+			// the parent's, so only its peak is added to the parent's use at
+			// the time.
+			for (auto category : { &ParseStats::matches, &ParseStats::cache,
+			                       &ParseStats::rule_states, &ParseStats::lines,
+			                       &ParseStats::input, &ParseStats::buffer,
+			                       &ParseStats::ast_stack,
+			                       &ParseStats::ast_nodes })
+			{
+				AllocationStats &to = parent.stats.*category;
+				const AllocationStats &from = stats.*category;
+				to.peak_bytes = std::max(to.peak_bytes,
+				                         to.current_bytes + from.peak_bytes);
+				to.allocations += from.allocations;
+				to.largest_allocation = std::max(to.largest_allocation,
+				                                 from.largest_allocation);
+			}
+			parent.stats.peak_bytes = std::max(parent.stats.peak_bytes,
+				parent.stats.current_bytes + stats.peak_bytes);
+			if (stats.limit_exceeded && !parent.stats.limit_exceeded)
+			{
+				parent.stats.limit_exceeded = true;
+				parent.stats.status = stats.status;
+			}
+		}
+		/**
+		 * Frees the context and the view once the fork is no longer needed.
+		 */
+		void release()
+		{
+			context.reset();
+			input.reset();
+		}
+	};
+	/**
+	 * Returns the number of characters that alternative `i` is expected to
+	 * examine.
+	 */
+	std::size_t expected_span(std::size_t i) const
+	{
+		return spans[i].load(std::memory_order_relaxed);
+	}
+	/**
+	 * Records that alternative `i` examined `span` characters.
+	 */
+	void learn(std::size_t i, std::size_t span) const
+	{
+		std::size_t old = spans[i].load(std::memory_order_relaxed);
+		std::size_t next = old - old / 8 + span / 8;
+		// Avoid writing to memory that other threads read when nothing has
+		// changed, as for the short alternatives of most choices.
+		if (next != old)
+		{
+			spans[i].store(next, std::memory_order_relaxed);
+		}
+	}
+	/**
+	 * Returns whether the alternatives should be matched in parallel from
+	 * the current position of `con`.
+	 */
+	bool parallel(const Context &con) const
+	{
+		if ((alternatives.size() < 2) || con.abandoned || con.reuse ||
+		    con.stopped || con.stats.limit_exceeded ||
+		    !con.start.input().supports_concurrent_reads())
+		{
+			return false;
+		}
+		if (min_span == 0)
+		{
+			return true;
+		}
+		static const unsigned cores = std::thread::hardware_concurrency();
+		// Matching the others while the first is matched only pays for
+		// itself if the first takes long enough and ordered choice would go
+		// on to spend long enough on at least one of the others.
+		if ((cores < 2) || (expected_span(0) < min_span))
+		{
+			return false;
+		}
+		for (std::size_t i=1 ; i<alternatives.size() ; i++)
+		{
+			if (expected_span(i) >= min_span)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	/**
+	 * Matches the alternatives in order on this thread, with `parse_func`,
+	 * which is either `Expr::parse_non_term` or `Expr::parse_term`.
+	 */
+	bool parse_in_order(Context &con,
+	                    bool (Expr::*parse_func)(Context &) const) const
+	{
+		ParsingState st(con);
+		bool ok = false;
+		for (std::size_t i=0 ; i<alternatives.size() ; i++)
+		{
+			if (ok)
+			{
+				learn(i, 0);
+				continue;
+			}
+			if (i > 0)
+			{
+				con.restore(st);
+			}
+			std::size_t examined = con.stats.characters_examined;
+			ok = (alternatives[i].get()->*parse_func)(con);
+			learn(i, con.stats.characters_examined - examined);
+		}
+		return ok;
+	}
+	/**
+	 * Matches the alternatives with `parse_func`, in parallel if they are
+	 * expected to examine enough input.
+	 */
+	bool parse(Context &con, bool (Expr::*parse_func)(Context &) const) const
+	{
+		if (!parallel(con))
+		{
+			return parse_in_order(con, parse_func);
+		}
+		// Forks that this thread has finished with, kept for their memory.
+		static thread_local std::vector<std::unique_ptr<Fork>> spare;
+		SpeculationPool &pool = SpeculationPool::get();
+		std::atomic<bool> abandon(false);
+		std::vector<std::unique_ptr<Fork>> forks;
+		for (std::size_t i=1 ; i<alternatives.size() ; i++)
+		{
+			if (spare.empty())
+			{
+				forks.emplace_back(new Fork());
+			}
+			else
+			{
+				forks.push_back(std::move(spare.back()));
+				spare.pop_back();
+			}
+			forks.back()->start(con, abandon, alternatives[i].get(),
+			                    parse_func);
+			pool.submit(*forks.back());
+		}
+		ParsingState st(con);
+		std::size_t examined = con.stats.characters_examined;
+		bool ok = (alternatives[0].get()->*parse_func)(con);
+		learn(0, con.stats.characters_examined - examined);
+		std::size_t next = 0;
+		if (!ok)
+		{
+			con.restore(st);
+			while (!ok && (next < forks.size()) && !con.stopped &&
+			       !con.stats.limit_exceeded)
+			{
+				Fork &f = *forks[next++];
+				pool.wait(f);
+				f.finish(con);
+				learn(next, f.examined());
+				ok = f.ok && !con.stats.limit_exceeded;
+			}
+		}
+		abandon.store(true, std::memory_order_relaxed);
+		for (; next < forks.size() ; next++)
+		{
+			pool.cancel(*forks[next]);
+			learn(next + 1, 0);
+		}
+		for (auto &f : forks)
+		{
+			f->release();
+			spare.push_back(std::move(f));
+		}
+		return ok;
+	}
+public:
+	ParallelChoiceExpr(const std::vector<ExprPtr> &a, std::size_t min) :
+		alternatives(a), sequential(a.front()), min_span(min),
+		spans(new std::atomic<std::size_t>[a.size()])
+	{
+		for (std::size_t i=0 ; i<a.size() ; i++)
+		{
+			spans[i].store(0, std::memory_order_relaxed);
+		}
+		for (std::size_t i=1 ; i<a.size() ; i++)
+		{
+			sequential = ExprPtr(new ChoiceExpr(sequential, a[i]));
+		}
+	}
+
+	virtual bool parse_non_term(Context &con) const
+	{
+		return parse(con, &Expr::parse_non_term);
+	}
+
+	virtual bool parse_term(Context &con) const
+	{
+		return parse(con, &Expr::parse_term);
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "parallel_choice( ");
+		sequential->dump();
+		fprintf(stderr, " )");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		sequential->generate(g);
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return sequential->estimate(g);
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return sequential->pika_clause(g, term);
+	}
+
+	virtual void line_ends(std::vector<char32_t> &chars) const
+	{
+		sequential->line_ends(chars);
+	}
+};
+
+
+//reference to rule
+class RuleReferenceExpr : public Expr
+{
+public:
+	//constructor.
+	RuleReferenceExpr(const Rule &r) : referenced_rule(r) { }
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		return con.parse_non_term(referenced_rule);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		return con.parse_term(referenced_rule);
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "{Reference to rule}");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.rule(referenced_rule);
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return g.estimate(referenced_rule);
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.rule(referenced_rule, term);
+	}
+
+private:
+	//reference
+	const Rule &referenced_rule;
+};
+
+
+//eof
+class EndOfFileExpr : public Expr
+{
+public:
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		return parse_term(con);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		con.examine(con.position);
+		return con.end();
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "$eof");
+	}
+};
+
+
+//AnyExpr
+class AnyExpr : public Expr
+{
+public:
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		return parse_term(con);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		if (!con.end())
+		{
+			con.next_col();
+			return true;
+		}
+		con.set_error_pos();
+		return false;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "$AnyExpr");
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.emit_any();
+	}
+};
+/**
+ * Trace expressions have no effect on parsing.  They wrap another expression
+ * and log a message when parsing for it begins and ends, along with whether it
+ * succeeds.
+ */
+class TraceExpr : public Expr
+{
+	/**
+	 * The message to log for this expression.
+	 */
+	const char *message;
+	/**
+	 * The real expression that will handle the parsing.
+	 */
+	const ExprPtr expr;
+	void log(int depth, const char *event, const char *result, Context &con) const
+	{
+		fprintf(stderr, "[%d] ", depth);
+		for (int i=0 ; i<depth ; i++)
+		{
+			fprintf(stderr, " ");
+		}
+		ParserPosition p = con.locate(con.position);
+		fprintf(stderr, "%s %s (line %zu, column %zu)\n",
+		                event,
+		                result,
+		                p.line,
+		                p.col);
+	}
+public:
+#ifdef DEBUG_PARSING
+	TraceExpr(const char *m, const ExprPtr e) : message(m), expr(e) {}
+#endif
+
+	virtual bool parse_non_term(Context &con) const
+	{
+		log(con.depth++, "Trying", message, con);
+		bool result = expr->parse_non_term(con);
+		log(--con.depth, message, result ? "succeeded" : "failed", con);
+		return result;
+	}
+	virtual bool parse_term(Context &con) const
+	{
+		log(con.depth++, "Trying", message, con);
+		bool result = expr->parse_term(con);
+		log(--con.depth, message, result ? "succeeded" : "failed", con);
+		return result;
+	}
+
+	virtual void dump() const
+	{
+		expr->dump();
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		expr->generate(g);
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return expr->estimate(g);
+	}
+
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const
+	{
+		return g.clause(*expr.get(), term);
+	}
+};
+class DebugExpr : public Expr
+{
+	std::function<void()> fn;
+public:
+	DebugExpr(std::function<void()> f) : fn(f) {}
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &) const
+	{
+		fn();
+		return true;
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &) const
+	{
+		fn();
+		return true;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "<DEBUG: ");
+		fn();
+		fprintf(stderr, ">");
+	}
+};
+
+/**
+ * Commit expression.  Always matches the empty string, and marks a point at
+ * which an incremental parse may run the parse procedures for the matches so
+ * far.
+ */
+class CommitExpr : public Expr
+{
+public:
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		con.commit_point();
+		return true;
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		con.commit_point();
+		return true;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "commit()");
+	}
+};
+
+/**
+ * Deferred expression.  Matches a region from an opening delimiter to the
+ * closing delimiter that balances it, by scanning for the delimiters rather
+ * than parsing the contents, which are left for the body rule to parse later.
+ */
+class DeferExpr : public Expr
+{
+	/**
+	 * The delimiter that starts the region.
+	 */
+	const char32_t open;
+	/**
+	 * The delimiter that ends the region.
+	 */
+	const char32_t close;
+	/**
+	 * The rule that parses the contents of the region.
+	 */
+	const Rule &body;
+	/**
+	 * The syntax of strings and comments inside the region.
+	 */
+	const DeferSyntax syntax;
+	/**
+	 * Flags for the ASCII characters that may start a delimiter, a string or
+	 * a comment.  The scan passes over all other ASCII characters without
+	 * looking at them further.
+	 */
+	bool special[128];
+	/**
+	 * Returns true if `c` may start a delimiter, a string or a comment.
+	 */
+	bool is_special(char32_t c) const
+	{
+		if (c < 128)
+		{
+			return special[c];
+		}
+		return (c == open) || (c == close) ||
+		       (syntax.quotes.find(c) != std::u32string::npos) ||
+		       (!syntax.line_comment.empty() &&
+		        (c == syntax.line_comment[0])) ||
+		       (!syntax.block_comment_open.empty() &&
+		        (c == syntax.block_comment_open[0]));
+	}
+	/**
+	 * Returns true if `str` is not empty and the input at the current
+	 * position starts with it.
+	 */
+	static bool looking_at(Context &con, const std::u32string &str)
+	{
+		if (str.empty() ||
+		    (static_cast<std::size_t>(con.finish - con.position) < str.size()))
+		{
+			return false;
+		}
+		Input::iterator it = con.position;
+		for (char32_t c : str)
+		{
+			if (*it != c)
+			{
+				return false;
+			}
+			++it;
+		}
+		return true;
+	}
+	/**
+	 * Skips the string that starts at the current position, which starts
+	 * and ends with the character `quote`.
+	 */
+	void skip_string(Context &con, char32_t quote) const
+	{
+		con.next_col();
+		while (!con.end())
+		{
+			char32_t c = con.symbol();
+			con.next_col();
+			if ((syntax.escape != 0) && (c == syntax.escape))
+			{
+				if (!con.end())
+				{
+					con.next_col();
+				}
+			}
+			else if (c == quote)
+			{
+				return;
+			}
+		}
+	}
+public:
+	DeferExpr(char32_t o, const Rule &b, char32_t c, const DeferSyntax &s) :
+		open(o), close(c), body(b), syntax(s)
+	{
+		std::fill(std::begin(special), std::end(special), false);
+		auto mark = [&](char32_t ch)
+		{
+			if (ch < 128)
+			{
+				special[ch] = true;
+			}
+		};
+		mark(open);
+		mark(close);
+		for (char32_t q : syntax.quotes)
+		{
+			mark(q);
+		}
+		if (!syntax.line_comment.empty())
+		{
+			mark(syntax.line_comment[0]);
+		}
+		if (!syntax.block_comment_open.empty())
+		{
+			mark(syntax.block_comment_open[0]);
+		}
+	}
+
+	//parse with whitespace
+	virtual bool parse_non_term(Context &con) const
+	{
+		return parse_term(con);
+	}
+
+	//parse terminal
+	virtual bool parse_term(Context &con) const
+	{
+		if (con.end() || (con.symbol() != open))
+		{
+			con.set_error_pos();
+			return false;
+		}
+		con.next_col();
+		std::size_t depth = 1;
+		while (!con.end())
+		{
+			char32_t c = con.symbol();
+			if (!is_special(c))
+			{
+				con.next_col();
+			}
+			else if (c == close)
+			{
+				con.next_col();
+				if (--depth == 0)
+				{
+					return true;
+				}
+			}
+			else if (c == open)
+			{
+				con.next_col();
+				depth++;
+			}
+			else if (looking_at(con, syntax.line_comment))
+			{
+				Input::Index nl = con.position.input().find_newline(
+					con.position.index(), con.finish.index());
+				con.consume(nl - con.position.index());
+			}
+			else if (looking_at(con, syntax.block_comment_open))
+			{
+				con.consume(syntax.block_comment_open.size());
+				while (!con.end() &&
+				       !looking_at(con, syntax.block_comment_close))
+				{
+					con.next_col();
+				}
+				if (!con.end())
+				{
+					con.consume(syntax.block_comment_close.size());
+				}
+			}
+			else if (syntax.quotes.find(c) != std::u32string::npos)
+			{
+				skip_string(con, c);
+			}
+			else
+			{
+				con.next_col();
+			}
+		}
+		// The region is not closed before the end of the input.
+		con.set_error_pos();
+		return false;
+	}
+
+	virtual void dump() const
+	{
+		fprintf(stderr, "defer( %c ... %c )", static_cast<char>(open),
+		        static_cast<char>(close));
+	}
+
+	virtual void generate(Generator &g) const
+	{
+		g.emit(open);
+		g.rule(body);
+		g.emit(close);
+	}
+
+	virtual GeneratorEstimate estimate(Generator &g) const
+	{
+		return g.estimate(body);
+	}
+};
+
+//constructor
+ParsingState::ParsingState(Context &con) :
+	position(con.position),
+	matches(con.matches.size()),
+	context(con)
+{
+	++con.live_states;
+}
+
+ParsingState::~ParsingState()
+{
+	--context.live_states;
+}
+
+static inline bool parseString(Context &con,
+                               const std::vector<char32_t> &characters)
+{
+	for (char32_t c : characters)
+	{
+		if (con.end() || con.symbol() != c)
+		{
+			con.set_error_pos();
+			return false;
+		}
+		con.next_col();
+	}
+	return true;
+}
+bool StringExpr::parse_non_term(Context &con) const
+{
+	return parseString(con, characters);
+}
+bool StringExpr::parse_term(Context &con) const
+{
+	return parseString(con, characters);
+}
+void StringExpr::dump() const
+{
+	fprintf(stderr, "\"");
+	for (char32_t c : characters)
+	{
+		fprintf(stderr, "%c", static_cast<char>(c));
+	}
+	fprintf(stderr, "\"");
+}
+void StringExpr::generate(Generator &g) const
+{
+	for (char32_t c : characters)
+	{
+		g.emit(c);
+	}
+}
+
+
+
+}
+
+namespace pegmatite {
+
+
+//parse non-term rule.
+bool Context::parse_non_term(const Rule &r)
+{
+	return parse_rule(r, &Context::_parse_non_term);
+}
+
+bool Context::parse_rule(const Rule &r, bool (Context::*parse_func)(const Rule &))
+{
+	// If we have run out of memory, or a parse procedure has failed, then
+	// fail without allocating any more.
+	if (stats.limit_exceeded || stopped)
+	{
+		return false;
+	}
+	if ((++stats.rule_entries >= next_check) && !check_limits())
+	{
+		return false;
+	}
+	// For each rule, we maintain a vector consisting of where it was last
+	// encountered (in the input stream) and what the parsing mode was.
+	auto &states = states_for_rule(r);
+	// If this is the first time that we've encountered this rule, then set the
+	// last position and mode to values that will trigger a normal parse: We
+	// can't be in left recursion if this is the first time that we've
+	// encountered the rule.
+	size_t last_pos = Input::npos;
+	MatchMode last_mode = PARSE;
+	if (!states.empty())
+	{
+		auto &last = states.back();
+		last_pos = last.position;
+		last_mode = last.mode;
+	}
+
+	// Return value (success or failure of parse)
+	bool ok;
+
+	// Compute the new position in the stream.  We're only tracking offsets to
+	// detect left recursion, not storing iterators.
+	size_t new_pos = position - start;
+
+	// Check if we have left recursion.  We are in a left-recursive state if
+	// the last time that we encountered this rule was at the same point in the
+	// input.
+	bool lr = new_pos == last_pos;
+
+	// Look up the current rule and parser position in the cache to see if
+	// we've been here before and successfully parsed the rule.
+	const MatchCache::Entry *cached = cache.find(std::addressof(r), new_pos);
+	if (cached)
+	{
+		// If we have a cache entry then grab the list of matched rules and the
+		// end parsing position from the cache and don't bother trying to apply
+		// the rules again.
+		cache.append_matches(*cached, matches);
+		position = cached->end;
+		examine_until(cached->examined);
+		return true;
+	}
+
+	// In an incremental reparse, reuse the match from the last parse if the
+	// input that it examined has not been edited.
+	std::size_t previous;
+	std::ptrdiff_t shift;
+	if (reuse && find_parse_proc(r) &&
+	    reuse->find(r.index(), new_pos, previous, shift))
+	{
+		stats.reused_matches += reuse->append(previous, shift, matches);
+		position = start;
+		position += static_cast<Input::Index>(
+			static_cast<std::ptrdiff_t>(reuse->end(previous)) + shift);
+		examine_until(static_cast<Input::Index>(
+			static_cast<std::ptrdiff_t>(reuse->examined_end(previous)) + shift));
+		// Errors are reported where a full parse would report them.
+		Input::iterator furthest = start;
+		furthest += static_cast<Input::Index>(
+			static_cast<std::ptrdiff_t>(reuse->error_end(previous)) + shift);
+		if (!recognizing && (furthest > error_pos))
+		{
+			error_pos = furthest;
+		}
+		return true;
+	}
+
+	size_t new_match_index = matches.size();
+	Input::Index outer_examined = examined;
+	examined = new_pos + 1;
+	// When matches may be reused, find how far errors reach while making
+	// this one, starting from its start.
+	Input::iterator outer_error = error_pos;
+	if (reuse)
+	{
+		error_pos = position;
+	}
+
+	switch (last_mode)
+	{
+		//normal parse
+		case PARSE:
+			if (lr)
+			{
+				//first try to parse the rule by rejecting it, so alternative
+				//branches are examined
+				states.push_back(RuleState(new_pos, REJECT));
+				ok = (this->*parse_func)(r);
+				states.pop_back();
+				break;
+			}
+			else
+			{
+				states.push_back(RuleState(new_pos, PARSE));
+				ok = (this->*parse_func)(r);
+				states.pop_back();
+			}
+			break;
+		case REJECT:
+			if (lr)
+			{
+				ok = false;
+			}
+			else
+			{
+				states.push_back(RuleState(new_pos, PARSE));
+				ok = (this->*parse_func)(r);
+				states.pop_back();
+			}
+			break;
+	}
+
+	if (reuse)
+	{
+		examine_until(position - start);
+		if (ok && find_parse_proc(r))
+		{
+			matches.set_last_reuse(matches.size() - 1 - new_match_index,
+			                       examined - new_pos,
+			                       static_cast<Input::Index>(error_pos - start) -
+			                       new_pos);
+		}
+		if (outer_error > error_pos)
+		{
+			error_pos = outer_error;
+		}
+	}
+
+	// If we successfully parsed the input, then cache the result, unless
+	// some of its matches have already been committed.
+	if (ok && (new_match_index >= matches.first()))
+	{
+		cache.insert(std::addressof(r), new_pos, position, examined, matches,
+		             new_match_index);
+	}
+	examined = std::max(examined, outer_examined);
+
+	return ok;
+}
+
+
+
+//parse term rule.
+bool Context::parse_term(const Rule &r) 
+{
+	return parse_rule(r, &Context::_parse_term);
+}
+const bool debug_parsing = false;
+
+
+//parse non-term rule internal.
+bool Context::_parse_non_term(const Rule &r)
+{
+	bool ok;
+	if (recognizing)
+	{
+		ok = r.expr->parse_non_term(*this);
+	}
+	else if (find_parse_proc(r))
+	{
+		Input::iterator b = position;
+		ok = r.expr->parse_non_term(*this);
+		if (debug_parsing)
+		{
+			r.expr->dump();
+			fprintf(stderr, "\n");
+		}
+		if (ok)
+		{
+			matches.push_back(r.index(), b - start, position - start);
+		}
+	}
+	else
+	{
+		ok = r.expr->parse_non_term(*this);
+	}
+	return ok;
+}
+
+
+//parse term rule internal.
+bool Context::_parse_term(const Rule &r)
+{
+	bool ok;
+	if (recognizing)
+	{
+		ok = r.expr->parse_term(*this);
+	}
+	else if (find_parse_proc(r))
+	{
+		Input::iterator b = position;
+		ok = r.expr->parse_term(*this);
+		if (ok)
+		{
+			matches.push_back(r.index(), b - start, position - start);
+		}
+	}
+	else
+	{
+		ok = r.expr->parse_term(*this);
+	}
+	return ok;
+}
+
+
+//get the next position
+static ParserPosition _next_pos(const ParserPosition &p)
+{
+	ParserPosition r = p;
+	++r.it;
+	++r.col;
+	return r;
+}
+
+
+//get syntax error
+static void _syntax_Error(ErrorReporter &err, Context &con)
+{
+	ParserPosition p = con.locate(con.error_pos);
+	err(InputRange(p, _next_pos(p)), "syntax error");
+}
+
+
+//get eof error
+static void _eof_Error(ErrorReporter &err, Context &con)
+{
+	ParserPosition p = con.locate(con.error_pos);
+	err(InputRange(p, p), "EOF");
+}
+
+
+//get resource limit error
+static void _limit_Error(ErrorReporter &err, Context &con)
+{
+	const char *message;
+	switch (con.stats.status)
+	{
+		case ParseStatus::MemoryLimit:
+			message = "memory limit exceeded";
+			break;
+		case ParseStatus::DeadlineExceeded:
+			message = "deadline exceeded";
+			break;
+		case ParseStatus::Cancelled:
+			message = "parse cancelled";
+			break;
+		default:
+			message = "work limit exceeded";
+			break;
+	}
+	ParserPosition p = con.locate(con.position);
+	err(InputRange(p, p), message);
+}
+
+Input::Index Input::find_newline(Index start, Index end)
+{
+	end = std::min(end, size());
+	while (start < end)
+	{
+		if ((start < buffer_start) || (start >= buffer_end))
+		{
+			slowCharacterLookup(start);
+			if ((start < buffer_start) || (start >= buffer_end))
+			{
+				return end;
+			}
+		}
+		const char32_t *chars = buffer + (start - buffer_start);
+		Index length = std::min(end, buffer_end) - start;
+		Index i = 0;
+		// Test blocks of characters without branching on each one, so that
+		// the compiler can vectorise the comparisons, and only look for the
+		// exact position in blocks that contain a newline.
+		const Index block = 16;
+		for ( ; i + block <= length ; i += block)
+		{
+			bool found = false;
+			for (Index j=0 ; j<block ; j++)
+			{
+				found |= (chars[i + j] == '\n');
+			}
+			if (found)
+			{
+				break;
+			}
+		}
+		for ( ; i < length ; i++)
+		{
+			if (chars[i] == '\n')
+			{
+				return start + i;
+			}
+		}
+		start += length;
+	}
+	return end;
+}
+
+char32_t Input::slowCharacterLookup(Index n)
+{
+	const int back_seek = static_buffer_size / 4;
+	if (n >= size())
+	{
+		return 0;
+	}
+	// Optimise backtracking by jumping back 64 characters so subsequent
+	// forward scans are fast.
+	if (n < buffer_start)
+	{
+		buffer_start = (n > back_seek) ? n - back_seek : 0;
+	}
+	else
+	{
+		buffer_start = n;
+	}
+	Index length = static_buffer_size;
+	buffer = local_buffer;
+	if (!fillBuffer(buffer_start, length, buffer))
+	{
+		buffer_end = 0;
+		return 0;
+	}
+	buffer_end = buffer_start + length;
+	assert((n >= buffer_start) && (n < buffer_end));
+	return buffer[n - buffer_start];
+}
+Input::~Input() {}
+
+Input::Input(const Input& orig)
+	: user_name(orig.user_name), buffer(orig.buffer),
+	  buffer_start(orig.buffer_start), buffer_end(orig.buffer_end) {}
+
+const std::string& Input::iterator::filename() const
+{
+	static std::string& None = *new std::string("<invalid input>");
+	return buffer ? buffer->name() : None;
+}
+
+bool  UnicodeVectorInput::fillBuffer(Index start, Index &length, char32_t *&b)
+{
+	if (start > vector.size())
+	{
+		return false;
+	}
+	length = vector.size() - start;
+	// The buffer can't be const because this function is allowed to write into
+	// it, but the caller guarantees that it will not write to the returned
+	// value.
+	// We should probably clean up this interface to a const char32_t* instead
+	// of a bool...
+	b = const_cast<char32_t*>(vector.data() + start);
+	return true;
+}
+Input::Index UnicodeVectorInput::size() const
+{
+	return vector.size();
+}
+
+bool  StringInput::fillBuffer(Index start, Index &length, char32_t *&b)
+{
+	if (start > str.size())
+	{
+		return false;
+	}
+	length = std::min(length, str.size() - start);
+	std::size_t j = 0;
+	for (Index i = start; i < start + length; ++i, ++j)
+	{
+		b[j] = static_cast<char32_t>(str[i]);
+	}
+	return true;
+}
+Input::Index StringInput::size() const
+{
+	return str.size();
+}
+
+AsciiFileInput::AsciiFileInput(int file, const std::string& name)
+	: Input(name), fd(file)
+{
+	struct stat buf;
+	if (fstat(fd, &buf) != 0)
+	{
+		file_size = 0;
+		perror("Input error");
+	}
+	else
+	{
+		file_size = static_cast<Index>(buf.st_size);
+	}
+}
+
+const std::size_t Input::static_buffer_size;
+bool AsciiFileInput::fillBuffer(Index start, Index &length, char32_t *&b)
+{
+	if (start > file_size)
+	{
+		return false;
+	}
+	char buffer[static_buffer_size];
+	// This should be a no-op
+	length = std::min(length, static_buffer_size);
+	length = std::min(length, file_size - start);
+	Index bytes_to_read = length;
+	do {
+		ssize_t ret = pread(fd, buffer, length,
+		                    static_cast<off_t>(start));
+		if (ret < 1)
+		{
+			return false;
+		}
+		bytes_to_read -= length;
+	} while (bytes_to_read > 0);
+	for (Index i=0 ; i<length ; i++)
+	{
+		b[i] = static_cast<char32_t>(buffer[i]);
+	}
+	return true;
+}
+Input::Index AsciiFileInput::size() const
+{
+	return file_size;
+}
+
+StreamInput StreamInput::Create(const std::string& name, std::istream& s)
+{
+	const std::streamoff start = s.tellg();
+	s.seekg(0, std::ios::end);
+
+	const std::streamoff len = s.tellg() - start;
+	s.seekg(start, std::ios::beg);
+
+	return StreamInput(name, s, static_cast<size_t>(len));
+}
+
+StreamInput::StreamInput(const std::string& name, std::istream& s, size_t len)
+	: Input(name), length(len), stream(s)
+{
+}
+
+MappedFileInput::MappedFileInput(int file, const std::string& name)
+	: Input(name), data(nullptr), file_size(0), ok(false)
+{
+	struct stat buf;
+	if (fstat(file, &buf) != 0)
+	{
+		perror("Input error");
+		return;
+	}
+	file_size = static_cast<Index>(buf.st_size);
+	ok = true;
+	// Empty files cannot be mapped, but need not be.
+	if (file_size == 0)
+	{
+		return;
+	}
+	void *p = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+	if (p == MAP_FAILED)
+	{
+		perror("Input error");
+		file_size = 0;
+		ok = false;
+		return;
+	}
+	data = static_cast<const char*>(p);
+}
+
+MappedFileInput::~MappedFileInput()
+{
+	if (data)
+	{
+		munmap(const_cast<char*>(data), file_size);
+	}
+}
+
+bool MappedFileInput::fillBuffer(Index start, Index &length, char32_t *&b)
+{
+	if (start > file_size)
+	{
+		return false;
+	}
+	length = std::min(length, file_size - start);
+	for (Index i=0 ; i<length ; i++)
+	{
+		b[i] = static_cast<char32_t>(data[start + i]);
+	}
+	return true;
+}
+
+Input::Index MappedFileInput::size() const
+{
+	return file_size;
+}
+
+bool StreamInput::fillBuffer(Index start, Index &len, char32_t *&b)
+{
+	if (start > length)
+	{
+		return false;
+	}
+
+	char buffer[static_buffer_size];
+	len = std::min(this->length, static_buffer_size);
+	len = std::min(len, this->length - start);
+
+	stream.seekg(static_cast<std::streamoff>(start));
+	if (not stream.good())
+	{
+		return false;
+	}
+
+	stream.read(buffer, static_cast<std::streamsize>(len));
+	if (static_cast<Index>(stream.gcount()) != len)
+	{
+		return false;
+	}
+
+	for (Index i = 0 ; i < len; i++)
+	{
+		b[i] = static_cast<char32_t>(buffer[i]);
+	}
+
+	return true;
+}
+
+Input::Index StreamInput::size() const
+{
+	return length;
+}
+
+/** constructor from input.
+	@param i input.
+ */
+ParserPosition::ParserPosition(Input &i) :
+	it(i.begin()),
+	line(1),
+	col(1)
+{
+}
+
+/** creates a zero-or-more loop out of this expression.
+	@return a zero-or-more loop expression.
+ */
+ExprPtr operator *(const ExprPtr &e)
+{
+	return ExprPtr(new Loop0Expr(e));
+}
+
+
+/** creates a one-or-more loop out of this expression.
+	@return a one-or-more loop expression.
+ */
+ExprPtr operator +(const ExprPtr &e)
+{
+	return ExprPtr(new Loop1Expr(e));
+}
+
+
+/** creates an optional out of e expression.
+	@return an optional expression.
+ */
+ExprPtr operator -(const ExprPtr &e)
+{
+	return ExprPtr(new OptionalExpr(e));
+}
+
+
+/** creates an AND-expression.
+	@return an AND-expression.
+ */
+ExprPtr operator &(const ExprPtr &e)
+{
+	return ExprPtr(new AndExpr(e));
+}
+
+
+/** creates a NOT-expression.
+	@return a NOT-expression.
+ */
+ExprPtr operator !(const ExprPtr &e)
+{
+	return ExprPtr(new NotExpr(e));
+}
+
+
+/** constructor.
+	@param b begin position.
+	@param e end position.
+ */
+InputRange::InputRange(const ParserPosition &b, const ParserPosition &e) : start(b), finish(e) { }
+
+std::string InputRange::str() const
+{
+	std::stringstream s;
+
+	for (char32_t c : *this)
+	{
+		s << static_cast<char>(c);
+	}
+
+	return s.str();
+}
+
+
+namespace {
+/**
+ * The allocator for rule indexes.
+ */
+struct RuleIndexes
+{
+	/**
+	 * Protects the other fields.
+	 */
+	std::mutex lock;
+	/**
+	 * One more than the largest index allocated so far.
+	 */
+	std::size_t limit = 0;
+	/**
+	 * Indexes released by destroyed rules.
+	 */
+	std::vector<std::size_t> free;
+	/**
+	 * Returns the allocator.  This is created by the first rule, so that it
+	 * is destroyed after all static rules.
+	 */
+	static RuleIndexes &get()
+	{
+		static RuleIndexes indexes;
+		return indexes;
+	}
+};
+}
+
+Rule::Rule(const ExprPtr e) :
+	expr(e)
+{
+	RuleIndexes &indexes = RuleIndexes::get();
+	std::lock_guard<std::mutex> guard(indexes.lock);
+	if (indexes.free.empty())
+	{
+		idx = indexes.limit++;
+	}
+	else
+	{
+		idx = indexes.free.back();
+		indexes.free.pop_back();
+	}
+}
+
+Rule::~Rule()
+{
+	RuleIndexes &indexes = RuleIndexes::get();
+	std::lock_guard<std::mutex> guard(indexes.lock);
+	indexes.free.push_back(idx);
+}
+
+std::size_t Rule::index_limit()
+{
+	RuleIndexes &indexes = RuleIndexes::get();
+	std::lock_guard<std::mutex> guard(indexes.lock);
+	return indexes.limit;
+}
+
+Rule& Rule::operator=(Rule &&r)
+{
+	expr = std::move(r.expr);
+	return *this;
+}
+
+/** constructor from rule.
+	@param r rule.
+ */
+ExprPtr::ExprPtr(const char *s) : std::shared_ptr<Expr>(new StringExpr(s)) {}
+ExprPtr::ExprPtr(const char32_t s) : std::shared_ptr<Expr>(new CharacterExpr(s)) {}
+ExprPtr::ExprPtr(const Rule &r) : std::shared_ptr<Expr>(new RuleReferenceExpr(r)) {}
+
+
+/** creates a sequence of expressions.
+	@param left left operand.
+	@param right right operand.
+	@return an expression which parses a sequence.
+ */
+ExprPtr operator >> (const ExprPtr &left, const ExprPtr &right)
+{
+	return ExprPtr(new SequenceExpr(left, right));
+}
+
+
+/** creates a choice of expressions.
+	@param left left operand.
+	@param right right operand.
+	@return an expression which parses a choice.
+ */
+ExprPtr operator | (const ExprPtr &left, const ExprPtr &right)
+{
+	return ExprPtr(new ChoiceExpr(left, right));
+}
+
+
+/** converts a parser expression into a terminal.
+	@param e expression.
+	@return an expression which parses a terminal.
+ */
+ExprPtr term(const ExprPtr &e)
+{
+	return ExprPtr(new TerminalExpr(e));
+}
+
+
+/** creates a set expression from a null-terminated string.
+	@param s null-terminated string with characters of the set.
+	@return an expression which parses a single character out of a set.
+ */
+ExprPtr set(const char *s)
+{
+	return ExprPtr(new SetExpr(s));
+}
+
+/**
+ * Creates a regex expression from the specified string.
+ */
+ExprPtr regex(const char *s)
+{
+	return ExprPtr(new RegexExpr<char>(s));
+}
+
+/**
+ * Creates a regex expression from the specified wide string.
+ */
+ExprPtr regex(const wchar_t *s)
+{
+	return ExprPtr(new RegexExpr<wchar_t>(s));
+}
+ExprPtr operator "" _R(const char *x, std::size_t len)
+{
+	return ExprPtr(new RegexExpr<char>(x, len));
+}
+
+
+/** creates a range expression.
+	@param min min character.
+	@param max max character.
+	@return an expression which parses a single character out of range.
+ */
+ExprPtr range(char32_t min, char32_t max)
+{
+	return ExprPtr(new SetExpr(min, max));
+}
+
+
+/** creates an expression which increments the line counter
+	and resets the column counter when the given expression
+	is parsed successfully; used for newline characters.
+	@param e expression to wrap into a newline parser.
+	@return an expression that handles newlines.
+ */
+ExprPtr nl(const ExprPtr &e)
+{
+	return ExprPtr(new NewlineExpr(e));
+}
+
+
+/** creates an expression which tests for the end of input.
+	@return an expression that handles the end of input.
+ */
+ExprPtr eof()
+{
+	return ExprPtr(new EndOfFileExpr());
+}
+
+
+
+/** creates an expression that parses any character.
+	@return the appropriate expression.
+ */
+ExprPtr any()
+{
+	return ExprPtr(new AnyExpr());
+}
+
+ExprPtr debug(std::function<void()> fn)
+{
+	return ExprPtr(new DebugExpr(fn));
+}
+
+ExprPtr commit()
+{
+	return ExprPtr(new CommitExpr());
+}
+
+ExprPtr defer(char32_t open, const Rule &body, char32_t close,
+              const DeferSyntax &syntax)
+{
+	return ExprPtr(new DeferExpr(open, body, close, syntax));
+}
+
+ExprPtr parallel_choice(const std::vector<ExprPtr> &alternatives,
+                        std::size_t min_span)
+{
+	assert(!alternatives.empty());
+	return ExprPtr(new ParallelChoiceExpr(alternatives, min_span));
+}
+#ifdef DEBUG_PARSING
+ExprPtr trace_debug(const char *msg, const ExprPtr e)
+{
+	return ExprPtr(new TraceExpr(msg, e));
+}
+#endif
+
+
+/** parses the given input.
+	The parse procedures of each rule parsed are executed
+	before this function returns, if parsing succeeds.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param el list of errors.
+	@param d user data, passed to the parse procedures.
+	@return true on parsing success, false on failure.
+ */
+bool parse(Input &i, const Rule &g, const Rule &ws, ErrorReporter &err,
+           const ParserDelegate &delegate, void *d)
+{
+	ParseStats stats;
+	return parse(i, g, ws, err, delegate, d, stats);
+}
+
+/**
+ * Matches the grammar `g` against the whole of the input, reporting any errors
+ * via `err`.  Returns true if the entire input matched.
+ */
+static bool _match_input(ErrorReporter &err, Context &con, const Rule &g)
+{
+	//parse initial whitespace
+	con.parse_term(con.whitespace_rule);
+
+	//parse grammar
+	if (!con.parse_non_term(g))
 	{
-		if (!con.end())
+		if (con.stats.limit_exceeded)
 		{
-			con.next_col();
-			return true;
+			_limit_Error(err, con);
+		}
+		else if (con.stopped)
+		{
+			// A parse procedure failed and has reported its own error.
+		}
+		else
+		{
+			con.stats.status = ParseStatus::SyntaxError;
+			_syntax_Error(err, con);
 		}
-		con.set_error_pos();
 		return false;
 	}
 
-	virtual void dump() const
+	//parse whitespace at the end
+	con.parse_term(con.whitespace_rule);
+
+	//if end is not reached, there was an error
+	if (!con.end())
 	{
-		fprintf(stderr, "$AnyExpr");
+		if (con.stats.limit_exceeded)
+		{
+			_limit_Error(err, con);
+		}
+		else if (con.stopped)
+		{
+			// A parse procedure failed and has reported its own error.
+		}
+		else if (con.error_pos < con.finish)
+		{
+			con.stats.status = ParseStatus::SyntaxError;
+			_syntax_Error(err, con);
+		}
+		else
+		{
+			con.stats.status = ParseStatus::UnexpectedEOF;
+			_eof_Error(err, con);
+		}
+		return false;
 	}
-};
+	return true;
+}
+
+namespace {
 /**
- * Trace expressions have no effect on parsing.  They wrap another expression
- * and log a message when parsing for it begins and ends, along with whether it
- * succeeds.
+ * When the parse procedures run.
  */
-class TraceExpr : public Expr
+enum class ProcMode
 {
 	/**
-	 * The message to log for this expression.
+	 * Once the whole input has matched.
 	 */
-	const char *message;
+	AtEnd,
 	/**
-	 * The real expression that will handle the parsing.
+	 * At commit points, as well as at the end.
 	 */
-	const ExprPtr expr;
-	void log(int depth, const char *event, const char *result, Context &con) const
-	{
-		fprintf(stderr, "[%d] ", depth);
-		for (int i=0 ; i<depth ; i++)
-		{
-			fprintf(stderr, " ");
-		}
-		fprintf(stderr, "%s %s (line %d, column %d)\n",
-		                event,
-		                result,
-		                con.position.line,
-		                con.position.col);
-	}
-public:
-#ifdef DEBUG_PARSING
-	TraceExpr(const char *m, const ExprPtr e) : message(m), expr(e) {}
-#endif
+	Incremental,
+	/**
+	 * On a worker thread, for the matches committed at commit points and for
+	 * those remaining at the end.
+	 */
+	Pipelined
+};
+}
 
-	virtual bool parse_non_term(Context &con) const
+/**
+ * Runs the parse procedures for the remaining matches of a pipelined parse on
+ * the worker, if the input matched, and waits for the worker to finish.
+ * Returns true if the input matched and all of the procedures succeeded.
+ */
+static bool _finish_pipeline(ProcPipeline &pipeline, Context &con,
+                             bool matched)
+{
+	if (matched && (con.matches.size() != con.matches.first()))
 	{
-		log(con.depth++, "Trying", message, con);
-		bool result = expr->parse_non_term(con);
-		log(--con.depth, message, result ? "succeeded" : "failed", con);
-		return result;
+		pipeline.submit(con.matches, con.handlers);
+		con.matches.discard(con.matches.size());
 	}
-	virtual bool parse_term(Context &con) const
+	bool ok = pipeline.finish(con.stats);
+	if (!ok && (con.stats.status == ParseStatus::Success))
 	{
-		log(con.depth++, "Trying", message, con);
-		bool result = expr->parse_term(con);
-		log(--con.depth, message, result ? "succeeded" : "failed", con);
-		return result;
+		con.stats.status = ParseStatus::ProcFailed;
 	}
+	return matched && ok;
+}
 
-	virtual void dump() const
+/**
+ * Parses the input using the data structures in `state`, which must be empty.
+ * If `keep_cache` is false, the memory used by the cache is freed before
+ * running the parse procedures.  The `mode` determines when the parse
+ * procedures run.
+ */
+static bool _parse(Input &i, const Rule &g, const Rule &ws, ErrorReporter &err,
+                   const ParserDelegate &delegate, void *d, ParseStats &stats,
+                   ContextState &state, bool keep_cache, ProcMode mode,
+                   std::size_t line = 1, std::size_t col = 1)
+{
+	typedef std::chrono::steady_clock clock;
+
+	//prepare context
+	Context con(i, ws, delegate, stats, state);
+	state.lines.reset(i, line, col);
+	con.incremental = (mode != ProcMode::AtEnd);
+	con.proc_data = d;
+	std::unique_ptr<ProcPipeline> pipeline;
+	if ((mode == ProcMode::Pipelined) && i.supports_concurrent_reads())
 	{
-		expr->dump();
+		pipeline.reset(new ProcPipeline(i, stats, d));
+		con.pipeline = pipeline.get();
 	}
-};
-class DebugExpr : public Expr
-{
-	std::function<void()> fn;
-public:
-	DebugExpr(std::function<void()> f) : fn(f) {}
 
-	//parse with whitespace
-	virtual bool parse_non_term(Context &) const
+	auto phase_start = clock::now();
+	bool matched = _match_input(err, con, g);
+	// Time spent running parse procedures at commit points is counted
+	// separately.
+	stats.match_time = clock::now() - phase_start - stats.proc_time;
+	if (!matched)
 	{
-		fn();
-		return true;
+		return pipeline ? _finish_pipeline(*pipeline, con, false) : false;
 	}
 
-	//parse terminal
-	virtual bool parse_term(Context &) const
+	if (keep_cache)
 	{
-		fn();
-		return true;
+		state.cache.clear();
+	}
+	else
+	{
+		state.cache.release();
+	}
+	if (pipeline)
+	{
+		return _finish_pipeline(*pipeline, con, true);
 	}
 
-	virtual void dump() const
+	//success; execute the remaining parse procedures
+	phase_start = clock::now();
+	bool ok = con.do_parse_procs(d);
+	stats.proc_time += clock::now() - phase_start;
+	if (!ok && stats.limit_exceeded)
 	{
-		fprintf(stderr, "<DEBUG: ");
-		fn();
-		fprintf(stderr, ">");
+		_limit_Error(err, con);
 	}
-};
+	return ok;
+}
 
-//constructor
-ParsingState::ParsingState(Context &con) :
-	position(con.position),
-	matches(con.matches.size())
+bool parse(Input &i, const Rule &g, const Rule &ws, ErrorReporter &err,
+           const ParserDelegate &delegate, void *d, ParseStats &stats)
 {
+	stats.reset();
+	ContextState state(stats);
+	return _parse(i, g, ws, err, delegate, d, stats, state, false,
+	              ProcMode::AtEnd);
 }
 
-static inline bool parseString(Context &con,
-                               const std::vector<char32_t> &characters)
+DeferredRegion::DeferredRegion(const InputRange &r) :
+	source(&r.begin().input()),
+	begin(r.begin().index()),
+	end(r.end().index()),
+	line(r.start.line),
+	col(r.start.col)
 {
-	for (char32_t c : characters)
+	// Refer to the input that a parser's view is of, rather than the view.
+	if (source->viewed)
 	{
-		if (con.end() || con.symbol() != c)
+		begin += source->viewed_offset;
+		end += source->viewed_offset;
+		source = source->viewed;
+	}
+	// Leave out the delimiters.
+	if (end - begin >= 2)
+	{
+		if (*r.begin() == '\n')
 		{
-			con.set_error_pos();
-			return false;
+			line++;
+			col = 1;
 		}
-		con.next_col();
+		else
+		{
+			col++;
+		}
+		begin++;
+		end--;
+	}
+	else
+	{
+		begin = end;
 	}
-	return true;
 }
-bool StringExpr::parse_non_term(Context &con) const
+
+bool DeferredRegion::parse(const Rule &body, const Rule &ws,
+                           ErrorReporter &err,
+                           const ParserDelegate &delegate, void *d,
+                           ParseStats &stats) const
 {
-	return parseString(con, characters);
+	assert(source);
+	stats.reset();
+	InputView view(*source, begin, end - begin);
+	ContextState state(stats);
+	return _parse(view, body, ws, err, delegate, d, stats, state, false,
+	              ProcMode::AtEnd, line, col);
 }
-bool StringExpr::parse_term(Context &con) const
+
+bool parse_incremental(Input &i, const Rule &g, const Rule &ws,
+                       ErrorReporter &err, const ParserDelegate &delegate,
+                       void *d)
 {
-	return parseString(con, characters);
+	ParseStats stats;
+	return parse_incremental(i, g, ws, err, delegate, d, stats);
 }
-void StringExpr::dump() const
+
+bool parse_incremental(Input &i, const Rule &g, const Rule &ws,
+                       ErrorReporter &err, const ParserDelegate &delegate,
+                       void *d, ParseStats &stats)
 {
-	fprintf(stderr, "\"");
-	for (char32_t c : characters)
-	{
-		fprintf(stderr, "%c", static_cast<char>(c));
-	}
-	fprintf(stderr, "\"");
+	stats.reset();
+	ContextState state(stats);
+	return _parse(i, g, ws, err, delegate, d, stats, state, false,
+	              ProcMode::Incremental);
 }
 
-
-
+bool parse_pipelined(Input &i, const Rule &g, const Rule &ws,
+                     ErrorReporter &err, const ParserDelegate &delegate,
+                     void *d)
+{
+	ParseStats stats;
+	return parse_pipelined(i, g, ws, err, delegate, d, stats);
 }
 
-namespace pegmatite {
-
-
-//parse non-term rule.
-bool Context::parse_non_term(const Rule &r)
+bool parse_pipelined(Input &i, const Rule &g, const Rule &ws,
+                     ErrorReporter &err, const ParserDelegate &delegate,
+                     void *d, ParseStats &stats)
 {
-	return parse_rule(r, &Context::_parse_non_term);
+	stats.reset();
+	ContextState state(stats);
+	return _parse(i, g, ws, err, delegate, d, stats, state, false,
+	              ProcMode::Pipelined);
 }
 
-bool Context::parse_rule(const Rule &r, bool (Context::*parse_func)(const Rule &))
+/**
+ * Recognises the input using the data structures in `state`, which must be
+ * empty.
+ */
+static bool _recognize(Input &i, const Rule &g, const Rule &ws,
+                       std::size_t &length, ErrorReporter &err,
+                       ParseStats &stats, ContextState &state)
 {
-	// For each rule, we maintain a vector consisting of where it was last
-	// encountered (in the input stream) and what the parsing mode was.
-	auto &states = rule_states[std::addressof(r)];
-	// If this is the first time that we've encountered this rule, then set the
-	// last position and mode to values that will trigger a normal parse: We
-	// can't be in left recursion if this is the first time that we've
-	// encountered the rule.
-	size_t last_pos = Input::npos;
-	MatchMode last_mode = PARSE;
-	if (!states.empty())
+	typedef std::chrono::steady_clock clock;
+	NullDelegate delegate;
+	Context con(i, ws, delegate, stats, state);
+	con.recognizing = true;
+
+	auto phase_start = clock::now();
+	con.parse_term(con.whitespace_rule);
+	bool matched = con.parse_non_term(g);
+	if (matched)
 	{
-		auto &last = states.back();
-		last_pos = last.position;
-		last_mode = last.mode;
+		con.parse_term(con.whitespace_rule);
 	}
-
-	// Return value (success or failure of parse)
-	bool ok;
-
-	// Compute the new position in the stream.  We're only tracking offsets to
-	// detect left recursion, not storing iterators.
-	size_t new_pos = position.it - start;
-
-	// Check if we have left recursion.  We are in a left-recursive state if
-	// the last time that we encountered this rule was at the same point in the
-	// input.
-	bool lr = new_pos == last_pos;
-
-	// Look up the current rule and parser position in the cache to see if
-	// we've been here before and successfully parsed the rule.
-	CacheKey k = { std::addressof(r), position.it };
-	auto cache_entry = cache.find(k);
-	if (cache_entry != cache.end())
+	stats.match_time = clock::now() - phase_start;
+	length = static_cast<std::size_t>(con.position - con.start);
+	if (matched && con.end())
 	{
-		// If we have a cache entry then grab the list of matched rules and the
-		// end parsing position from the cache and don't bother trying to apply
-		// the rules again.
-		auto cached_matches = cache_entry->second.second;
-		matches.insert(matches.end(), cached_matches.begin(), cached_matches.end());
-		position = cache_entry->second.first;
 		return true;
 	}
-
-	size_t new_match_index = matches.size();
-
-	switch (last_mode)
+	if (stats.limit_exceeded)
 	{
-		//normal parse
-		case PARSE:
-			if (lr)
-			{
-				//first try to parse the rule by rejecting it, so alternative
-				//branches are examined
-				states.push_back(RuleState(new_pos, REJECT));
-				ok = (this->*parse_func)(r);
-				states.pop_back();
-				break;
-			}
-			else
-			{
-				states.push_back(RuleState(new_pos, PARSE));
-				ok = (this->*parse_func)(r);
-				states.pop_back();
-			}
-			break;
-		case REJECT:
-			if (lr)
-			{
-				ok = false;
-			}
-			else
-			{
-				states.push_back(RuleState(new_pos, PARSE));
-				ok = (this->*parse_func)(r);
-				states.pop_back();
-			}
-			break;
+		if (err)
+		{
+			_limit_Error(err, con);
+		}
+		return false;
+	}
+	stats.status = ParseStatus::SyntaxError;
+	// The error position was not tracked, so match again with tracking
+	// enabled to find it.  Only failed inputs pay for this, and the work
+	// done is included in the statistics.
+	if (err)
+	{
+		state.reset();
+		Context error_con(i, ws, delegate, stats, state);
+		_match_input(err, error_con, g);
 	}
+	return false;
+}
+
+bool recognize(Input &i, const Rule &g, const Rule &ws, std::size_t &length)
+{
+	ErrorReporter err;
+	ParseStats stats;
+	return recognize(i, g, ws, length, err, stats);
+}
 
-	// If we successfully parsed the input, then cache the result.
-	if (ok)
+bool recognize(Input &i, const Rule &g, const Rule &ws, std::size_t &length,
+               ErrorReporter &err)
+{
+	ParseStats stats;
+	return recognize(i, g, ws, length, err, stats);
+}
+
+bool recognize(Input &i, const Rule &g, const Rule &ws, std::size_t &length,
+               ErrorReporter &err, ParseStats &stats)
+{
+	stats.reset();
+	ContextState state(stats);
+	return _recognize(i, g, ws, length, err, stats, state);
+}
+
+/**
+ * The statistics and data structures owned by a session.
+ */
+struct ParseSession::Impl
+{
+	/**
+	 * The statistics for the most recent parse.
+	 */
+	ParseStats stats;
+	/**
+	 * The data structures reused by each parse.
+	 */
+	ContextState state;
+	Impl() : state(stats) {}
+	/**
+	 * Prepares for a new parse.
+	 */
+	void reset()
 	{
-		// To prevent the cache growing too large, if it starts to get quite
-		// big, delete everything.  256is a mostly arbitrary number generated
-		// by running a big(ish) parse with a few different values and finding
-		// the place where the increase in memory didn't come with a noticeable
-		// speedup.
-		if (cache.size() > 256)
-		{
-			cache.clear();
-		}
-		// Insert the new cache entry
-		auto &new_cache = cache[k];
-		new_cache.first = position;
-		auto &cached_matches = new_cache.second;
-		cached_matches.clear();
-		// If there some rules were matched, record them
-		if (matches.size() > new_match_index)
-		{
-			const auto index =
-				static_cast<Input::iterator::difference_type>(new_match_index);
-			cached_matches.insert(cached_matches.begin(), matches.begin() +
-					index, matches.end());
-		}
+		state.reset();
+		stats.restart();
 	}
+};
 
-	return ok;
-}
+ParseSession::ParseSession() : impl(new Impl()) {}
 
+ParseSession::~ParseSession() {}
 
+ParseStats &ParseSession::stats()
+{
+	return impl->stats;
+}
 
-//parse term rule.
-bool Context::parse_term(const Rule &r) 
+bool ParseSession::parse(Input &i, const Rule &g, const Rule &ws,
+                         ErrorReporter &err, const ParserDelegate &delegate,
+                         void *d)
 {
-	return parse_rule(r, &Context::_parse_term);
+	impl->reset();
+	return _parse(i, g, ws, err, delegate, d, impl->stats, impl->state, true,
+	              ProcMode::AtEnd);
 }
-const bool debug_parsing = false;
 
+bool ParseSession::parse_incremental(Input &i, const Rule &g, const Rule &ws,
+                                     ErrorReporter &err,
+                                     const ParserDelegate &delegate, void *d)
+{
+	impl->reset();
+	return _parse(i, g, ws, err, delegate, d, impl->stats, impl->state, true,
+	              ProcMode::Incremental);
+}
 
-//parse non-term rule internal.
-bool Context::_parse_non_term(const Rule &r)
+bool ParseSession::recognize(Input &i, const Rule &g, const Rule &ws,
+                             std::size_t &length, ErrorReporter &err)
 {
-	bool ok;
-	if (get_parse_proc(r))
+	impl->reset();
+	return _recognize(i, g, ws, length, err, impl->stats, impl->state);
+}
+
+namespace {
+/**
+ * Input that reads an `IncrementalParser`'s text in place, as `StringInput`
+ * reads its copy.
+ */
+class TextInput : public Input
+{
+	/**
+	 * The text.
+	 */
+	const std::string &text;
+public:
+	TextInput(const std::string &t, const std::string &name) :
+		Input(name), text(t) {}
+	bool fillBuffer(Index start, Index &length, char32_t *&b) override
 	{
-		ParserPosition b = position;
-		ok = r.expr->parse_non_term(*this);
-		if (debug_parsing)
+		if (start > text.size())
 		{
-			r.expr->dump();
-			fprintf(stderr, "\n");
+			return false;
 		}
-		if (ok)
+		length = std::min(length, text.size() - start);
+		for (Index i=0 ; i<length ; i++)
 		{
-			matches.push_back(ParseMatch(std::addressof(r), b, position));
+			b[i] = static_cast<char32_t>(text[start + i]);
 		}
+		return true;
 	}
-	else
+	Index size() const override
 	{
-		ok = r.expr->parse_non_term(*this);
+		return text.size();
 	}
-	return ok;
+	bool supports_concurrent_reads() const override
+	{
+		return true;
+	}
+};
 }
 
-
-//parse term rule internal.
-bool Context::_parse_term(const Rule &r)
+/**
+ * The state that an incremental parser keeps between parses.
+ */
+struct IncrementalParser::Impl
 {
-	bool ok;
-	if (get_parse_proc(r))
-	{
-		ParserPosition b = position;
-		ok = r.expr->parse_term(*this);
-		if (ok)
-		{
-			matches.push_back(ParseMatch(std::addressof(r), b, position));
-		}
-	}
-	else
+	const Rule &grammar;
+	const Rule &whitespace;
+	ErrorReporter &err;
+	const ParserDelegate &delegate;
+	/**
+	 * The name of the input.
+	 */
+	std::string name;
+	/**
+	 * The current text.
+	 */
+	std::string text;
+	/**
+	 * The statistics for the most recent parse.
+	 */
+	ParseStats stats;
+	/**
+	 * The data structures reused by each parse.
+	 */
+	ContextState state;
+	/**
+	 * The matches of the last parse that succeeded.
+	 */
+	ReuseTable reuse;
+	Impl(const Rule &g, const Rule &ws, ErrorReporter &e,
+	     const ParserDelegate &d, const std::string &n) :
+		grammar(g), whitespace(ws), err(e), delegate(d), name(n),
+		state(stats), reuse(stats)
 	{
-		ok = r.expr->parse_term(*this);
+		state.matches.set_reusable(true);
+		state.cache.set_reusable(true);
 	}
-	return ok;
-}
+};
 
+IncrementalParser::IncrementalParser(const Rule &g, const Rule &ws,
+                                     ErrorReporter &err,
+                                     const ParserDelegate &delegate,
+                                     const std::string &name) :
+	impl(new Impl(g, ws, err, delegate, name)) {}
 
-//get the next position
-static ParserPosition _next_pos(const ParserPosition &p)
+IncrementalParser::~IncrementalParser() {}
+
+bool IncrementalParser::parse(const std::string &text, void *d)
 {
-	ParserPosition r = p;
-	++r.it;
-	++r.col;
-	return r;
+	impl->text = text;
+	// Nothing can be reused from a different text.
+	impl->reuse.clear();
+	return run(d);
 }
 
-
-//get syntax error
-static void _syntax_Error(ErrorReporter &err, Context &con)
+bool IncrementalParser::reparse(const std::vector<TextEdit> &edits, void *d)
 {
-	err(InputRange(con.error_pos, _next_pos(con.error_pos)), "syntax error");
+	for (auto &e : edits)
+	{
+		assert(e.offset + e.removed <= impl->text.size());
+		impl->text.replace(e.offset, e.removed, e.inserted);
+		impl->reuse.edit(e.offset, e.removed, e.inserted.size());
+	}
+	return run(d);
 }
 
+const std::string &IncrementalParser::text() const
+{
+	return impl->text;
+}
 
-//get eof error
-static void _eof_Error(ErrorReporter &err, Context &con)
+ParseStats &IncrementalParser::stats()
 {
-	err(InputRange(con.error_pos, con.error_pos), "EOF");
+	return impl->stats;
 }
 
-char32_t Input::slowCharacterLookup(Index n)
+bool IncrementalParser::run(void *d)
 {
-	const int back_seek = static_buffer_size / 4;
-	if (n >= size())
-	{
-		return 0;
-	}
-	// Optimise backtracking by jumping back 64 characters so subsequent
-	// forward scans are fast.
-	if (n < buffer_start)
+	typedef std::chrono::steady_clock clock;
+	Impl &p = *impl;
+	p.state.reset();
+	p.stats.restart();
+	TextInput input(p.text, p.name);
+	Context con(input, p.whitespace, p.delegate, p.stats, p.state);
+	con.reuse = &p.reuse;
+	con.proc_data = d;
+
+	auto phase_start = clock::now();
+	bool matched = _match_input(p.err, con, p.grammar);
+	p.stats.match_time = clock::now() - phase_start;
+	p.state.cache.clear();
+	if (!matched)
 	{
-		buffer_start = (n > back_seek) ? n - back_seek : 0;
+		return false;
 	}
-	else
+
+	phase_start = clock::now();
+	bool ok = con.do_parse_procs(d);
+	p.stats.proc_time = clock::now() - phase_start;
+	if (!ok && p.stats.limit_exceeded)
 	{
-		buffer_start = n;
+		_limit_Error(p.err, con);
 	}
-	Index length = static_buffer_size;
-	buffer = local_buffer;
-	if (!fillBuffer(buffer_start, length, buffer))
+	p.reuse.keep(p.state.matches, p.text.size());
+	return ok;
+}
+
+/**
+ * The state that a record parser keeps between records.
+ */
+struct RecordParser::Impl
+{
+	/**
+	 * The statistics for the records parsed so far.
+	 */
+	ParseStats stats;
+	/**
+	 * The data structures, emptied after each record.
+	 */
+	ContextState state;
+	/**
+	 * The context, whose position is the end of the last record.
+	 */
+	Context con;
+	/**
+	 * The rule that matches a record.
+	 */
+	const Rule &record;
+	/**
+	 * The callback used to report errors.
+	 */
+	ErrorReporter err;
+	/**
+	 * Set once the end of the input has been reached or an error has
+	 * stopped the parser.
+	 */
+	bool done = false;
+	/**
+	 * Set once the first record has been started.  The limits may be set
+	 * through `stats()` after the context is constructed, so the first check
+	 * is scheduled then.
+	 */
+	bool started = false;
+	Impl(Input &i, const Rule &r, const Rule &ws, ErrorReporter &e,
+	     const ParserDelegate &d) :
+		state(stats), con(i, ws, d, stats, state), record(r), err(e) {}
+	/**
+	 * Stops the parser because of an error, returning false.
+	 */
+	bool stop()
 	{
-		buffer_end = 0;
-		return 0;
+		done = true;
+		state.reset();
+		return false;
 	}
-	buffer_end = buffer_start + length;
-	assert((n >= buffer_start) && (n < buffer_end));
-	return buffer[n - buffer_start];
-}
-Input::~Input() {}
+};
 
-Input::Input(const Input& orig)
-	: user_name(orig.user_name), buffer(orig.buffer),
-	  buffer_start(orig.buffer_start), buffer_end(orig.buffer_end) {}
+RecordParser::RecordParser(Input &i, const Rule &record, const Rule &ws,
+                           ErrorReporter &err, const ParserDelegate &delegate)
+	: impl(new Impl(i, record, ws, err, delegate)) {}
 
-const std::string& Input::iterator::filename() const
-{
-	static std::string& None = *new std::string("<invalid input>");
-	return buffer ? buffer->name() : None;
-}
+RecordParser::~RecordParser() {}
 
-bool  UnicodeVectorInput::fillBuffer(Index start, Index &length, char32_t *&b)
+bool RecordParser::parse_next(void *d)
 {
-	if (start > vector.size())
+	typedef std::chrono::steady_clock clock;
+	if (impl->done)
 	{
 		return false;
 	}
-	length = vector.size() - start;
-	// The buffer can't be const because this function is allowed to write into
-	// it, but the caller guarantees that it will not write to the returned
-	// value.
-	// We should probably clean up this interface to a const char32_t* instead
-	// of a bool...
-	b = const_cast<char32_t*>(vector.data() + start);
-	return true;
-}
-Input::Index UnicodeVectorInput::size() const
-{
-	return vector.size();
-}
-
-bool  StringInput::fillBuffer(Index start, Index &length, char32_t *&b)
-{
-	if (start > str.size())
+	Context &con = impl->con;
+	ParseStats &stats = impl->stats;
+	if (!impl->started)
+	{
+		impl->started = true;
+		con.schedule_check();
+	}
+	auto phase_start = clock::now();
+	con.parse_ws();
+	if (con.end())
 	{
+		stats.match_time += clock::now() - phase_start;
+		impl->done = true;
 		return false;
 	}
-	length = std::min(length, str.size() - start);
-	std::size_t j = 0;
-	for (Index i = start; i < start + length; ++i, ++j)
+	Input::iterator record_start = con.position;
+	con.error_pos = con.position;
+	bool matched = con.parse_non_term(impl->record);
+	stats.match_time += clock::now() - phase_start;
+	if (!matched || (con.position == record_start))
 	{
-		b[j] = static_cast<char32_t>(str[i]);
+		if (stats.limit_exceeded)
+		{
+			_limit_Error(impl->err, con);
+		}
+		else if (con.error_pos < con.finish)
+		{
+			stats.status = ParseStatus::SyntaxError;
+			_syntax_Error(impl->err, con);
+		}
+		else
+		{
+			stats.status = ParseStatus::UnexpectedEOF;
+			_eof_Error(impl->err, con);
+		}
+		return impl->stop();
 	}
+
+	phase_start = clock::now();
+	bool ok = con.do_parse_procs(d);
+	stats.proc_time += clock::now() - phase_start;
+	if (!ok)
+	{
+		if (stats.limit_exceeded)
+		{
+			_limit_Error(impl->err, con);
+		}
+		return impl->stop();
+	}
+	// Nothing before the end of this record will be looked at again.
+	impl->state.reset();
+	con.lines.discard_before(con.position.index());
 	return true;
 }
-Input::Index StringInput::size() const
+
+bool RecordParser::done() const
 {
-	return str.size();
+	return impl->done;
 }
 
-AsciiFileInput::AsciiFileInput(int file, const std::string& name)
-	: Input(name), fd(file)
+ParserPosition RecordParser::position()
 {
-	struct stat buf;
-	if (fstat(fd, &buf) != 0)
-	{
-		file_size = 0;
-		perror("Input error");
-	}
-	else
-	{
-		file_size = static_cast<Index>(buf.st_size);
-	}
+	return impl->con.locate(impl->con.position);
 }
 
-const std::size_t Input::static_buffer_size;
-bool AsciiFileInput::fillBuffer(Index start, Index &length, char32_t *&b)
+ParseStats &RecordParser::stats()
 {
-	if (start > file_size)
+	return impl->stats;
+}
+
+namespace {
+/**
+ * Input that reads a range of bytes.
+ */
+class BufferInput : public Input
+{
+	/**
+	 * The bytes.
+	 */
+	const char *data;
+	/**
+	 * The number of bytes.
+	 */
+	std::size_t length;
+public:
+	BufferInput(const char *d, std::size_t l, const std::string &name) :
+		Input(name), data(d), length(l) {}
+	bool fillBuffer(Index start, Index &length, char32_t *&b) override
 	{
-		return false;
-	}
-	char buffer[static_buffer_size];
-	// This should be a no-op
-	length = std::min(length, static_buffer_size);
-	length = std::min(length, file_size - start);
-	Index bytes_to_read = length;
-	do {
-		ssize_t ret = pread(fd, buffer, length,
-		                    static_cast<off_t>(start));
-		if (ret < 1)
+		if (start > size())
 		{
 			return false;
 		}
-		bytes_to_read -= length;
-	} while (bytes_to_read > 0);
-	for (Index i=0 ; i<length ; i++)
+		length = std::min(length, size() - start);
+		for (Index i=0 ; i<length ; i++)
+		{
+			b[i] = static_cast<char32_t>(data[start + i]);
+		}
+		return true;
+	}
+	Index size() const override
+	{
+		return length;
+	}
+};
+}
+
+/**
+ * The state that a push parser keeps between pieces of input.
+ */
+struct PushParser::Impl
+{
+	/**
+	 * The statistics for the records parsed so far.
+	 */
+	ParseStats stats;
+	/**
+	 * The data structures, emptied after each record.
+	 */
+	ContextState state;
+	/**
+	 * The data received that has not yet been parsed.
+	 */
+	std::vector<char, StatsAllocator<char>> buffer;
+	/**
+	 * The line of the first byte in `buffer`.
+	 */
+	std::size_t line = 1;
+	/**
+	 * The column of the first byte in `buffer`.
+	 */
+	std::size_t col = 1;
+	/**
+	 * The size that `buffer` must reach before parsing is tried again.
+	 */
+	std::size_t retry_size = 0;
+	/**
+	 * The rule that matches a record.
+	 */
+	const Rule &record;
+	/**
+	 * The whitespace rule.
+	 */
+	const Rule &whitespace;
+	/**
+	 * The callback used to report errors.
+	 */
+	ErrorReporter err;
+	/**
+	 * The delegate that provides the parse procedures.
+	 */
+	const ParserDelegate &delegate;
+	/**
+	 * The argument for the parse procedures.
+	 */
+	void *data;
+	/**
+	 * The name of the input.
+	 */
+	std::string name;
+	/**
+	 * Set once an error has stopped the parser or `finish()` has been
+	 * called.
+	 */
+	bool done = false;
+	/**
+	 * Set if an error has stopped the parser.
+	 */
+	bool failed = false;
+	Impl(const Rule &r, const Rule &ws, ErrorReporter &e,
+	     const ParserDelegate &del, void *d, const std::string &n) :
+		state(stats),
+		buffer(StatsAllocator<char>(&stats, &stats.buffer)),
+		record(r), whitespace(ws), err(e), delegate(del), data(d), name(n) {}
+	/**
+	 * Stops the parser because of an error, returning false.
+	 */
+	bool stop()
 	{
-		b[i] = static_cast<char32_t>(buffer[i]);
+		done = true;
+		failed = true;
+		state.reset();
+		return false;
 	}
-	return true;
-}
-Input::Index AsciiFileInput::size() const
-{
-	return file_size;
-}
-
-StreamInput StreamInput::Create(const std::string& name, std::istream& s)
-{
-	const std::streamoff start = s.tellg();
-	s.seekg(0, std::ios::end);
-
-	const std::streamoff len = s.tellg() - start;
-	s.seekg(start, std::ios::beg);
+};
 
-	return StreamInput(name, s, static_cast<size_t>(len));
-}
+PushParser::PushParser(const Rule &record, const Rule &ws, ErrorReporter &err,
+                       const ParserDelegate &delegate, void *d,
+                       const std::string &name)
+	: impl(new Impl(record, ws, err, delegate, d, name)) {}
 
-StreamInput::StreamInput(const std::string& name, std::istream& s, size_t len)
-	: Input(name), length(len), stream(s)
-{
-}
+PushParser::~PushParser() {}
 
-bool StreamInput::fillBuffer(Index start, Index &len, char32_t *&b)
+bool PushParser::feed(const char *data, std::size_t length)
 {
-	if (start > length)
-	{
-		return false;
-	}
-
-	char buffer[static_buffer_size];
-	len = std::min(this->length, static_buffer_size);
-	len = std::min(len, this->length - start);
-
-	stream.seekg(static_cast<std::streamoff>(start));
-	if (not stream.good())
+	if (impl->done)
 	{
-		return false;
+		return !impl->failed;
 	}
-
-	stream.read(buffer, static_cast<std::streamsize>(len));
-	if (static_cast<Index>(stream.gcount()) != len)
+	impl->buffer.insert(impl->buffer.end(), data, data + length);
+	if (impl->stats.limit_exceeded)
 	{
-		return false;
+		BufferInput input(impl->buffer.data(), impl->buffer.size(), impl->name);
+		Context con(input, impl->whitespace, impl->delegate, impl->stats,
+		            impl->state);
+		impl->state.lines.reset(input, impl->line, impl->col);
+		_limit_Error(impl->err, con);
+		return impl->stop();
 	}
-
-	for (Index i = 0 ; i < len; i++)
+	if (impl->buffer.size() < impl->retry_size)
 	{
-		b[i] = static_cast<char32_t>(buffer[i]);
+		return true;
 	}
-
-	return true;
+	return run(false);
 }
 
-Input::Index StreamInput::size() const
+bool PushParser::feed(const std::string &data)
 {
-	return length;
+	return feed(data.data(), data.size());
 }
 
-/** constructor from input.
-	@param i input.
- */
-ParserPosition::ParserPosition(Input &i) :
-	it(i.begin()),
-	line(1),
-	col(1)
+bool PushParser::finish()
 {
+	if (impl->done)
+	{
+		return !impl->failed;
+	}
+	bool ok = run(true);
+	impl->done = true;
+	return ok;
 }
 
-/** creates a zero-or-more loop out of this expression.
-	@return a zero-or-more loop expression.
- */
-ExprPtr operator *(const ExprPtr &e)
+std::size_t PushParser::buffered() const
 {
-	return ExprPtr(new Loop0Expr(e));
+	return impl->buffer.size();
 }
 
-
-/** creates a one-or-more loop out of this expression.
-	@return a one-or-more loop expression.
- */
-ExprPtr operator +(const ExprPtr &e)
+ParseStats &PushParser::stats()
 {
-	return ExprPtr(new Loop1Expr(e));
+	return impl->stats;
 }
 
+void PushParser::record_parsed() {}
 
-/** creates an optional out of e expression.
-	@return an optional expression.
- */
-ExprPtr operator -(const ExprPtr &e)
+bool PushParser::run(bool final)
 {
-	return ExprPtr(new OptionalExpr(e));
+	typedef std::chrono::steady_clock clock;
+	BufferInput input(impl->buffer.data(), impl->buffer.size(), impl->name);
+	ParseStats &stats = impl->stats;
+	Context con(input, impl->whitespace, impl->delegate, stats, impl->state);
+	impl->state.lines.reset(input, impl->line, impl->col);
+	// The end of the last complete record.
+	Input::iterator consumed = con.position;
+	bool complete = true;
+	for (;;)
+	{
+		auto phase_start = clock::now();
+		con.error_pos = con.position;
+		con.parse_ws();
+		// As in `Generator::check()`, a match that tried to read past the
+		// end of the data may change when more data arrives.
+		if (!final && (con.end() || (con.error_pos == con.finish)))
+		{
+			stats.match_time += clock::now() - phase_start;
+			complete = false;
+			break;
+		}
+		if (con.end())
+		{
+			stats.match_time += clock::now() - phase_start;
+			consumed = con.position;
+			break;
+		}
+		Input::iterator record_start = con.position;
+		con.error_pos = con.position;
+		bool matched = con.parse_non_term(impl->record);
+		stats.match_time += clock::now() - phase_start;
+		if (!final && !stats.limit_exceeded &&
+		    ((con.position == con.finish) || (con.error_pos == con.finish)))
+		{
+			complete = false;
+			break;
+		}
+		if (!matched || (con.position == record_start))
+		{
+			if (stats.limit_exceeded)
+			{
+				_limit_Error(impl->err, con);
+			}
+			else if (con.error_pos < con.finish)
+			{
+				stats.status = ParseStatus::SyntaxError;
+				_syntax_Error(impl->err, con);
+			}
+			else
+			{
+				stats.status = ParseStatus::UnexpectedEOF;
+				_eof_Error(impl->err, con);
+			}
+			return impl->stop();
+		}
+		phase_start = clock::now();
+		bool ok = con.do_parse_procs(impl->data);
+		stats.proc_time += clock::now() - phase_start;
+		if (!ok)
+		{
+			if (stats.limit_exceeded)
+			{
+				_limit_Error(impl->err, con);
+			}
+			return impl->stop();
+		}
+		record_parsed();
+		impl->state.reset();
+		consumed = con.position;
+		con.lines.discard_before(consumed.index());
+	}
+	// The matches and the cache refer to `input`, which is about to be
+	// replaced by one over the shifted buffer, so none of them may survive.
+	impl->state.reset();
+	// Keep only the data that has not been parsed, and remember where it
+	// starts.
+	ParserPosition p = con.locate(consumed);
+	impl->line = p.line;
+	impl->col = p.col;
+	impl->buffer.erase(impl->buffer.begin(),
+		impl->buffer.begin() + static_cast<std::ptrdiff_t>(consumed.index()));
+	impl->retry_size = complete ? 0 : 2 * impl->buffer.size();
+	return true;
 }
 
-
-/** creates an AND-expression.
-	@return an AND-expression.
- */
-ExprPtr operator &(const ExprPtr &e)
+InputSplitter split_lines()
 {
-	return ExprPtr(new AndExpr(e));
+	return [](Input &i, Input::Index from) -> Input::Index
+	{
+		if (from == 0)
+		{
+			return 0;
+		}
+		Input::Index size = i.end().index();
+		Input::Index newline = i.find_newline(from - 1, size);
+		return (newline < size) ? newline + 1 : size;
+	};
 }
 
-
-/** creates a NOT-expression.
-	@return a NOT-expression.
+namespace {
+/**
+ * A chunk of the input for a split parse, and the results of matching the
+ * records in it.
  */
-ExprPtr operator !(const ExprPtr &e)
+struct SplitChunk
 {
-	return ExprPtr(new NotExpr(e));
-}
-
+	/**
+	 * The statistics for matching the chunk.
+	 */
+	ParseStats stats;
+	/**
+	 * The data structures, which hold the matches until their parse
+	 * procedures have run.
+	 */
+	ContextState state;
+	/**
+	 * The index at which the chunk starts.
+	 */
+	Input::Index begin;
+	/**
+	 * The index at which the next chunk starts.  A record that starts
+	 * before this belongs to this chunk, even if it ends after it.
+	 */
+	Input::Index limit;
+	/**
+	 * The index of the start of the first record, after any whitespace.
+	 */
+	Input::Index first = 0;
+	/**
+	 * The index after the whitespace that follows the last record, where
+	 * the next record would start.
+	 */
+	Input::Index next = 0;
+	/**
+	 * The number of matches after each record.
+	 */
+	std::vector<std::size_t> records;
+	/**
+	 * Set if a record failed to match, which stops the parse.
+	 */
+	bool failed = false;
+	/**
+	 * The furthest position reached by the record that failed to match.
+	 */
+	Input::Index error_pos = 0;
+	/**
+	 * The position at which the record that failed to match stopped.
+	 */
+	Input::Index stop_pos = 0;
+	/**
+	 * Set once the chunk has been matched.  Guarded by the parser's lock.
+	 */
+	bool matched = false;
+	/**
+	 * The exception thrown while a worker matched the chunk, which is
+	 * rethrown on the calling thread when it reaches the chunk.
+	 */
+	std::exception_ptr error;
+	/**
+	 * Constructs a chunk from `b` to `l`, using the limits in `limits`,
+	 * which must have no counters set.
+	 */
+	SplitChunk(Input::Index b, Input::Index l, const ParseStats &limits) :
+		stats(limits), state(stats), begin(b), limit(l) {}
+};
 
-/** constructor.
-	@param b begin position.
-	@param e end position.
+/**
+ * Matches the records that start in the chunk `c`, using the context `con`,
+ * whose structures are those of the chunk.
  */
-InputRange::InputRange(const ParserPosition &b, const ParserPosition &e) : start(b), finish(e) { }
-
-std::string InputRange::str() const
+void _match_chunk(Context &con, const Rule &record, SplitChunk &c)
 {
-	std::stringstream s;
-
-	for (char32_t c : *this)
+	typedef std::chrono::steady_clock clock;
+	auto start = clock::now();
+	con.position += c.begin;
+	con.parse_ws();
+	c.first = con.position.index();
+	while (!con.end() && (con.position.index() < c.limit))
 	{
-		s << static_cast<char>(c);
+		Input::iterator record_start = con.position;
+		con.error_pos = con.position;
+		if (!con.parse_non_term(record) || (con.position == record_start))
+		{
+			c.failed = true;
+			c.error_pos = con.error_pos.index();
+			c.stop_pos = con.position.index();
+			break;
+		}
+		c.records.push_back(con.matches.size());
+		// Nothing before the end of this record will be looked at again.
+		c.state.cache.clear();
+		con.parse_ws();
 	}
-
-	return s.str();
-}
-
-
-Rule::Rule(const ExprPtr e) :
-	expr(e)
-{
-}
-
-Rule& Rule::operator=(Rule &&r)
-{
-	expr = std::move(r.expr);
-	return *this;
+	c.next = con.position.index();
+	c.state.cache.release();
+	c.stats.match_time = clock::now() - start;
 }
-
-/** constructor from rule.
-	@param r rule.
- */
-ExprPtr::ExprPtr(const char *s) : std::shared_ptr<Expr>(new StringExpr(s)) {}
-ExprPtr::ExprPtr(const char32_t s) : std::shared_ptr<Expr>(new CharacterExpr(s)) {}
-ExprPtr::ExprPtr(const Rule &r) : std::shared_ptr<Expr>(new RuleReferenceExpr(r)) {}
-
-
-/** creates a sequence of expressions.
-	@param left left operand.
-	@param right right operand.
-	@return an expression which parses a sequence.
- */
-ExprPtr operator >> (const ExprPtr &left, const ExprPtr &right)
-{
-	return ExprPtr(new SequenceExpr(left, right));
 }
 
-
-/** creates a choice of expressions.
-	@param left left operand.
-	@param right right operand.
-	@return an expression which parses a choice.
+/**
+ * The configuration and statistics of a split parser, and the chunks and
+ * worker threads of the current parse.
  */
-ExprPtr operator | (const ExprPtr &left, const ExprPtr &right)
+struct SplitParser::Impl
 {
-	return ExprPtr(new ChoiceExpr(left, right));
-}
-
+	/**
+	 * The statistics for the last parse.
+	 */
+	ParseStats stats;
+	/**
+	 * The rule that matches a record.
+	 */
+	const Rule &record;
+	/**
+	 * The whitespace rule.
+	 */
+	const Rule &whitespace;
+	/**
+	 * The function that finds the positions at which to split the input.
+	 */
+	InputSplitter split;
+	/**
+	 * The callback used to report errors.
+	 */
+	ErrorReporter err;
+	/**
+	 * The delegate that provides the parse procedures.
+	 */
+	const ParserDelegate &delegate;
+	/**
+	 * The argument for the parse procedures.
+	 */
+	void *data;
+	/**
+	 * The number of threads to match chunks on, or 0 for one per core.
+	 */
+	unsigned threads;
+	/**
+	 * The approximate size of a chunk.
+	 */
+	std::size_t chunk_size;
+	/**
+	 * The chunks of the current parse.  Each is freed once the parse
+	 * procedures for its records have run.
+	 */
+	std::vector<std::unique_ptr<SplitChunk>> chunks;
+	/**
+	 * Guards the fields below, and the `matched` flags of the chunks.
+	 */
+	std::mutex lock;
+	/**
+	 * Signalled when a chunk has been matched or the calling thread has
+	 * finished with one.
+	 */
+	std::condition_variable changed;
+	/**
+	 * The index of the next chunk to be matched.
+	 */
+	std::size_t next_chunk = 0;
+	/**
+	 * The number of chunks whose parse procedures have run.  The workers
+	 * keep no more than `window` chunks ahead of this, which bounds the
+	 * memory held by matches that are waiting for their procedures.
+	 */
+	std::size_t consumed = 0;
+	/**
+	 * The number of chunks that may be matched before their procedures run.
+	 */
+	std::size_t window = 0;
+	/**
+	 * Set when the parse has stopped, so the workers take no more chunks.
+	 */
+	bool stopping = false;
+	Impl(const Rule &r, const Rule &ws, const InputSplitter &s,
+	     ErrorReporter &e, const ParserDelegate &del, void *d, unsigned t,
+	     std::size_t size) :
+		record(r), whitespace(ws), split(s), err(e), delegate(del), data(d),
+		threads(t), chunk_size(std::max<std::size_t>(size, 1)) {}
+	/**
+	 * The body of a worker thread, which matches chunks in `i` until there
+	 * are none left or the parse stops.
+	 */
+	void work(Input &i)
+	{
+		InputView view(i);
+		std::unique_lock<std::mutex> guard(lock);
+		for (;;)
+		{
+			changed.wait(guard, [&]()
+				{
+					return stopping || (next_chunk >= chunks.size()) ||
+					       (next_chunk < consumed + window);
+				});
+			if (stopping || (next_chunk >= chunks.size()))
+			{
+				return;
+			}
+			SplitChunk &c = *chunks[next_chunk++];
+			guard.unlock();
+			try
+			{
+				Context con(view, whitespace, delegate, c.stats, c.state);
+				_match_chunk(con, record, c);
+			}
+			catch (...)
+			{
+				c.error = std::current_exception();
+			}
+			guard.lock();
+			c.matched = true;
+			changed.notify_all();
+		}
+	}
+	/**
+	 * Waits for chunk `k` to be matched.
+	 */
+	void wait_for(std::size_t k)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [&]() { return chunks[k]->matched; });
+	}
+	/**
+	 * Records that the calling thread has finished with chunk `k`, or with
+	 * all of them if `stop` is true.
+	 */
+	void release(std::size_t k, bool stop)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		consumed = k + 1;
+		stopping = stop;
+		changed.notify_all();
+	}
+	/**
+	 * Stops the workers and waits for them to finish.  This runs however
+	 * the parse ends, including when a parse procedure or a match throws,
+	 * so that no worker is left running, or joinable, as the parse unwinds.
+	 */
+	void join(std::vector<std::thread> &workers)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+			changed.notify_all();
+		}
+		for (auto &t : workers)
+		{
+			t.join();
+		}
+		workers.clear();
+		chunks.clear();
+	}
+	/**
+	 * Runs the parse procedures for the records in `c`, using `con` to find
+	 * the lines and columns of their ranges.  Returns false if one fails,
+	 * with the position of `con` set to the end of its match.
+	 */
+	bool run_procs(Context &con, SplitParser &p, SplitChunk &c)
+	{
+		typedef std::chrono::steady_clock clock;
+		MatchLog &matches = c.state.matches;
+		std::size_t i = matches.first();
+		for (std::size_t end : c.records)
+		{
+			auto phase_start = clock::now();
+			for ( ; i<end ; i++)
+			{
+				const parse_proc *proc = c.state.handlers.get(matches.rule(i));
+				assert(proc && *proc);
+				bool ok = (*proc)(matches.range(i, con.start, con.lines), data);
+				if (!ok || stats.limit_exceeded)
+				{
+					if (!stats.limit_exceeded)
+					{
+						stats.status = ParseStatus::ProcFailed;
+					}
+					stats.proc_time += clock::now() - phase_start;
+					con.position = con.start;
+					con.position += matches.end(i);
+					return false;
+				}
+			}
+			stats.proc_time += clock::now() - phase_start;
+			p.record_parsed();
+		}
+		return true;
+	}
+	/**
+	 * Adds the counters and the peak memory use of `c` to the statistics.
+	 */
+	void add_stats(const SplitChunk &c)
+	{
+		stats.rule_entries += c.stats.rule_entries;
+		stats.characters_examined += c.stats.characters_examined;
+		stats.match_time += c.stats.match_time;
+		stats.peak_bytes = std::max(stats.peak_bytes,
+		                            stats.current_bytes + c.stats.peak_bytes);
+	}
+};
 
-/** converts a parser expression into a terminal.
-	@param e expression.
-	@return an expression which parses a terminal.
- */
-ExprPtr term(const ExprPtr &e)
-{
-	return ExprPtr(new TerminalExpr(e));
-}
+SplitParser::SplitParser(const Rule &record, const Rule &ws,
+                         const InputSplitter &split, ErrorReporter &err,
+                         const ParserDelegate &delegate, void *d,
+                         unsigned threads, std::size_t chunk_size)
+	: impl(new Impl(record, ws, split, err, delegate, d, threads,
+	                chunk_size)) {}
 
+SplitParser::~SplitParser() {}
 
-/** creates a set expression from a null-terminated string.
-	@param s null-terminated string with characters of the set.
-	@return an expression which parses a single character out of a set.
- */
-ExprPtr set(const char *s)
+bool SplitParser::parse(Input &i)
 {
-	return ExprPtr(new SetExpr(s));
-}
+	Impl &p = *impl;
+	ParseStats &stats = p.stats;
+	stats.reset();
+	// The chunks have their own counters, which are added to `stats` once
+	// they have been matched, so they are given only its limits.
+	const ParseStats limits = stats;
+	// Split the input.  Each split is at least a chunk after the last one.
+	Input::Index size = i.end().index();
+	std::vector<Input::Index> splits(1, 0);
+	Input::Index target = p.chunk_size;
+	while (target < size)
+	{
+		Input::Index s = p.split(i, target);
+		if (s >= size)
+		{
+			break;
+		}
+		if (s > splits.back())
+		{
+			splits.push_back(s);
+		}
+		target = std::max(target, s) + p.chunk_size;
+	}
+	p.chunks.clear();
+	for (std::size_t k=0 ; k<splits.size() ; k++)
+	{
+		Input::Index limit = (k + 1 < splits.size()) ? splits[k + 1] : size;
+		p.chunks.emplace_back(new SplitChunk(splits[k], limit, limits));
+	}
+	p.next_chunk = 0;
+	p.consumed = 0;
+	p.stopping = false;
+
+	// If there is only one chunk, or the input cannot be read by several
+	// threads, the chunks are matched on this thread, one at a time.
+	std::vector<std::thread> workers;
+	// The workers are stopped and joined when the parse returns or throws.
+	struct Joiner
+	{
+		Impl &p;
+		std::vector<std::thread> &workers;
+		~Joiner() { p.join(workers); }
+	} joiner{p, workers};
+	if ((p.chunks.size() > 1) && i.supports_concurrent_reads())
+	{
+		unsigned threads = p.threads;
+		if (threads == 0)
+		{
+			threads = std::max(1U, std::thread::hardware_concurrency());
+		}
+		threads = static_cast<unsigned>(std::min<std::size_t>(threads,
+			p.chunks.size()));
+		p.window = 2 * threads;
+		for (unsigned t=0 ; t<threads ; t++)
+		{
+			workers.emplace_back([&p, &i]() { p.work(i); });
+		}
+	}
 
-/**
- * Creates a regex expression from the specified string.
- */
-ExprPtr regex(const char *s)
-{
-	return ExprPtr(new RegexExpr<char>(s));
+	// This thread's context finds lines and columns and reports errors.
+	ContextState state(stats);
+	Context con(i, p.whitespace, p.delegate, stats, state);
+	bool ok = true;
+	Input::Index next = 0;
+	for (std::size_t k=0 ; ok && k<p.chunks.size() ; k++)
+	{
+		std::unique_ptr<SplitChunk> &chunk = p.chunks[k];
+		if (!workers.empty())
+		{
+			p.wait_for(k);
+		}
+		// Match the records on this thread, from where the last chunk's
+		// records ended, if no worker has matched them from there.
+		if (workers.empty() || ((k > 0) && (chunk->first != next)))
+		{
+			chunk.reset(new SplitChunk(next, chunk->limit, limits));
+			Context own(i, p.whitespace, p.delegate, chunk->stats,
+			            chunk->state);
+			_match_chunk(own, p.record, *chunk);
+		}
+		else if (chunk->error)
+		{
+			std::rethrow_exception(chunk->error);
+		}
+		SplitChunk &c = *chunk;
+		p.add_stats(c);
+		ok = p.run_procs(con, *this, c);
+		if (!ok)
+		{
+			if (stats.limit_exceeded)
+			{
+				_limit_Error(p.err, con);
+			}
+		}
+		else if (c.stats.limit_exceeded)
+		{
+			stats.limit_exceeded = true;
+			stats.status = c.stats.status;
+			con.position = con.start;
+			con.position += c.failed ? c.stop_pos : c.next;
+			_limit_Error(p.err, con);
+			ok = false;
+		}
+		else if (c.failed)
+		{
+			con.error_pos = con.start;
+			con.error_pos += c.error_pos;
+			if (c.error_pos < size)
+			{
+				stats.status = ParseStatus::SyntaxError;
+				_syntax_Error(p.err, con);
+			}
+			else
+			{
+				stats.status = ParseStatus::UnexpectedEOF;
+				_eof_Error(p.err, con);
+			}
+			ok = false;
+		}
+		next = c.next;
+		chunk.reset();
+		con.lines.discard_before(next);
+		if (!workers.empty())
+		{
+			p.release(k, !ok);
+		}
+	}
+	return ok;
 }
 
-/**
- * Creates a regex expression from the specified wide string.
- */
-ExprPtr regex(const wchar_t *s)
-{
-	return ExprPtr(new RegexExpr<wchar_t>(s));
-}
-ExprPtr operator "" _R(const char *x, std::size_t len)
+ParseStats &SplitParser::stats()
 {
-	return ExprPtr(new RegexExpr<char>(x, len));
+	return impl->stats;
 }
 
+void SplitParser::record_parsed() {}
 
-/** creates a range expression.
-	@param min min character.
-	@param max max character.
-	@return an expression which parses a single character out of range.
- */
-ExprPtr range(char32_t min, char32_t max)
+void ParseStats::allocated(AllocationStats &s, std::size_t bytes)
 {
-	return ExprPtr(new SetExpr(min, max));
+	s.current_bytes += bytes;
+	s.peak_bytes = std::max(s.peak_bytes, s.current_bytes);
+	s.allocations++;
+	s.largest_allocation = std::max(s.largest_allocation, bytes);
+	current_bytes += bytes;
+	peak_bytes = std::max(peak_bytes, current_bytes);
+	if ((memory_limit != 0) && (current_bytes > memory_limit) &&
+	    !limit_exceeded)
+	{
+		limit_exceeded = true;
+		status = ParseStatus::MemoryLimit;
+	}
 }
 
-
-/** creates an expression which increments the line counter
-	and resets the column counter when the given expression
-	is parsed successfully; used for newline characters.
-	@param e expression to wrap into a newline parser.
-	@return an expression that handles newlines.
- */
-ExprPtr nl(const ExprPtr &e)
+void ParseStats::deallocated(AllocationStats &s, std::size_t bytes)
 {
-	return ExprPtr(new NewlineExpr(e));
+	s.current_bytes -= bytes;
+	current_bytes -= bytes;
 }
 
-
-/** creates an expression which tests for the end of input.
-	@return an expression that handles the end of input.
- */
-ExprPtr eof()
+void ParseStats::reset()
 {
-	return ExprPtr(new EndOfFileExpr());
+	ParseStats limits;
+	limits.memory_limit = memory_limit;
+	limits.work_limit = work_limit;
+	limits.rule_entry_limit = rule_entry_limit;
+	limits.character_limit = character_limit;
+	limits.deadline = deadline;
+	limits.cancel = cancel;
+	limits.check_interval = check_interval;
+	*this = limits;
 }
 
-
-
-/** creates an expression that parses any character.
-	@return the appropriate expression.
- */
-ExprPtr any()
+void ParseStats::restart()
 {
-	return ExprPtr(new AnyExpr());
+	ParseStats previous = *this;
+	reset();
+	for (auto kept : { &ParseStats::matches, &ParseStats::cache,
+	                   &ParseStats::rule_states, &ParseStats::lines,
+	                   &ParseStats::ast_stack })
+	{
+		(this->*kept).current_bytes = (previous.*kept).current_bytes;
+		(this->*kept).peak_bytes = (previous.*kept).current_bytes;
+		current_bytes += (previous.*kept).current_bytes;
+	}
+	peak_bytes = current_bytes;
 }
 
-ExprPtr debug(std::function<void()> fn)
+void ParseStats::merge(const ParseStats &other)
 {
-	return ExprPtr(new DebugExpr(fn));
-}
-#ifdef DEBUG_PARSING
-ExprPtr trace_debug(const char *msg, const ExprPtr e)
-{
-	return ExprPtr(new TraceExpr(msg, e));
+	for (auto category : { &ParseStats::matches, &ParseStats::cache,
+	                       &ParseStats::rule_states, &ParseStats::lines,
+	                       &ParseStats::input, &ParseStats::buffer,
+	                       &ParseStats::ast_stack,
+	                       &ParseStats::ast_nodes })
+	{
+		AllocationStats &to = this->*category;
+		const AllocationStats &from = other.*category;
+		to.current_bytes += from.current_bytes;
+		to.peak_bytes += from.peak_bytes;
+		to.allocations += from.allocations;
+		to.largest_allocation = std::max(to.largest_allocation,
+		                                 from.largest_allocation);
+	}
+	current_bytes += other.current_bytes;
+	peak_bytes += other.peak_bytes;
+	if (other.limit_exceeded && !limit_exceeded)
+	{
+		limit_exceeded = true;
+		status = other.status;
+	}
 }
-#endif
-
 
-/** parses the given input.
-	The parse procedures of each rule parsed are executed
-	before this function returns, if parsing succeeds.
-	@param i input.
-	@param g root rule of grammar.
-	@param ws whitespace rule.
-	@param el list of errors.
-	@param d user data, passed to the parse procedures.
-	@return true on parsing success, false on failure.
- */
-bool parse(Input &i, const Rule &g, const Rule &ws, ErrorReporter &err,
-           const ParserDelegate &delegate, void *d)
+bool ParseStats::check_limits()
 {
-	//prepare context
-	Context con(i, ws, delegate);
-
-	//parse initial whitespace
-	con.parse_term(con.whitespace_rule);
-
-	//parse grammar
-	if (!con.parse_non_term(g))
+	if (limit_exceeded)
 	{
-		_syntax_Error(err, con);
 		return false;
 	}
-
-	//parse whitespace at the end
-	con.parse_term(con.whitespace_rule);
-
-	//if end is not reached, there was an error
-	if (!con.end())
+	if (((work_limit != 0) &&
+	     (rule_entries + characters_examined > work_limit)) ||
+	    ((rule_entry_limit != 0) && (rule_entries > rule_entry_limit)) ||
+	    ((character_limit != 0) && (characters_examined > character_limit)))
 	{
-		if (con.error_pos.it < con.finish)
-		{
-			_syntax_Error(err, con);
-		}
-		else
-		{
-			_eof_Error(err, con);
-		}
-		return false;
+		status = ParseStatus::WorkLimit;
 	}
-
-	con.clear_cache();
-
-	//success; execute the parse procedures
-	return con.do_parse_procs(d);
+	else if (cancel && cancel->load(std::memory_order_relaxed))
+	{
+		status = ParseStatus::Cancelled;
+	}
+	else if ((deadline != std::chrono::steady_clock::time_point::max()) &&
+	         (std::chrono::steady_clock::now() > deadline))
+	{
+		status = ParseStatus::DeadlineExceeded;
+	}
+	else
+	{
+		return true;
+	}
+	limit_exceeded = true;
+	return false;
 }
 
 ParserDelegate::~ParserDelegate() {}
 
+const parse_proc *ParserDelegate::find_parse_proc(const Rule &r,
+                                                  parse_proc &storage) const
+{
+	storage = get_parse_proc(r);
+	return storage ? std::addressof(storage) : nullptr;
+}
+
 static inline bool parseCharacter(Context &con, char32_t character)
 {
 	if (!con.end())
@@ -1836,6 +6164,10 @@ void CharacterExpr::dump() const
 {
 	fprintf(stderr, "'%c'", static_cast<char>(character));
 }
+void CharacterExpr::generate(Generator &g) const
+{
+	g.emit(character);
+}
 
 ExprPtr CharacterExpr::operator-(const CharacterExpr &other)
 {
@@ -1846,7 +6178,173 @@ ExprPtr CharacterExpr::operator-(char32_t other)
 	return range(character, other);
 }
 
+namespace {
+/**
+ * Input that reads the output of a generator, starting from an offset.
+ */
+class GeneratorInput : public Input
+{
+	/**
+	 * The output of the generator.
+	 */
+	const std::string &str;
+	/**
+	 * The offset of the start of this input in `str`.
+	 */
+	std::size_t offset;
+	/**
+	 * The number of characters in this input.
+	 */
+	std::size_t length;
+public:
+	GeneratorInput(const std::string &s, std::size_t o, std::size_t l) :
+		Input(std::string()), str(s), offset(o), length(l) {}
+	bool fillBuffer(Index start, Index &length, char32_t *&b) override
+	{
+		if (start > size())
+		{
+			return false;
+		}
+		length = std::min(length, size() - start);
+		for (Index i=0 ; i<length ; i++)
+		{
+			b[i] = static_cast<char32_t>(str[offset + start + i]);
+		}
+		return true;
+	}
+	Index size() const override
+	{
+		return length;
+	}
+};
+}
+
+Generator::CheckResult Generator::check(const Constraint &c)
+{
+	// Output that has already been written out can no longer be regenerated,
+	// so there is no point in checking it.
+	if (c.position < flushed)
+	{
+		return Satisfied;
+	}
+	// Only look at a bounded amount of output, so that the cost of checking
+	// does not grow with the size of the output.
+	std::size_t offset = c.position - flushed;
+	std::size_t length = std::min(buffer.size() - offset, check_window);
+	GeneratorInput input(buffer, offset, length);
+	NullDelegate delegate;
+	ParseStats stats;
+	ContextState state(stats);
+	Context con(input, whitespace, delegate, stats, state);
+	bool matched = c.term ? c.expr->parse_term(con) :
+	                        c.expr->parse_non_term(con);
+	// If the match tried to read past the end of the output, then the result
+	// may change when more is generated.  If the end is the end of the window,
+	// then we give up and assume that the constraint holds.
+	if (con.error_pos == con.finish)
+	{
+		return (length < check_window) ? Undecided : Satisfied;
+	}
+	return (matched == c.positive) ? Satisfied : Violated;
+}
+
+void PikaGrammar::match_terminals(Input &i, const Rule &ws,
+                                  const std::vector<Terminal> &terminals,
+                                  Input::Index begin, Input::Index end,
+                                  std::vector<TerminalMatch> &out,
+                                  ParseStats &stats)
+{
+	// Several threads may match terminals in the same input, so each reads
+	// it through its own view.
+	InputView view(i);
+	NullDelegate delegate;
+	ContextState state(stats);
+	Context con(view, ws, delegate, stats, state);
+	con.recognizing = true;
+	Input::iterator start = con.start;
+	for (Input::Index p=begin ; (p<=end) && !stats.limit_exceeded ; p++)
+	{
+		for (std::uint32_t t=0 ; t<terminals.size() ; t++)
+		{
+			con.position = start;
+			con.position += p;
+			const Terminal &terminal = terminals[t];
+			bool matched = terminal.term ? terminal.expr->parse_term(con) :
+			                               terminal.expr->parse_non_term(con);
+			if (matched)
+			{
+				out.push_back({ p, t, con.position.index() - p });
+			}
+		}
+		state.cache.clear();
+		if ((stats.check_interval == 0) ||
+		    ((p - begin) % stats.check_interval == 0))
+		{
+			stats.check_limits();
+		}
+	}
+}
 
+bool PikaGrammar::finish(Input &i, bool matched,
+                         const std::vector<RuleMatch> &matches,
+                         Input::Index fail_pos, ErrorReporter &err,
+                         const ParserDelegate &delegate, void *d,
+                         ParseStats &stats) const
+{
+	typedef std::chrono::steady_clock clock;
+	if (stats.limit_exceeded)
+	{
+		ContextState state(stats);
+		Context con(i, whitespace, delegate, stats, state);
+		con.position += fail_pos;
+		_limit_Error(err, con);
+		return false;
+	}
+	if (!matched)
+	{
+		// The table does not record how far each failed match got, so find
+		// the error by matching the input with the packrat parser, without
+		// recording any matches.
+		NullDelegate null;
+		ContextState state(stats);
+		Context con(i, whitespace, null, stats, state);
+		if (!_match_input(err, con, root))
+		{
+			return false;
+		}
+		// The packrat parser matched, which it can only do if the two differ
+		// in how they treat left recursion.
+		con.error_pos = con.start;
+		con.error_pos += fail_pos;
+		if (con.error_pos < con.finish)
+		{
+			stats.status = ParseStatus::SyntaxError;
+			_syntax_Error(err, con);
+		}
+		else
+		{
+			stats.status = ParseStatus::UnexpectedEOF;
+			_eof_Error(err, con);
+		}
+		return false;
+	}
+	ContextState state(stats);
+	Context con(i, whitespace, delegate, stats, state);
+	for (const RuleMatch &m : matches)
+	{
+		if (con.find_parse_proc(*m.rule))
+		{
+			con.matches.push_back(m.rule->index(), m.start, m.end);
+		}
+	}
+	auto phase_start = clock::now();
+	bool ok = con.do_parse_procs(d);
+	stats.proc_time += clock::now() - phase_start;
+	if (!ok && stats.limit_exceeded)
+	{
+		_limit_Error(err, con);
+	}
+	return ok;
+}
 
 } //namespace pegmatite
-
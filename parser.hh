@@ -29,6 +29,8 @@
 #define PEGMATITE_PARSER_HPP
 
 
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <string>
 #include <list>
@@ -42,6 +44,10 @@ namespace pegmatite {
 class Expr;
 class Context;
 class Rule;
+class Generator;
+class PikaGrammar;
+struct GeneratorEstimate;
+class InputView;
 
 
 /**
@@ -172,6 +178,10 @@ class Input
 		 * Returns the index into the input stream.
 		 */
 		Index index() const { return idx; }
+		/**
+		 * Returns the input that this iterator refers to.
+		 */
+		Input &input() const { return *buffer; }
 	};
 	/**
 	 * Returns an iterator for the start of the input.
@@ -194,6 +204,18 @@ class Input
 	{
 		return user_name;
 	}
+	/**
+	 * Returns the size, in bytes, of the character window that inputs cache.
+	 */
+	static constexpr std::size_t window_bytes()
+	{
+		return sizeof(char32_t) * static_buffer_size;
+	}
+	/**
+	 * Returns the index of the first newline character (`'\n'`) at or after
+	 * `start` and before `end`, or `end` if there is none.
+	 */
+	Index find_newline(Index start, Index end);
 	/**
 	 * Fetch the character at the specified index.  This is intended to be
 	 * inlined and returns the character from the cached buffer if possible,
@@ -220,7 +242,33 @@ class Input
 		  buffer_start(1), buffer_end(0)
 	{
 	}
+	/**
+	 * Returns true if `fillBuffer()` may be called from several threads at
+	 * once.  Each `Input` object caches a window of characters and so may
+	 * only be read by one thread, but a `pegmatite::parse_pipelined()` reads
+	 * an input that supports concurrent reads from a second thread through a
+	 * separate window.
+	 */
+	virtual bool supports_concurrent_reads() const { return false; }
 	private:
+	/**
+	 * `InputView` provides a second window onto an input, so it calls
+	 * `fillBuffer()` and `size()` on the input that it views.
+	 */
+	friend class InputView;
+	/**
+	 * `DeferredRegion` refers to the input that a view is of, which outlives
+	 * the view.
+	 */
+	friend class DeferredRegion;
+	/**
+	 * The input that this is a view of, if it is an `InputView`, or null.
+	 */
+	Input *viewed = nullptr;
+	/**
+	 * The index in `viewed` of the first character of this input.
+	 */
+	Index viewed_offset = 0;
 	/**
 	 * A user-meaningful name.
 	 * This will typically be a filename, but it doesn't have to be.
@@ -307,6 +355,10 @@ class UnicodeVectorInput : public Input
 	 * Returns the size of the vector.
 	 */
 	Index size() const override;
+	/**
+	 * The vector is never modified, so it can be read from any thread.
+	 */
+	bool supports_concurrent_reads() const override { return true; }
 };
 
 /**
@@ -323,6 +375,11 @@ struct AsciiFileInput : public Input
 	AsciiFileInput(int file, const std::string& name = "");
 	bool  fillBuffer(Index start, Index &length, char32_t *&b) override;
 	Index size() const override;
+	/**
+	 * The file is read with `pread()`, which does not move the file offset,
+	 * so it can be read from any thread.
+	 */
+	bool supports_concurrent_reads() const override { return true; }
 	private:
 	/**
 	 * The file descriptor for the file that this encapsulates.
@@ -334,6 +391,51 @@ struct AsciiFileInput : public Input
 	size_t file_size;
 };
 
+/**
+ * A concrete `Input` class that maps a file into memory.  As with
+ * `AsciiFileInput`, the file is assumed to be in ASCII.  Reading a mapped
+ * file does not need a system call each time that the parser moves to
+ * another part of it.  The file descriptor may be closed once the input has
+ * been constructed.
+ */
+struct MappedFileInput : public Input
+{
+	/**
+	 * Maps the file with the descriptor `file`.
+	 */
+	MappedFileInput(int file, const std::string& name = "");
+	/**
+	 * Unmaps the file.
+	 */
+	~MappedFileInput();
+	MappedFileInput(const MappedFileInput&) = delete;
+	MappedFileInput &operator=(const MappedFileInput&) = delete;
+	/**
+	 * Returns false if the file could not be mapped, in which case the input
+	 * is empty.
+	 */
+	bool mapped() const { return ok; }
+	bool  fillBuffer(Index start, Index &length, char32_t *&b) override;
+	Index size() const override;
+	/**
+	 * The mapping is never modified, so it can be read from any thread.
+	 */
+	bool supports_concurrent_reads() const override { return true; }
+	private:
+	/**
+	 * The start of the mapping.
+	 */
+	const char *data;
+	/**
+	 * The size of the file.
+	 */
+	size_t file_size;
+	/**
+	 * Set if the file was mapped.
+	 */
+	bool ok;
+};
+
 /** An Input that wraps a std::istream. */
 struct StreamInput : public Input
 {
@@ -395,6 +497,10 @@ class StringInput : public Input
 	 * Returns the size of the string.
 	 */
 	Index size() const override;
+	/**
+	 * The string is never modified, so it can be read from any thread.
+	 */
+	bool supports_concurrent_reads() const override { return true; }
 };
 
 template<class T>
@@ -448,11 +554,11 @@ struct ParserPosition
 	///user-meaningful filename.
 	const std::string& filename() const { return it.filename(); }
 
-	///line.
-	int line;
+	///line, starting from 1.
+	std::size_t line;
 
-	///column.
-	int col;
+	///column, starting from 1.
+	std::size_t col;
 
 	///null constructor.
 	ParserPosition() {}
@@ -582,17 +688,39 @@ public:
 	 * subclass.
 	 */
 	Rule& operator=(Rule &&);
+	/**
+	 * Destroys the rule, releasing its index for reuse.
+	 */
+	~Rule();
+	/**
+	 * Returns a small integer identifying this rule.  The indexes of all of
+	 * the rules that exist at any one time are distinct and less than
+	 * `index_limit()`, so they can be used to index tables with one entry per
+	 * rule.  The index of a destroyed rule may be reused by a new one.
+	 */
+	std::size_t index() const { return idx; }
+	/**
+	 * Returns a value greater than the index of every rule that currently
+	 * exists.
+	 */
+	static std::size_t index_limit();
 private:
 	/**
 	 * The expression that this rule invokes.
 	 */
 	ExprPtr expr;
+	/**
+	 * The index of this rule.
+	 */
+	std::size_t idx;
 
 	/**
 	 * Copying rules is not allowed.
 	 */
 
 	friend class Context;
+	friend class Generator;
+	friend class PikaGrammar;
 };
 
 /**
@@ -629,6 +757,33 @@ public:
 	 */
 	virtual void dump() const = 0;
 
+	/**
+	 * Generate a random string that this expression matches, by calling back
+	 * into the generator.  The default implementation generates nothing.
+	 */
+	virtual void generate(Generator &g) const;
+
+	/**
+	 * Estimate the cost of generating a string from this expression.  The
+	 * default implementation returns a depth of 0 and a weight of 1.
+	 */
+	virtual GeneratorEstimate estimate(Generator &g) const;
+
+	/**
+	 * Returns the clause that matches this expression in a `PikaGrammar`, by
+	 * calling back into the grammar.  The default implementation returns a
+	 * terminal clause, which matches this expression with `parse_term()` or
+	 * `parse_non_term()`.
+	 */
+	virtual std::size_t pika_clause(PikaGrammar &g, bool term) const;
+
+	/**
+	 * Adds the characters that a match of this expression can end with to
+	 * `chars`, as far as they are known.  This is used by `nl()` to find the
+	 * characters that end lines.  The default implementation adds nothing.
+	 */
+	virtual void line_ends(std::vector<char32_t> &chars) const;
+
 };
 /** creates a zero-or-more loop out of this expression.
 	@return a zero-or-more loop expression.
@@ -765,9 +920,13 @@ ExprPtr set(const wchar_t *s);
 ExprPtr range(char32_t min, char32_t max);
 
 
-/** creates an expression which increments the line counter
-	and resets the column counter when the given expression
-	is parsed successfully; used for newline characters.
+/** creates an expression which marks the given expression as a newline.
+	Line and column numbers are computed from the positions of newline
+	characters in the input when they are needed, so this does not change how
+	the expression is parsed.  Lines always end at '\n'.  If the expression
+	can end with another control character, such as '\r', then that
+	character also ends lines in every input parsed afterwards, except that
+	"\r\n" counts as a single line end.
 	@param e expression to wrap into a newline parser.
 	@return an expression that handles newlines.
  */
@@ -791,6 +950,89 @@ ExprPtr any();
  */
 ExprPtr debug(std::function<void()> fn);
 
+/**
+ * Returns a new expression that always matches the empty string and marks a
+ * commit point for `parse_incremental()`.  Iterations of loops are also
+ * commit points.
+ */
+ExprPtr commit();
+
+/**
+ * The syntax of the strings and comments inside a region that `defer()`
+ * skips.  Delimiters inside strings and comments do not count towards the
+ * balance.  Set any field to empty (or the escape character to 0) to turn
+ * that feature off.  The defaults are those of C-like languages.
+ */
+struct DeferSyntax
+{
+	/**
+	 * The characters that start and end strings.
+	 */
+	std::u32string quotes = U"\"'";
+	/**
+	 * The character that escapes the next character in a string.
+	 */
+	char32_t escape = '\\';
+	/**
+	 * The sequence that starts a comment that runs to the end of the line.
+	 */
+	std::u32string line_comment = U"//";
+	/**
+	 * The sequence that starts a block comment.
+	 */
+	std::u32string block_comment_open = U"/*";
+	/**
+	 * The sequence that ends a block comment.
+	 */
+	std::u32string block_comment_close = U"*/";
+};
+
+/**
+ * Returns a new expression that matches a region from `open` to the `close`
+ * that balances it, without parsing what lies between them.  The region is
+ * found by scanning for the delimiters, counting nested pairs and skipping
+ * the strings and comments described by `syntax`, which is much faster than
+ * parsing it.  The region's contents are meant to be parsed with `body`
+ * later, if at all: bind a parse procedure to a rule whose expression is this
+ * expression, and construct a `DeferredRegion` from the range that it is
+ * passed.
+ */
+ExprPtr defer(char32_t open, const Rule &body, char32_t close,
+              const DeferSyntax &syntax = DeferSyntax());
+
+/**
+ * Returns a new expression that matches exactly as the ordered choice between
+ * `alternatives` does, but which may match them concurrently.  Each time the
+ * choice is matched, it records how many characters each alternative
+ * examined, and ordered choice would have examined, keeping a moving
+ * average.  When the first alternative and at least one of the others are
+ * each expected to examine at least `min_span` characters, the input
+ * supports concurrent reads and the machine has more than one core, the
+ * alternatives after the first are matched speculatively by a shared pool of
+ * threads while the first is matched on the calling thread.  The first
+ * alternative, in order, that matches is taken, and the threads matching the
+ * ones after it are stopped.  This only pays for itself when several
+ * alternatives each examine a lot of input before failing; choices whose
+ * alternatives are short are matched in order, at little more than the cost
+ * of `|`.  A `min_span` of 0 matches the alternatives in parallel whenever
+ * the input supports concurrent reads, even on one core, which is mainly
+ * useful for testing.  A parallel choice within an alternative that is
+ * already being matched speculatively is matched on one thread.
+ */
+ExprPtr parallel_choice(const std::vector<ExprPtr> &alternatives,
+                        std::size_t min_span = 4096);
+
+/**
+ * Returns a new expression that matches the first of its arguments, in
+ * order, that matches.  This is `parallel_choice({first, second, rest...})`.
+ */
+template<class... Rest>
+ExprPtr parallel_choice(const ExprPtr &first, const ExprPtr &second,
+                        const Rest &...rest)
+{
+	return parallel_choice(std::vector<ExprPtr>{ first, second, rest... });
+}
+
 /**
  * Parser delegate abstract class.  Subclasses of this are responsible for
  * providing handlers for the rules in the grammar.
@@ -801,12 +1043,317 @@ struct ParserDelegate
 	 * Returns the handler for the specified rule.
 	 */
 	virtual parse_proc get_parse_proc(const Rule &) const = 0;
+	/**
+	 * Returns a pointer to the handler for the specified rule, or null if
+	 * there is none.  The parser calls this once for each rule that it
+	 * encounters during a parse and invokes the handler through the returned
+	 * pointer, rather than calling `get_parse_proc()` for every match.
+	 *
+	 * The default implementation copies the result of `get_parse_proc()` into
+	 * `storage` and returns a pointer to that.  Delegates that store their
+	 * handlers should override this to return a pointer to the stored
+	 * handler, which must remain valid until the parse finishes.
+	 */
+	virtual const parse_proc *find_parse_proc(const Rule &r,
+	                                          parse_proc &storage) const;
 	/**
 	 * Virtual destructor, for cleaning up subclasses correctly.
 	 */
 	virtual ~ParserDelegate();
 };
 
+/**
+ * Memory accounting for one of the data structures used during a parse.
+ */
+struct AllocationStats
+{
+	/**
+	 * The number of bytes currently allocated.
+	 */
+	std::size_t current_bytes = 0;
+	/**
+	 * The largest value that `current_bytes` has reached.
+	 */
+	std::size_t peak_bytes = 0;
+	/**
+	 * The number of allocations performed.
+	 */
+	std::size_t allocations = 0;
+	/**
+	 * The size of the largest single allocation.
+	 */
+	std::size_t largest_allocation = 0;
+};
+
+/**
+ * The outcome of a parse.
+ */
+enum class ParseStatus
+{
+	/**
+	 * The input matched the grammar and the parse procedures succeeded.
+	 */
+	Success,
+	/**
+	 * The input did not match the grammar.
+	 */
+	SyntaxError,
+	/**
+	 * The input ended before the grammar was matched.
+	 */
+	UnexpectedEOF,
+	/**
+	 * A parse procedure failed.
+	 */
+	ProcFailed,
+	/**
+	 * `ParseStats::memory_limit` was exceeded.
+	 */
+	MemoryLimit,
+	/**
+	 * One of the work limits in `ParseStats` was exceeded.
+	 */
+	WorkLimit,
+	/**
+	 * `ParseStats::deadline` passed before the parse finished.
+	 */
+	DeadlineExceeded,
+	/**
+	 * The parse was stopped by setting `ParseStats::cancel`.
+	 */
+	Cancelled
+};
+
+/**
+ * Statistics describing the memory and time used by a parse.  Pass an instance
+ * of this to `parse()` and it will be filled in as the parse runs.
+ *
+ * Setting `memory_limit` before the parse places a hard cap on the total
+ * number of bytes that the parser's data structures may hold.  If the cap is
+ * exceeded then the parse stops and fails with a "memory limit exceeded"
+ * error, rather than continuing to allocate.  Similarly, `work_limit`,
+ * `rule_entry_limit` and `character_limit` cap the work done by the parser,
+ * so that an input that makes a grammar backtrack excessively fails with a
+ * "work limit exceeded" error.  Setting `deadline` or `cancel` allows a parse
+ * to be stopped when it takes too long or when another thread asks.  After
+ * the parse, `status` records why it failed.
+ *
+ * The memory limit is checked on every allocation.  The other limits are
+ * checked once every `check_interval` rule entries (and as often while running
+ * the parse procedures), so that checking them costs little, and so a parse
+ * may overrun them by a small amount.
+ */
+struct ParseStats
+{
+	/**
+	 * The list of rules matched so far.
+	 */
+	AllocationStats matches;
+	/**
+	 * The memoisation cache, including the copies of matches that it holds.
+	 */
+	AllocationStats cache;
+	/**
+	 * The per-rule state used to detect left recursion.
+	 */
+	AllocationStats rule_states;
+	/**
+	 * The index of the starts of lines, used to find the line and column of
+	 * positions.
+	 */
+	AllocationStats lines;
+	/**
+	 * The character window cached by the `Input`.  This is part of the
+	 * `Input` object, so it is reported here but not counted in the totals.
+	 */
+	AllocationStats input;
+	/**
+	 * The data held by a `PushParser` that has not yet been parsed.
+	 */
+	AllocationStats buffer;
+	/**
+	 * The AST stack, when building an AST.
+	 */
+	AllocationStats ast_stack;
+	/**
+	 * The AST node objects created by `BindAST`.  Memory that the nodes
+	 * allocate themselves (for example, the contents of strings) is not
+	 * included.  Nodes constructed in an `ASTArena` are counted as the arena
+	 * allocates its blocks.
+	 */
+	AllocationStats ast_nodes;
+	/**
+	 * The number of bytes currently allocated, across all structures.
+	 */
+	std::size_t current_bytes = 0;
+	/**
+	 * The largest value that `current_bytes` has reached.
+	 */
+	std::size_t peak_bytes = 0;
+	/**
+	 * The time spent matching the grammar against the input.
+	 */
+	std::chrono::steady_clock::duration match_time =
+		std::chrono::steady_clock::duration::zero();
+	/**
+	 * The time spent running the parse procedures (for an AST parse, this
+	 * is the time spent constructing the AST).
+	 */
+	std::chrono::steady_clock::duration proc_time =
+		std::chrono::steady_clock::duration::zero();
+	/**
+	 * The number of times that a rule was entered, including entries that
+	 * were answered from the memoisation cache.
+	 */
+	std::size_t rule_entries = 0;
+	/**
+	 * The number of characters examined by terminal expressions.  A
+	 * character that is examined again after backtracking is counted again,
+	 * so the ratio of this to the input size shows how much work the
+	 * grammar repeats.
+	 */
+	std::size_t characters_examined = 0;
+	/**
+	 * The number of times that an incremental parse has run the parse
+	 * procedures at a commit point, or that a pipelined parse has handed
+	 * them to its worker thread.
+	 */
+	std::size_t commits = 0;
+	/**
+	 * The number of matches that an `IncrementalParser` reused from its
+	 * previous parse, rather than matching the input again.
+	 */
+	std::size_t reused_matches = 0;
+	/**
+	 * The maximum value permitted for `current_bytes`, or 0 for no limit.
+	 */
+	std::size_t memory_limit = 0;
+	/**
+	 * The maximum value permitted for `rule_entries + characters_examined`,
+	 * or 0 for no limit.
+	 */
+	std::size_t work_limit = 0;
+	/**
+	 * The maximum value permitted for `rule_entries`, or 0 for no limit.
+	 */
+	std::size_t rule_entry_limit = 0;
+	/**
+	 * The maximum value permitted for `characters_examined`, or 0 for no
+	 * limit.
+	 */
+	std::size_t character_limit = 0;
+	/**
+	 * The time by which the parse must finish.
+	 */
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::time_point::max();
+	/**
+	 * A flag that another thread may set to stop the parse, or null.
+	 */
+	const std::atomic<bool> *cancel = nullptr;
+	/**
+	 * The number of rule entries (or parse procedures) between checks of
+	 * the limits other than `memory_limit`.
+	 */
+	unsigned check_interval = 256;
+	/**
+	 * Set if any limit was exceeded, the deadline passed or the parse was
+	 * cancelled.  The parse stops as soon as this is set.
+	 */
+	bool limit_exceeded = false;
+	/**
+	 * The outcome of the parse.
+	 */
+	ParseStatus status = ParseStatus::Success;
+	/**
+	 * Records an allocation of `bytes` bytes for the structure `s`.
+	 */
+	void allocated(AllocationStats &s, std::size_t bytes);
+	/**
+	 * Records that `bytes` bytes have been freed from the structure `s`.
+	 */
+	void deallocated(AllocationStats &s, std::size_t bytes);
+	/**
+	 * Checks the limits other than `memory_limit`, setting `limit_exceeded`
+	 * and `status` and returning false if any has been reached.
+	 */
+	bool check_limits();
+	/**
+	 * Adds the allocations recorded in `other`, which were made at the same
+	 * time as those recorded here (for example, by another thread), to these
+	 * statistics.  The peaks are added, so the combined peak is an upper
+	 * bound.  If `other` exceeded a limit, its status is taken.
+	 */
+	void merge(const ParseStats &other);
+	/**
+	 * Resets all of the counters.  The limits are preserved.
+	 */
+	void reset();
+	/**
+	 * Resets the counters for a new parse that reuses the data structures of
+	 * the last one, as a `ParseSession` does.  The memory that those
+	 * structures still hold remains counted.
+	 */
+	void restart();
+};
+
+/**
+ * Allocator that records its allocations in a `ParseStats` object.  A
+ * default-constructed allocator records nothing.
+ */
+template<typename T>
+struct StatsAllocator
+{
+	typedef T value_type;
+	/**
+	 * The statistics object to update, or null.
+	 */
+	ParseStats *stats;
+	/**
+	 * The structure within `stats` that allocations are attributed to.
+	 */
+	AllocationStats *counter;
+	/**
+	 * Constructs an allocator that attributes its allocations to the
+	 * structure `c` within `s`.
+	 */
+	StatsAllocator(ParseStats *s = nullptr, AllocationStats *c = nullptr)
+		: stats(s), counter(c) {}
+	/**
+	 * Copy constructor from an allocator for a different type.
+	 */
+	template<typename U>
+	StatsAllocator(const StatsAllocator<U> &other)
+		: stats(other.stats), counter(other.counter) {}
+	T *allocate(std::size_t n)
+	{
+		T *p = static_cast<T*>(::operator new(n * sizeof(T)));
+		if (stats)
+		{
+			stats->allocated(*counter, n * sizeof(T));
+		}
+		return p;
+	}
+	void deallocate(T *p, std::size_t n)
+	{
+		if (stats)
+		{
+			stats->deallocated(*counter, n * sizeof(T));
+		}
+		::operator delete(p);
+	}
+	template<typename U>
+	bool operator==(const StatsAllocator<U> &other) const
+	{
+		return (stats == other.stats) && (counter == other.counter);
+	}
+	template<typename U>
+	bool operator!=(const StatsAllocator<U> &other) const
+	{
+		return !(*this == other);
+	}
+};
+
 /** parses the given input.
 	The parse procedures of each rule parsed are executed
 	before this function returns, if parsing succeeds.
@@ -820,6 +1367,555 @@ struct ParserDelegate
 bool parse(Input &i, const Rule &g, const Rule &ws, ErrorReporter &err,
            const ParserDelegate &delegate, void *d);
 
+/** parses the given input, recording memory statistics.
+	The statistics are reset at the start of the parse and then filled in
+	as it runs.  If one of the limits in `stats` is exceeded, the parse
+	fails and `stats.status` records which one.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback used to report errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse.
+	@return true on parsing success, false on failure.
+ */
+bool parse(Input &i, const Rule &g, const Rule &ws, ErrorReporter &err,
+           const ParserDelegate &delegate, void *d, ParseStats &stats);
+
+/** parses the given input, running the parse procedures as it goes.
+	When the parser reaches a commit point (the end of an iteration of a
+	loop, or a `commit()` expression) at which it can no longer backtrack,
+	the parse procedures for the matches so far are run and the matches are
+	freed.  This bounds the memory used for the matches when parsing long
+	inputs made of many records, such as `*record`, and lets the first
+	results appear before the whole input has been read.  The parser can
+	backtrack anywhere inside an enclosing choice or predicate, so only loops
+	that are not nested in those (typically the top-level one) commit.
+
+	The parse procedures run in the same order as with `parse()`, but if a
+	later part of the input fails to parse, the procedures for the matches
+	before the last commit point will already have run.  If a parse procedure
+	fails, the parse stops.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback used to report errors.
+	@param d user data, passed to the parse procedures.
+	@return true on parsing success, false on failure.
+ */
+bool parse_incremental(Input &i, const Rule &g, const Rule &ws,
+                       ErrorReporter &err, const ParserDelegate &delegate,
+                       void *d);
+
+/** parses the given input incrementally, recording statistics.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback used to report errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse.
+	@return true on parsing success, false on failure.
+ */
+bool parse_incremental(Input &i, const Rule &g, const Rule &ws,
+                       ErrorReporter &err, const ParserDelegate &delegate,
+                       void *d, ParseStats &stats);
+
+/** parses the given input, running the parse procedures on a second thread.
+	As with `parse_incremental()`, the matches before each commit point are
+	committed, but they are collected into batches that are handed to a
+	worker thread, which runs their parse procedures while this thread keeps
+	parsing.  The procedures run in the same order as with `parse()`, one at
+	a time and all on the worker thread, so a single-threaded structure such
+	as an `ASTStack` may be used as `d`.  If a parse procedure fails, the
+	parse stops at the next commit point.  If one throws, the parse stops in
+	the same way and the exception is rethrown on the calling thread.  This
+	function returns once all of the procedures for the committed matches
+	have run.
+
+	The worker reads the input through its own window, so the input must
+	support concurrent reads (see `Input::supports_concurrent_reads()`);
+	if it does not, the procedures run on this thread, as with
+	`parse_incremental()`.  The ranges that are passed to the procedures
+	refer to that window and are valid only until this function returns.
+	The procedures must not use `stats`, the delegate must not be modified
+	during the parse, and errors that the procedures report are reported
+	from the worker thread.  `stats.proc_time` is the time that the worker
+	spent running procedures, which overlaps `stats.match_time`.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback used to report errors.
+	@param d user data, passed to the parse procedures.
+	@return true on parsing success, false on failure.
+ */
+bool parse_pipelined(Input &i, const Rule &g, const Rule &ws,
+                     ErrorReporter &err, const ParserDelegate &delegate,
+                     void *d);
+
+/** parses the given input, running the parse procedures on a second thread
+	and recording statistics.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param err callback used to report errors.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse.
+	@return true on parsing success, false on failure.
+ */
+bool parse_pipelined(Input &i, const Rule &g, const Rule &ws,
+                     ErrorReporter &err, const ParserDelegate &delegate,
+                     void *d, ParseStats &stats);
+
+/** checks whether the input matches the grammar, without running any parse
+	procedures.  This is faster than `parse()`: rules are matched without
+	recording matches for the parse procedures and without tracking the
+	position of errors.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param length set to the number of characters matched.  On success, this
+		is the whole input.
+	@return true if the entire input matched.
+ */
+bool recognize(Input &i, const Rule &g, const Rule &ws, std::size_t &length);
+
+/** checks whether the input matches the grammar, as above, reporting an
+	error on failure.  The position of the error is found by matching the
+	input a second time, so only failed inputs pay for tracking it.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param length set to the number of characters matched.
+	@param err callback used to report errors.
+	@return true if the entire input matched.
+ */
+bool recognize(Input &i, const Rule &g, const Rule &ws, std::size_t &length,
+               ErrorReporter &err);
+
+/** checks whether the input matches the grammar, as above, recording
+	statistics and applying the limits in `stats`.
+	@param i input.
+	@param g root rule of grammar.
+	@param ws whitespace rule.
+	@param length set to the number of characters matched.
+	@param err callback used to report errors.
+	@param stats statistics for the parse.
+	@return true if the entire input matched.
+ */
+bool recognize(Input &i, const Rule &g, const Rule &ws, std::size_t &length,
+               ErrorReporter &err, ParseStats &stats);
+
+/**
+ * Storage that is reused by many parses.  Each call to `pegmatite::parse()`
+ * allocates the parser's data structures (the list of matches, the
+ * memoisation cache and the left-recursion state) and frees them at the end.
+ * A session keeps them between parses, emptying them in constant time, so
+ * that parsing many small inputs does not repeatedly allocate and free the
+ * same memory.  Once a session has parsed inputs of a given size, parsing
+ * more inputs like them makes no heap allocations in the parser.
+ *
+ * A session may be used by only one thread at a time.
+ */
+class ParseSession
+{
+public:
+	ParseSession();
+	virtual ~ParseSession();
+	ParseSession(const ParseSession &) = delete;
+	ParseSession &operator=(const ParseSession &) = delete;
+	/**
+	 * Returns the statistics for the most recent parse.  The limits set in
+	 * this object apply to every parse in this session.  The memory that the
+	 * session keeps between parses remains counted in the statistics.
+	 */
+	ParseStats &stats();
+	/**
+	 * Parses the input, as `pegmatite::parse()` does.
+	 */
+	bool parse(Input &i, const Rule &g, const Rule &ws, ErrorReporter &err,
+	           const ParserDelegate &delegate, void *d);
+	/**
+	 * Parses the input, as `pegmatite::parse_incremental()` does.
+	 */
+	bool parse_incremental(Input &i, const Rule &g, const Rule &ws,
+	                       ErrorReporter &err, const ParserDelegate &delegate,
+	                       void *d);
+	/**
+	 * Checks whether the input matches the grammar, as
+	 * `pegmatite::recognize()` does.
+	 */
+	bool recognize(Input &i, const Rule &g, const Rule &ws,
+	               std::size_t &length, ErrorReporter &err);
+private:
+	struct Impl;
+	/**
+	 * The reused state.
+	 */
+	std::unique_ptr<Impl> impl;
+};
+
+/**
+ * A parser that reads an input one record at a time.  Each call to
+ * `parse_next()` skips whitespace, matches the record rule from the current
+ * position, runs the parse procedures for the record and returns, so that the
+ * caller can process each record before the next one is parsed.  Unlike
+ * `parse()`, the record rule does not need to match the whole input.
+ *
+ * The matches, the memoisation cache and the line starts for a record are
+ * discarded once it has been parsed, so the memory used does not grow with
+ * the number of records.  The statistics accumulate over all of the records,
+ * and the limits apply to the whole input.
+ *
+ * The input, the rules, the delegate and the error reporter's target must
+ * outlive the parser.  A record parser may be used by only one thread at a
+ * time.
+ */
+class RecordParser
+{
+public:
+	/**
+	 * Prepares to parse `i` as a sequence of `record`s separated by `ws`,
+	 * reporting errors via `err` and running the parse procedures from
+	 * `delegate`.
+	 */
+	RecordParser(Input &i, const Rule &record, const Rule &ws,
+	             ErrorReporter &err, const ParserDelegate &delegate);
+	virtual ~RecordParser();
+	RecordParser(const RecordParser &) = delete;
+	RecordParser &operator=(const RecordParser &) = delete;
+	/**
+	 * Parses the next record, passing `d` to its parse procedures.  Returns
+	 * true if a record was parsed and all of its procedures succeeded.
+	 * Returns false at the end of the input, with `stats().status` set to
+	 * `ParseStatus::Success`, or on an error, which is reported via the
+	 * error reporter and stops the parser.  A record that matches no input
+	 * is reported as a syntax error, because it would never advance.
+	 */
+	bool parse_next(void *d);
+	/**
+	 * Returns true once the end of the input has been reached or an error
+	 * has stopped the parser.
+	 */
+	bool done() const;
+	/**
+	 * Returns the position after the last record parsed.
+	 */
+	ParserPosition position();
+	/**
+	 * Returns the statistics for the records parsed so far.  Limits must be
+	 * set before the first call to `parse_next()`.
+	 */
+	ParseStats &stats();
+private:
+	struct Impl;
+	/**
+	 * The parser's state between records.
+	 */
+	std::unique_ptr<Impl> impl;
+};
+
+/**
+ * A parser for input that arrives in pieces, such as a document received
+ * over a network.  The input is a sequence of records separated by
+ * whitespace, as with `RecordParser`.  Each call to `feed()` parses all of
+ * the records that the data received so far completes and runs their parse
+ * procedures, and `finish()` parses the rest once there is no more data.
+ *
+ * The parser cannot stop in the middle of a rule, so a record that reaches
+ * the end of the data received so far is parsed again from its start once
+ * more data arrives.  A record is complete only if parsing it did not look
+ * at the end of the data, so a record whose extent depends on what follows
+ * it is not parsed until that arrives.  Only the data from the start of the
+ * incomplete record onwards is kept.  To avoid parsing a long record many
+ * times, an incomplete record is retried only once the data after its start
+ * has doubled in size since the last attempt.
+ *
+ * The ranges passed to the parse procedures are valid only while they run.
+ * Their line and column numbers count from the start of all of the data
+ * fed to the parser.  `stats().memory_limit`, if set, also limits the data
+ * buffered for an incomplete record.
+ */
+class PushParser
+{
+public:
+	/**
+	 * Prepares to parse a sequence of `record`s separated by `ws`, reporting
+	 * errors via `err` and running the parse procedures from `delegate` with
+	 * the argument `d`.  The `name` is used as the name of the input.
+	 */
+	PushParser(const Rule &record, const Rule &ws, ErrorReporter &err,
+	           const ParserDelegate &delegate, void *d,
+	           const std::string &name = "");
+	virtual ~PushParser();
+	PushParser(const PushParser &) = delete;
+	PushParser &operator=(const PushParser &) = delete;
+	/**
+	 * Appends `length` bytes of `data` to the input and parses the records
+	 * that they complete.  Returns false if an error, which is reported via
+	 * the error reporter, has stopped the parser.
+	 */
+	bool feed(const char *data, std::size_t length);
+	/**
+	 * Appends `data` to the input, as above.
+	 */
+	bool feed(const std::string &data);
+	/**
+	 * Parses the remaining records, now that there is no more data.  Returns
+	 * true if all of the input was parsed and all of the parse procedures
+	 * succeeded.
+	 */
+	bool finish();
+	/**
+	 * Returns the number of bytes received that have not yet been parsed.
+	 */
+	std::size_t buffered() const;
+	/**
+	 * Returns the statistics for the records parsed so far.
+	 */
+	ParseStats &stats();
+protected:
+	/**
+	 * Called after the parse procedures for each record have run.
+	 */
+	virtual void record_parsed();
+private:
+	struct Impl;
+	/**
+	 * The parser's state between pieces of input.
+	 */
+	std::unique_ptr<Impl> impl;
+	/**
+	 * Parses as many records as possible.  If `final` is true, there is no
+	 * more data, so all of the records must be complete.
+	 */
+	bool run(bool final);
+};
+
+/**
+ * A change to a text: `removed` characters starting at `offset` are replaced
+ * by `inserted`.
+ */
+struct TextEdit
+{
+	/**
+	 * The offset of the first character changed.
+	 */
+	std::size_t offset;
+	/**
+	 * The number of characters removed.
+	 */
+	std::size_t removed;
+	/**
+	 * The text inserted in their place.
+	 */
+	std::string inserted;
+};
+
+/**
+ * A parser for a text that is parsed again after each edit, as in an editor.
+ * Each parse keeps its matches, along with how far past the start of each
+ * one the parser looked to make it.  `reparse()` applies a list of edits to
+ * the text and parses it again, reusing every match of a rule with a parse
+ * procedure whose examined input was not changed, so that only the matches
+ * around the edits are made again.  The parse procedures then run for all of
+ * the matches, as they do after `parse()`.
+ *
+ * The text is read as one character per byte, as `StringInput` reads it.  If
+ * a parse fails, the matches from the last parse that succeeded are kept for
+ * the next one.  The rules, the delegate and the error reporter's target must
+ * outlive the parser.  An incremental parser may be used by only one thread
+ * at a time.
+ */
+class IncrementalParser
+{
+public:
+	/**
+	 * Prepares to parse texts with the grammar `g` and the whitespace rule
+	 * `ws`, reporting errors via `err` and running the parse procedures from
+	 * `delegate`.  The `name` is used as the name of the input.
+	 */
+	IncrementalParser(const Rule &g, const Rule &ws, ErrorReporter &err,
+	                  const ParserDelegate &delegate,
+	                  const std::string &name = "");
+	virtual ~IncrementalParser();
+	IncrementalParser(const IncrementalParser &) = delete;
+	IncrementalParser &operator=(const IncrementalParser &) = delete;
+	/**
+	 * Replaces the text with `text` and parses all of it, running the parse
+	 * procedures with the argument `d`.  Returns true if the text matched
+	 * and the parse procedures succeeded.
+	 */
+	bool parse(const std::string &text, void *d);
+	/**
+	 * Applies `edits` to the text, in order, so that the offset of each
+	 * refers to the text left by the ones before it, and parses the text
+	 * again, as `parse()` does.  Each edit must lie within the text.
+	 */
+	bool reparse(const std::vector<TextEdit> &edits, void *d);
+	/**
+	 * Returns the current text.
+	 */
+	const std::string &text() const;
+	/**
+	 * Returns the statistics for the most recent parse.  The limits set in
+	 * this object apply to every parse.
+	 */
+	ParseStats &stats();
+private:
+	struct Impl;
+	/**
+	 * The text and the matches kept between parses.
+	 */
+	std::unique_ptr<Impl> impl;
+	/**
+	 * Parses the current text.
+	 */
+	bool run(void *d);
+};
+
+/**
+ * A function that finds a place where an input can be split for a
+ * `SplitParser`.  Given an index `from` in the input, it returns the index of
+ * the first position at or after `from` at which a record may start, or the
+ * size of the input if there is none.  It is only a hint: a record that
+ * turns out to cross the returned position is still parsed correctly, but
+ * the work done in parallel after it is wasted.
+ */
+typedef std::function<Input::Index(Input &i, Input::Index from)> InputSplitter;
+
+/**
+ * Returns a splitter that splits the input at the start of a line, for
+ * inputs in which each record starts on a new line, such as JSON Lines, CSV
+ * or log files.
+ */
+InputSplitter split_lines();
+
+/**
+ * A parser that parses a large input on several threads.  The input is a
+ * sequence of records separated by whitespace, as with `RecordParser`.  It
+ * is split into chunks at the positions found by a splitter, and the records
+ * in each chunk are matched on a worker thread, in a context of their own.
+ * The matches for the chunks are then joined in order, and the parse
+ * procedures for each record run on the calling thread, while later chunks
+ * are still being matched.
+ *
+ * The parse procedures and any error are the same as those of a
+ * `RecordParser` reading the same input.  A chunk is only used if it starts
+ * where the records in the chunk before it end.  When the splitter picks a
+ * position in the middle of a record, the records from the end of the chunk
+ * before it are matched again on the calling thread.
+ *
+ * If the input does not support concurrent reads, the chunks are matched
+ * one at a time on the calling thread.  The limits in the statistics apply
+ * to each chunk separately, and `stats().peak_bytes` includes the largest
+ * chunk, but not the other chunks waiting for their parse procedures.
+ */
+class SplitParser
+{
+public:
+	/**
+	 * Prepares to parse sequences of `record`s separated by `ws`, split with
+	 * `split`, reporting errors via `err` and running the parse procedures
+	 * from `delegate` with the argument `d`.  The input is split into chunks
+	 * of about `chunk_size` characters, which are matched by `threads`
+	 * threads, or one per core if `threads` is 0.
+	 */
+	SplitParser(const Rule &record, const Rule &ws, const InputSplitter &split,
+	            ErrorReporter &err, const ParserDelegate &delegate, void *d,
+	            unsigned threads = 0, std::size_t chunk_size = 1 << 20);
+	virtual ~SplitParser();
+	SplitParser(const SplitParser &) = delete;
+	SplitParser &operator=(const SplitParser &) = delete;
+	/**
+	 * Parses all of the records in `i`.  Returns true if all of them were
+	 * parsed and all of their parse procedures succeeded.  On an error, the
+	 * procedures for the records before it have already run.  An exception
+	 * thrown by a procedure, or while a worker matches a chunk, is rethrown
+	 * here once the workers have stopped.
+	 */
+	bool parse(Input &i);
+	/**
+	 * Returns the statistics for the last parse.  The match time is the
+	 * total for all of the threads.
+	 */
+	ParseStats &stats();
+protected:
+	/**
+	 * Called after the parse procedures for each record have run.
+	 */
+	virtual void record_parsed();
+private:
+	struct Impl;
+	/**
+	 * The parser's configuration and statistics.
+	 */
+	std::unique_ptr<Impl> impl;
+};
+
+/**
+ * A region of an input that a `defer()` expression skipped, which can be
+ * parsed later with the body rule that was passed to `defer()`.  The input
+ * must outlive the region.  Regions in an input that supports concurrent
+ * reads may be parsed on several threads at once.
+ */
+class DeferredRegion
+{
+public:
+	/**
+	 * Constructs an empty region.
+	 */
+	DeferredRegion() {}
+	/**
+	 * Records the region matched by a rule whose expression is a `defer()`
+	 * expression, from the range passed to that rule's parse procedure.  The
+	 * region to parse is the range without its delimiters.  If the range
+	 * refers to a window that the parser opened onto the input, as in
+	 * `pegmatite::parse_pipelined()`, then the region refers to the input
+	 * itself, so it remains valid after the parse.
+	 */
+	DeferredRegion(const InputRange &r);
+	/**
+	 * Parses the region with `body` as the root rule and `ws` as the
+	 * whitespace rule, reporting errors via `err` and running the parse
+	 * procedures from `delegate` with the argument `d`.  The ranges passed
+	 * to the procedures, and any errors, have the line and column numbers of
+	 * the whole input.  Returns true if the whole region matched and the
+	 * procedures succeeded.
+	 */
+	bool parse(const Rule &body, const Rule &ws, ErrorReporter &err,
+	           const ParserDelegate &delegate, void *d,
+	           ParseStats &stats) const;
+	/**
+	 * Returns the input that contains the region, or null for an empty
+	 * region.
+	 */
+	Input *input() const { return source; }
+	/**
+	 * Returns the number of characters in the region.
+	 */
+	Input::Index size() const { return end - begin; }
+private:
+	/**
+	 * The input that contains the region.
+	 */
+	Input *source = nullptr;
+	/**
+	 * The index in the input of the first character of the region.
+	 */
+	Input::Index begin = 0;
+	/**
+	 * The index in the input after the last character of the region.
+	 */
+	Input::Index end = 0;
+	/**
+	 * The line of the first character of the region.
+	 */
+	std::size_t line = 1;
+	/**
+	 * The column of the first character of the region.
+	 */
+	std::size_t col = 1;
+};
 
 /** output the specific input range to the specific stream.
 	@param stream stream.
@@ -28,4 +28,8 @@
 #define PEGMATITE_HPP
 #include "parser.hh"
 #include "ast.hh"
+#include "generator.hh"
+#include "fuzzer.hh"
+#include "pool.hh"
+#include "pika.hh"
 #endif //PEGMATITE_HPP
@@ -0,0 +1,1044 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <queue>
+#include <thread>
+#include "pika.hh"
+
+namespace pegmatite {
+
+namespace {
+/**
+ * The kinds of clause in a compiled grammar.
+ */
+enum class ClauseKind
+{
+	/**
+	 * An expression matched directly against the input.
+	 */
+	Terminal,
+	/**
+	 * Each subclause in turn.
+	 */
+	Sequence,
+	/**
+	 * The first subclause that matches.
+	 */
+	First,
+	/**
+	 * The subclause, as many times as possible, and at least once.
+	 */
+	OneOrMore,
+	/**
+	 * Matches nothing if the subclause matches.
+	 */
+	FollowedBy,
+	/**
+	 * Matches nothing if the subclause does not match.
+	 */
+	NotFollowedBy,
+	/**
+	 * Always matches nothing.
+	 */
+	Empty,
+	/**
+	 * A rule, whose body is the subclause.
+	 */
+	Rule
+};
+
+/**
+ * A clause in a compiled grammar.
+ */
+struct Clause
+{
+	/**
+	 * The kind of clause.
+	 */
+	ClauseKind kind;
+	/**
+	 * The subclauses.  A sequence has at most three: two expressions and the
+	 * whitespace between them.
+	 */
+	std::vector<std::uint32_t> subs;
+	/**
+	 * For a terminal, its index in the list of terminals.
+	 */
+	std::uint32_t terminal = 0;
+	/**
+	 * For a rule clause, the rule.
+	 */
+	const pegmatite::Rule *rule = nullptr;
+	/**
+	 * Set if the clause can match without consuming any input.
+	 */
+	bool can_match_zero = false;
+	/**
+	 * The position of the clause in bottom-up order: subclauses come before
+	 * the clauses that contain them, except where the grammar is recursive.
+	 */
+	std::uint32_t order = 0;
+	/**
+	 * The clauses that a match of this clause may start, and which must be
+	 * matched again at the same position when this one's match improves.
+	 */
+	std::vector<std::uint32_t> seed_parents;
+	Clause(ClauseKind k, std::vector<std::uint32_t> s = {}) :
+		kind(k), subs(std::move(s)) {}
+};
+
+/**
+ * The longest sequence.
+ */
+const std::size_t max_subs = 3;
+
+/**
+ * A match of a clause.  Matches are never changed once they have been
+ * stored: a better match for the same clause at the same position is stored
+ * as a new match, so the matches that refer to the old one remain valid.
+ */
+struct Match
+{
+	/**
+	 * The clause that matched.
+	 */
+	std::uint32_t clause;
+	/**
+	 * For a `First` clause, the index of the subclause that matched.
+	 */
+	std::uint16_t alternative;
+	/**
+	 * The number of entries in `subs` that are used.
+	 */
+	std::uint16_t sub_count;
+	/**
+	 * The index in the input of the start of the match.
+	 */
+	Input::Index start;
+	/**
+	 * The number of characters matched.
+	 */
+	Input::Index length;
+	/**
+	 * The matches of the subclauses, as indexes of stored matches.
+	 */
+	std::size_t subs[max_subs];
+};
+}
+
+/**
+ * The clauses of a compiled grammar.
+ */
+struct PikaGrammar::Impl
+{
+	/**
+	 * The clauses, indexed by the values returned from the builder methods.
+	 */
+	std::vector<Clause> clauses;
+	/**
+	 * The expressions of the terminal clauses.
+	 */
+	std::vector<Terminal> terminals;
+	/**
+	 * The clause for each terminal.
+	 */
+	std::vector<std::uint32_t> terminal_clauses;
+	/**
+	 * The clauses that have been compiled, keyed by the expression or rule
+	 * that they match and the mode.
+	 */
+	std::map<std::pair<const void*, bool>, std::uint32_t> compiled;
+	/**
+	 * The clause that matches nothing.
+	 */
+	std::uint32_t empty;
+	/**
+	 * The clause for the whitespace rule.
+	 */
+	std::uint32_t whitespace = 0;
+	/**
+	 * The clause for the root rule.
+	 */
+	std::uint32_t root = 0;
+	/**
+	 * The clause for the whole input: the root rule, with whitespace before
+	 * and after it.
+	 */
+	std::uint32_t top = 0;
+	Impl() : empty(add(ClauseKind::Empty)) {}
+	/**
+	 * Adds a clause, returning its index.
+	 */
+	std::uint32_t add(ClauseKind k, std::vector<std::uint32_t> subs = {})
+	{
+		assert(subs.size() <= max_subs);
+		clauses.emplace_back(k, std::move(subs));
+		return static_cast<std::uint32_t>(clauses.size() - 1);
+	}
+	/**
+	 * Assigns the clauses their bottom-up order, starting from `c`, where
+	 * `visited` records the clauses that have been seen and `next` is the
+	 * next position to assign.
+	 */
+	void assign_order(std::uint32_t c, std::vector<bool> &visited,
+	                  std::uint32_t &next)
+	{
+		visited[c] = true;
+		for (std::uint32_t s : clauses[c].subs)
+		{
+			if (!visited[s])
+			{
+				assign_order(s, visited, next);
+			}
+		}
+		clauses[c].order = next++;
+	}
+	/**
+	 * Finds the clauses that can match nothing, given that the terminals
+	 * that can do so are already marked.
+	 */
+	void find_empty_matches()
+	{
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (Clause &c : clauses)
+			{
+				if (c.can_match_zero)
+				{
+					continue;
+				}
+				bool zero = false;
+				switch (c.kind)
+				{
+					case ClauseKind::Terminal:
+						break;
+					case ClauseKind::Sequence:
+						zero = std::all_of(c.subs.begin(), c.subs.end(),
+							[&](std::uint32_t s)
+							{ return clauses[s].can_match_zero; });
+						break;
+					case ClauseKind::First:
+						zero = std::any_of(c.subs.begin(), c.subs.end(),
+							[&](std::uint32_t s)
+							{ return clauses[s].can_match_zero; });
+						break;
+					case ClauseKind::OneOrMore:
+					case ClauseKind::Rule:
+						zero = clauses[c.subs[0]].can_match_zero;
+						break;
+					case ClauseKind::FollowedBy:
+					case ClauseKind::NotFollowedBy:
+					case ClauseKind::Empty:
+						zero = true;
+						break;
+				}
+				if (zero)
+				{
+					c.can_match_zero = true;
+					changed = true;
+				}
+			}
+		}
+	}
+	/**
+	 * Records, for each clause, the clauses whose matches it can start.  A
+	 * sequence can be started by each of its subclauses up to the first one
+	 * that cannot match nothing.  A negative lookahead is never started by
+	 * its subclause: it is matched when it is looked up.
+	 */
+	void find_seed_parents()
+	{
+		for (std::uint32_t p=0 ; p<clauses.size() ; p++)
+		{
+			const Clause &parent = clauses[p];
+			if (parent.kind == ClauseKind::NotFollowedBy)
+			{
+				continue;
+			}
+			for (std::uint32_t s : parent.subs)
+			{
+				std::vector<std::uint32_t> &seeds = clauses[s].seed_parents;
+				if (std::find(seeds.begin(), seeds.end(), p) == seeds.end())
+				{
+					seeds.push_back(p);
+				}
+				if ((parent.kind == ClauseKind::Sequence) &&
+				    !clauses[s].can_match_zero)
+				{
+					break;
+				}
+			}
+		}
+	}
+};
+
+std::size_t Expr::pika_clause(PikaGrammar &g, bool term) const
+{
+	return g.terminal(*this, term);
+}
+
+PikaGrammar::PikaGrammar(const Rule &g, const Rule &ws) :
+	root(g), whitespace(ws), impl(new Impl())
+{
+	impl->whitespace = static_cast<std::uint32_t>(rule(ws, true));
+	impl->root = static_cast<std::uint32_t>(rule(g, false));
+	impl->top = impl->add(ClauseKind::Sequence,
+		{ impl->whitespace, impl->root, impl->whitespace });
+
+	// A terminal that matches at the end of an empty input matches nothing.
+	StringInput empty("");
+	std::vector<TerminalMatch> found;
+	ParseStats stats;
+	match_terminals(empty, ws, impl->terminals, 0, 0, found, stats);
+	for (const TerminalMatch &m : found)
+	{
+		impl->clauses[impl->terminal_clauses[m.terminal]].can_match_zero = true;
+	}
+	impl->find_empty_matches();
+	impl->find_seed_parents();
+	std::vector<bool> visited(impl->clauses.size());
+	std::uint32_t next = 0;
+	for (std::uint32_t c=0 ; c<impl->clauses.size() ; c++)
+	{
+		if (!visited[c])
+		{
+			impl->assign_order(c, visited, next);
+		}
+	}
+}
+
+PikaGrammar::~PikaGrammar() {}
+
+std::size_t PikaGrammar::size() const
+{
+	return impl->clauses.size();
+}
+
+std::size_t PikaGrammar::clause(const Expr &e, bool term)
+{
+	auto key = std::make_pair(static_cast<const void*>(std::addressof(e)),
+	                          term);
+	auto found = impl->compiled.find(key);
+	if (found != impl->compiled.end())
+	{
+		return found->second;
+	}
+	std::uint32_t c = static_cast<std::uint32_t>(e.pika_clause(*this, term));
+	impl->compiled[key] = c;
+	return c;
+}
+
+std::size_t PikaGrammar::terminal(const Expr &e, bool term)
+{
+	std::uint32_t c = impl->add(ClauseKind::Terminal);
+	impl->clauses[c].terminal =
+		static_cast<std::uint32_t>(impl->terminals.size());
+	impl->terminals.push_back({ &e, term });
+	impl->terminal_clauses.push_back(c);
+	return c;
+}
+
+std::size_t PikaGrammar::sequence(const Expr &left, const Expr &right,
+                                  bool term)
+{
+	std::uint32_t l = static_cast<std::uint32_t>(clause(left, term));
+	std::uint32_t r = static_cast<std::uint32_t>(clause(right, term));
+	if (term)
+	{
+		return impl->add(ClauseKind::Sequence, { l, r });
+	}
+	return impl->add(ClauseKind::Sequence, { l, impl->whitespace, r });
+}
+
+std::size_t PikaGrammar::choice(const Expr &left, const Expr &right,
+                                bool term)
+{
+	std::uint32_t l = static_cast<std::uint32_t>(clause(left, term));
+	std::uint32_t r = static_cast<std::uint32_t>(clause(right, term));
+	return impl->add(ClauseKind::First, { l, r });
+}
+
+std::size_t PikaGrammar::repeat(const Expr &e, unsigned min, bool term)
+{
+	// As in the packrat parser, a non-terminal loop matches whitespace before
+	// each repetition, and keeps the whitespace before the one that fails.
+	std::uint32_t body = static_cast<std::uint32_t>(clause(e, term));
+	if (!term)
+	{
+		body = impl->add(ClauseKind::Sequence, { impl->whitespace, body });
+	}
+	std::uint32_t loop = impl->add(ClauseKind::OneOrMore, { body });
+	if (min == 0)
+	{
+		loop = impl->add(ClauseKind::First, { loop, impl->empty });
+	}
+	if (!term)
+	{
+		loop = impl->add(ClauseKind::Sequence, { loop, impl->whitespace });
+	}
+	return loop;
+}
+
+std::size_t PikaGrammar::optional(const Expr &e, bool term)
+{
+	std::uint32_t c = static_cast<std::uint32_t>(clause(e, term));
+	return impl->add(ClauseKind::First, { c, impl->empty });
+}
+
+std::size_t PikaGrammar::lookahead(const Expr &e, bool positive, bool term)
+{
+	std::uint32_t c = static_cast<std::uint32_t>(clause(e, term));
+	return impl->add(positive ? ClauseKind::FollowedBy :
+	                            ClauseKind::NotFollowedBy, { c });
+}
+
+std::size_t PikaGrammar::rule(const Rule &r, bool term)
+{
+	auto key = std::make_pair(static_cast<const void*>(std::addressof(r)),
+	                          term);
+	auto found = impl->compiled.find(key);
+	if (found != impl->compiled.end())
+	{
+		return found->second;
+	}
+	// Register the rule before compiling its body, which may refer to it.
+	std::uint32_t c = impl->add(ClauseKind::Rule);
+	impl->clauses[c].rule = std::addressof(r);
+	impl->compiled[key] = c;
+	std::uint32_t body = static_cast<std::uint32_t>(clause(*r.expr.get(), term));
+	impl->clauses[c].subs.push_back(body);
+	return c;
+}
+
+namespace {
+/**
+ * A map from a clause and a position to the index of a match, with open
+ * addressing.  A parse stores millions of entries, and looks them up far more
+ * often, so this avoids allocating a node for each entry.
+ */
+class MemoTable
+{
+	/**
+	 * An entry in the table.
+	 */
+	struct Slot
+	{
+		std::uint64_t key;
+		std::size_t value;
+	};
+	/**
+	 * The key of an empty slot.
+	 */
+	static const std::uint64_t unused = static_cast<std::uint64_t>(-1);
+	/**
+	 * The slots.  The number is a power of two.
+	 */
+	std::vector<Slot, StatsAllocator<Slot>> slots;
+	/**
+	 * The number of slots that are in use.
+	 */
+	std::size_t used = 0;
+	/**
+	 * The number of bits in the index of a slot.
+	 */
+	unsigned bits = 0;
+	/**
+	 * Returns the slot where the search for `key` starts.
+	 */
+	std::size_t home(std::uint64_t key) const
+	{
+		return static_cast<std::size_t>(
+			(key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits));
+	}
+	/**
+	 * Doubles the number of slots.
+	 */
+	void grow()
+	{
+		std::vector<Slot, StatsAllocator<Slot>> old(slots.get_allocator());
+		old.swap(slots);
+		bits = bits ? bits + 1 : 12;
+		slots.assign(std::size_t(1) << bits, Slot{ unused, 0 });
+		std::size_t mask = slots.size() - 1;
+		for (const Slot &s : old)
+		{
+			if (s.key != unused)
+			{
+				std::size_t i = home(s.key);
+				while (slots[i].key != unused)
+				{
+					i = (i + 1) & mask;
+				}
+				slots[i] = s;
+			}
+		}
+	}
+public:
+	MemoTable(ParseStats &s) :
+		slots(StatsAllocator<Slot>(&s, &s.cache)) {}
+	/**
+	 * Returns the value for `key`, or null if there is none.
+	 */
+	std::size_t *find(std::uint64_t key)
+	{
+		if (slots.empty())
+		{
+			return nullptr;
+		}
+		std::size_t mask = slots.size() - 1;
+		for (std::size_t i=home(key) ; slots[i].key != unused ;
+		     i = (i + 1) & mask)
+		{
+			if (slots[i].key == key)
+			{
+				return &slots[i].value;
+			}
+		}
+		return nullptr;
+	}
+	/**
+	 * Returns the value for `key`, inserting it if there is none.
+	 */
+	std::size_t &operator[](std::uint64_t key)
+	{
+		if ((used + 1) * 2 > slots.size())
+		{
+			grow();
+		}
+		std::size_t mask = slots.size() - 1;
+		std::size_t i = home(key);
+		while ((slots[i].key != unused) && (slots[i].key != key))
+		{
+			i = (i + 1) & mask;
+		}
+		if (slots[i].key == unused)
+		{
+			slots[i].key = key;
+			used++;
+		}
+		return slots[i].value;
+	}
+	/**
+	 * Frees the memory used by the table.
+	 */
+	void release()
+	{
+		std::vector<Slot, StatsAllocator<Slot>>(slots.get_allocator())
+			.swap(slots);
+		used = 0;
+		bits = 0;
+	}
+};
+
+/**
+ * The matches of a parse, stored in fixed-size blocks so that adding a match
+ * never copies the others, and so that the storage grows in small steps.
+ */
+class MatchArena
+{
+	/**
+	 * The number of bits in the index of a match within a block.
+	 */
+	static const unsigned block_bits = 12;
+	/**
+	 * The type of a block.
+	 */
+	typedef std::vector<Match, StatsAllocator<Match>> Block;
+	/**
+	 * The blocks.
+	 */
+	std::vector<Block> blocks;
+	/**
+	 * The number of matches.
+	 */
+	std::size_t count = 0;
+	/**
+	 * The statistics for the parse.
+	 */
+	ParseStats &stats;
+public:
+	MatchArena(ParseStats &s) : stats(s) {}
+	/**
+	 * Returns the number of matches.
+	 */
+	std::size_t size() const { return count; }
+	/**
+	 * Adds a match.
+	 */
+	void push_back(const Match &m)
+	{
+		if ((count & ((1U << block_bits) - 1)) == 0)
+		{
+			blocks.emplace_back(StatsAllocator<Match>(&stats, &stats.matches));
+			blocks.back().reserve(1U << block_bits);
+		}
+		blocks.back().push_back(m);
+		count++;
+	}
+	/**
+	 * Returns the match with index `i`.
+	 */
+	const Match &operator[](std::size_t i) const
+	{
+		return blocks[i >> block_bits][i & ((1U << block_bits) - 1)];
+	}
+	/**
+	 * Frees the memory used by the matches.
+	 */
+	void release()
+	{
+		std::vector<Block>().swap(blocks);
+		count = 0;
+	}
+};
+
+/**
+ * The table of matches for one Pika parse.
+ */
+class PikaTable
+{
+	/**
+	 * The clauses of the grammar.
+	 */
+	const std::vector<Clause> &clauses;
+	/**
+	 * The statistics for the parse.
+	 */
+	ParseStats &stats;
+	/**
+	 * The best match found so far for each clause at each position.
+	 */
+	MemoTable memo;
+	/**
+	 * The clauses that are waiting to be matched at the current position,
+	 * with their order, lowest first.
+	 */
+	std::priority_queue<std::pair<std::uint32_t, std::uint32_t>,
+	                    std::vector<std::pair<std::uint32_t, std::uint32_t>>,
+	                    std::greater<std::pair<std::uint32_t, std::uint32_t>>>
+	                    queue;
+	/**
+	 * Whether each clause is in `queue`.
+	 */
+	std::vector<bool> queued;
+	/**
+	 * The clauses being matched on demand by `look_up()`, which must not be
+	 * matched again inside themselves.
+	 */
+	std::vector<std::uint64_t> matching;
+	/**
+	 * The number of times that `look_up()` has found a clause inside
+	 * itself.
+	 */
+	std::size_t cycles = 0;
+	/**
+	 * Returns the key in `memo` for clause `c` at position `pos`.
+	 */
+	std::uint64_t key(std::uint32_t c, Input::Index pos) const
+	{
+		return static_cast<std::uint64_t>(pos) * clauses.size() + c;
+	}
+	/**
+	 * Queues clause `c` to be matched at the current position.
+	 */
+	void enqueue(std::uint32_t c)
+	{
+		if (!queued[c])
+		{
+			queued[c] = true;
+			queue.push(std::make_pair(clauses[c].order, c));
+		}
+	}
+public:
+	/**
+	 * Returned by `look_up()` when there is no match.
+	 */
+	static const std::size_t none = static_cast<std::size_t>(-1);
+	/**
+	 * The position being matched.
+	 */
+	Input::Index current = 0;
+	/**
+	 * All of the matches.
+	 */
+	MatchArena matches;
+	PikaTable(const std::vector<Clause> &c, ParseStats &s) :
+		clauses(c), stats(s), memo(s), queued(c.size()), matches(s) {}
+	/**
+	 * Returns the best match of clause `c` at position `pos`, or `none`.
+	 * Clauses are only matched at a position once all of the positions after
+	 * it are finished, so the only clauses that may have no entry yet are
+	 * those that can match nothing, including lookaheads.  These are matched
+	 * here, and the result is stored if the position is finished.
+	 */
+	std::size_t look_up(std::uint32_t c, Input::Index pos)
+	{
+		std::uint64_t k = key(c, pos);
+		const std::size_t *found = memo.find(k);
+		if (found)
+		{
+			return *found;
+		}
+		const Clause &cl = clauses[c];
+		if (!cl.can_match_zero || (cl.kind == ClauseKind::Terminal))
+		{
+			return none;
+		}
+		// A clause that can match nothing may look itself up at the same
+		// position.  The inner lookup fails, and the result depends on
+		// where the lookup started, so it is not stored.
+		if (std::find(matching.begin(), matching.end(), k) != matching.end())
+		{
+			cycles++;
+			return none;
+		}
+		std::size_t cycles_before = cycles;
+		matching.push_back(k);
+		Match m;
+		std::size_t id = none;
+		if (match(c, pos, m))
+		{
+			matches.push_back(m);
+			id = matches.size() - 1;
+		}
+		matching.pop_back();
+		if ((pos > current) && (cycles == cycles_before))
+		{
+			memo[k] = id;
+		}
+		return id;
+	}
+	/**
+	 * Matches clause `c` at position `pos`, using the best matches of its
+	 * subclauses, and stores the result in `m`.  Returns false if it does
+	 * not match.
+	 */
+	bool match(std::uint32_t c, Input::Index pos, Match &m)
+	{
+		const Clause &cl = clauses[c];
+		stats.rule_entries++;
+		m.clause = c;
+		m.alternative = 0;
+		m.start = pos;
+		m.length = 0;
+		m.sub_count = 0;
+		switch (cl.kind)
+		{
+			case ClauseKind::Terminal:
+				// Terminals are only matched by `match_terminals()`.
+				return false;
+			case ClauseKind::Empty:
+				return true;
+			case ClauseKind::Sequence:
+			{
+				Input::Index end = pos;
+				for (std::uint32_t s : cl.subs)
+				{
+					std::size_t sub = look_up(s, end);
+					if (sub == none)
+					{
+						return false;
+					}
+					m.subs[m.sub_count++] = sub;
+					end += matches[sub].length;
+				}
+				m.length = end - pos;
+				return true;
+			}
+			case ClauseKind::First:
+				for (std::uint32_t i=0 ; i<cl.subs.size() ; i++)
+				{
+					std::size_t sub = look_up(cl.subs[i], pos);
+					if (sub != none)
+					{
+						m.alternative = static_cast<std::uint16_t>(i);
+						m.subs[m.sub_count++] = sub;
+						m.length = matches[sub].length;
+						return true;
+					}
+				}
+				return false;
+			case ClauseKind::OneOrMore:
+			{
+				// The repetitions after the first are the match of this
+				// clause after it.
+				std::size_t sub = look_up(cl.subs[0], pos);
+				if (sub == none)
+				{
+					return false;
+				}
+				m.subs[m.sub_count++] = sub;
+				m.length = matches[sub].length;
+				if (m.length > 0)
+				{
+					std::size_t rest = look_up(c, pos + m.length);
+					if (rest != none)
+					{
+						m.subs[m.sub_count++] = rest;
+						m.length += matches[rest].length;
+					}
+				}
+				return true;
+			}
+			case ClauseKind::FollowedBy:
+				return look_up(cl.subs[0], pos) != none;
+			case ClauseKind::NotFollowedBy:
+				return look_up(cl.subs[0], pos) == none;
+			case ClauseKind::Rule:
+			{
+				std::size_t sub = look_up(cl.subs[0], pos);
+				if (sub == none)
+				{
+					return false;
+				}
+				m.subs[m.sub_count++] = sub;
+				m.length = matches[sub].length;
+				return true;
+			}
+		}
+		return false;
+	}
+	/**
+	 * Stores `m` as the match of its clause at its position if it is better
+	 * than the one found so far: if it is longer, or if it is an earlier
+	 * alternative of a choice.  If it is stored, then the clauses that it
+	 * can start are queued to be matched again.
+	 */
+	void add(const Match &m)
+	{
+		std::uint64_t k = key(m.clause, m.start);
+		std::size_t *found = memo.find(k);
+		if (found && (*found != none))
+		{
+			const Match &old = matches[*found];
+			bool earlier = (clauses[m.clause].kind == ClauseKind::First) &&
+			               (m.alternative < old.alternative);
+			if (!earlier && (m.length <= old.length))
+			{
+				return;
+			}
+		}
+		matches.push_back(m);
+		if (found)
+		{
+			*found = matches.size() - 1;
+		}
+		else
+		{
+			memo[k] = matches.size() - 1;
+		}
+		for (std::uint32_t p : clauses[m.clause].seed_parents)
+		{
+			enqueue(p);
+		}
+	}
+	/**
+	 * Matches the clauses at position `pos`, given the terminal matches from
+	 * `terminals` to `terminals_end`, in descending order of position.  The
+	 * matches at `pos` are consumed.
+	 */
+	template<typename Iterator>
+	void match_at(Input::Index pos,
+	              const std::vector<std::uint32_t> &terminal_clauses,
+	              Iterator &terminals, Iterator terminals_end)
+	{
+		current = pos;
+		for ( ; (terminals != terminals_end) && (terminals->position == pos) ;
+		     ++terminals)
+		{
+			Match m;
+			m.clause = terminal_clauses[terminals->terminal];
+			m.alternative = 0;
+			m.start = pos;
+			m.length = terminals->length;
+			m.sub_count = 0;
+			add(m);
+		}
+		while (!queue.empty())
+		{
+			std::uint32_t c = queue.top().second;
+			queue.pop();
+			queued[c] = false;
+			Match m;
+			if (match(c, pos, m))
+			{
+				add(m);
+			}
+		}
+	}
+	/**
+	 * Appends the matches of rules within match `root` to `out`, each after
+	 * the matches within it, which is the order in which the packrat parser
+	 * records them.
+	 */
+	template<typename RuleMatch>
+	void rule_matches(std::size_t root, std::vector<RuleMatch> &out) const
+	{
+		// Sequences of repetitions nest deeply, so use an explicit stack.
+		std::vector<std::pair<std::size_t, std::size_t>> stack;
+		stack.push_back(std::make_pair(root, 0));
+		while (!stack.empty())
+		{
+			std::size_t id = stack.back().first;
+			std::size_t next = stack.back().second;
+			const Match &m = matches[id];
+			if (next < m.sub_count)
+			{
+				stack.back().second++;
+				stack.push_back(std::make_pair(m.subs[next], 0));
+				continue;
+			}
+			const Clause &c = clauses[m.clause];
+			if (c.kind == ClauseKind::Rule)
+			{
+				out.push_back({ c.rule, m.start, m.start + m.length });
+			}
+			stack.pop_back();
+		}
+	}
+	/**
+	 * Frees the memory used by the table.
+	 */
+	void release()
+	{
+		memo.release();
+		matches.release();
+	}
+};
+}
+
+bool parse_pika(Input &i, const PikaGrammar &g, ErrorReporter &err,
+                const ParserDelegate &delegate, void *d, ParseStats &stats,
+                unsigned threads)
+{
+	typedef std::chrono::steady_clock clock;
+	typedef PikaGrammar::TerminalMatch TerminalMatch;
+	stats.reset();
+	const PikaGrammar::Impl &grammar = *g.impl;
+	auto phase_start = clock::now();
+
+	// Match the terminals at every position, including the end, in spans
+	// that are matched on separate threads.
+	Input::Index size = i.end().index();
+	std::size_t spans = 1;
+	if ((threads > 1) && i.supports_concurrent_reads())
+	{
+		spans = std::min<std::size_t>(threads, size + 1);
+	}
+	std::vector<std::vector<TerminalMatch>> found(spans);
+	std::vector<ParseStats> span_stats(spans, stats);
+	{
+		std::vector<std::thread> workers;
+		auto match_span = [&](std::size_t s)
+		{
+			Input::Index begin = (size + 1) * s / spans;
+			Input::Index end = (size + 1) * (s + 1) / spans - 1;
+			PikaGrammar::match_terminals(i, g.whitespace, grammar.terminals,
+			                             begin, end, found[s], span_stats[s]);
+		};
+		for (std::size_t s=1 ; s<spans ; s++)
+		{
+			workers.emplace_back(match_span, s);
+		}
+		match_span(0);
+		for (auto &t : workers)
+		{
+			t.join();
+		}
+	}
+	for (const ParseStats &s : span_stats)
+	{
+		stats.merge(s);
+		stats.rule_entries += s.rule_entries;
+		stats.characters_examined += s.characters_examined;
+	}
+
+	// Fill in the table from the end of the input to the start.
+	PikaTable table(grammar.clauses, stats);
+	Input::Index pos = size + 1;
+	std::size_t next_check = stats.rule_entries + stats.check_interval;
+	for (std::size_t s=spans ; (s-- > 0) && !stats.limit_exceeded ; )
+	{
+		auto terminals = found[s].crbegin();
+		Input::Index begin = (size + 1) * s / spans;
+		while ((pos > begin) && !stats.limit_exceeded)
+		{
+			table.match_at(--pos, grammar.terminal_clauses, terminals,
+			               found[s].crend());
+			if (stats.rule_entries >= next_check)
+			{
+				next_check = stats.rule_entries + stats.check_interval;
+				stats.check_limits();
+			}
+		}
+		std::vector<TerminalMatch>().swap(found[s]);
+	}
+
+	// Find the match of the whole input, or how far the root rule matched.
+	bool matched = false;
+	Input::Index fail_pos = 0;
+	std::vector<PikaGrammar::RuleMatch> rules;
+	if (!stats.limit_exceeded)
+	{
+		std::size_t top = table.look_up(grammar.top, 0);
+		if ((top != PikaTable::none) && (table.matches[top].length == size))
+		{
+			matched = true;
+			table.rule_matches(top, rules);
+		}
+		else
+		{
+			std::size_t ws = table.look_up(grammar.whitespace, 0);
+			if (ws != PikaTable::none)
+			{
+				fail_pos = table.matches[ws].length;
+			}
+			std::size_t root = table.look_up(grammar.root, fail_pos);
+			if (root != PikaTable::none)
+			{
+				fail_pos += table.matches[root].length;
+			}
+		}
+	}
+	else
+	{
+		// If the limit was reached while matching the terminals, then no
+		// position has been filled in and `pos` is past the end.
+		fail_pos = std::min(pos, size);
+	}
+	table.release();
+	stats.match_time = clock::now() - phase_start;
+	return g.finish(i, matched, rules, fail_pos, err, delegate, d, stats);
+}
+
+} //namespace pegmatite
@@ -0,0 +1,225 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEGMATITE_PIKA_HPP
+#define PEGMATITE_PIKA_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "parser.hh"
+
+namespace pegmatite {
+
+/**
+ * A grammar compiled for the Pika parser (see `parse_pika()`).  Each
+ * expression in the grammar, in each of the two modes in which it can be
+ * matched (as a terminal, without whitespace, or as a non-terminal), becomes
+ * a clause.  Expressions that contain no rules or compound expressions, such
+ * as characters, strings, sets and regular expressions, become terminal
+ * clauses, which are matched with `Expr::parse_term()` or
+ * `Expr::parse_non_term()`.
+ *
+ * The grammar is frozen when it is compiled: the rules and expressions that
+ * it refers to must not be changed or destroyed while it is in use.  A
+ * compiled grammar may be used by several threads at once.
+ */
+class PikaGrammar
+{
+public:
+	/**
+	 * Compiles the grammar whose root rule is `g`, using `ws` as the
+	 * whitespace rule.
+	 */
+	PikaGrammar(const Rule &g, const Rule &ws);
+	~PikaGrammar();
+	PikaGrammar(const PikaGrammar &) = delete;
+	PikaGrammar &operator=(const PikaGrammar &) = delete;
+	/**
+	 * Returns the number of clauses in the compiled grammar.
+	 */
+	std::size_t size() const;
+	/**
+	 * Returns the clause for the expression `e`, matched as a terminal if
+	 * `term` is true, compiling it if it has not been seen before.
+	 */
+	std::size_t clause(const Expr &e, bool term);
+	/**
+	 * Returns a clause that matches `e` as a single terminal.
+	 */
+	std::size_t terminal(const Expr &e, bool term);
+	/**
+	 * Returns a clause that matches `left` followed by `right`, with
+	 * whitespace between them if `term` is false.
+	 */
+	std::size_t sequence(const Expr &left, const Expr &right, bool term);
+	/**
+	 * Returns a clause that matches `left`, or `right` if `left` does not
+	 * match.
+	 */
+	std::size_t choice(const Expr &left, const Expr &right, bool term);
+	/**
+	 * Returns a clause that matches `e` as many times as possible, and at
+	 * least `min` times, which must be 0 or 1.  If `term` is false, then
+	 * whitespace is matched before each repetition and after the last one.
+	 */
+	std::size_t repeat(const Expr &e, unsigned min, bool term);
+	/**
+	 * Returns a clause that matches `e` or nothing.
+	 */
+	std::size_t optional(const Expr &e, bool term);
+	/**
+	 * Returns a clause that matches nothing if `e` matches (when `positive`
+	 * is true) or if it does not (when `positive` is false).
+	 */
+	std::size_t lookahead(const Expr &e, bool positive, bool term);
+	/**
+	 * Returns the clause for the rule `r`.
+	 */
+	std::size_t rule(const Rule &r, bool term);
+private:
+	/**
+	 * The root rule of the grammar.
+	 */
+	const Rule &root;
+	/**
+	 * The whitespace rule.
+	 */
+	const Rule &whitespace;
+	struct Impl;
+	/**
+	 * The clauses.
+	 */
+	std::unique_ptr<Impl> impl;
+	/**
+	 * A terminal clause, as passed to `match_terminals()`.
+	 */
+	struct Terminal
+	{
+		/**
+		 * The expression to match.
+		 */
+		const Expr *expr;
+		/**
+		 * Whether to match it as a terminal.
+		 */
+		bool term;
+	};
+	/**
+	 * A match of a terminal, found by `match_terminals()`.
+	 */
+	struct TerminalMatch
+	{
+		/**
+		 * The index in the input of the start of the match.
+		 */
+		Input::Index position;
+		/**
+		 * The index of the terminal in the list passed to
+		 * `match_terminals()`.
+		 */
+		std::uint32_t terminal;
+		/**
+		 * The length of the match.
+		 */
+		Input::Index length;
+	};
+	/**
+	 * A match of a rule, in the order in which their parse procedures run.
+	 */
+	struct RuleMatch
+	{
+		/**
+		 * The rule.
+		 */
+		const Rule *rule;
+		/**
+		 * The index in the input of the start of the match.
+		 */
+		Input::Index start;
+		/**
+		 * The index in the input of the end of the match.
+		 */
+		Input::Index end;
+	};
+	/**
+	 * Matches each of the `terminals` at each position from `begin` up to
+	 * and including `end` in `i`, appending the matches to `out` in order of
+	 * position.  The whitespace rule is `ws`.  The work done is recorded in
+	 * `stats`.  Defined in parser.cc, because matching needs a context.
+	 */
+	static void match_terminals(Input &i, const Rule &ws,
+	                            const std::vector<Terminal> &terminals,
+	                            Input::Index begin, Input::Index end,
+	                            std::vector<TerminalMatch> &out,
+	                            ParseStats &stats);
+	/**
+	 * Finishes a parse of `i`.  If `matched` is true, then this runs the
+	 * parse procedures for the rules in `matches`, which have handlers in
+	 * `delegate`, with the argument `d`.  Otherwise, it reports the error via
+	 * `err`, finding it by matching the input with the packrat parser, or at
+	 * `fail_pos` if that parser matches.  Returns true if the input matched
+	 * and all of the procedures succeeded.  Defined in parser.cc.
+	 */
+	bool finish(Input &i, bool matched, const std::vector<RuleMatch> &matches,
+	            Input::Index fail_pos, ErrorReporter &err,
+	            const ParserDelegate &delegate, void *d,
+	            ParseStats &stats) const;
+	friend bool parse_pika(Input &i, const PikaGrammar &g, ErrorReporter &err,
+	                       const ParserDelegate &delegate, void *d,
+	                       ParseStats &stats, unsigned threads);
+};
+
+/** parses the given input with the Pika algorithm, which matches the grammar
+	bottom-up, filling in a table of the matches of each clause at each
+	position from the end of the input to the start.  Each match of a clause
+	triggers the clauses that it can start, so left-recursive rules match
+	directly, without the packrat parser's rejection of left recursion.
+	For grammars without left recursion, the matches, and so the parse
+	procedures, are the same as those of `pegmatite::parse()`.
+
+	The terminals are first matched at every position, with the input split
+	into `threads` spans that are matched on separate threads, if the input
+	supports concurrent reads.  The table holds every match found, so this
+	uses much more memory than the packrat parser.  On an error, the input
+	is matched again with the packrat parser to find the position of the
+	error.
+	@param i input.
+	@param g compiled grammar.
+	@param err callback for reporting errors.
+	@param delegate the delegate that provides the parse procedures.
+	@param d user data, passed to the parse procedures.
+	@param stats statistics for the parse.
+	@param threads number of threads on which to match the terminals.
+	@return true on parsing success, false on failure.
+ */
+bool parse_pika(Input &i, const PikaGrammar &g, ErrorReporter &err,
+                const ParserDelegate &delegate, void *d, ParseStats &stats,
+                unsigned threads = 1);
+
+} //namespace pegmatite
+
+#endif //PEGMATITE_PIKA_HPP
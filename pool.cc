@@ -0,0 +1,568 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pool.hh"
+
+namespace pegmatite {
+
+namespace {
+/**
+ * A queued parse.
+ */
+struct ParserPoolJob
+{
+	/**
+	 * The work to do.
+	 */
+	std::function<bool(ASTParseSession &, ParseResult &)> task;
+	/**
+	 * The promise for the result, if there is no completion callback.
+	 */
+	std::promise<ParseResult> promise;
+	/**
+	 * The completion callback, if any.
+	 */
+	ParserPool::Completion done;
+	/**
+	 * The time at which the parse was queued.
+	 */
+	std::chrono::steady_clock::time_point queued;
+};
+}
+
+struct ParserPool::Impl
+{
+	/**
+	 * Protects the queue and `stopping`.
+	 */
+	std::mutex lock;
+	/**
+	 * Signalled when a parse is queued or the pool is stopping.
+	 */
+	std::condition_variable not_empty;
+	/**
+	 * Signalled when a thread takes a parse from the queue.
+	 */
+	std::condition_variable not_full;
+	/**
+	 * The parses waiting for a thread.
+	 */
+	std::deque<ParserPoolJob> queue;
+	/**
+	 * The largest number of parses that may wait.
+	 */
+	std::size_t max_queued;
+	/**
+	 * The limits for each parse.
+	 */
+	ParseStats limits;
+	/**
+	 * Set when the threads should stop once the queue is empty.
+	 */
+	bool stopping = false;
+	/**
+	 * The threads.
+	 */
+	std::vector<std::thread> threads;
+	Impl(std::size_t max, const ParseStats &l) : max_queued(max), limits(l)
+	{
+		limits.reset();
+	}
+	/**
+	 * The body of each thread.
+	 */
+	void run()
+	{
+		typedef std::chrono::steady_clock clock;
+		std::unique_ptr<ASTParseSession> session(new ASTParseSession);
+		session->stats() = limits;
+		for (;;)
+		{
+			ParserPoolJob job;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				not_empty.wait(guard, [&]() { return stopping || !queue.empty(); });
+				if (queue.empty())
+				{
+					return;
+				}
+				job = std::move(queue.front());
+				queue.pop_front();
+			}
+			not_full.notify_one();
+			ParseResult result;
+			auto start = clock::now();
+			result.wait_time = start - job.queued;
+			std::exception_ptr error;
+			try
+			{
+				result.ok = job.task(*session, result);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+			result.run_time = clock::now() - start;
+			result.stats = session->stats();
+			if (error)
+			{
+				// The parse stopped part way through, so the session is
+				// replaced rather than reused.
+				session.reset(new ASTParseSession);
+				session->stats() = limits;
+				result.ok = false;
+				result.ast.reset();
+				result.stats.status = ParseStatus::ProcFailed;
+				result.error = error;
+			}
+			if (job.done)
+			{
+				// There is no caller to pass an exception from the callback
+				// to, and letting it escape would terminate the process.
+				try
+				{
+					job.done(result);
+				}
+				catch (...) {}
+			}
+			else if (error)
+			{
+				job.promise.set_exception(error);
+			}
+			else
+			{
+				job.promise.set_value(std::move(result));
+			}
+		}
+	}
+};
+
+ParserPool::ParserPool(unsigned threads, std::size_t max_queued,
+                       const ParseStats &limits)
+	: impl(new Impl(max_queued, limits))
+{
+	if (threads == 0)
+	{
+		threads = std::max(1U, std::thread::hardware_concurrency());
+	}
+	for (unsigned i=0 ; i<threads ; i++)
+	{
+		impl->threads.emplace_back([this]() { impl->run(); });
+	}
+}
+
+ParserPool::~ParserPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(impl->lock);
+		impl->stopping = true;
+	}
+	impl->not_empty.notify_all();
+	for (auto &t : impl->threads)
+	{
+		t.join();
+	}
+}
+
+bool ParserPool::enqueue(Task task, std::promise<ParseResult> *promise,
+                         Completion done, bool wait)
+{
+	ParserPoolJob job;
+	job.task = std::move(task);
+	if (promise)
+	{
+		job.promise = std::move(*promise);
+	}
+	job.done = std::move(done);
+	{
+		std::unique_lock<std::mutex> guard(impl->lock);
+		if (impl->queue.size() >= impl->max_queued)
+		{
+			if (!wait)
+			{
+				return false;
+			}
+			impl->not_full.wait(guard, [&]() {
+				return impl->queue.size() < impl->max_queued; });
+		}
+		job.queued = std::chrono::steady_clock::now();
+		impl->queue.push_back(std::move(job));
+	}
+	impl->not_empty.notify_one();
+	return true;
+}
+
+std::future<ParseResult> ParserPool::submit(Input &i, const Rule &g,
+                                            const Rule &ws, ErrorReporter err,
+                                            const ParserDelegate &delegate,
+                                            void *d)
+{
+	std::promise<ParseResult> promise;
+	std::future<ParseResult> future = promise.get_future();
+	enqueue([&i, &g, &ws, err, &delegate, d](ASTParseSession &s, ParseResult &)
+		mutable { return s.parse(i, g, ws, err, delegate, d); },
+		&promise, nullptr, true);
+	return future;
+}
+
+std::future<ParseResult> ParserPool::submit(Input &i, const Rule &g,
+                                            const Rule &ws, ErrorReporter err,
+                                            const ASTParserDelegate &delegate)
+{
+	std::promise<ParseResult> promise;
+	std::future<ParseResult> future = promise.get_future();
+	const ParserDelegate &d = delegate;
+	enqueue([&i, &g, &ws, err, &d](ASTParseSession &s, ParseResult &r)
+		mutable
+		{
+			r.ast = s.parse(i, g, ws, err, d);
+			return r.ast != nullptr;
+		},
+		&promise, nullptr, true);
+	return future;
+}
+
+bool ParserPool::submit(Input &i, const Rule &g, const Rule &ws,
+                        ErrorReporter err, const ParserDelegate &delegate,
+                        void *d, Completion done, bool wait)
+{
+	return enqueue([&i, &g, &ws, err, &delegate, d](ASTParseSession &s,
+	                                                 ParseResult &)
+		mutable { return s.parse(i, g, ws, err, delegate, d); },
+		nullptr, std::move(done), wait);
+}
+
+bool ParserPool::submit(Input &i, const Rule &g, const Rule &ws,
+                        ErrorReporter err, const ASTParserDelegate &delegate,
+                        Completion done, bool wait)
+{
+	const ParserDelegate &d = delegate;
+	return enqueue([&i, &g, &ws, err, &d](ASTParseSession &s, ParseResult &r)
+		mutable
+		{
+			r.ast = s.parse(i, g, ws, err, d);
+			return r.ast != nullptr;
+		},
+		nullptr, std::move(done), wait);
+}
+
+unsigned ParserPool::size() const
+{
+	return static_cast<unsigned>(impl->threads.size());
+}
+
+std::size_t ParserPool::queued() const
+{
+	std::lock_guard<std::mutex> guard(impl->lock);
+	return impl->queue.size();
+}
+
+double BatchStats::bytes_per_second() const
+{
+	double seconds = std::chrono::duration<double>(wall_time).count();
+	return (seconds > 0) ? static_cast<double>(bytes) / seconds : 0;
+}
+
+namespace {
+/**
+ * The files that one thread of `parse_files()` has still to parse, as
+ * indexes into the list of paths, largest first.  The owning thread takes
+ * files from the front and other threads steal from the back, so they only
+ * contend for the last few files.
+ */
+struct FileQueue
+{
+	std::mutex lock;
+	std::deque<std::size_t> files;
+	/**
+	 * Takes the next file for the owning thread, returning false if there
+	 * are none left.
+	 */
+	bool take(std::size_t &file)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (files.empty())
+		{
+			return false;
+		}
+		file = files.front();
+		files.pop_front();
+		return true;
+	}
+	/**
+	 * Takes a file for another thread, returning false if there are none
+	 * left.
+	 */
+	bool steal(std::size_t &file)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (files.empty())
+		{
+			return false;
+		}
+		file = files.back();
+		files.pop_back();
+		return true;
+	}
+};
+
+/**
+ * Returns the message of the exception `e`.
+ */
+std::string describe(std::exception_ptr e)
+{
+	try
+	{
+		std::rethrow_exception(e);
+	}
+	catch (const std::exception &x)
+	{
+		return x.what();
+	}
+	catch (...)
+	{
+		return "unknown exception";
+	}
+}
+
+/**
+ * Reads and parses the file for `r`, using `session`.
+ */
+void parse_file(FileParseResult &r, const Rule &g, const Rule &ws,
+                const ASTParserDelegate &d, ASTParseSession &session)
+{
+	typedef std::chrono::steady_clock clock;
+	auto start = clock::now();
+	int fd = open(r.path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		r.errors.push_back(r.path + ": " + strerror(errno));
+		return;
+	}
+	MappedFileInput input(fd, r.path);
+	close(fd);
+	if (!input.mapped())
+	{
+		r.errors.push_back(r.path + ": cannot map file");
+		return;
+	}
+	ErrorReporter err = [&r](const InputRange &ir, const std::string &message)
+	{
+		std::stringstream s;
+		s << r.path << ':' << ir.start.line << ':' << ir.start.col << ": "
+		  << message;
+		r.errors.push_back(s.str());
+	};
+	r.ok = d.parse(session, input, g, ws, err, r.ast);
+	r.stats = session.stats();
+	r.run_time = clock::now() - start;
+}
+}
+
+std::vector<FileParseResult> parse_files(const std::vector<std::string> &paths,
+                                         const Rule &g, const Rule &ws,
+                                         const ASTParserDelegate &d,
+                                         BatchStats &stats, unsigned threads)
+{
+	typedef std::chrono::steady_clock clock;
+	auto start = clock::now();
+	std::vector<FileParseResult> results(paths.size());
+	std::vector<std::size_t> order(paths.size());
+	for (std::size_t i=0 ; i<paths.size() ; i++)
+	{
+		results[i].path = paths[i];
+		struct stat buf;
+		if (stat(paths[i].c_str(), &buf) == 0)
+		{
+			results[i].bytes = static_cast<std::size_t>(buf.st_size);
+		}
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[&](std::size_t a, std::size_t b)
+		{ return results[a].bytes > results[b].bytes; });
+	if (threads == 0)
+	{
+		threads = std::max(1U, std::thread::hardware_concurrency());
+	}
+	threads = static_cast<unsigned>(std::max<std::size_t>(1,
+		std::min<std::size_t>(threads, paths.size())));
+	// Deal the files out, largest first, so that each thread's share is
+	// sorted by size and the shares are similar in size.
+	std::vector<FileQueue> queues(threads);
+	for (std::size_t i=0 ; i<order.size() ; i++)
+	{
+		queues[i % threads].files.push_back(order[i]);
+	}
+	std::vector<std::size_t> steals(threads);
+	auto run = [&](unsigned self)
+	{
+		std::unique_ptr<ASTParseSession> session(new ASTParseSession);
+		std::size_t file;
+		for (;;)
+		{
+			if (!queues[self].take(file))
+			{
+				bool stolen = false;
+				for (unsigned i=1 ; i<threads && !stolen ; i++)
+				{
+					stolen = queues[(self + i) % threads].steal(file);
+				}
+				if (!stolen)
+				{
+					return;
+				}
+				steals[self]++;
+			}
+			try
+			{
+				parse_file(results[file], g, ws, d, *session);
+			}
+			catch (...)
+			{
+				// The parse stopped part way through, so the session is
+				// replaced rather than reused.
+				session.reset(new ASTParseSession);
+				FileParseResult &r = results[file];
+				r.ok = false;
+				r.ast.reset();
+				r.stats.status = ParseStatus::ProcFailed;
+				r.errors.push_back(r.path + ": " +
+				                   describe(std::current_exception()));
+			}
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned i=1 ; i<threads ; i++)
+	{
+		workers.emplace_back(run, i);
+	}
+	run(0);
+	for (auto &t : workers)
+	{
+		t.join();
+	}
+
+	stats = BatchStats();
+	stats.threads = threads;
+	stats.files = results.size();
+	for (auto &r : results)
+	{
+		stats.bytes += r.bytes;
+		stats.busy_time += r.run_time;
+		if (!r.ok)
+		{
+			stats.failed++;
+		}
+	}
+	for (std::size_t s : steals)
+	{
+		stats.steals += s;
+	}
+	stats.wall_time = clock::now() - start;
+	return results;
+}
+
+std::vector<DeferredParseResult>
+parse_deferred(const std::vector<DeferredRegion> &regions, const Rule &body,
+               const Rule &ws, const ASTParserDelegate &d, unsigned threads)
+{
+	std::vector<DeferredParseResult> results(regions.size());
+	bool concurrent = std::all_of(regions.begin(), regions.end(),
+		[](const DeferredRegion &r)
+		{ return r.input() && r.input()->supports_concurrent_reads(); });
+	if (threads == 0)
+	{
+		threads = std::max(1U, std::thread::hardware_concurrency());
+	}
+	if (!concurrent)
+	{
+		threads = 1;
+	}
+	threads = static_cast<unsigned>(std::max<std::size_t>(1,
+		std::min<std::size_t>(threads, regions.size())));
+	std::atomic<std::size_t> next(0);
+	auto run = [&]()
+	{
+		for (std::size_t i=next++ ; i<regions.size() ; i=next++)
+		{
+			DeferredParseResult &r = results[i];
+			if (!regions[i].input())
+			{
+				r.errors.push_back("empty deferred region");
+				continue;
+			}
+			const std::string &name = regions[i].input()->name();
+			ErrorReporter err = [&](const InputRange &ir,
+			                        const std::string &message)
+			{
+				std::stringstream s;
+				s << name << ':' << ir.start.line << ':' << ir.start.col
+				  << ": " << message;
+				r.errors.push_back(s.str());
+			};
+			try
+			{
+				r.ok = d.parse(regions[i], body, ws, err, r.ast, r.stats);
+			}
+			catch (...)
+			{
+				r.ok = false;
+				r.ast.reset();
+				r.stats.status = ParseStatus::ProcFailed;
+				r.errors.push_back(name + ": " +
+				                   describe(std::current_exception()));
+			}
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned i=1 ; i<threads ; i++)
+	{
+		workers.emplace_back(run);
+	}
+	run();
+	for (auto &t : workers)
+	{
+		t.join();
+	}
+	return results;
+}
+
+} //namespace pegmatite
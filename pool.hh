@@ -0,0 +1,310 @@
+/*-
+ * Copyright (c) 2026, The Pegmatite contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEGMATITE_POOL_HPP
+#define PEGMATITE_POOL_HPP
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ast.hh"
+
+namespace pegmatite {
+
+/**
+ * The result of a parse run by a `ParserPool`.
+ */
+struct ParseResult
+{
+	/**
+	 * True if the parse succeeded.
+	 */
+	bool ok = false;
+	/**
+	 * The root of the AST, for a parse that builds one.
+	 */
+	std::unique_ptr<ASTNode> ast;
+	/**
+	 * The statistics for the parse.
+	 */
+	ParseStats stats;
+	/**
+	 * The time that the parse waited in the queue before a thread started it.
+	 */
+	std::chrono::steady_clock::duration wait_time =
+		std::chrono::steady_clock::duration::zero();
+	/**
+	 * The time that the parse took, including running the parse procedures.
+	 */
+	std::chrono::steady_clock::duration run_time =
+		std::chrono::steady_clock::duration::zero();
+	/**
+	 * The exception thrown by a parse procedure, if one stopped the parse.
+	 */
+	std::exception_ptr error;
+};
+
+/**
+ * A fixed set of threads that run parses in the background.  Each thread
+ * has its own `ASTParseSession`, so the parser's data structures are reused
+ * from one parse to the next.  Parses are queued until a thread is free.
+ * Once `max_queued` parses are waiting, submitting another one blocks until
+ * there is space, or fails if the caller asks not to wait.
+ *
+ * Grammars and delegates may be shared by parses that run at the same time,
+ * but each parse needs its own input.  The input, the rules and the delegate
+ * must remain valid until the parse has finished.  Errors are reported, and
+ * completion callbacks are called, on the thread that ran the parse.  If a
+ * parse procedure throws an exception, the future result rethrows it, or the
+ * completion callback is called with a failed result whose status is
+ * `ParseStatus::ProcFailed` and whose `error` holds the exception, and the
+ * thread carries on with the next parse.  Exceptions thrown by completion
+ * callbacks are discarded, so callbacks must handle their own errors.
+ */
+class ParserPool
+{
+public:
+	/**
+	 * A function called with the result of a parse when it finishes.
+	 */
+	typedef std::function<void(ParseResult &)> Completion;
+	/**
+	 * Starts `threads` threads, or one per core if `threads` is 0, with room
+	 * for `max_queued` waiting parses.  The limits in `limits` apply to
+	 * every parse.
+	 */
+	ParserPool(unsigned threads = 0, std::size_t max_queued = 256,
+	           const ParseStats &limits = ParseStats());
+	/**
+	 * Runs the parses that are still queued and then stops the threads.
+	 */
+	~ParserPool();
+	ParserPool(const ParserPool &) = delete;
+	ParserPool &operator=(const ParserPool &) = delete;
+	/**
+	 * Queues a parse of `i`, as `pegmatite::parse()` does, and returns the
+	 * future result.
+	 */
+	std::future<ParseResult> submit(Input &i, const Rule &g, const Rule &ws,
+	                                ErrorReporter err,
+	                                const ParserDelegate &delegate, void *d);
+	/**
+	 * Queues a parse of `i` that builds an AST with `delegate`, and returns
+	 * the future result.
+	 */
+	std::future<ParseResult> submit(Input &i, const Rule &g, const Rule &ws,
+	                                ErrorReporter err,
+	                                const ASTParserDelegate &delegate);
+	/**
+	 * Queues a parse of `i`, as `pegmatite::parse()` does, calling `done`
+	 * with the result.  If `wait` is false and the queue is full, this
+	 * returns false without queuing the parse.
+	 */
+	bool submit(Input &i, const Rule &g, const Rule &ws, ErrorReporter err,
+	            const ParserDelegate &delegate, void *d, Completion done,
+	            bool wait = true);
+	/**
+	 * Queues a parse of `i` that builds an AST with `delegate`, calling
+	 * `done` with the result.  If `wait` is false and the queue is full, this
+	 * returns false without queuing the parse.
+	 */
+	bool submit(Input &i, const Rule &g, const Rule &ws, ErrorReporter err,
+	            const ASTParserDelegate &delegate, Completion done,
+	            bool wait = true);
+	/**
+	 * Returns the number of threads.
+	 */
+	unsigned size() const;
+	/**
+	 * Returns the number of parses waiting for a thread.
+	 */
+	std::size_t queued() const;
+private:
+	/**
+	 * The work done for one parse, using the session of the thread that
+	 * runs it.
+	 */
+	typedef std::function<bool(ASTParseSession &, ParseResult &)> Task;
+	struct Impl;
+	/**
+	 * The threads and the queue.
+	 */
+	std::unique_ptr<Impl> impl;
+	/**
+	 * Queues `task`.  The result is passed to `done` if it is set, and
+	 * otherwise to `promise`.  Returns false if `wait` is false and the queue
+	 * is full.
+	 */
+	bool enqueue(Task task, std::promise<ParseResult> *promise,
+	             Completion done, bool wait);
+};
+
+/**
+ * The result of parsing one file with `parse_files()`.
+ */
+struct FileParseResult
+{
+	/**
+	 * The path of the file.
+	 */
+	std::string path;
+	/**
+	 * True if the file was read and parsed.
+	 */
+	bool ok = false;
+	/**
+	 * The root of the AST, if the file was parsed.
+	 */
+	std::unique_ptr<ASTNode> ast;
+	/**
+	 * The errors reported while parsing the file, each as
+	 * `path:line:col: message`, or the reason that it could not be read or
+	 * the message of an exception thrown while parsing it, as
+	 * `path: message`.
+	 */
+	std::vector<std::string> errors;
+	/**
+	 * The size of the file, in bytes.
+	 */
+	std::size_t bytes = 0;
+	/**
+	 * The statistics for the parse.
+	 */
+	ParseStats stats;
+	/**
+	 * The time taken to read and parse the file.
+	 */
+	std::chrono::steady_clock::duration run_time =
+		std::chrono::steady_clock::duration::zero();
+};
+
+/**
+ * Totals for a call to `parse_files()`.
+ */
+struct BatchStats
+{
+	/**
+	 * The number of files.
+	 */
+	std::size_t files = 0;
+	/**
+	 * The number of files that could not be read or parsed.
+	 */
+	std::size_t failed = 0;
+	/**
+	 * The total size of the files, in bytes.
+	 */
+	std::size_t bytes = 0;
+	/**
+	 * The number of files that a thread took from another thread's share.
+	 */
+	std::size_t steals = 0;
+	/**
+	 * The number of threads used.
+	 */
+	unsigned threads = 0;
+	/**
+	 * The time from the start of the batch until all of the files had been
+	 * parsed.
+	 */
+	std::chrono::steady_clock::duration wall_time =
+		std::chrono::steady_clock::duration::zero();
+	/**
+	 * The total of the times taken for each file, across all threads.
+	 */
+	std::chrono::steady_clock::duration busy_time =
+		std::chrono::steady_clock::duration::zero();
+	/**
+	 * Returns the throughput of the batch, in bytes per second of wall time.
+	 */
+	double bytes_per_second() const;
+};
+
+/**
+ * Parses each of the files in `paths` with the grammar `g`, whitespace rule
+ * `ws` and delegate `d`, using `threads` threads, or one per core if
+ * `threads` is 0.  The files are mapped into memory and parsed as ASCII.
+ *
+ * The files are sorted by size and dealt out, largest first, to the threads,
+ * so that no thread is left with a large file at the end.  Each thread
+ * parses its own share in order of size, using one `ASTParseSession` for all
+ * of them, and then takes the smallest remaining files from the other
+ * threads.  The results are in the same order as `paths`, and the totals are
+ * stored in `stats`.
+ */
+std::vector<FileParseResult> parse_files(const std::vector<std::string> &paths,
+                                         const Rule &g, const Rule &ws,
+                                         const ASTParserDelegate &d,
+                                         BatchStats &stats,
+                                         unsigned threads = 0);
+
+/**
+ * The result of parsing one region with `parse_deferred()`.
+ */
+struct DeferredParseResult
+{
+	/**
+	 * True if the region was parsed.
+	 */
+	bool ok = false;
+	/**
+	 * The root of the AST, if the region was parsed.
+	 */
+	std::unique_ptr<ASTNode> ast;
+	/**
+	 * The errors reported while parsing the region, each as
+	 * `name:line:col: message`, where the name is that of the input, or the
+	 * message of an exception thrown while parsing it, as `name: message`.
+	 */
+	std::vector<std::string> errors;
+	/**
+	 * The statistics for the parse.
+	 */
+	ParseStats stats;
+};
+
+/**
+ * Parses each of the `regions` that `defer()` expressions skipped, with the
+ * body rule `body`, whitespace rule `ws` and delegate `d`, using `threads`
+ * threads, or one per core if `threads` is 0.  Each thread takes the next
+ * region that has not been started, so many small regions spread evenly.
+ * If any region's input does not support concurrent reads, the regions are
+ * parsed on the calling thread.  A region whose parse throws an exception
+ * fails with `ParseStatus::ProcFailed` and the others are still parsed.  The
+ * results are in the same order as `regions`.
+ */
+std::vector<DeferredParseResult>
+parse_deferred(const std::vector<DeferredRegion> &regions, const Rule &body,
+               const Rule &ws, const ASTParserDelegate &d,
+               unsigned threads = 0);
+
+} //namespace pegmatite
+
+#endif //PEGMATITE_POOL_HPP
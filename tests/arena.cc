@@ -0,0 +1,154 @@
+#include <thread>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace {
+/**
+ * A word, whose construction fails if it is "bad".
+ */
+class Word : public ASTContainer
+{
+public:
+	std::string value;
+	bool construct(const InputRange &r, ASTStack &,
+	               const ErrorReporter &) override
+	{
+		value = r.str();
+		return value != "bad";
+	}
+	PEGMATITE_RTTI(Word, ASTContainer)
+};
+
+class Words : public ASTContainer
+{
+public:
+	ASTList<Word> words;
+	PEGMATITE_RTTI(Words, ASTContainer)
+};
+
+struct Grammar
+{
+	Rule ws    = *" \t\n"_S;
+	Rule word  = term(+range('a', 'z'));
+	Rule words = *word;
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+struct Parser : public ASTParserDelegate
+{
+	const Grammar &g = Grammar::get();
+	BindAST<Word> word = g.word;
+	BindAST<Words> words = g.words;
+};
+}
+
+/**
+ * Tests that AST nodes are freed to the right place, whether they are in an
+ * arena or on the heap, including nodes whose construction fails.
+ */
+int main()
+{
+	static Parser p;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	const Grammar &g = Grammar::get();
+
+	// A node whose construction fails is freed, so the arena is empty again
+	// and can be destroyed.
+	{
+		ASTArena arena;
+		ParseStats stats;
+		StringInput input("some good words and one bad one");
+		std::unique_ptr<Words> root;
+		CHECK(!p.parse(input, g.words, g.ws, quiet, root, stats, arena));
+		CHECK(arena.live() == 0);
+	}
+	// The same on the heap, where the statistics count the nodes.
+	{
+		ParseStats stats;
+		StringInput input("some good words and one bad one");
+		std::unique_ptr<Words> root;
+		CHECK(!p.parse(input, g.words, g.ws, quiet, root, stats));
+		CHECK(stats.ast_nodes.allocations > 0);
+		CHECK(stats.ast_nodes.current_bytes == 0);
+	}
+	// A session with an arena can parse again after a failure.
+	{
+		ASTParseSession session(true);
+		StringInput bad("a bad start");
+		std::unique_ptr<Words> root;
+		CHECK(!p.parse(session, bad, g.words, g.ws, quiet, root));
+		StringInput good("a good start");
+		CHECK(p.parse(session, good, g.words, g.ws, quiet, root));
+		CHECK(root && (root->words.size() == 3));
+		root.reset();
+	}
+
+	// Nodes on the heap and in an arena can be deleted in any order while
+	// the arena is alive, and nodes on the heap after it has gone.
+	static Bench::JSON::Parser json;
+	std::string text = Bench::generate_input("json", 20000, 1);
+	std::unique_ptr<Bench::JSON::Value> outlives;
+	{
+		ASTArena arena;
+		std::unique_ptr<Bench::JSON::Value> heap, in_arena;
+		ParseStats s1, s2, s3;
+		StringInput i1(text), i2(text), i3(text);
+		CHECK(json.parse(i1, json.root(), json.whitespace(), quiet, heap, s1));
+		CHECK(json.parse(i2, json.root(), json.whitespace(), quiet, in_arena,
+		                 s2, arena));
+		CHECK(json.parse(i3, json.root(), json.whitespace(), quiet, outlives,
+		                 s3));
+		CHECK(arena.live() > 0);
+		heap.reset();
+		CHECK(arena.live() > 0);
+		in_arena.reset();
+		CHECK(arena.live() == 0);
+	}
+	outlives.reset();
+
+	// Nodes in an arena may be deleted on other threads at once, and when
+	// they have all gone the next parse reuses the same blocks.
+	{
+		ASTArena arena;
+		std::size_t capacity = 0;
+		for (int round=0 ; round<3 ; round++)
+		{
+			std::vector<std::unique_ptr<Bench::JSON::Value>> asts(4);
+			for (auto &ast : asts)
+			{
+				ParseStats s;
+				StringInput input(text);
+				CHECK(json.parse(input, json.root(), json.whitespace(), quiet,
+				                 ast, s, arena));
+			}
+			if (round == 0)
+			{
+				capacity = arena.capacity();
+			}
+			CHECK(arena.capacity() == capacity);
+			std::vector<std::thread> threads;
+			for (auto &ast : asts)
+			{
+				threads.emplace_back([&ast]() { ast.reset(); });
+			}
+			for (auto &t : threads)
+			{
+				t.join();
+			}
+			CHECK(arena.live() == 0);
+		}
+		arena.reset();
+		CHECK(arena.capacity() == capacity);
+	}
+	return Test::result();
+}
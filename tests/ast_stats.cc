@@ -0,0 +1,64 @@
+#include <type_traits>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+/**
+ * Tests that `ParseStats::ast_nodes` counts the AST nodes that are alive,
+ * rather than every node ever constructed.
+ */
+int main()
+{
+	static_assert(!std::is_convertible<ParseStats*, ASTStack>::value,
+	              "ASTStack must not be implicitly constructed from stats");
+	static Bench::JSON::Parser p;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	std::string text = Bench::generate_input("json", 20000, 1);
+
+	// A successful parse keeps all of its nodes.
+	ParseStats full;
+	{
+		StringInput input(text);
+		std::unique_ptr<Bench::JSON::Value> root;
+		CHECK(p.parse(input, p.root(), p.whitespace(), quiet, root, full));
+		CHECK(full.ast_nodes.allocations > 0);
+		CHECK(full.ast_nodes.current_bytes > 0);
+		CHECK(full.ast_nodes.current_bytes == full.ast_nodes.peak_bytes);
+	}
+
+	// A limit that is reached while building the AST frees the nodes built
+	// so far, and the statistics record that.  Lower the limit from the peak
+	// until it is reached after some nodes have been built.
+	std::size_t limit = 0;
+	std::size_t step = full.ast_nodes.peak_bytes / 16;
+	for (std::size_t l=full.peak_bytes - 1 ; l > step ; l -= step)
+	{
+		ParseStats limited;
+		limited.memory_limit = l;
+		StringInput input(text);
+		std::unique_ptr<Bench::JSON::Value> root;
+		CHECK(!p.parse(input, p.root(), p.whitespace(), quiet, root,
+		               limited));
+		CHECK(limited.status == ParseStatus::MemoryLimit);
+		if (limited.ast_nodes.allocations > 0)
+		{
+			CHECK(limited.ast_nodes.current_bytes == 0);
+			limit = l;
+			break;
+		}
+	}
+	CHECK(limit != 0);
+
+	// The same through a session, whose stack outlives the parse.
+	ASTParseSession session;
+	session.stats().memory_limit = limit;
+	{
+		StringInput input(text);
+		std::unique_ptr<Bench::JSON::Value> root;
+		CHECK(!p.parse(session, input, p.root(), p.whitespace(), quiet, root));
+		CHECK(session.stats().ast_nodes.current_bytes == 0);
+	}
+	return Test::result();
+}
@@ -0,0 +1,239 @@
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "pegmatite.hh"
+#include "pool.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * A sequence of named blocks, whose contents are deferred.  Blocks contain
+ * words and nested groups in parentheses, which are also deferred.
+ */
+struct Grammar
+{
+	Rule ws      = *" \n"_S;
+	Rule name    = term(+range('A', 'Z'));
+	Rule word    = term(+range('a', 'z'));
+	Rule body    = *(word | group);
+	Rule group   = defer('(', body, ')');
+	Rule block   = defer('{', body, '}');
+	Rule item    = name >> block;
+	Rule program = *item;
+};
+
+/**
+ * The regions and words found by a parse.
+ */
+struct Found
+{
+	std::vector<DeferredRegion> regions;
+	std::vector<std::string> words;
+};
+
+/**
+ * A delegate that records the deferred regions and the words.
+ */
+class Delegate : public ParserDelegate
+{
+	const Grammar &g;
+	parse_proc region = [](const InputRange &r, void *d)
+		{
+			static_cast<Found*>(d)->regions.emplace_back(r);
+			return true;
+		};
+	parse_proc word = [](const InputRange &r, void *d)
+		{
+			static_cast<Found*>(d)->words.push_back(r.str());
+			return true;
+		};
+public:
+	Delegate(const Grammar &grammar) : g(grammar) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if ((std::addressof(r) == std::addressof(g.block)) ||
+		    (std::addressof(r) == std::addressof(g.group)))
+		{
+			return region;
+		}
+		return (std::addressof(r) == std::addressof(g.word)) ? word : nullptr;
+	}
+};
+
+/**
+ * Parses the region `r` of `input`, and then the regions that it defers,
+ * appending the words in each to `words`.
+ */
+void parse_region(const DeferredRegion &r, Input &input, const Grammar &g,
+                  const Delegate &d, std::vector<std::string> &words)
+{
+	CHECK(r.input() == &input);
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	Found found;
+	ParseStats stats;
+	CHECK(r.parse(g.body, g.ws, quiet, d, &found, stats));
+	words.insert(words.end(), found.words.begin(), found.words.end());
+	for (const DeferredRegion &nested : found.regions)
+	{
+		parse_region(nested, input, g, d, words);
+	}
+}
+
+/**
+ * A word, whose construction throws if it is "boom".
+ */
+class Word : public ASTContainer
+{
+public:
+	std::string value;
+	bool construct(const InputRange &r, ASTStack &,
+	               const ErrorReporter &) override
+	{
+		value = r.str();
+		if (value == "boom")
+		{
+			throw std::runtime_error("cannot construct boom");
+		}
+		return true;
+	}
+	PEGMATITE_RTTI(Word, ASTContainer)
+};
+
+class Words : public ASTContainer
+{
+public:
+	ASTList<Word> words;
+	PEGMATITE_RTTI(Words, ASTContainer)
+};
+
+/**
+ * A sequence of named blocks of words, whose contents are deferred.
+ */
+struct FlatGrammar
+{
+	Rule ws      = *" \n"_S;
+	Rule name    = term(+range('A', 'Z'));
+	Rule word    = term(+range('a', 'z'));
+	Rule body    = *word;
+	Rule block   = defer('{', body, '}');
+	Rule program = *(name >> block);
+	static const FlatGrammar &get()
+	{
+		static FlatGrammar g;
+		return g;
+	}
+private:
+	FlatGrammar() {}
+};
+
+/**
+ * A delegate that records the deferred regions of a `FlatGrammar`.
+ */
+class RegionDelegate : public ParserDelegate
+{
+	parse_proc region = [](const InputRange &r, void *d)
+		{
+			static_cast<Found*>(d)->regions.emplace_back(r);
+			return true;
+		};
+public:
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		return (std::addressof(r) == std::addressof(FlatGrammar::get().block)) ?
+			region : nullptr;
+	}
+};
+
+/**
+ * Builds the AST for the body of a block in a `FlatGrammar`.
+ */
+struct BodyParser : public ASTParserDelegate
+{
+	const FlatGrammar &g = FlatGrammar::get();
+	BindAST<Word> word = g.word;
+	BindAST<Words> body = g.body;
+};
+
+/**
+ * Tests that a region whose parse throws fails on its own in
+ * `parse_deferred()`, without stopping the others.
+ */
+void check_throwing_region()
+{
+	const FlatGrammar &g = FlatGrammar::get();
+	static BodyParser p;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	std::string text;
+	for (int i=0 ; i<64 ; i++)
+	{
+		text += (i == 7) ? "B { some boom words }\n" : "B { some words }\n";
+	}
+	StringInput input(text, "blocks");
+	Found found;
+	RegionDelegate d;
+	CHECK(parse(input, g.program, g.ws, quiet, d, &found));
+	CHECK(found.regions.size() == 64);
+	for (unsigned threads : { 1, 2, 4 })
+	{
+		auto results = parse_deferred(found.regions, g.body, g.ws, p, threads);
+		CHECK(results.size() == found.regions.size());
+		for (std::size_t i=0 ; i<results.size() ; i++)
+		{
+			const DeferredParseResult &r = results[i];
+			if (i == 7)
+			{
+				CHECK(!r.ok && !r.ast);
+				CHECK(r.stats.status == ParseStatus::ProcFailed);
+				CHECK((r.errors.size() == 1) &&
+				      (r.errors[0] == "blocks: cannot construct boom"));
+			}
+			else
+			{
+				CHECK(r.ok && r.ast && r.errors.empty());
+			}
+		}
+	}
+}
+}
+
+/**
+ * Tests that the regions deferred by a pipelined parse can be parsed after
+ * it has returned, and parsing regions on several threads.
+ */
+int main()
+{
+	static Grammar g;
+	Delegate d(g);
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	std::string text;
+	std::vector<std::string> expected;
+	for (int i=0 ; i<5000 ; i++)
+	{
+		text += "BLOCK { alpha (beta (gamma)) delta }\n";
+		for (const char *w : { "alpha", "delta", "beta", "gamma" })
+		{
+			expected.push_back(w);
+		}
+	}
+	StringInput input(text);
+	Found found;
+	ParseStats stats;
+	CHECK(parse_pipelined(input, g.program, g.ws, quiet, d, &found, stats));
+	CHECK(found.regions.size() == 5000);
+
+	// Parse the regions, and the groups that they defer, after the parse
+	// that found them has returned.
+	std::vector<std::string> words;
+	for (const DeferredRegion &r : found.regions)
+	{
+		parse_region(r, input, g, d, words);
+	}
+	CHECK(words == expected);
+
+	check_throwing_region();
+	return Test::result();
+}
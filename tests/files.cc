@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "pool.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * A word, whose construction throws if it is "boom".
+ */
+class Word : public ASTContainer
+{
+public:
+	std::string value;
+	bool construct(const InputRange &r, ASTStack &,
+	               const ErrorReporter &) override
+	{
+		value = r.str();
+		if (value == "boom")
+		{
+			throw std::runtime_error("cannot construct boom");
+		}
+		return true;
+	}
+	PEGMATITE_RTTI(Word, ASTContainer)
+};
+
+class Words : public ASTContainer
+{
+public:
+	ASTList<Word> words;
+	PEGMATITE_RTTI(Words, ASTContainer)
+};
+
+struct Grammar
+{
+	Rule ws    = *" \n"_S;
+	Rule word  = term(+range('a', 'z'));
+	Rule words = *word;
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+struct Parser : public ASTParserDelegate
+{
+	const Grammar &g = Grammar::get();
+	BindAST<Word> word = g.word;
+	BindAST<Words> words = g.words;
+};
+
+/**
+ * Writes `text` to a new temporary file and returns its path.
+ */
+std::string temp_file(const std::string &text)
+{
+	char path[] = "/tmp/pegmatite-files-XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	CHECK(write(fd, text.data(), text.size()) ==
+	      static_cast<ssize_t>(text.size()));
+	close(fd);
+	return path;
+}
+}
+
+/**
+ * Tests that a file whose parse throws an exception fails on its own in
+ * `parse_files()`, without stopping the others.
+ */
+int main()
+{
+	static Parser p;
+	const Grammar &g = Grammar::get();
+	std::vector<std::string> paths;
+	for (int i=0 ; i<8 ; i++)
+	{
+		std::string text;
+		for (int j=0 ; j<1000 ; j++)
+		{
+			text += (i == 3) && (j == 500) ? "boom\n" : "some words\n";
+		}
+		paths.push_back(temp_file(text));
+	}
+	for (unsigned threads : { 1, 2, 4 })
+	{
+		BatchStats stats;
+		auto results = parse_files(paths, g.words, g.ws, p, stats, threads);
+		CHECK(results.size() == paths.size());
+		CHECK(stats.failed == 1);
+		for (std::size_t i=0 ; i<results.size() ; i++)
+		{
+			const FileParseResult &r = results[i];
+			if (i == 3)
+			{
+				CHECK(!r.ok && !r.ast);
+				CHECK(r.stats.status == ParseStatus::ProcFailed);
+				CHECK((r.errors.size() == 1) &&
+				      (r.errors[0] == r.path + ": cannot construct boom"));
+			}
+			else
+			{
+				CHECK(r.ok && r.ast && r.errors.empty());
+			}
+		}
+	}
+	for (auto &path : paths)
+	{
+		unlink(path.c_str());
+	}
+	return Test::result();
+}
@@ -0,0 +1,58 @@
+#include <stdexcept>
+#include "generator.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace {
+struct Grammar
+{
+	Rule ws      = *" \n"_S;
+	Rule letter  = range('x', 0x4ff) | range('a', 'c');
+	Rule word    = term(+letter);
+	Rule words   = *(word >> ';');
+	Rule foreign = term(+range(0x400, 0x4ff)) | U'é'_E;
+	Rule any     = *(word | foreign);
+};
+}
+
+/**
+ * Tests that the generator only emits characters that `StringInput` reads
+ * back as they were generated, and that it reports characters that it
+ * cannot emit.
+ */
+int main()
+{
+	Grammar g;
+	GeneratorOptions options;
+	options.target_size = 2000;
+	for (std::uint64_t seed=0 ; seed<20 ; seed++)
+	{
+		options.seed = seed;
+		std::string text = generate(g.words, g.ws, options);
+		bool ascii = true;
+		for (char c : text)
+		{
+			ascii &= (static_cast<unsigned char>(c) < 0x80);
+		}
+		CHECK(ascii);
+		StringInput input(text);
+		std::size_t length = 0;
+		CHECK(recognize(input, g.words, g.ws, length));
+		CHECK(length == text.size());
+	}
+
+	// Sets, ranges and literals with no ASCII members cannot be generated.
+	bool thrown = false;
+	try
+	{
+		options.seed = 0;
+		generate(g.foreign, g.ws, options);
+	}
+	catch (std::domain_error &)
+	{
+		thrown = true;
+	}
+	CHECK(thrown);
+	return Test::result();
+}
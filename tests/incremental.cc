@@ -0,0 +1,183 @@
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The rule and text of each match, in the order in which the parse
+ * procedures ran.
+ */
+typedef std::vector<std::pair<const Rule*, std::string>> Log;
+
+/**
+ * A delegate that logs the matches of the rules that another delegate
+ * handles.
+ */
+class LoggingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+public:
+	LoggingDelegate(const ASTParserDelegate &d) : inner(d) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (!inner.get_parse_proc(r))
+		{
+			return nullptr;
+		}
+		const Rule *rule = std::addressof(r);
+		return [rule](const InputRange &range, void *d)
+			{
+				static_cast<Log*>(d)->emplace_back(rule, range.str());
+				return true;
+			};
+	}
+};
+
+/**
+ * The result of a parse.
+ */
+struct Result
+{
+	bool ok = false;
+	Log log;
+	std::size_t error_pos = 0;
+	bool operator==(const Result &other) const
+	{
+		return (ok == other.ok) && (log == other.log) &&
+		       (error_pos == other.error_pos);
+	}
+};
+
+/**
+ * A list of items, each of which first looks for a `!` anywhere after it,
+ * so that each match examines the rest of the input and fails at its end.
+ */
+struct Lookahead
+{
+	Rule ws      = *" "_S;
+	Rule word    = term(+range('a', 'z'));
+	Rule item    = (word >> ',' >> *" ,.()abcdefghijklmnopqrstuvwxyz"_S >> '!') |
+	               (word >> ',');
+	Rule program = ('(' >> *item >> ')') | (*item >> '.');
+};
+
+/**
+ * A delegate that logs the items in a `Lookahead` list.
+ */
+class ItemDelegate : public ParserDelegate
+{
+	const Lookahead &g;
+public:
+	ItemDelegate(const Lookahead &grammar) : g(grammar) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (std::addressof(r) != std::addressof(g.item))
+		{
+			return nullptr;
+		}
+		const Rule *rule = std::addressof(r);
+		return [rule](const InputRange &range, void *d)
+			{
+				static_cast<Log*>(d)->emplace_back(rule, range.str());
+				return true;
+			};
+	}
+};
+
+/**
+ * Checks that reparsing a generated input after each of a series of random
+ * edits gives the same matches and errors as parsing the edited text from
+ * scratch.
+ */
+template<class P>
+void check_grammar(const char *name)
+{
+	static P p;
+	LoggingDelegate d(p);
+	std::size_t *error_pos = nullptr;
+	ErrorReporter err = [&](const InputRange &r, const std::string &)
+		{
+			*error_pos = r.begin().index();
+		};
+	std::string text = Bench::generate_input(name, 4000, 1);
+	IncrementalParser incremental(p.root(), p.whitespace(), err, d);
+	std::mt19937 random(1);
+	std::size_t reused = 0;
+	std::size_t errors = 0;
+	for (int i=0 ; i<300 ; i++)
+	{
+		Result original;
+		error_pos = &original.error_pos;
+		CHECK(incremental.parse(text, &original.log));
+
+		// Remove up to two characters and insert up to two others.
+		std::size_t offset = random() % text.size();
+		std::size_t removed = std::min<std::size_t>(random() % 3,
+		                                            text.size() - offset);
+		std::string inserted;
+		for (std::size_t j=random() % 3 ; j>0 ; j--)
+		{
+			inserted += " ,;:{}()[]\"+=a1"[random() % 15];
+		}
+		std::string edited = text;
+		edited.replace(offset, removed, inserted);
+
+		Result reparsed;
+		error_pos = &reparsed.error_pos;
+		reparsed.ok = incremental.reparse({ { offset, removed, inserted } },
+		                                  &reparsed.log);
+		reused += incremental.stats().reused_matches;
+
+		Result full;
+		error_pos = &full.error_pos;
+		IncrementalParser fresh(p.root(), p.whitespace(), err, d);
+		full.ok = fresh.parse(edited, &full.log);
+		CHECK(reparsed == full);
+		errors += full.ok ? 0 : 1;
+	}
+	// Both outcomes were tested, and matches were reused.
+	CHECK(errors > 10);
+	CHECK(errors < 290);
+	CHECK(reused > 0);
+}
+}
+
+/**
+ * Tests that `IncrementalParser::reparse()` gives the same result as a
+ * parse of the edited text from scratch, including where it reports errors.
+ */
+int main()
+{
+	check_grammar<Bench::JSON::Parser>("json");
+	check_grammar<Bench::CLike::Parser>("clike");
+	check_grammar<Bench::INI::Parser>("ini");
+
+	// A reused match that failed further on than where the reparse fails
+	// moves the error there, as it does in a full parse.
+	static Lookahead g;
+	ItemDelegate d(g);
+	std::size_t error_pos = 0;
+	ErrorReporter err = [&](const InputRange &r, const std::string &)
+		{
+			error_pos = r.begin().index();
+		};
+	IncrementalParser incremental(g.program, g.ws, err, d);
+	Log log;
+	CHECK(incremental.parse("a, b, c, d, .", &log));
+	CHECK(log.size() == 4);
+	CHECK(!incremental.reparse({ { 0, 0, "(" } }, &log));
+	CHECK(incremental.stats().reused_matches > 0);
+	std::size_t reparsed_error = error_pos;
+	IncrementalParser fresh(g.program, g.ws, err, d);
+	CHECK(!fresh.parse(incremental.text(), &log));
+	CHECK(error_pos == 14);
+	CHECK(reparsed_error == error_pos);
+	return Test::result();
+}
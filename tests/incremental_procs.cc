@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The rule and text of each match, in the order in which the parse
+ * procedures ran.
+ */
+typedef std::vector<std::pair<const Rule*, std::string>> Log;
+
+/**
+ * A delegate that handles the rules that another delegate handles, by
+ * logging each match.
+ */
+class LoggingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	Log &log;
+public:
+	LoggingDelegate(const ASTParserDelegate &d, Log &l) : inner(d), log(l) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (!inner.get_parse_proc(r))
+		{
+			return nullptr;
+		}
+		const Rule *rule = std::addressof(r);
+		Log &l = log;
+		return [rule, &l](const InputRange &range, void *)
+			{
+				l.emplace_back(rule, range.str());
+				return true;
+			};
+	}
+};
+
+/**
+ * Checks that `parse_incremental()` runs the same procedures as `parse()`,
+ * in the same order.  If the grammar's root is a loop, then it must also
+ * commit, keep the memory for matches bounded, and run the procedures for
+ * the records before a syntax error.
+ */
+template<class P>
+void check_grammar(const char *name, bool loop)
+{
+	static P p;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	std::string text = Bench::generate_input(name, 200000, 1);
+
+	Log expected;
+	ParseStats whole;
+	{
+		StringInput input(text);
+		LoggingDelegate d(p, expected);
+		CHECK(parse(input, p.root(), p.whitespace(), quiet, d, nullptr,
+		            whole));
+	}
+	CHECK(expected.size() > 1000);
+
+	Log log;
+	ParseStats incremental;
+	{
+		StringInput input(text);
+		LoggingDelegate d(p, log);
+		CHECK(parse_incremental(input, p.root(), p.whitespace(), quiet, d,
+		                        nullptr, incremental));
+		CHECK(incremental.status == ParseStatus::Success);
+	}
+	CHECK(log == expected);
+	CHECK(incremental.matches.peak_bytes <= whole.matches.peak_bytes);
+	CHECK(incremental.peak_bytes <= whole.peak_bytes);
+	if (!loop)
+	{
+		return;
+	}
+	CHECK(incremental.commits > 100);
+	// The matches are freed at each commit point, so only a few records'
+	// worth are held at once.
+	CHECK(incremental.matches.peak_bytes * 20 < whole.matches.peak_bytes);
+
+	// With a syntax error at the end, parse() runs no procedures, but the
+	// procedures for the records committed before the error have run.
+	std::string broken = text + "\x01";
+	Log none;
+	{
+		StringInput input(broken);
+		LoggingDelegate d(p, none);
+		CHECK(!parse(input, p.root(), p.whitespace(), quiet, d, nullptr));
+	}
+	CHECK(none.empty());
+	Log committed;
+	{
+		StringInput input(broken);
+		LoggingDelegate d(p, committed);
+		CHECK(!parse_incremental(input, p.root(), p.whitespace(), quiet, d,
+		                         nullptr));
+	}
+	CHECK(committed.size() * 10 > expected.size() * 9);
+	CHECK(committed.size() <= expected.size());
+	CHECK(std::equal(committed.begin(), committed.end(), expected.begin()));
+}
+}
+
+/**
+ * Tests `parse_incremental()` against `parse()`.
+ */
+int main()
+{
+	check_grammar<Bench::JSON::Parser>("json", false);
+	check_grammar<Bench::CLike::Parser>("clike", true);
+	check_grammar<Bench::Calculator::Parser>("calculator", true);
+	check_grammar<Bench::CSV::Parser>("csv", true);
+	check_grammar<Bench::INI::Parser>("ini", true);
+	return Test::result();
+}
@@ -0,0 +1,134 @@
+#include <new>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace {
+/**
+ * A node with no fields.
+ */
+class Word : public ASTContainer
+{
+	PEGMATITE_RTTI(Word, ASTContainer)
+};
+
+/**
+ * A node with one field, whose allocation fails while `fail` is set.
+ */
+class Single : public ASTContainer
+{
+public:
+	ASTPtr<Word, true> word;
+	static bool fail;
+	static void *operator new(std::size_t size)
+	{
+		if (fail)
+		{
+			throw std::bad_alloc();
+		}
+		return ASTNode::operator new(size);
+	}
+	static void *operator new(std::size_t size, ASTArena &arena)
+	{
+		if (fail)
+		{
+			throw std::bad_alloc();
+		}
+		return ASTNode::operator new(size, arena);
+	}
+	PEGMATITE_RTTI(Single, ASTContainer)
+};
+bool Single::fail = false;
+
+/**
+ * A node with two fields, which is constructed without `BindAST`.
+ */
+class Pair : public ASTContainer
+{
+public:
+	ASTPtr<Word> first;
+	ASTPtr<Word> second;
+	PEGMATITE_RTTI(Pair, ASTContainer)
+};
+
+struct Grammar
+{
+	Rule ws   = *" \t\n"_S;
+	Rule item = term(+range('a', 'z'));
+	static const Grammar &get()
+	{
+		static Grammar g;
+		return g;
+	}
+private:
+	Grammar() {}
+};
+
+struct Parser : public ASTParserDelegate
+{
+	const Grammar &g = Grammar::get();
+	BindAST<Single> item = g.item;
+};
+}
+
+/**
+ * Tests that when `BindAST` fails to allocate a container whose layout it
+ * has recorded, the next container constructed on the thread does not take
+ * that layout.
+ */
+int main()
+{
+	static Parser p;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	const Grammar &g = Grammar::get();
+
+	// Record the layout of `Single`, then fail to allocate one, on the heap
+	// and in an arena.
+	ASTArena arena;
+	for (ASTArena *a : { static_cast<ASTArena*>(nullptr), &arena })
+	{
+		Single::fail = false;
+		std::unique_ptr<Single> root;
+		ParseStats stats;
+		StringInput good("abc");
+		CHECK(a ? p.parse(good, g.item, g.ws, quiet, root, stats, *a) :
+		          p.parse(good, g.item, g.ws, quiet, root, stats));
+		CHECK(root != nullptr);
+		root.reset();
+
+		Single::fail = true;
+		bool threw = false;
+		StringInput bad("abc");
+		try
+		{
+			if (a)
+			{
+				p.parse(bad, g.item, g.ws, quiet, root, stats, *a);
+			}
+			else
+			{
+				p.parse(bad, g.item, g.ws, quiet, root, stats);
+			}
+		}
+		catch (std::bad_alloc &)
+		{
+			threw = true;
+		}
+		CHECK(threw);
+		CHECK(arena.live() == 0);
+
+		// A container constructed directly records its own layout, so it
+		// constructs both of its fields.
+		Pair pair;
+		ASTStack st;
+		InputRange r;
+		st.push_back(std::make_pair(r, std::unique_ptr<ASTNode>(new Word())));
+		st.push_back(std::make_pair(r, std::unique_ptr<ASTNode>(new Word())));
+		CHECK(pair.construct(r, st, quiet));
+		CHECK(pair.first && pair.second);
+		CHECK(st.empty());
+	}
+	return Test::result();
+}
@@ -0,0 +1,88 @@
+#include <atomic>
+#include <memory>
+#include "pegmatite.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * A list of words.
+ */
+struct Grammar
+{
+	Rule ws   = *" "_S;
+	Rule word = term(+range('a', 'z'));
+	Rule list = *word;
+};
+
+/**
+ * A delegate that counts the words and sets `cancel` after `cancel_after` of
+ * them.
+ */
+struct CancellingDelegate : public ParserDelegate
+{
+	const Grammar &g;
+	std::atomic<bool> cancel{false};
+	std::size_t cancel_after;
+	std::size_t count = 0;
+	parse_proc proc = [this](const InputRange &, void *)
+		{
+			if (++count == cancel_after)
+			{
+				cancel = true;
+			}
+			return true;
+		};
+	CancellingDelegate(const Grammar &grammar, std::size_t after)
+		: g(grammar), cancel_after(after) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		return (std::addressof(r) == std::addressof(g.word)) ? proc : nullptr;
+	}
+};
+
+/**
+ * Cancels a parse from inside its parse procedures and returns the number of
+ * procedures that ran, checking that the parse failed as cancelled.
+ */
+std::size_t procs_run(const Grammar &g, const std::string &text,
+                      unsigned interval, bool incremental)
+{
+	CancellingDelegate d(g, 1000);
+	ParseStats stats;
+	stats.check_interval = interval;
+	stats.cancel = &d.cancel;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	StringInput input(text);
+	bool ok = incremental ?
+		parse_incremental(input, g.list, g.ws, quiet, d, nullptr, stats) :
+		parse(input, g.list, g.ws, quiet, d, nullptr, stats);
+	CHECK(!ok);
+	CHECK(stats.status == ParseStatus::Cancelled);
+	return d.count;
+}
+}
+
+/**
+ * Tests that the limits are checked throughout the parse procedures, not
+ * just once.
+ */
+int main()
+{
+	static Grammar g;
+	std::string text;
+	for (int i=0 ; i<10000 ; i++)
+	{
+		text += "word ";
+	}
+	for (bool incremental : { false, true })
+	{
+		CHECK(procs_run(g, text, 16, incremental) <= 1016);
+		CHECK(procs_run(g, text, 300, incremental) <= 1300);
+		// An interval of 0 checks after every procedure.
+		CHECK(procs_run(g, text, 0, incremental) == 1000);
+	}
+	return Test::result();
+}
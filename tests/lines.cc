@@ -0,0 +1,77 @@
+#include <memory>
+#include <vector>
+#include "pegmatite.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * A list of words separated by spaces and `newline`.
+ */
+struct Grammar
+{
+	Rule ws;
+	Rule word = term(+range('a', 'z'));
+	Rule list = *word;
+	Grammar(const ExprPtr &newline) : ws(*(" "_S | newline)) {}
+};
+
+/**
+ * A delegate that records the line and column of each word.
+ */
+struct PositionDelegate : public ParserDelegate
+{
+	const Grammar &g;
+	std::vector<std::pair<std::size_t, std::size_t>> positions;
+	parse_proc proc = [this](const InputRange &r, void *)
+		{
+			positions.emplace_back(r.start.line, r.start.col);
+			return true;
+		};
+	PositionDelegate(const Grammar &grammar) : g(grammar) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		return (std::addressof(r) == std::addressof(g.word)) ? proc : nullptr;
+	}
+};
+
+/**
+ * Parses `text` and returns the line and column of each word.
+ */
+std::vector<std::pair<std::size_t, std::size_t>>
+positions(const Grammar &g, const std::string &text)
+{
+	PositionDelegate d(g);
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	StringInput input(text);
+	CHECK(parse(input, g.list, g.ws, quiet, d, nullptr));
+	return d.positions;
+}
+
+typedef std::vector<std::pair<std::size_t, std::size_t>> Positions;
+}
+
+/**
+ * Tests the line and column numbers reported to parse procedures, for
+ * grammars that mark '\n' and '\r' as newlines with `nl()`.
+ */
+int main()
+{
+	const std::string text = "ab cd\nef\rgh\r\nij\n\nkl";
+	// Before any grammar marks '\r' as a newline, lines end only at '\n'.
+	Grammar lf(nl('\n'_E) | '\r'_E);
+	Positions lf_lines = positions(lf, text);
+	CHECK(lf_lines == (Positions{ {1, 1}, {1, 4}, {2, 1}, {2, 4}, {3, 1},
+	                              {5, 1} }));
+	// Marking '\r' with nl() makes it end lines too, but "\r\n" is one line
+	// end.
+	Grammar cr(nl('\r'_E) | "\r\n"_E | '\n'_E);
+	Positions cr_lines = positions(cr, text);
+	CHECK(cr_lines == (Positions{ {1, 1}, {1, 4}, {2, 1}, {3, 1}, {4, 1},
+	                              {6, 1} }));
+	// Lines are reported consistently after the first lookup.
+	CHECK(positions(lf, text) == cr_lines);
+	return Test::result();
+}
@@ -0,0 +1,195 @@
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "pegmatite.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The threads on which a sentence other than the first kind matched.
+ */
+std::mutex lock;
+std::set<std::thread::id> threads;
+
+/**
+ * Records the thread that a sentence matched on.
+ */
+void record_thread()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	threads.insert(std::this_thread::get_id());
+}
+
+/**
+ * Waits briefly for the pool to start matching the other alternatives, until
+ * one has matched on another thread, so that the test does not depend on how
+ * the threads are scheduled on a single core.
+ */
+void let_forks_start()
+{
+	static int waits = 0;
+	std::lock_guard<std::mutex> guard(lock);
+	if ((threads.size() < 2) && (waits++ < 100))
+	{
+		lock.unlock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		lock.lock();
+	}
+}
+
+/**
+ * Sentences of three kinds, which share their words, so each alternative
+ * examines the whole sentence before it fails.  The same sentences are
+ * matched by an ordered choice, a parallel choice with the default
+ * threshold, and a parallel choice that is always matched in parallel.
+ */
+struct Grammar
+{
+	Rule ws          = *" \n"_S;
+	Rule word        = term(+range('a', 'z'));
+	Rule exclamation = debug(let_forks_start) >> +word >> '!';
+	Rule question    = +word >> '?' >> debug(record_thread);
+	Rule statement   = +word >> '.' >> debug(record_thread);
+	Rule ordered     = *(exclamation | question | statement);
+	Rule by_span     = *parallel_choice(exclamation, question, statement);
+	Rule forced      = *parallel_choice({ exclamation, question, statement },
+	                                    0);
+};
+
+/**
+ * The rule and text of each match, in the order in which the parse
+ * procedures ran.
+ */
+typedef std::vector<std::pair<const Rule*, std::string>> Log;
+
+/**
+ * A delegate that logs the sentences and words.
+ */
+class LoggingDelegate : public ParserDelegate
+{
+	const Grammar &g;
+public:
+	LoggingDelegate(const Grammar &grammar) : g(grammar) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		for (const Rule *rule : { std::addressof(g.word),
+		                          std::addressof(g.exclamation),
+		                          std::addressof(g.question),
+		                          std::addressof(g.statement) })
+		{
+			if (std::addressof(r) == rule)
+			{
+				return [rule](const InputRange &range, void *d)
+					{
+						static_cast<Log*>(d)->emplace_back(rule, range.str());
+						return true;
+					};
+			}
+		}
+		return nullptr;
+	}
+};
+
+/**
+ * The result of a parse.
+ */
+struct Result
+{
+	bool ok;
+	Log log;
+	std::size_t error_pos = 0;
+	ParseStats stats;
+};
+
+/**
+ * Parses `text` with the root rule `root`.
+ */
+Result run(const Grammar &g, const Rule &root, const std::string &text,
+           std::size_t work_limit = 0)
+{
+	LoggingDelegate d(g);
+	Result r;
+	ErrorReporter err = [&](const InputRange &range, const std::string &)
+		{
+			r.error_pos = range.begin().index();
+		};
+	StringInput input(text);
+	r.stats.work_limit = work_limit;
+	r.ok = parse(input, root, g.ws, err, d, &r.log, r.stats);
+	return r;
+}
+
+/**
+ * Returns `count` sentences of `words` words each, of all three kinds.
+ */
+std::string sentences(int count, int words)
+{
+	std::string text;
+	for (int i=0 ; i<count ; i++)
+	{
+		for (int j=0 ; j<words ; j++)
+		{
+			text += "word ";
+		}
+		text += "!?."[i % 3];
+		text += '\n';
+	}
+	return text;
+}
+}
+
+/**
+ * Tests that a parallel choice matches exactly as an ordered choice does,
+ * whether or not it matches its alternatives in parallel.
+ */
+int main()
+{
+	static Grammar g;
+	const std::thread::id main_thread = std::this_thread::get_id();
+	std::string text = sentences(300, 200);
+
+	Result ordered = run(g, g.ordered, text);
+	CHECK(ordered.ok);
+	CHECK(ordered.log.size() == 300 * 201);
+
+	// Matching in parallel gives the same matches, and some of them are made
+	// on other threads.
+	threads.clear();
+	Result forced = run(g, g.forced, text);
+	CHECK(forced.ok);
+	CHECK(forced.log == ordered.log);
+	CHECK(forced.stats.rule_entries == ordered.stats.rule_entries);
+	CHECK(threads.size() > 1);
+	CHECK(forced.stats.current_bytes <= 2 * ordered.stats.current_bytes);
+
+	// An error is reported at the same position.
+	std::string bad = text;
+	bad.replace(bad.size() / 2, 4, "w0rd");
+	Result ordered_error = run(g, g.ordered, bad);
+	Result forced_error = run(g, g.forced, bad);
+	CHECK(!ordered_error.ok);
+	CHECK(!forced_error.ok);
+	CHECK(forced_error.error_pos == ordered_error.error_pos);
+	CHECK(forced_error.error_pos > 0);
+
+	// The work done by the other threads counts towards the limits.
+	Result limited = run(g, g.forced, text,
+	                     ordered.stats.rule_entries / 2);
+	CHECK(!limited.ok);
+	CHECK(limited.stats.status == ParseStatus::WorkLimit);
+
+	// Short alternatives are matched in order on this thread.
+	threads.clear();
+	Result by_span = run(g, g.by_span, sentences(3000, 3));
+	CHECK(by_span.ok);
+	CHECK(threads.size() == 1);
+	CHECK(threads.count(main_thread) == 1);
+	return Test::result();
+}
@@ -0,0 +1,144 @@
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "pika.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The rule and text of each match, in the order in which the parse
+ * procedures ran.
+ */
+typedef std::vector<std::pair<const Rule*, std::string>> Log;
+
+/**
+ * A delegate that logs each match of the rules that `handled` accepts.
+ */
+class LoggingDelegate : public ParserDelegate
+{
+	std::function<bool(const Rule &)> handled;
+public:
+	LoggingDelegate(std::function<bool(const Rule &)> h) : handled(h) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (!handled(r))
+		{
+			return nullptr;
+		}
+		const Rule *rule = std::addressof(r);
+		return [rule](const InputRange &range, void *d)
+			{
+				static_cast<Log*>(d)->emplace_back(rule, range.str());
+				return true;
+			};
+	}
+};
+
+/**
+ * Checks that the Pika parser runs the same procedures as the packrat parser
+ * for a generated input.
+ */
+template<class P>
+void check_grammar(const char *name)
+{
+	static P p;
+	static PikaGrammar pika(p.root(), p.whitespace());
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	LoggingDelegate d([](const Rule &r) { return bool(p.get_parse_proc(r)); });
+	std::string text = Bench::generate_input(name, 5000, 1);
+
+	Log expected;
+	StringInput input(text);
+	CHECK(parse(input, p.root(), p.whitespace(), quiet, d, &expected));
+	CHECK(expected.size() > 100);
+	for (unsigned threads : { 1, 3 })
+	{
+		Log log;
+		ParseStats stats;
+		CHECK(parse_pika(input, pika, quiet, d, &log, stats, threads));
+		CHECK(stats.status == ParseStatus::Success);
+		CHECK(log == expected);
+	}
+}
+
+/**
+ * A left-recursive grammar of subtractions.
+ */
+struct Subtraction
+{
+	Rule ws   = *" "_S;
+	Rule num  = term(+range('0', '9'));
+	Rule expr = (expr >> '-' >> num) | num;
+};
+}
+
+/**
+ * Tests `parse_pika()`.
+ */
+int main()
+{
+	check_grammar<Bench::JSON::Parser>("json");
+	check_grammar<Bench::CLike::Parser>("clike");
+
+	// Left recursion associates to the left.
+	static Subtraction g;
+	static PikaGrammar pika(g.expr, g.ws);
+	LoggingDelegate d([](const Rule &r)
+		{
+			return std::addressof(r) == std::addressof(g.expr);
+		});
+	{
+		StringInput input(std::string("10 - 3 - 2"));
+		ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+		Log log;
+		ParseStats stats;
+		CHECK(parse_pika(input, pika, quiet, d, &log, stats));
+		const Rule *expr = std::addressof(g.expr);
+		Log expected { { expr, "10" }, { expr, "10 - 3" },
+		               { expr, "10 - 3 - 2" } };
+		CHECK(log == expected);
+	}
+
+	// A syntax error is reported where the packrat parser reports it.
+	{
+		StringInput input(std::string("10 - 3 - - 2"));
+		std::size_t packrat_error = 0;
+		std::size_t pika_error = 0;
+		ErrorReporter packrat = [&](const InputRange &r, const std::string &)
+			{
+				packrat_error = r.begin().index();
+			};
+		ErrorReporter err = [&](const InputRange &r, const std::string &)
+			{
+				pika_error = r.begin().index();
+			};
+		Log log;
+		ParseStats stats;
+		parse(input, g.expr, g.ws, packrat, d, &log);
+		CHECK(!parse_pika(input, pika, err, d, &log, stats));
+		CHECK(pika_error == packrat_error);
+		CHECK(pika_error > 0);
+	}
+
+	// The limits are checked at every position when the interval is 0.
+	{
+		StringInput input(std::string("10 - 3 - 2"));
+		ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+		std::atomic<bool> cancel(true);
+		Log log;
+		ParseStats stats;
+		stats.check_interval = 0;
+		stats.cancel = &cancel;
+		CHECK(!parse_pika(input, pika, quiet, d, &log, stats));
+		CHECK(stats.status == ParseStatus::Cancelled);
+		CHECK(log.empty());
+	}
+	return Test::result();
+}
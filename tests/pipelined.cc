@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The rule and text of each match, in the order in which the parse
+ * procedures ran.
+ */
+typedef std::vector<std::pair<const Rule*, std::string>> Log;
+
+/**
+ * A delegate that handles the rules that another delegate handles, by
+ * logging each match.  After `fail_after` matches, the procedures fail.
+ */
+class LoggingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	Log &log;
+	std::size_t fail_after;
+public:
+	LoggingDelegate(const ASTParserDelegate &d, Log &l,
+	                std::size_t fail = SIZE_MAX)
+		: inner(d), log(l), fail_after(fail) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (!inner.get_parse_proc(r))
+		{
+			return nullptr;
+		}
+		const Rule *rule = std::addressof(r);
+		Log &l = log;
+		std::size_t fail = fail_after;
+		return [rule, &l, fail](const InputRange &range, void *)
+			{
+				if (l.size() == fail)
+				{
+					return false;
+				}
+				l.emplace_back(rule, range.str());
+				return true;
+			};
+	}
+};
+
+/**
+ * A delegate that handles the rules that another delegate handles, and
+ * throws from the procedure for the `throw_at`th match.
+ */
+class ThrowingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	std::size_t throw_at;
+	mutable std::size_t count = 0;
+public:
+	ThrowingDelegate(const ASTParserDelegate &d, std::size_t at)
+		: inner(d), throw_at(at) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (!inner.get_parse_proc(r))
+		{
+			return nullptr;
+		}
+		return [this](const InputRange &, void *)
+			{
+				if (++count == throw_at)
+				{
+					throw std::runtime_error("boom");
+				}
+				return true;
+			};
+	}
+};
+
+/**
+ * Checks that a pipelined parse of a generated input runs the same
+ * procedures, in the same order, as a parse that runs them on this thread,
+ * and that a failing procedure stops it.
+ */
+template<class P>
+void check_grammar(const char *name)
+{
+	static P p;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	std::string text = Bench::generate_input(name, 100000, 1);
+
+	Log expected;
+	{
+		StringInput input(text);
+		LoggingDelegate d(p, expected);
+		CHECK(parse(input, p.root(), p.whitespace(), quiet, d, nullptr));
+	}
+	CHECK(expected.size() > 1000);
+
+	Log log;
+	{
+		StringInput input(text);
+		LoggingDelegate d(p, log);
+		ParseStats stats;
+		CHECK(parse_pipelined(input, p.root(), p.whitespace(), quiet, d,
+		                      nullptr, stats));
+		CHECK(stats.status == ParseStatus::Success);
+	}
+	CHECK(log == expected);
+
+	Log partial;
+	{
+		StringInput input(text);
+		LoggingDelegate d(p, partial, expected.size() / 2);
+		ParseStats stats;
+		CHECK(!parse_pipelined(input, p.root(), p.whitespace(), quiet, d,
+		                       nullptr, stats));
+		CHECK(stats.status == ParseStatus::ProcFailed);
+	}
+	CHECK(partial.size() == expected.size() / 2);
+	CHECK(std::equal(partial.begin(), partial.end(), expected.begin()));
+
+	// An exception thrown by a procedure on the worker reaches the caller,
+	// as it does from parse().
+	for (bool pipelined : { false, true })
+	{
+		StringInput input(text);
+		ThrowingDelegate d(p, expected.size() / 2);
+		bool caught = false;
+		try
+		{
+			ParseStats stats;
+			if (pipelined)
+			{
+				parse_pipelined(input, p.root(), p.whitespace(), quiet, d,
+				                nullptr, stats);
+			}
+			else
+			{
+				parse(input, p.root(), p.whitespace(), quiet, d, nullptr);
+			}
+		}
+		catch (std::runtime_error &e)
+		{
+			caught = (std::string(e.what()) == "boom");
+		}
+		CHECK(caught);
+	}
+
+	// The AST built on the worker thread is the same size as the one built
+	// on this thread.
+	ParseStats direct;
+	ParseStats pipelined;
+	{
+		StringInput input(text);
+		std::unique_ptr<typename P::Root> root;
+		CHECK(p.parse(input, p.root(), p.whitespace(), quiet, root, direct));
+		CHECK(root != nullptr);
+	}
+	{
+		StringInput input(text);
+		std::unique_ptr<typename P::Root> root;
+		CHECK(p.parse_pipelined(input, p.root(), p.whitespace(), quiet, root,
+		                        pipelined));
+		CHECK(root != nullptr);
+	}
+	CHECK(pipelined.ast_nodes.allocations == direct.ast_nodes.allocations);
+	CHECK(pipelined.ast_nodes.peak_bytes == direct.ast_nodes.peak_bytes);
+}
+}
+
+/**
+ * Tests `parse_pipelined()` against `parse()`.
+ */
+int main()
+{
+	check_grammar<Bench::JSON::Parser>("json");
+	check_grammar<Bench::CLike::Parser>("clike");
+	return Test::result();
+}
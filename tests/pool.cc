@@ -0,0 +1,112 @@
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "pool.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * A delegate whose parse procedures throw for every rule that the JSON
+ * delegate handles.
+ */
+class ThrowingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+public:
+	ThrowingDelegate(const ASTParserDelegate &d) : inner(d) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (!inner.get_parse_proc(r))
+		{
+			return nullptr;
+		}
+		return [](const InputRange &, void *) -> bool
+			{
+				throw std::runtime_error("parse procedure failed");
+			};
+	}
+};
+}
+
+/**
+ * Tests that an exception thrown by a parse in a `ParserPool` is passed to
+ * the caller and that the pool carries on running parses.
+ */
+int main()
+{
+	static Bench::JSON::Parser p;
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	std::string text = Bench::generate_input("json", 10000, 1);
+	ThrowingDelegate throwing(p);
+	ParserPool pool(1);
+
+	for (int i=0 ; i<3 ; i++)
+	{
+		StringInput bad(text);
+		auto failed = pool.submit(bad, p.root(), p.whitespace(), quiet,
+		                          throwing, nullptr);
+		bool threw = false;
+		try
+		{
+			failed.get();
+		}
+		catch (const std::runtime_error &)
+		{
+			threw = true;
+		}
+		CHECK(threw);
+
+		StringInput good(text);
+		auto result = pool.submit(good, p.root(), p.whitespace(), quiet, p);
+		ParseResult r = result.get();
+		CHECK(r.ok);
+		CHECK(r.ast != nullptr);
+		CHECK(r.stats.status == ParseStatus::Success);
+	}
+
+	// A completion callback is given a failed result instead, which holds
+	// the exception.
+	StringInput bad(text);
+	std::atomic<bool> called(false);
+	std::atomic<bool> rethrown(false);
+	std::promise<ParseStatus> status;
+	CHECK(pool.submit(bad, p.root(), p.whitespace(), quiet, throwing, nullptr,
+		[&](ParseResult &r)
+		{
+			CHECK(!r.ok);
+			try
+			{
+				std::rethrow_exception(r.error);
+			}
+			catch (const std::runtime_error &)
+			{
+				rethrown = true;
+			}
+			catch (...) {}
+			called = true;
+			status.set_value(r.stats.status);
+		}));
+	CHECK(status.get_future().get() == ParseStatus::ProcFailed);
+	CHECK(called);
+	CHECK(rethrown);
+
+	// A callback that throws does not stop the pool.
+	StringInput thrown(text);
+	std::promise<void> finished;
+	CHECK(pool.submit(thrown, p.root(), p.whitespace(), quiet, p,
+		[&](ParseResult &r)
+		{
+			CHECK(r.ok && !r.error);
+			finished.set_value();
+			throw std::runtime_error("completion failed");
+		}));
+	finished.get_future().get();
+	StringInput good(text);
+	CHECK(pool.submit(good, p.root(), p.whitespace(), quiet, p).get().ok);
+	return Test::result();
+}
@@ -0,0 +1,122 @@
+#include <memory>
+#include <utility>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The rule and text of each match, in the order in which the parse
+ * procedures ran.
+ */
+typedef std::vector<std::pair<const Rule*, std::string>> Log;
+
+/**
+ * A delegate that handles the rules that another delegate handles, by
+ * logging each match.
+ */
+class LoggingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	Log &log;
+public:
+	LoggingDelegate(const ASTParserDelegate &d, Log &l) : inner(d), log(l) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		if (!inner.get_parse_proc(r))
+		{
+			return nullptr;
+		}
+		const Rule *rule = std::addressof(r);
+		Log &l = log;
+		return [rule, &l](const InputRange &range, void *)
+			{
+				l.emplace_back(rule, range.str());
+				return true;
+			};
+	}
+};
+
+/**
+ * The errors reported, with their line and column.
+ */
+struct Errors
+{
+	std::vector<std::pair<std::size_t, std::size_t>> positions;
+	ErrorReporter reporter()
+	{
+		return [this](const InputRange &r, const std::string &)
+			{
+				positions.emplace_back(r.start.line, r.start.col);
+			};
+	}
+};
+
+/**
+ * Checks that feeding `text` to a `PushParser` in pieces of each of several
+ * sizes runs the same procedures and reports the same errors as a
+ * `RecordParser` over the whole text.
+ */
+template<class P>
+void check_text(const P &p, const Rule &record, const std::string &text)
+{
+	Log expected;
+	Errors expected_errors;
+	bool expected_ok = true;
+	{
+		StringInput input(text);
+		LoggingDelegate d(p, expected);
+		ErrorReporter err = expected_errors.reporter();
+		RecordParser records(input, record, p.whitespace(), err, d);
+		while (records.parse_next(nullptr)) {}
+		expected_ok = (records.stats().status == ParseStatus::Success);
+	}
+	CHECK(!expected.empty());
+	for (std::size_t size : { 1, 2, 3, 7, 64, 1000, 100000 })
+	{
+		Log log;
+		Errors errors;
+		LoggingDelegate d(p, log);
+		ErrorReporter err = errors.reporter();
+		PushParser push(record, p.whitespace(), err, d, nullptr);
+		bool ok = true;
+		for (std::size_t i=0 ; ok && (i<text.size()) ; i+=size)
+		{
+			ok = push.feed(text.substr(i, size));
+		}
+		ok = push.finish() && ok;
+		CHECK(ok == expected_ok);
+		CHECK(log == expected);
+		CHECK(errors.positions == expected_errors.positions);
+	}
+}
+
+/**
+ * Checks a generated input for a grammar, with and without a syntax error.
+ */
+template<class P>
+void check_grammar(const char *name, const Rule &record)
+{
+	static P p;
+	std::string text = Bench::generate_input(name, 20000, 1);
+	check_text(p, record, text);
+	check_text(p, record, text + "\n @");
+}
+}
+
+/**
+ * Tests `PushParser` against `RecordParser`.
+ */
+int main()
+{
+	using namespace Bench;
+	check_grammar<Calculator::Parser>("calculator",
+	                                  Calculator::Grammar::get().statement);
+	check_grammar<CLike::Parser>("clike", CLike::Grammar::get().statement);
+	check_grammar<JSON::Parser>("json", JSON::Grammar::get().value);
+	return Test::result();
+}
@@ -0,0 +1,154 @@
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * The rule and text of each match, in the order in which the parse
+ * procedures ran.
+ */
+typedef std::vector<std::pair<const Rule*, std::string>> Log;
+
+/**
+ * A delegate that handles the rules that another delegate handles, except
+ * for `skip`, by logging each match.
+ */
+class LoggingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	Log &log;
+	const Rule *skip;
+public:
+	LoggingDelegate(const ASTParserDelegate &d, Log &l, const Rule *s)
+		: inner(d), log(l), skip(s) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		const Rule *rule = std::addressof(r);
+		if (!inner.get_parse_proc(r) || (rule == skip))
+		{
+			return nullptr;
+		}
+		Log &l = log;
+		return [rule, &l](const InputRange &range, void *)
+			{
+				l.emplace_back(rule, range.str());
+				return true;
+			};
+	}
+};
+
+/**
+ * The line and column of the first error reported.
+ */
+struct FirstError
+{
+	std::size_t line = 0;
+	std::size_t col = 0;
+	ErrorReporter reporter()
+	{
+		return [this](const InputRange &r, const std::string &)
+			{
+				if (line == 0)
+				{
+					line = r.start.line;
+					col = r.start.col;
+				}
+			};
+	}
+};
+
+/**
+ * Parses `text` with a `RecordParser`, logging the procedures and the first
+ * error.  Returns the status.
+ */
+ParseStatus parse_records(const ASTParserDelegate &p, const Rule &record,
+                          const Rule &ws, const std::string &text, Log &log,
+                          FirstError &error)
+{
+	StringInput input(text);
+	LoggingDelegate d(p, log, nullptr);
+	ErrorReporter err = error.reporter();
+	RecordParser records(input, record, ws, err, d);
+	while (records.parse_next(nullptr)) {}
+	CHECK(records.done());
+	return records.stats().status;
+}
+
+/**
+ * Checks that a `RecordParser` for `record` runs the same procedures as
+ * `parse()` does for the root rule, apart from the root's own, and reports
+ * a syntax error at the same place.
+ */
+template<class P>
+void check_grammar(const char *name, const Rule &record)
+{
+	static P p;
+	const Rule *root = std::addressof(p.root());
+	const Rule *skip = (root == std::addressof(record)) ? nullptr : root;
+	std::string text = Bench::generate_input(name, 100000, 1);
+	for (const std::string &t : { text, text + "\n @" })
+	{
+		Log expected;
+		FirstError expected_error;
+		{
+			StringInput input(t);
+			LoggingDelegate d(p, expected, skip);
+			ErrorReporter err = expected_error.reporter();
+			parse(input, p.root(), p.whitespace(), err, d, nullptr);
+		}
+		Log log;
+		FirstError error;
+		ParseStatus status = parse_records(p, record, p.whitespace(), t, log,
+		                                   error);
+		if (t == text)
+		{
+			CHECK(status == ParseStatus::Success);
+			CHECK(log.size() > 1000);
+			CHECK(log == expected);
+			CHECK(error.line == 0);
+			continue;
+		}
+		// parse() runs no procedures for an input that fails, but the
+		// record parser has run them for every record before the error.
+		CHECK(status == ParseStatus::SyntaxError);
+		CHECK(expected_error.line > 1);
+		CHECK((error.line == expected_error.line) &&
+		      (error.col == expected_error.col));
+	}
+}
+}
+
+/**
+ * Tests `RecordParser` against `parse()`, and that limits set through its
+ * statistics apply from the first record.
+ */
+int main()
+{
+	using namespace Bench;
+	check_grammar<Calculator::Parser>("calculator",
+	                                  Calculator::Grammar::get().statement);
+	check_grammar<CLike::Parser>("clike", CLike::Grammar::get().statement);
+	check_grammar<JSON::Parser>("json", JSON::Grammar::get().value);
+
+	// A check interval set before the first record takes effect at once.
+	static Bench::Calculator::Parser calc;
+	std::atomic<bool> cancel(true);
+	Log log;
+	LoggingDelegate d(calc, log, nullptr);
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	StringInput input("1; 2; 3;");
+	RecordParser records(input, calc.g.statement, calc.whitespace(), quiet, d);
+	records.stats().check_interval = 1;
+	records.stats().cancel = &cancel;
+	CHECK(!records.parse_next(nullptr));
+	CHECK(records.stats().status == ParseStatus::Cancelled);
+	CHECK(log.empty());
+	return Test::result();
+}
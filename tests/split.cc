@@ -0,0 +1,164 @@
+#include <memory>
+#include <stdexcept>
+#include "grammars.hh"
+#include "inputs.hh"
+#include "test.hh"
+
+using namespace pegmatite;
+
+namespace
+{
+/**
+ * A delegate that counts the matches for the rules that another delegate
+ * handles.
+ */
+class CountingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	parse_proc count = [](const InputRange &, void *d)
+		{
+			++*static_cast<std::size_t*>(d);
+			return true;
+		};
+public:
+	CountingDelegate(const ASTParserDelegate &d) : inner(d) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		return inner.get_parse_proc(r) ? count : nullptr;
+	}
+};
+
+/**
+ * A delegate whose procedure throws at the `n`th match that it handles.
+ */
+class ThrowingDelegate : public ParserDelegate
+{
+	const ASTParserDelegate &inner;
+	parse_proc count = [](const InputRange &, void *d)
+		{
+			if (--*static_cast<std::size_t*>(d) == 0)
+			{
+				throw std::runtime_error("proc");
+			}
+			return true;
+		};
+public:
+	ThrowingDelegate(const ASTParserDelegate &d) : inner(d) {}
+	parse_proc get_parse_proc(const Rule &r) const override
+	{
+		return inner.get_parse_proc(r) ? count : nullptr;
+	}
+};
+
+/**
+ * A delegate that throws when the matcher looks up a procedure, which
+ * happens on the worker that matches each chunk.
+ */
+class LookupThrowingDelegate : public ParserDelegate
+{
+public:
+	parse_proc get_parse_proc(const Rule &) const override
+	{
+		throw std::runtime_error("lookup");
+	}
+};
+
+/**
+ * Parses `text` with `threads` workers, and returns the message of the
+ * exception that the parse throws, or an empty string if it throws none.
+ */
+std::string thrown(const Rule &record, const Rule &ws,
+                   const ParserDelegate &d, std::size_t &count,
+                   const std::string &text, unsigned threads)
+{
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	SplitParser parser(record, ws, split_lines(), quiet, d, &count, threads,
+	                   4096);
+	StringInput input(text);
+	try
+	{
+		parser.parse(input);
+	}
+	catch (std::runtime_error &e)
+	{
+		return e.what();
+	}
+	return std::string();
+}
+
+/**
+ * A string input that cannot be read by several threads, so a
+ * `SplitParser` matches its chunks one at a time on the calling thread.
+ */
+class SerialInput : public StringInput
+{
+public:
+	SerialInput(const std::string &s) : StringInput(s) {}
+	bool supports_concurrent_reads() const override { return false; }
+};
+}
+
+/**
+ * Tests that the statistics of a `SplitParser` count the work for each
+ * chunk once, so that they match those of a `RecordParser` and the limits
+ * apply to the work actually done.
+ */
+int main()
+{
+	static Bench::Calculator::Parser p;
+	const auto &g = Bench::Calculator::Grammar::get();
+	ErrorReporter quiet = [](const InputRange &, const std::string &) {};
+	std::string text = Bench::generate_input("calculator", 200000, 1);
+	CountingDelegate d(p);
+
+	std::size_t expected = 0;
+	ParseStats records;
+	{
+		StringInput input(text);
+		RecordParser parser(input, g.statement, g.ws, quiet, d);
+		while (parser.parse_next(&expected)) {}
+		CHECK(parser.stats().status == ParseStatus::Success);
+		records = parser.stats();
+	}
+	CHECK(records.rule_entries > 0);
+
+	for (std::size_t work : { std::size_t(0),
+	                          (records.rule_entries +
+	                           records.characters_examined) * 101 / 100 })
+	{
+		std::size_t count = 0;
+		SplitParser parser(g.statement, g.ws, split_lines(), quiet, d, &count,
+		                   1, 4096);
+		parser.stats().work_limit = work;
+		SerialInput input(text);
+		CHECK(parser.parse(input));
+		CHECK(parser.stats().status == ParseStatus::Success);
+		CHECK(count == expected);
+		// Each chunk matches the whitespace at its start again, but the
+		// rest of the work is counted once.
+		const ParseStats &s = parser.stats();
+		CHECK(s.rule_entries >= records.rule_entries);
+		CHECK(s.rule_entries < records.rule_entries * 101 / 100);
+		CHECK(s.characters_examined >= records.characters_examined);
+		CHECK(s.characters_examined <
+		      records.characters_examined * 101 / 100);
+	}
+
+	// An exception from a procedure, or from matching on a worker, stops
+	// the workers and reaches the caller.
+	ThrowingDelegate throwing(p);
+	LookupThrowingDelegate lookup;
+	for (unsigned threads : { 1U, 2U, 4U })
+	{
+		for (std::size_t n : { std::size_t(1), expected / 2, expected })
+		{
+			std::size_t count = n;
+			CHECK(thrown(g.statement, g.ws, throwing, count, text, threads) ==
+			      "proc");
+		}
+		std::size_t count = 0;
+		CHECK(thrown(g.statement, g.ws, lookup, count, text, threads) ==
+		      "lookup");
+	}
+	return Test::result();
+}
@@ -0,0 +1,50 @@
+#ifndef PEGMATITE_TESTS_TEST_HH
+#define PEGMATITE_TESTS_TEST_HH
+
+#include <cstdio>
+
+/**
+ * A minimal harness for the regression tests.  Each test is a program that
+ * uses `CHECK()` for its assertions and returns `Test::result()` from `main`,
+ * so that ctest reports it as failed if any check failed.
+ */
+namespace Test
+{
+/**
+ * The number of checks that have failed.
+ */
+inline int &failures()
+{
+	static int count = 0;
+	return count;
+}
+
+/**
+ * The exit status for the test program.
+ */
+inline int result()
+{
+	if (failures() > 0)
+	{
+		fprintf(stderr, "%d checks failed\n", failures());
+		return 1;
+	}
+	return 0;
+}
+}
+
+/**
+ * Checks that `cond` is true, reporting it and counting a failure if not.
+ */
+#define CHECK(cond)                                                         \
+	do                                                                      \
+	{                                                                       \
+		if (!(cond))                                                        \
+		{                                                                   \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,         \
+			        __LINE__, #cond);                                       \
+			Test::failures()++;                                             \
+		}                                                                   \
+	} while (0)
+
+#endif